@@ -349,6 +349,10 @@ bool PerformPred::doInitialization(llvm::Module& M)
    {
       PassMgr.add(createProfileLoaderPass(PostBranchPro));
       ProfileInfoLoader PIL("profile-loader",PostBranchPro);
+      if(PIL.hasError()){
+         errs()<<"profile-loader: "<<PIL.getError()<<"\n";
+         exit(1);
+      }
       BPP = new BranchProbabilityPosterior(PIL);
       PassMgr.add(BPP);
       PassMgr.run(M);
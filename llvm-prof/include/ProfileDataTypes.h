@@ -38,7 +38,16 @@ enum ProfilingType {
    EdgeInfo64   = 105, /* Edge Profiling information with 64bit */
    BlockInfoDouble   = 106, /* Block Profiling information with double */
 	 MPITimeInfo					 = 107, /*MPI Time Profiling information*/
-	 RankInfo					 = 108 /*Rank of process Profiling information*/
+	 RankInfo					 = 108, /*Rank of process Profiling information*/
+   SampleInfo   = 109, /* total and sampled checks of sampled profiling */
+   OmpInfo      = 110, /* team size and per thread block counts of omp regions */
+   StrideInfo   = 111, /* address stride histogram of loads/stores in loops */
+   IOInfo       = 112, /* calls, bytes and time of io runtime calls */
+   MemOpInfo    = 113, /* bytes and size histogram of memcpy/memmove/memset */
+   LightInfo    = 114, /* function entries, loop entries and iterations */
+   CommInfo     = 115, /* messages and bytes from one rank to another */
+   HeapInfo     = 116, /* live, peak and size histogram of heap allocations */
+   CFGInfo      = 117  /* name hash and cfg checksum of every function */
 };
 
 // special flags used in value profiling
@@ -49,6 +58,97 @@ enum ProfilingFlags {
 
 #define FORTRAN_DATATYPE_MAP_SIZE 128
 
+// histogram bins of stride profiling, a stride no longer than the access
+// size is unit, a repeated stride below STRIDE_SMALL_LIMIT bytes is small
+enum StrideBins {
+	STRIDE_UNIT = 0,
+	STRIDE_SMALL = 1,
+	STRIDE_LARGE = 2,
+	STRIDE_IRREGULAR = 3,
+	STRIDE_BINS = 4
+};
+
+#define STRIDE_SMALL_LIMIT 64
+
+// counters of each call site in io profiling
+enum IOFields {
+	IO_CALLS = 0,
+	IO_BYTES = 1,
+	IO_NANOSEC = 2,
+	IO_FIELDS = 3
+};
+
+// counters of each call site in memory op profiling: total bytes, then the
+// number of calls of each size bin. bin b holds lengths up to
+// MEMOP_BIN_SIZE(b), the last bin is open, its timing is taken at its size
+// and scaled by the bytes the total leaves for it
+enum MemOpFields {
+	MEMOP_BYTES = 0,
+	MEMOP_BIN0 = 1,
+	MEMOP_BINS = 8,
+	MEMOP_FIELDS = MEMOP_BIN0 + MEMOP_BINS
+};
+
+#define MEMOP_BIN_SIZE(b) ((uint64_t)16 << (2 * (b)))
+
+// descriptor of each counter array in combined profiling
+enum CombinedFields {
+	COMBINED_TYPE = 0,
+	COMBINED_ELEM_SIZE = 1,
+	COMBINED_START = 2,
+	COMBINED_COUNT = 3,
+	COMBINED_FIELDS = 4
+};
+
+#define COMBINED_ARENA_ALIGN 64
+
+// counters of light profiling, one per function followed by two per loop
+enum LightFields {
+	LIGHT_LOOP_ENTRIES = 0,
+	LIGHT_LOOP_ITERATIONS = 1,
+	LIGHT_LOOP_FIELDS = 2
+};
+
+// a record of the sparse communication matrix, only nonzero pairs are written
+enum CommFields {
+	COMM_SRC = 0,
+	COMM_DEST = 1,
+	COMM_MESSAGES = 2,
+	COMM_BYTES = 3,
+	COMM_FIELDS = 4
+};
+
+// heap profiling writes HEAP_HEADER counters, then HEAP_FIELDS per allocation
+// site. a size falls in the first bin b with size <= HEAP_BIN_SIZE(b)
+enum HeapHeader {
+	HEAP_NPROCS = 0,
+	HEAP_TOTAL_LIVE = 1,
+	HEAP_TOTAL_PEAK = 2,
+	HEAP_HEADER = 3
+};
+
+enum HeapFields {
+	HEAP_CALLS = 0,
+	HEAP_BYTES = 1,
+	HEAP_LIVE = 2,
+	HEAP_PEAK = 3,
+	HEAP_BIN0 = 4,
+	HEAP_BINS = 8,
+	HEAP_FIELDS = HEAP_BIN0 + HEAP_BINS
+};
+
+#define HEAP_BIN_SIZE(b) ((uint64_t)64 << (2 * (b)))
+
+// a record per defined function, in module order. the edge and block counters
+// of a function start after the CFG_EDGES and CFG_BLOCKS of the ones before it
+enum CFGFields {
+	CFG_NAME = 0,     /* ProfileNameHash of the function name */
+	CFG_CHECKSUM = 1, /* FunctionCFGChecksum */
+	CFG_BLOCKS = 2,
+	CFG_EDGES = 3,
+	CFG_FIELDS = 4
+};
+
 #if defined(__cplusplus)
 }
 #endif
@@ -21,16 +21,21 @@
 #ifndef LLVM_ANALYSIS_PROFILEINFO_H
 #define LLVM_ANALYSIS_PROFILEINFO_H
 
+#include "llvm/ADT/DenseMap.h"
 #include "llvm/Support/Debug.h"
 #include "llvm/Support/ErrorHandling.h"
 #include "llvm/Support/Format.h"
 #include "llvm/Support/raw_ostream.h"
 #include <llvm/IR/Instructions.h>
 #include "ProfileDataTypes.h"
+#include "ProfileInfoLoader.h"
+#include <algorithm>
 #include <cassert>
+#include <iterator>
 #include <map>
 #include <set>
 #include <string>
+#include <vector>
 
 namespace llvm {
   class Pass;
@@ -51,6 +56,88 @@ namespace llvm {
   raw_ostream& operator<<(raw_ostream &O, const Function *F);
   raw_ostream& operator<<(raw_ostream &O, const MachineFunction *MF);
 
+  /// ValueRuns - The contents of a value trap as runs of equal values, read in
+  /// place from the run length encoded (value, length) pairs or the plain
+  /// values they were stored as.  Adjacent equal runs are joined, and the
+  /// aggregates work on the runs without expanding them.
+  class ValueRuns {
+    const int *Begin, *End;
+    unsigned Stride; // 2 for (value, length) pairs, 1 for plain values
+  public:
+    struct Run {
+      int Value;
+      uint64_t Length;
+    };
+    class iterator : public std::iterator<std::forward_iterator_tag, Run> {
+      const int *P, *Next, *End;
+      unsigned Stride;
+      Run R;
+      void scan() {
+        if (P == End) return;
+        R.Value = P[0];
+        R.Length = 0;
+        for (Next = P; Next != End && Next[0] == R.Value; Next += Stride)
+          R.Length += Stride == 2 ? (unsigned)Next[1] : 1;
+      }
+    public:
+      iterator(const int *P, const int *End, unsigned Stride)
+        : P(P), Next(P), End(End), Stride(Stride) { scan(); }
+      const Run &operator*() const { return R; }
+      const Run *operator->() const { return &R; }
+      iterator &operator++() { P = Next; scan(); return *this; }
+      iterator operator++(int) { iterator I = *this; ++*this; return I; }
+      bool operator==(const iterator &O) const { return P == O.P; }
+      bool operator!=(const iterator &O) const { return P != O.P; }
+    };
+
+    ValueRuns() : Begin(0), End(0), Stride(1) {}
+    ValueRuns(const std::vector<int> &Contents, bool RunLength)
+      : Begin(Contents.data()), End(Contents.data() + Contents.size()),
+        Stride(RunLength ? 2 : 1) {
+      if (RunLength) End -= Contents.size() % 2;
+    }
+
+    iterator begin() const { return iterator(Begin, End, Stride); }
+    iterator end() const { return iterator(End, End, Stride); }
+    bool empty() const { return Begin == End; }
+
+    // size - The number of values, not of runs.
+    uint64_t size() const {
+      uint64_t N = 0;
+      for (iterator I = begin(), E = end(); I != E; ++I) N += I->Length;
+      return N;
+    }
+    int64_t sum() const {
+      int64_t S = 0;
+      for (iterator I = begin(), E = end(); I != E; ++I)
+        S += (int64_t)I->Value * (int64_t)I->Length;
+      return S;
+    }
+    double mean() const {
+      uint64_t N = size();
+      return N ? (double)sum() / N : 0.;
+    }
+    // histogram - How many times each value occurs.
+    std::map<int, uint64_t> histogram() const {
+      std::map<int, uint64_t> H;
+      for (iterator I = begin(), E = end(); I != E; ++I) H[I->Value] += I->Length;
+      return H;
+    }
+    // distinct - The values which occur, in ascending order.
+    std::vector<int> distinct() const {
+      std::set<int> S;
+      for (iterator I = begin(), E = end(); I != E; ++I) S.insert(I->Value);
+      return std::vector<int>(S.begin(), S.end());
+    }
+    // expand - Every value in order, for the consumers which need them all.
+    std::vector<int> expand() const {
+      std::vector<int> V;
+      for (iterator I = begin(), E = end(); I != E; ++I)
+        V.insert(V.end(), I->Length, I->Value);
+      return V;
+    }
+  };
+
   /// ProfileInfo Class - This class holds and maintains profiling
   /// information for some unit of code.
   template<class FType, class BType>
@@ -62,6 +149,8 @@ namespace llvm {
     typedef std::map<Edge, double> EdgeWeights;
     typedef std::map<const BType*, double> BlockCounts;
     typedef std::map<const BType*, const BType*> Path;
+    // ValueCounts - a constant content is kept as a single run, the
+    // loader expands CONSTANT_COMPRESS from the traped constant.
     struct ValueCounts{
        unsigned Nums;
        enum ProfilingFlags flags;
@@ -69,8 +158,35 @@ namespace llvm {
     };
     typedef std::pair<unsigned, const Instruction*>
        SLGCounts;
-    typedef std::pair<unsigned, unsigned> MPICounts; // index, count
-    typedef std::pair<unsigned, double> TimeCounts; // index, time
+    // TrapedSite - An instruction traped by the Kind packet, the index of its
+    // counter there, its count and its time for MPITimeInfo.  MPInfo counts
+    // calls, MPIFullInfo count * size(fortran_type).
+    struct TrapedSite {
+      const Instruction *I;
+      ProfilingType Kind;
+      unsigned Index;
+      double Count;
+      double Time;
+    };
+    // team size and ThreadCounts[thread][block] of an omp outlined function
+    struct OmpRegionCounts {
+       unsigned TeamSize;
+       std::vector<std::vector<double> > ThreadCounts;
+    };
+    typedef std::vector<double> StrideCounts; // count of each StrideBins
+    typedef std::vector<double> IOCounts; // value of each IOFields
+    typedef std::vector<double> MemOpCounts; // value of each MemOpFields
+    typedef std::vector<double> HeapCounts; // value of each HeapFields
+    // FunctionCounts - The execution count of a function and the ones of its
+    // blocks by block number, MissingValue until they are known.
+    struct FunctionCounts {
+      const FType *F;
+      double Count;
+      std::vector<double> Blocks;
+    };
+    // BlockNumber - The index of the FunctionCounts of a block and its number
+    // in them.
+    typedef std::pair<unsigned, unsigned> BlockNumber;
 
   protected:
     // EdgeInformation - Count the number of times a transition between two
@@ -79,26 +195,108 @@ namespace llvm {
     // function was entered.
     std::map<const FType*, EdgeWeights> EdgeInformation;
 
-    // BlockInformation - Count the number of times a block is executed.
-    std::map<const FType*, BlockCounts> BlockInformation;
-
-    // FunctionInformation - Count the number of times a function is executed.
-    std::map<const FType*, double> FunctionInformation;
+    // FunctionInformation - Count the number of times a function and each of
+    // its blocks is executed.  The blocks of a function are numbered in order
+    // when it gets its FunctionCounts, blocks made later take the next
+    // numbers.  A count is then one hash lookup and an array index away.
+    std::vector<FunctionCounts> FunctionInformation;
+    DenseMap<const FType*, unsigned> FunctionNumbers;
+    DenseMap<const BType*, BlockNumber> BlockNumbers;
 
     std::map<const CallInst*, ValueCounts> ValueInformation;
 
     std::map<const Instruction*, SLGCounts> SLGInformation;
 
-    // MPICounts = count
-    std::map<const CallInst*, MPICounts> MPInformation; // old mpi profiling format
     int  RankInformation = -1; // Rank information
 
-    std::map<const CallInst*, TimeCounts> MPITimeInformation; // mpi time profiling format
+    // TrapedSites - The sites of ValueInfo, SLGInfo, MPInfo, MPIFullInfo and
+    // MPITimeInfo grouped by kind, each kind in the order getAllTrapedValues
+    // returns it.  SiteLookup holds the sites which answer the count, the mpi
+    // time and the traped index of an instruction, -1 for none.
+    struct SiteRefs { int Count, Time, Index; };
+    std::vector<TrapedSite> TrapedSites;
+    DenseMap<const Instruction*, SiteRefs> SiteLookup;
+
+    void addTrapedSite(const Instruction *I, ProfilingType Kind, unsigned Index,
+                       double Count, double Time = MissingValue) {
+      TrapedSite S = {I, Kind, Index, Count, Time};
+      TrapedSites.push_back(S);
+    }
+    // indexTrapedSites - Sort the sites added and build SiteLookup.
+    void indexTrapedSites();
 
-    // MPICounts = count * size(fortran_type)
-    std::map<const CallInst*, MPICounts> MPIFullInformation; // new mpi profiling format
+    std::map<const FType*, OmpRegionCounts> OmpInformation; // omp parallel regions
+
+    std::map<const Instruction*, StrideCounts> StrideInformation; // loads/stores in loops
+
+    std::map<const CallInst*, IOCounts> IOInformation; // io runtime calls
+
+    std::map<const CallInst*, MemOpCounts> MemOpInformation; // memcpy/memmove/memset
+
+    std::map<const CallInst*, HeapCounts> HeapInformation; // heap allocations
+    HeapCounts HeapTotal; // value of each HeapHeader, empty if not profiled
 
     ProfileInfoT<MachineFunction, MachineBasicBlock> *MachineProfile;
+
+    // getFunctionCounts - The counts of F, numbering its blocks the first
+    // time.
+    FunctionCounts &getFunctionCounts(const FType *F) {
+      typename DenseMap<const FType*, unsigned>::iterator I =
+        FunctionNumbers.find(F);
+      if (I != FunctionNumbers.end())
+        return FunctionInformation[I->second];
+      unsigned N = FunctionInformation.size();
+      FunctionNumbers[F] = N;
+      FunctionInformation.push_back(FunctionCounts());
+      FunctionCounts &FC = FunctionInformation.back();
+      FC.F = F;
+      FC.Count = MissingValue;
+      FC.Blocks.assign(F->size(), MissingValue);
+      unsigned b = 0;
+      for (typename FType::const_iterator BI = F->begin(), BE = F->end();
+           BI != BE; ++BI)
+        BlockNumbers[&*BI] = BlockNumber(N, b++);
+      return FC;
+    }
+
+    // findBlockCount - The count of BB, or null if its function has none.
+    const double *findBlockCount(const BType *BB) const {
+      typename DenseMap<const BType*, BlockNumber>::const_iterator I =
+        BlockNumbers.find(BB);
+      if (I == BlockNumbers.end()) return 0;
+      return &FunctionInformation[I->second.first].Blocks[I->second.second];
+    }
+
+    // blockCount - The count of BB to be set, MissingValue if it is new.
+    double &blockCount(const BType *BB) {
+      typename DenseMap<const BType*, BlockNumber>::iterator I =
+        BlockNumbers.find(BB);
+      if (I != BlockNumbers.end())
+        return FunctionInformation[I->second.first].Blocks[I->second.second];
+      FunctionCounts &FC = getFunctionCounts(BB->getParent());
+      I = BlockNumbers.find(BB);
+      if (I != BlockNumbers.end())
+        return FC.Blocks[I->second.second];
+      BlockNumbers[BB] = BlockNumber(FunctionNumbers[BB->getParent()],
+                                     FC.Blocks.size());
+      FC.Blocks.push_back(MissingValue);
+      return FC.Blocks.back();
+    }
+
+    // clearCounts - Forget the count of F and of its blocks.
+    void clearCounts(const FType *F) {
+      FunctionCounts &FC = getFunctionCounts(F);
+      FC.Count = MissingValue;
+      std::fill(FC.Blocks.begin(), FC.Blocks.end(), MissingValue);
+    }
+
+    // clearBlockCounts - Forget the counts of every block, the functions keep
+    // theirs and the numbering is kept.
+    void clearBlockCounts() {
+      for (unsigned i = 0; i < FunctionInformation.size(); ++i)
+        std::fill(FunctionInformation[i].Blocks.begin(),
+                  FunctionInformation[i].Blocks.end(), MissingValue);
+    }
   public:
     static char ID; // Class identification, replacement for typeinfo
     ProfileInfoT();
@@ -135,7 +333,63 @@ namespace llvm {
 
 	int getRankValue(ProfilingType T);
 
-    const std::vector<int>& getValueContents(const CallInst* V);
+    // getOmpRegion - per thread counts if F is the outlined function of a
+    // profiled omp parallel region, else NULL
+    const OmpRegionCounts* getOmpRegion(const FType* F) const {
+      typename std::map<const FType*, OmpRegionCounts>::const_iterator I =
+        OmpInformation.find(F);
+      return I == OmpInformation.end() ? NULL : &I->second;
+    }
+
+    // getStrideCounts - stride histogram of a load/store in a loop, NULL if
+    // it was not profiled
+    const StrideCounts* getStrideCounts(const Instruction* I) const {
+      typename std::map<const Instruction*, StrideCounts>::const_iterator J =
+        StrideInformation.find(I);
+      return J == StrideInformation.end() ? NULL : &J->second;
+    }
+
+    // getIOCounts - calls, bytes and nanoseconds of an io call, NULL if it
+    // was not profiled
+    const IOCounts* getIOCounts(const CallInst* CI) const {
+      typename std::map<const CallInst*, IOCounts>::const_iterator J =
+        IOInformation.find(CI);
+      return J == IOInformation.end() ? NULL : &J->second;
+    }
+
+    // getMemOpCounts - bytes and size histogram of a memory op, NULL if it
+    // was not profiled
+    const MemOpCounts* getMemOpCounts(const CallInst* CI) const {
+      typename std::map<const CallInst*, MemOpCounts>::const_iterator J =
+        MemOpInformation.find(CI);
+      return J == MemOpInformation.end() ? NULL : &J->second;
+    }
+
+    // getHeapCounts - calls, bytes, live and peak bytes and size histogram of
+    // an allocation site, NULL if it was not profiled
+    const HeapCounts* getHeapCounts(const CallInst* CI) const {
+      typename std::map<const CallInst*, HeapCounts>::const_iterator J =
+        HeapInformation.find(CI);
+      return J == HeapInformation.end() ? NULL : &J->second;
+    }
+    // getHeapTotal - process size, live and peak bytes of the process
+    const HeapCounts& getHeapTotal() const {
+      return HeapTotal;
+    }
+
+    // getValueRuns - The contents of the value trap V as runs, empty if V was
+    // not profiled.  The runs point into this ProfileInfo.
+    ValueRuns getValueRuns(const CallInst* V) const {
+      typename std::map<const CallInst*, ValueCounts>::const_iterator J =
+        ValueInformation.find(V);
+      if (J == ValueInformation.end()) return ValueRuns();
+      return ValueRuns(J->second.Contents,
+                       J->second.flags & RUN_LENGTH_COMPRESS);
+    }
+    // getValueContents - Every value of the value trap V, expanded.
+    std::vector<int> getValueContents(const CallInst* V) const {
+      return getValueRuns(V).expand();
+    }
     /** return traped instructions.
      * if Instruction is CallInst it is ValueProfiling
      * if Instruction is LoadInst it is SLGProfiling
@@ -157,6 +411,17 @@ namespace llvm {
 
     void setExecutionCount(const BType *BB, double w);
 
+    // getBlockCounts - The known block counts of F.
+    BlockCounts getBlockCounts(const FType *F) {
+      BlockCounts Counts;
+      for (typename FType::const_iterator BI = F->begin(), BE = F->end();
+           BI != BE; ++BI) {
+        const double *C = findBlockCount(&*BI);
+        if (C && *C != MissingValue) Counts[&*BI] = *C;
+      }
+      return Counts;
+    }
+
     void addExecutionCount(const BType *BB, double w);
 
     double getEdgeWeight(Edge e) const {
@@ -216,8 +481,21 @@ namespace llvm {
 
     void transfer(const FType *Old, const FType *New);
 
+    // repair - Estimates the missing edges of F from the counted ones.
     void repair(const FType *F);
 
+    // RepairCounts - How the edges of repaired functions got their counts:
+    // read from the profile, inferred by flow conservation, or estimated by
+    // repair(F) where the flow leaves them open.
+    struct RepairCounts {
+      unsigned Measured, Inferred, Estimated;
+      RepairCounts() : Measured(0), Inferred(0), Estimated(0) {}
+    };
+
+    // repair - Repairs the functions Fs, solving their flow in parallel on
+    // Jobs threads (0 for one per core) before falling back to repair(F).
+    RepairCounts repair(const std::vector<const FType*> &Fs, unsigned Jobs = 0);
+
     void dump(FType *F = 0, bool real = true) {
       dbgs() << "**** This is ProfileInfo " << this << " speaking:\n";
       if (!real) {
@@ -228,19 +506,20 @@ namespace llvm {
           dbgs() << F << "@" << format("%p", F) << ": " << format("%.20g",getExecutionCount(F)) << "\n";
           Functions.insert(F);
         } else {
-          for (typename std::map<const FType*, double>::iterator fi = FunctionInformation.begin(),
+          for (typename std::vector<FunctionCounts>::iterator fi = FunctionInformation.begin(),
                fe = FunctionInformation.end(); fi != fe; ++fi) {
-            dbgs() << fi->first << "@" << format("%p",fi->first) << ": " << format("%.20g",fi->second) << "\n";
-            Functions.insert(fi->first);
+            if (fi->Count == MissingValue) continue;
+            dbgs() << fi->F << "@" << format("%p",fi->F) << ": " << format("%.20g",fi->Count) << "\n";
+            Functions.insert(fi->F);
           }
         }
 
         for (typename std::set<const FType*>::iterator FI = Functions.begin(), FE = Functions.end();
              FI != FE; ++FI) {
           const FType *F = *FI;
-          typename std::map<const FType*, BlockCounts>::iterator bwi = BlockInformation.find(F);
+          BlockCounts Counts = getBlockCounts(F);
           dbgs() << "BasicBlocks for Function " << F << ":\n";
-          for (typename BlockCounts::const_iterator bi = bwi->second.begin(), be = bwi->second.end(); bi != be; ++bi) {
+          for (typename BlockCounts::const_iterator bi = Counts.begin(), be = Counts.end(); bi != be; ++bi) {
             dbgs() << bi->first << "@" << format("%p", bi->first) << ": " << format("%.20g",bi->second) << "\n";
           }
         }
@@ -289,8 +568,24 @@ namespace llvm {
 
   /// createProfileLoaderPass - This function returns a Pass that loads the
   /// profiling information for the module from the specified filename, making
-  /// it available to the optimizers.
-  Pass *createProfileLoaderPass(const std::string &Filename);
+  /// it available to the optimizers.  Only the packet types in Wanted are read.
+  Pass *createProfileLoaderPass(const std::string &Filename,
+                                const PacketMask &Wanted = AllPackets());
+  /// createProfileLoaderPass - The same, for a profile loaded by the caller,
+  /// who keeps PIL alive while the pass runs.
+  Pass *createProfileLoaderPass(const ProfileInfoLoader &PIL);
+
+  class LoopInfo;
+  class BranchProbabilityInfo;
+  /// estimateProfileInfo - Estimate the edge and block counts of F like the
+  /// ProfileEstimatorPass, but starting with EntryCount executions, taking the
+  /// backedges per entry of a loop from LoopTrips (keyed by its header) and
+  /// splitting branches by BPI if it is not NULL.
+  void estimateProfileInfo(Function &F, LoopInfo &LI,
+                           BranchProbabilityInfo *BPI, double EntryCount,
+                           const ProfileInfo::BlockCounts &LoopTrips,
+                           ProfileInfo::EdgeWeights &Edges,
+                           ProfileInfo::BlockCounts &Blocks);
 
 } // End llvm namespace
 
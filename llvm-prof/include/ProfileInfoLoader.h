@@ -16,46 +16,99 @@
 #ifndef LLVM_ANALYSIS_PROFILEINFOLOADER_H
 #define LLVM_ANALYSIS_PROFILEINFOLOADER_H
 
+#include <bitset>
+#include <functional>
+#include <initializer_list>
+#include <map>
 #include <string>
 #include <utility>
 #include <vector>
+#include <stdint.h>
 
 namespace llvm {
 
 class Module;
 class Function;
 class BasicBlock;
+class PacketCursor;
 
 raw_ostream& operator<<(raw_ostream& O,
                         std::pair<const BasicBlock*, const BasicBlock*> E);
 
+// PacketMask - A set of packet types, bit i stands for the ProfilingType i.
+typedef std::bitset<128> PacketMask;
+
+// AllPackets - The mask of every packet type.
+inline PacketMask AllPackets() { return PacketMask().set(); }
+
+// PacketTypes - The mask of the packet types in Types.
+PacketMask PacketTypes(std::initializer_list<unsigned> Types);
+
 class ProfileInfoLoader {
-  const std::string &Filename;
+  std::string Filename;
   std::vector<std::string> CommandLines;
   std::vector<unsigned>    FunctionCounts;
   std::vector<uint64_t>    BlockCounts;
+  std::vector<double>      BlockDoubleCounts;
   std::vector<double>      TimeMess;
   std::vector<uint64_t>    EdgeCounts;
   std::vector<unsigned>    OptimalEdgeCounts;
-  std::vector<unsigned>    BBTrace;
   std::vector<unsigned>	   ValueCounts;
   std::vector<std::vector<int> > ValueContents;
   std::vector<unsigned>    SLGCounts;
   std::vector<unsigned>    MPICounts;
   std::vector<unsigned>    MPIFullCounters; // new mpi profiling format
   std::vector<unsigned>    RankCounts;
+  std::vector<uint64_t>    SampleCounts;
+  std::vector<uint64_t>    OmpCounts;
+  std::vector<uint64_t>    StrideCounts;
+  std::vector<uint64_t>    IOCounts;
+  std::vector<uint64_t>    MemOpCounts;
+  std::vector<uint64_t>    LightCounts;
+  std::vector<uint64_t>    CommCounts; // CommFields records, sorted
+  std::vector<uint64_t>    HeapCounts;
+  std::vector<uint64_t>    CFGCounts; // CFGFields records of every function
+  // counters of indexed files keyed by packet type and function name hash
+  std::map<std::pair<unsigned, uint64_t>, std::vector<uint64_t> > FunctionRecords;
+  bool Indexed;
+  PacketMask Wanted;
+  std::string Error;
+
+  bool isWanted(unsigned PacketType) const {
+    return PacketType >= Wanted.size() || Wanted[PacketType];
+  }
+  void readPacket(PacketCursor &C, unsigned PacketType);
+  void readIndexed(const char *ToolName, PacketCursor &C);
 public:
-  // ProfileInfoLoader ctor - Read the specified profiling data file, exiting
-  // the program if the file is invalid or broken.
-  ProfileInfoLoader(const char *ToolName, const std::string &Filename);
+  // ProfileInfoLoader ctor - Read the specified profiling data file.  If it
+  // can't be opened, or is invalid or broken, reading stops and hasError() is
+  // true; the counts are incomplete then and must not be used.  Packets of a
+  // type not in Wanted are stepped over without reading their payload, their
+  // counts stay empty.  The command lines are always read, and the sample
+  // counts with the edge counts they scale.
+  ProfileInfoLoader(const char *ToolName, const std::string &Filename,
+                    const PacketMask &Wanted = AllPackets());
 
   static const uint64_t Uncounted;
 
+  // hasError - Whether the file could not be read, getError() tells why.
+  bool hasError() const { return !Error.empty(); }
+  const std::string &getError() const { return Error; }
+
   unsigned getNumExecutions() const { return CommandLines.size(); }
   const std::string &getExecution(unsigned i) const { return CommandLines[i]; }
 
   const std::string &getFileName() const { return Filename; }
 
+  // isIndexed - Whether the file was in the indexed format with a table of
+  // contents rather than a flat stream of packets.
+  bool isIndexed() const { return Indexed; }
+
+  // getFunctionRecord - The counters of packet type Type written for the
+  // function named Name alone, or null if the file has none.
+  const std::vector<uint64_t> *getFunctionRecord(unsigned Type,
+                                                 const std::string &Name) const;
+
   // getRawFunctionCounts - This method is used by consumers of function
   // counting information.
   //
@@ -69,6 +122,11 @@ public:
   const std::vector<uint64_t> &getRawBlockCounts() const {
     return BlockCounts;
   }
+  // getRawBlockDoubleCounts - The BlockInfoDouble counts before they were
+  // truncated into the block counts above.
+  const std::vector<double> &getRawBlockDoubleCounts() const {
+    return BlockDoubleCounts;
+  }
   // getRawTimeMess - This method is used by consumers of mpi time information
   const std::vector<double> &getRawTimeMess() const{
     return TimeMess;
@@ -110,9 +168,76 @@ public:
   const std::vector<unsigned> &getRawRankCounts() const {
      return RankCounts;
   }
+  // getRawSampleCounts - total and sampled checks of a sampled profile, the
+  // edge counts returned above are already scaled by their ratio.
+  const std::vector<uint64_t> &getRawSampleCounts() const {
+     return SampleCounts;
+  }
+  const std::vector<uint64_t> &getRawOmpCounts() const {
+     return OmpCounts;
+  }
+  const std::vector<uint64_t> &getRawStrideCounts() const {
+     return StrideCounts;
+  }
+  const std::vector<uint64_t> &getRawIOCounts() const {
+     return IOCounts;
+  }
+  const std::vector<uint64_t> &getRawMemOpCounts() const {
+     return MemOpCounts;
+  }
+  const std::vector<uint64_t> &getRawLightCounts() const {
+     return LightCounts;
+  }
+  const std::vector<uint64_t> &getRawCommCounts() const {
+     return CommCounts;
+  }
+  const std::vector<uint64_t> &getRawHeapCounts() const {
+     return HeapCounts;
+  }
+  // getRawCFGCounts - The CFGFields of every function of the profiled
+  // program, empty for a profile without checksums.
+  const std::vector<uint64_t> &getRawCFGCounts() const {
+     return CFGCounts;
+  }
 
 };
 
+// TraceCallback - Takes N blocks of the trace of the Run-th execution in a
+// profile, the blocks are only valid during the call.
+typedef std::function<void(const unsigned *Blocks, size_t N, unsigned Run)>
+    TraceCallback;
+
+// ReadBBTrace - Pass the BBTraceInfo packets of Filename to Fn in the order
+// they were executed, ChunkSize blocks at a time, without loading the whole
+// trace.  ProfileInfoLoader steps over these packets.  Returns false with the
+// reason in Error if the file can't be read, Fn saw the blocks before it.
+bool ReadBBTrace(const std::string &Filename, const TraceCallback &Fn,
+                 std::string &Error,
+                 size_t ChunkSize = 1 << 16);
+
+// ProfileHash - The 64 bit FNV-1a hash of the bytes, the checksum of the
+// payloads of an indexed profile.  Passing the hash of the preceding bytes as
+// Seed hashes a payload piece by piece.
+uint64_t ProfileHash(const void *Data, size_t Size,
+                     uint64_t Seed = 0xcbf29ce484222325ULL);
+
+// ProfileNameHash - The key of the records of function Name in an indexed
+// profile, never 0.
+uint64_t ProfileNameHash(const std::string &Name);
+
+// Is64BitPacket - Whether the entries and their number are 64 bit words in a
+// packet of type Type.
+bool Is64BitPacket(unsigned Type);
+
+// IsDoublePacket - Whether the entries of a packet of type Type are doubles,
+// their number is a 64 bit word.
+bool IsDoublePacket(unsigned Type);
+
+// MergeCommCounts - Sum the CommInfo records of Packet into Data, keyed by
+// source and destination rank.
+void MergeCommCounts(const std::vector<uint64_t> &Packet,
+                     std::vector<uint64_t> &Data);
+
 } // End llvm namespace
 
 #endif
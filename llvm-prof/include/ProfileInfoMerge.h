@@ -8,78 +8,73 @@
 
 namespace llvm {
 
+/* what a merged file holds for every counter */
+enum MergeStat {
+   MergeSum,
+   MergeMean,   /* sum divided by the number of profiles counting it */
+   MergeMin,
+   MergeMax,
+   MergeStddev, /* population standard deviation */
+   MergeArgMax  /* rank of the profile with the maximum */
+};
 
+/* sum and distribution of the profiles of many runs. counters are kept as 64
+ * bit or double values, the way they are written out again */
 class ProfileInfoMerge
 {
+   /* one kind of packet over all profiles, values which a profile left
+    * Uncounted are not part of its distribution */
+   struct Counters {
+      ProfilingType Type;           /* type of the written packet */
+      bool IsDouble;
+      std::vector<uint64_t> Sum;    /* exact sum of integer packets */
+      std::vector<double> DoubleSum;
+      /* running mean and sum of squared deviations (Welford), partial
+       * sums are combined with Chan's pairwise update */
+      std::vector<double> Mean, M2, Min, Max;
+      std::vector<uint64_t> ArgMax, Seen;
+      explicit Counters(ProfilingType T, bool D = false):Type(T), IsDouble(D) {}
+      void resize(size_t N);
+      template<class T>
+      bool add(const std::vector<T>& Values, uint64_t Rank);
+      void add(const Counters& Other);
+      double statistic(MergeStat S, size_t i) const;
+      uint64_t count(MergeStat S, size_t i) const;
+   };
    std::string Filename;
    std::string Toolname;
-   std::vector<std::string> CommandLines;
-   std::vector<unsigned> FunctionCounts;
-   std::vector<uint64_t> BlockCounts;
-   std::vector<uint64_t> EdgeCounts;
-   std::vector<unsigned> OptimalEdgeCounts;
-   std::vector<unsigned> BBTrace;
-   std::vector<unsigned> ValueCounts;
-   std::vector<unsigned> SLGCounts;
-   std::vector<std::vector<int> > ValueContents; 
+   /* command lines of every run, after the index of its file */
+   std::vector<std::pair<size_t, std::string> > CommandLines;
+   Counters FunctionCounts;
+   Counters BlockCounts;
+   Counters BlockDoubleCounts;
+   Counters EdgeCounts;
+   Counters OptimalEdgeCounts;
+   Counters SLGCounts;
+   Counters MPICounts;
+   Counters MPIFullCounts;
+   Counters MPITimeCounts;
+   /* checksums of the profiled program, the same in every profile */
+   std::vector<uint64_t> CFGCounts;
+   size_t NumProfiles;
+   void addCFGCounts(const std::vector<uint64_t>& Other, const std::string& From);
    public:
-   /*Create a initial total data*/
-   explicit ProfileInfoMerge(std::string toolName,std::string fileName,ProfileInfoLoader& AHS) {
-      this->Toolname = toolName;
-      this->Filename = fileName;
-      this->FunctionCounts = AHS.getRawFunctionCounts();
-      this->OptimalEdgeCounts = AHS.getRawOptimalEdgeCounts();
-      this->SLGCounts = AHS.getRawSLGCounts();
-      this->EdgeCounts = AHS.getRawEdgeCounts();
-      this->BlockCounts = AHS.getRawBlockCounts();
-      this->ValueCounts = AHS.getRawValueCounts();
-      for(unsigned i = 0;i < AHS.getNumExecutions();i++){
-         std::string tmp = AHS.getExecution(i);
-         this->CommandLines.push_back(tmp);
-      }
-   }
-   /*Merge the file*/
-   template<class F>
-   void  addProfileInfo(ProfileInfoLoader& THS, F acc) {
-#define MERGEVECTOR(what)                                                      \
-  assert(this->what.size() == THS.getRaw##what().size() && #what               \
-         " size should be equal.");                                            \
-  std::transform(this->what.begin(), this->what.end(),                         \
-                 THS.getRaw##what().begin(), this->what.begin(), acc);
-      MERGEVECTOR(BlockCounts);
-      MERGEVECTOR(OptimalEdgeCounts);
-      MERGEVECTOR(EdgeCounts);
-      MERGEVECTOR(FunctionCounts);
-      MERGEVECTOR(ValueCounts);
-      MERGEVECTOR(SLGCounts);
-#undef MERGEVECTOR
-   }
-   void addProfileInfo(ProfileInfoLoader& THS) {
-      addProfileInfo(THS, std::plus<unsigned>());
-   }
-   /*write totle merging file*/
-   template<class F>
-   void writeTotalFile(F distribution) {
-      ProfileInfoWriter totalFile((this->Toolname.c_str()),this->Filename);
-      std::vector<unsigned> counts;
-#define WRITEVECTOR(info, what)                                                \
-  counts.resize(what.size());                                                  \
-  std::transform(what.begin(), what.end(), counts.begin(), distribution);      \
-  totalFile.write(info, counts);
-      WRITEVECTOR(FunctionInfo, FunctionCounts);
-      WRITEVECTOR(BlockInfo, BlockCounts);
-      WRITEVECTOR(EdgeInfo, EdgeCounts);
-      WRITEVECTOR(OptEdgeInfo, OptimalEdgeCounts);
-      WRITEVECTOR(SLGInfo, SLGCounts);
-      for(unsigned i = 0;i < this->CommandLines.size();i++){
-         totalFile.write(this->CommandLines[i]);
-      }
-#undef WRITEVECTOR
-   }
-   void writeTotalFile() {
-      /** x + 0 --> x ; it doesn't make any distribution **/
-      writeTotalFile(std::bind2nd(std::plus<unsigned>(), 0));
-   }
+   /*Create a empty total data, written to fileName*/
+   ProfileInfoMerge(std::string toolName, std::string fileName);
+   /*Merge the file, it was the Index-th of the inputs. its rank is the one
+    * of its RankInfo packet, or Index without one*/
+   void addProfileInfo(const ProfileInfoLoader& THS, size_t Index = 0);
+   /*Merge a partial sum*/
+   void addProfileInfo(const ProfileInfoMerge& Other);
+   /* load and sum Files with Jobs threads. each thread streams the files
+    * one by one into its own partial sum, the partial sums are then added
+    * pairwise as a tree. false, with nothing added, if a file can't be read */
+   bool addProfileFiles(const std::vector<std::string>& Files, unsigned Jobs);
+   size_t getNumProfiles() const { return NumProfiles; }
+   /*write totle merging file, with statistic S of every counter. false if
+    * a packet could not be written*/
+   bool writeTotalFile(MergeStat S = MergeSum) { return writeTotalFile(S, Filename); }
+   bool writeTotalFile(MergeStat S, const std::string& File);
 };
 
 }
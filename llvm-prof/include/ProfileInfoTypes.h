@@ -28,6 +28,7 @@ enum ProfilingStorageType {
 };
 
 #include "ProfileDataTypes.h"
+#include <stdint.h>
 
 /*
  * The header for tables that map path numbers to path counters.
@@ -45,6 +46,32 @@ typedef struct {
   unsigned pathCounter;
 } PathProfileTableEntry;
 
+/*
+ * The indexed profile file (format version 2) starts with a header and a table
+ * of contents of numEntries entries, followed by the payloads.  A payload is
+ * the body of a packet of the flat format without its type word, aligned to
+ * PROFILE_V2_ALIGN bytes.  Entries with a nonzero key only hold the counters
+ * of the function whose name hashes to the key.
+ */
+#define PROFILE_V2_MAGIC 0x32666f72706c6cffULL /* "\377llprof2" */
+#define PROFILE_V2_VERSION 2
+#define PROFILE_V2_ALIGN 8
+
+typedef struct {
+  uint64_t magic;
+  uint32_t version;
+  uint32_t numEntries;
+} ProfileV2Header;
+
+typedef struct {
+  uint32_t type;     /* enum ProfilingType of the payload */
+  uint32_t flags;    /* reserved, 0 */
+  uint64_t key;      /* hash of the function name, 0 for the whole program */
+  uint64_t offset;   /* of the payload from the start of the file */
+  uint64_t length;   /* of the payload in bytes */
+  uint64_t checksum; /* FNV-1a hash of the payload */
+} ProfileV2Entry;
+
 #if defined(__cplusplus)
 }
 #endif
@@ -4,25 +4,205 @@
 #include "ProfileInfoLoader.h"
 #include "ProfileInfoTypes.h"
 
+#include <assert.h>
+#include <iterator>
+#include <stdio.h>
+
 namespace llvm {
 
+/* the layout of the file written by ProfileInfoWriter */
+enum ProfileFormat {
+   ProfileFlat,   /* a stream of packets, as written by libprofile */
+   ProfileIndexed /* a table of contents, see ProfileV2Header */
+};
+
+/* packets are streamed to the file as they are written, through a small
+ * buffer, whatever their size. the payloads of an indexed file go to a
+ * temporary file first and are copied after the table of contents on close */
 class ProfileInfoWriter {
+   std::string ToolName;
    FILE* File;
+   ProfileFormat Format;
+   /* entries of an indexed file and their payloads, offsets are relative to
+    * the start of Payloads until the file is closed */
+   std::vector<ProfileV2Entry> Entries;
+   FILE* Payloads;
+   /* the packet being written, Skip if a flat file can't hold it */
+   FILE* Out;
+   bool Skip;
+   uint64_t Length, Checksum;
+   /* a packet could not be written */
+   bool Failed;
+
+   /* report and return false if N counters don't fit the count of Type */
+   bool checkCount(ProfilingType Type, uint64_t N);
+   void beginPacket(ProfilingType Type, uint64_t Key);
+   void emit(const void* Data, size_t Size);
+   void endPacket();
+   /* Entries converted to EntryT, a buffer full at a time */
+   template<class EntryT, class Iter>
+   void emitEntries(Iter Begin, Iter End);
+   template<class EntryT, class Fn>
+   void emitGenerated(uint64_t N, Fn Entry);
+   template<class Iter>
+   void writeCounters(ProfilingType Type, uint64_t Key, Iter Begin, Iter End);
    public:
    /* open a Filename and prepare for write */
-   ProfileInfoWriter(const char* ToolName, const std::string& Filename);
+   ProfileInfoWriter(const char* ToolName, const std::string& Filename,
+         ProfileFormat Format = ProfileFlat);
    /* close file and release memory */
    ~ProfileInfoWriter();
+   ProfileFormat getFormat() const { return Format; }
+   /* true if a packet was dropped, because its counters did not fit */
+   bool hasFailed() const { return Failed; }
    /* write the execution argument type */
    void write(const std::string& cmd);
+   /* write the counters [Begin, End) as a packet of Type, each converted to
+    * the entry of Type: unsigned, uint64_t or double. Begin is read twice,
+    * once to count the entries */
+   template<class Iter>
+   void write(ProfilingType Type, Iter Begin, Iter End) {
+      writeCounters(Type, 0, Begin, End);
+   }
+   /* write the N counters Entry(0) ... Entry(N-1) as a packet of Type, for
+    * counters computed while they are written */
+   template<class Fn>
+   void writeGenerated(ProfilingType Type, uint64_t N, Fn Entry);
    /* write the counters
-    * @param Type: set type of Counters
-    *              !NOTE! Doesn't support ValueInfo Now
-    * @param Counter: a Array of unsigned Counter
+    * @param Type: set type of Counters, any but ValueInfo, which
+    * writeValues writes, and ArgumentInfo, which write(cmd) writes
+    * @param Counter: a Array of Counter
     */
-   void write(ProfilingType Type, const std::vector<unsigned>& Counter);
+   void write(ProfilingType Type, const std::vector<unsigned>& Counter) {
+      write(Type, Counter.begin(), Counter.end());
+   }
+   void write(ProfilingType Type, const std::vector<uint64_t>& Counter) {
+      write(Type, Counter.begin(), Counter.end());
+   }
+   void write(ProfilingType Type, const std::vector<double>& Counter) {
+      write(Type, Counter.begin(), Counter.end());
+   }
+   /* write a ValueInfo packet: the count of every traped value in
+    * [Begin, End), then the contents, *Contents++ for each of them. a
+    * content is any container of int, its first element is the flags, an
+    * empty one is a value never traped */
+   template<class CountIter, class ContentIter>
+   void writeValues(CountIter Begin, CountIter End, ContentIter Contents);
+   void writeValues(const std::vector<unsigned>& Counts,
+         const std::vector<std::vector<int> >& Contents) {
+      assert(Contents.size() >= Counts.size());
+      writeValues(Counts.begin(), Counts.end(), Contents.begin());
+   }
+   /* write the counters of function Name alone, keyed by its name hash
+    * @param Type: a 64 bit packet type
+    * !NOTE! only an indexed file holds them, a flat file skips them
+    */
+   template<class Iter>
+   void write(ProfilingType Type, const std::string& Name, Iter Begin, Iter End) {
+      assert(Is64BitPacket(Type));
+      writeCounters(Type, ProfileNameHash(Name), Begin, End);
+   }
+   void write(ProfilingType Type, const std::string& Name,
+         const std::vector<uint64_t>& Counter) {
+      write(Type, Name, Counter.begin(), Counter.end());
+   }
 };
 
+template<class EntryT, class Iter>
+void ProfileInfoWriter::emitEntries(Iter Begin, Iter End)
+{
+   EntryT Buffer[512];
+   size_t n = 0;
+   for(; Begin != End; ++Begin){
+      Buffer[n++] = (EntryT)*Begin;
+      if(n == sizeof(Buffer)/sizeof(EntryT)){
+         emit(Buffer, sizeof(Buffer));
+         n = 0;
+      }
+   }
+   emit(Buffer, n * sizeof(EntryT));
+}
+
+template<class EntryT, class Fn>
+void ProfileInfoWriter::emitGenerated(uint64_t N, Fn Entry)
+{
+   EntryT Buffer[512];
+   size_t n = 0;
+   for(uint64_t i = 0; i < N; ++i){
+      Buffer[n++] = (EntryT)Entry(i);
+      if(n == sizeof(Buffer)/sizeof(EntryT)){
+         emit(Buffer, sizeof(Buffer));
+         n = 0;
+      }
+   }
+   emit(Buffer, n * sizeof(EntryT));
+}
+
+template<class Iter>
+void ProfileInfoWriter::writeCounters(ProfilingType Type, uint64_t Key,
+      Iter Begin, Iter End)
+{
+   assert(Type != ValueInfo && Type != ArgumentInfo && "see writeValues and write(cmd)");
+   uint64_t N = std::distance(Begin, End);
+   if(N == 0 || !checkCount(Type, N)) return;
+   beginPacket(Type, Key);
+   if(IsDoublePacket(Type)){
+      emit(&N, sizeof(N));
+      emitEntries<double>(Begin, End);
+   }else if(Is64BitPacket(Type)){
+      emit(&N, sizeof(N));
+      emitEntries<uint64_t>(Begin, End);
+   }else{
+      unsigned N32 = N;
+      emit(&N32, sizeof(N32));
+      emitEntries<unsigned>(Begin, End);
+   }
+   endPacket();
+}
+
+template<class Fn>
+void ProfileInfoWriter::writeGenerated(ProfilingType Type, uint64_t N, Fn Entry)
+{
+   assert(Type != ValueInfo && Type != ArgumentInfo && "see writeValues and write(cmd)");
+   if(N == 0 || !checkCount(Type, N)) return;
+   beginPacket(Type, 0);
+   if(IsDoublePacket(Type)){
+      emit(&N, sizeof(N));
+      emitGenerated<double>(N, Entry);
+   }else if(Is64BitPacket(Type)){
+      emit(&N, sizeof(N));
+      emitGenerated<uint64_t>(N, Entry);
+   }else{
+      unsigned N32 = N;
+      emit(&N32, sizeof(N32));
+      emitGenerated<unsigned>(N, Entry);
+   }
+   endPacket();
+}
+
+template<class CountIter, class ContentIter>
+void ProfileInfoWriter::writeValues(CountIter Begin, CountIter End,
+      ContentIter Contents)
+{
+   uint64_t N = std::distance(Begin, End);
+   if(N == 0 || !checkCount(ValueInfo, N)) return;
+   // the contents are counted in 32 bit as well, check them all before the
+   // packet is started
+   ContentIter C = Contents;
+   for(uint64_t i = 0; i < N; ++i, ++C)
+      if(!checkCount(ValueInfo, std::distance(C->begin(), C->end()))) return;
+   beginPacket(ValueInfo, 0);
+   unsigned N32 = N;
+   emit(&N32, sizeof(N32));
+   emitEntries<unsigned>(Begin, End);
+   for(uint64_t i = 0; i < N; ++i, ++Contents){
+      unsigned Size = std::distance(Contents->begin(), Contents->end());
+      emit(&Size, sizeof(Size));
+      emitEntries<int>(Contents->begin(), Contents->end());
+   }
+   endPacket();
+}
+
 }
 
 #endif
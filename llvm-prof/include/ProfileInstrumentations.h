@@ -68,6 +68,8 @@ ModulePass *createPathProfileVerifierPass();
 // Insert edge profiling instrumentation
 ModulePass *createEdgeProfilerPass();
 
+ModulePass *createSampledEdgeProfilerPass();
+
 // Insert optimal edge profiling instrumentation
 ModulePass *createOptimalEdgeProfilerPass();
 
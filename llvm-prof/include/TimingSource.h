@@ -5,6 +5,7 @@
 #include <llvm/ADT/SmallVector.h>
 #include <llvm/IR/GlobalVariable.h>
 #include <llvm/Support/raw_ostream.h>
+#include "ProfileDataTypes.h"
 
 class FreeExpression;
 
@@ -36,7 +37,9 @@ class TimingSource{
       MPILast,
       LibCall = MPILast,
       LibFn,
-      LibCallLast
+      MemOp,
+      LibCallLast,
+      IO
    };
 
    virtual ~TimingSource(){};
@@ -52,8 +55,10 @@ class TimingSource{
       params.clear();
       params.assign(list);
    }
-   virtual void init_with_file(const char* file) {
-      init(std::bind(file_initializer, file, std::placeholders::_1));
+   /* init params from file with file_initializer. false with the reason in
+    * Error if the file can't be read */
+   virtual bool init_with_file(const char* file, std::string& Error) {
+      return file_initializer(file, params.data(), Error);
    }
    Kind getKind() const { return kindof;}
 
@@ -61,7 +66,7 @@ class TimingSource{
 
    protected:
    Kind kindof;
-   void (*file_initializer)(const char* file, double* data);
+   bool (*file_initializer)(const char* file, double* data, std::string& Error);
    std::vector<double> params;
 
    TimingSource(Kind K, size_t NumParam):kindof(K){
@@ -97,8 +102,11 @@ class MPITiming: public TimingSource
                         double count) const = 0; // io part
    virtual double newcount(const llvm::Instruction& I, double bfreq,
                         double count, int fixed) const = 0;
+   bool init_with_file(const char* file, std::string& Error) override;
    protected:
    MPITiming(Kind K, size_t N);
+   /* false if MPI_SIZE wasn't set */
+   bool checkSize(std::string& Error) const;
    unsigned R;
 };
 
@@ -157,7 +165,7 @@ class LmbenchTiming : public BBlockTiming,
    typedef LmbenchInstGroups EnumTy;
    static llvm::StringRef getName(EnumTy);
    static EnumTy classify(llvm::Instruction* I);
-   static void load_lmbench(const char* file, double* cpu_times);
+   static bool load_lmbench(const char* file, double* cpu_times, std::string& Error);
    static bool classof(const TimingSource* S)
    {
       return S->getKind() == Kind::Lmbench;
@@ -186,7 +194,7 @@ class IrinstTiming : public BBlockTiming,
    static const char* Name;
    typedef IrinstGroups EnumTy;
    static EnumTy classify(llvm::Instruction* I);
-   static void load_irinst(const char* file, double* cpu_times);
+   static bool load_irinst(const char* file, double* cpu_times, std::string& Error);
    static bool classof(const TimingSource* S) {
       return S->getKind() == Kind::Irinst;
    }
@@ -223,7 +231,7 @@ class MPBenchReTiming : public MPITiming
 
    MPBenchReTiming();
    ~MPBenchReTiming();
-   void init_with_file(const char* file);
+   bool init_with_file(const char* file, std::string& Error) override;
 
    double fittingcount(const llvm::Instruction& I, double bfreq,
                 double count) const override;
@@ -262,7 +270,7 @@ class LatencyTiming : public MPITiming, public _timing_source::T<MPISpec>
    static bool classof(const TimingSource* S) {
       return S->getKind() == Kind::Latency;
    }
-   static void load_files(const char*, double *);
+   static bool load_files(const char*, double *, std::string&);
    LatencyTiming();
    
    double fittingcount(const llvm::Instruction& I, double bfreq,
@@ -285,13 +293,59 @@ class LibFnTiming : public LibCallTiming, public _timing_source::T<LibFnSpec>
    static bool classof(const TimingSource* S) {
       return S->getKind() == Kind::LibFn;
    }
-   static void load_libfn(const char* file, double* cpu_times);
+   static bool load_libfn(const char* file, double* cpu_times, std::string& Error);
 
    LibFnTiming();
 
    double count(const llvm::CallInst& CI, double bfreq) const override;
 };
 
+// MEMOP_BINS timings for each op, taken at MEMOP_BIN_SIZE of the bin
+enum MemOpSpec {
+   MEMOP_COPY = 0, MEMOP_MOVE = MEMOP_BINS, MEMOP_SET = 2*MEMOP_BINS,
+   MemOpNumSpec = 3*MEMOP_BINS
+};
+
+class MemOpTiming : public LibCallTiming, public _timing_source::T<MemOpSpec>
+{
+   public:
+   typedef MemOpSpec EnumTy;
+   static const char* Name;
+   static bool classof(const TimingSource* S) {
+      return S->getKind() == Kind::MemOp;
+   }
+   static bool load_memop(const char* file, double* param, std::string& Error);
+
+   MemOpTiming();
+
+   // without profile, a constant length decides the bin, else the first bin
+   double count(const llvm::CallInst& CI, double bfreq) const override;
+   // Counts is the MemOpFields of the call site, the open top bin is scaled
+   // by the bytes of MEMOP_BYTES the lower bins leave
+   double count(const llvm::CallInst& CI, const std::vector<double>& Counts) const;
+   protected:
+   // first param of the op CI performs
+   static unsigned op_base(const llvm::CallInst& CI);
+};
+
+enum IOSpec { IO_PER_CALL, IO_PER_BYTE, IONumSpec };
+
+class IOTiming : public TimingSource, public _timing_source::T<IOSpec>
+{
+   public:
+   typedef IOSpec EnumTy;
+   static const char* Name;
+   static bool classof(const TimingSource* S) {
+      return S->getKind() == Kind::IO;
+   }
+   static bool load_io(const char* file, double* param, std::string& Error);
+
+   IOTiming();
+
+   // io call executed Calls times, transferring Bytes in total
+   double count(const llvm::CallInst& CI, double Calls, double Bytes) const;
+};
+
 }
 
 #endif
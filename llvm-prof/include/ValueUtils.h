@@ -5,11 +5,17 @@
  * author: xiehuc@gmail.com 
  */
 
+#include <vector>
+
 namespace llvm{
    class Value;
+   class Function;
+   class Module;
    class GlobalVariable;
    class Instruction;
    class CallInst;
+   class Loop;
+   class LoopInfo;
 }
 
 namespace lle{
@@ -50,5 +56,66 @@ namespace lle{
     * if unknow --- throw std::out_of_range
     */
    MPICategoryType get_mpi_collection(const llvm::CallInst*) noexcept(false);
+
+   /**
+    * if CI starts an OpenMP parallel region (__kmpc_fork_call, GOMP_parallel,
+    * GOMP_parallel_start), return the outlined function of the region
+    * else return NULL */
+   llvm::Function* get_omp_outlined(const llvm::CallInst* CI);
+   /**
+    * return the outlined functions of all parallel regions in M, each once,
+    * in the order they are first forked */
+   std::vector<llvm::Function*> get_omp_regions(llvm::Module& M);
+
+   /**
+    * return loads and stores in blocks lying on a cycle of the cfg, in module
+    * order. they are the targets of stride profiling */
+   std::vector<llvm::Instruction*> get_loop_memory_accesses(llvm::Module& M);
+
+   /**
+    * return true if CI calls the gfortran io runtime (_gfortran_st_*,
+    * _gfortran_transfer_*) or posix read/write */
+   bool is_io_call(const llvm::CallInst* CI);
+   /**
+    * return all io calls in M, in module order. they are the targets of io
+    * profiling */
+   std::vector<llvm::CallInst*> get_io_calls(llvm::Module& M);
+
+   /**
+    * return true if CI is a llvm.memcpy/memmove/memset intrinsic or a call
+    * of the libc function of the same name. the length is operand 2 */
+   bool is_memory_op(const llvm::CallInst* CI);
+   /**
+    * return all memory ops in M, in module order. they are the targets of
+    * memory op profiling */
+   std::vector<llvm::CallInst*> get_memory_op_calls(llvm::Module& M);
+
+   enum HeapCallKind {
+      HEAP_CALL_NONE  = 0,
+      HEAP_CALL_ALLOC = 1, // returns the allocated pointer
+      HEAP_CALL_FREE  = 2
+   };
+   /**
+    * operands of a heap call, -1 if it has none. the allocated bytes are
+    * Size, times Num for calloc. Ptr is freed by the call, realloc both
+    * frees and allocates */
+   struct HeapCallSpec {
+      HeapCallKind Kind;
+      int Size, Num, Ptr;
+   };
+   /**
+    * return how CI allocates or frees heap memory: malloc, calloc, realloc,
+    * free and the gfortran _gfortran_allocate, _gfortran_allocate_array and
+    * _gfortran_deallocate. Kind is HEAP_CALL_NONE for other calls */
+   HeapCallSpec get_heap_call(const llvm::CallInst* CI);
+   /**
+    * return all heap allocations in M, in module order. they are the sites
+    * of heap profiling */
+   std::vector<llvm::CallInst*> get_heap_alloc_calls(llvm::Module& M);
+
+   /**
+    * return all loops of LI in preorder, each outer loop before its subloops.
+    * light profiling lays out its loop counters in this order */
+   std::vector<llvm::Loop*> get_loops_preorder(llvm::LoopInfo& LI);
 }
 #endif
@@ -0,0 +1,178 @@
+#include "preheader.h"
+#include <llvm/Pass.h>
+#include <llvm/PassManager.h>
+#include <llvm/PassRegistry.h>
+#include <llvm/IR/Module.h>
+#include <llvm/IR/Constants.h>
+#include <llvm/IR/DerivedTypes.h>
+#include <llvm/IR/Instructions.h>
+#include <llvm/Support/CommandLine.h>
+#include <llvm/Support/raw_ostream.h>
+
+#include "ProfilingUtils.h"
+#include "ProfileInstrumentations.h"
+#include "ProfileDataTypes.h"
+
+#include <algorithm>
+
+/**
+ * run several instrumentations at once, then move their counter arrays into
+ * one arena and replace their llvm_start_* calls by a single
+ * llvm_start_combined_profiling call. the arena is a packed struct aligned to
+ * COMBINED_ARENA_ALIGN, each counter array starts on its own cache line.
+ *
+ * the runtime gets a descriptor table of COMBINED_FIELDS uint64_t per array:
+ *    [packet type] [element size] [address] [number of elements]
+ * the rank array of time profiling follows its time array with the same type.
+ */
+namespace {
+   class CombinedProfiler : public llvm::ModulePass
+   {
+      public:
+      static char ID;
+      CombinedProfiler():ModulePass(ID) {};
+      bool runOnModule(llvm::Module&) override;
+   };
+
+   struct CombinedKind {
+      const char* Name;    // name in -profile-kinds
+      const char* PassArg; // instrumentation pass
+      const char* StartFn; // its init call
+      ProfilingType Type;  // its packet
+   };
+}
+
+using namespace llvm;
+
+static cl::list<std::string> ProfileKinds("profile-kinds", cl::CommaSeparated,
+      cl::desc("Instrumentations combined by -insert-combined-profiling"),
+      cl::value_desc("edge,pred-double,mpi,time,rank"));
+
+char CombinedProfiler::ID = 0;
+static RegisterPass<CombinedProfiler> X("insert-combined-profiling",
+      "insert several profilings sharing one counter arena and init call", false, false);
+
+static const CombinedKind Kinds[] = {
+   {"edge"        , "insert-edge-profiling"        , "llvm_start_edge_profiling"              , EdgeInfo64}      ,
+   {"pred-double" , "insert-pred-double-profiling" , "llvm_start_pred_double_block_profiling" , BlockInfoDouble} ,
+   {"mpi"         , "insert-mpi-profiling"         , "llvm_start_mpi_profiling"               , MPIFullInfo}     ,
+   {"time"        , "insert-time-profiling"        , "llvm_start_time_profiling"              , MPITimeInfo}     ,
+   {"rank"        , "insert-rank-profiling"        , "llvm_start_rank_profiling"              , RankInfo}
+};
+
+static const CombinedKind* findKind(StringRef Name)
+{
+   for(const CombinedKind& K : Kinds)
+      if(Name == K.Name) return &K;
+   return NULL;
+}
+
+bool CombinedProfiler::runOnModule(llvm::Module &M)
+{
+   Function *Main = M.getFunction("main");
+   if (Main == 0) {
+      errs() << "WARNING: cannot insert combined profiling into a module"
+         << " with no main function!\n";
+      return false;  // No main, no instrumentation!
+   }
+
+   std::vector<const CombinedKind*> Selected;
+   PassManager PM;
+   for(const std::string& Name : ProfileKinds){
+      const CombinedKind* K = findKind(Name);
+      const PassInfo* PI = K ? PassRegistry::getPassRegistry()->getPassInfo(K->PassArg) : NULL;
+      if(PI == NULL){
+         errs() << "WARNING: unknown profile kind '" << Name << "', ignored!\n";
+         continue;
+      }
+      if(std::find(Selected.begin(), Selected.end(), K) != Selected.end())
+         continue;
+      Selected.push_back(K);
+      PM.add(PI->createPass());
+   }
+   if(Selected.empty()){
+      errs() << "WARNING: no profile kind given by -profile-kinds!\n";
+      return false;
+   }
+   PM.run(M);
+
+   // collect the counter arrays in the order of -profile-kinds and drop the
+   // init calls, each of them only passed argc on
+   std::vector<std::pair<ProfilingType, GlobalVariable*> > Arrays;
+   for(const CombinedKind* K : Selected){
+      Function* StartFn = M.getFunction(K->StartFn);
+      if(StartFn == NULL) continue; // the pass gave up
+      std::vector<CallInst*> Calls;
+      for(BasicBlock::iterator I = Main->getEntryBlock().begin(),
+            IE = Main->getEntryBlock().end(); I != IE; ++I){
+         CallInst* CI = dyn_cast<CallInst>(I);
+         if(CI && CI->getCalledFunction() == StartFn) Calls.push_back(CI);
+      }
+      for(CallInst* CI : Calls){
+         // the arrays are at 2 and, for time profiling, 4
+         for(unsigned a = 2; a < CI->getNumArgOperands(); a += 2){
+            GlobalVariable* G = dyn_cast<GlobalVariable>(
+                  CI->getArgOperand(a)->stripPointerCasts());
+            if(G) Arrays.push_back(std::make_pair(K->Type, G));
+         }
+         CI->replaceAllUsesWith(CI->getArgOperand(0));
+         CI->eraseFromParent();
+      }
+      if(StartFn->use_empty()) StartFn->eraseFromParent();
+   }
+
+   LLVMContext& Context = M.getContext();
+   Type* I8Ty = Type::getInt8Ty(Context);
+   Type* I32Ty = Type::getInt32Ty(Context);
+   Type* I64Ty = Type::getInt64Ty(Context);
+
+   // lay out the arena, padding every array up to the next cache line
+   std::vector<Type*> Fields;
+   std::vector<Constant*> Inits;
+   std::vector<unsigned> FieldOf;
+   uint64_t Offset = 0;
+   for(auto& A : Arrays){
+      GlobalVariable* G = A.second;
+      ArrayType* ATy = cast<ArrayType>(G->getType()->getElementType());
+      uint64_t Size = ATy->getNumElements() * (ATy->getElementType()->getPrimitiveSizeInBits() / 8);
+      FieldOf.push_back(Fields.size());
+      Fields.push_back(ATy);
+      Inits.push_back(G->getInitializer());
+      Offset += Size;
+      if(uint64_t Pad = (COMBINED_ARENA_ALIGN - Offset % COMBINED_ARENA_ALIGN) % COMBINED_ARENA_ALIGN){
+         ArrayType* PadTy = ArrayType::get(I8Ty, Pad);
+         Fields.push_back(PadTy);
+         Inits.push_back(Constant::getNullValue(PadTy));
+         Offset += Pad;
+      }
+   }
+   StructType* ArenaTy = StructType::get(Context, Fields, true);
+   GlobalVariable* Arena = new GlobalVariable(M, ArenaTy, false,
+         GlobalVariable::InternalLinkage, ConstantStruct::get(ArenaTy, Inits),
+         "CombinedProfArena");
+   Arena->setAlignment(COMBINED_ARENA_ALIGN);
+
+   std::vector<Constant*> Desc;
+   for(unsigned i = 0; i < Arrays.size(); ++i){
+      GlobalVariable* G = Arrays[i].second;
+      ArrayType* ATy = cast<ArrayType>(G->getType()->getElementType());
+      Constant* Indices[2] = {
+         Constant::getNullValue(I32Ty), ConstantInt::get(I32Ty, FieldOf[i])
+      };
+      Constant* Field = ConstantExpr::getGetElementPtr(Arena, Indices);
+      G->replaceAllUsesWith(Field);
+      G->eraseFromParent();
+
+      Desc.push_back(ConstantInt::get(I64Ty, Arrays[i].first));
+      Desc.push_back(ConstantInt::get(I64Ty, ATy->getElementType()->getPrimitiveSizeInBits() / 8));
+      Desc.push_back(ConstantExpr::getPtrToInt(Field, I64Ty));
+      Desc.push_back(ConstantInt::get(I64Ty, ATy->getNumElements()));
+   }
+   ArrayType* DescTy = ArrayType::get(I64Ty, Desc.size());
+   GlobalVariable* Descriptors = new GlobalVariable(M, DescTy, true,
+         GlobalVariable::InternalLinkage, ConstantArray::get(DescTy, Desc),
+         "CombinedProfDescriptors");
+
+   InsertProfilingInitCall(Main, "llvm_start_combined_profiling", Descriptors);
+   return true;
+}
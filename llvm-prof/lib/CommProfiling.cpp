@@ -0,0 +1,114 @@
+#include "preheader.h"
+#include <llvm/Pass.h>
+#include <llvm/IR/Module.h>
+#include <llvm/IR/IRBuilder.h>
+#include <llvm/IR/Constants.h>
+#include <llvm/Support/raw_ostream.h>
+
+#include "ValueUtils.h"
+#include "ProfilingUtils.h"
+#include "ProfileInstrumentations.h"
+#include "ProfileDataTypes.h"
+
+/**
+ * record who talks to whom: every mpi_send_, mpi_isend_ and mpi_sendrecv_
+ * passes its destination, count, datatype and communicator to the runtime,
+ * which keeps a row of the communication matrix per rank. every
+ * mpi_comm_rank_ passes its communicator and rank, the runtime stores the
+ * first rank in MPI_COMM_WORLD into the only element of CommRank.
+ *
+ * only MPI_COMM_WORLD is recorded: ranks of other communicators aren't
+ * translated, the runtime skips their sends and reports how many it skipped.
+ */
+namespace {
+   class CommProfiler : public llvm::ModulePass
+   {
+      public:
+      static char ID;
+      CommProfiler():ModulePass(ID) {};
+      bool runOnModule(llvm::Module&) override;
+   };
+}
+
+using namespace llvm;
+using namespace lle;
+char CommProfiler::ID = 0;
+static RegisterPass<CommProfiler> X("insert-comm-profiling",
+      "insert communication matrix profiling for mpi point to point sends", false, false);
+
+// all of them pass count, datatype and dest as argument 1, 2 and 3
+static bool isMPISend(StringRef Name)
+{
+   return Name == "mpi_send_" || Name == "mpi_isend_" || Name == "mpi_sendrecv_";
+}
+
+// the communicator follows the tag of mpi_send_ and mpi_isend_, and the
+// receive arguments of mpi_sendrecv_
+static unsigned getCommOperand(StringRef Name)
+{
+   return Name == "mpi_sendrecv_" ? 10 : 5;
+}
+
+bool CommProfiler::runOnModule(llvm::Module &M)
+{
+   Function *Main = M.getFunction("main");
+   if (Main == 0) {
+      errs() << "WARNING: cannot insert comm profiling into a module"
+         << " with no main function!\n";
+      return false;  // No main, no instrumentation!
+   }
+
+   // the sends with the index of their communicator argument
+   std::vector<std::pair<CallInst*, unsigned> > Sends;
+   std::vector<CallInst*> CommRanks;
+   for(Module::iterator F = M.begin(), E = M.end(); F != E; ++F){
+      if(F->isDeclaration()) continue;
+      for(inst_iterator I = inst_begin(*F), IE = inst_end(*F); I != IE; ++I){
+         CallInst* CI = dyn_cast<CallInst>(&*I);
+         if(CI == NULL) continue;
+         Function* Called = dyn_cast<Function>(castoff(CI->getCalledValue()));
+         if(Called == NULL) continue;
+         StringRef Name = Called->getName();
+         if(isMPISend(Name) && CI->getNumArgOperands() > getCommOperand(Name))
+            Sends.push_back(std::make_pair(CI, getCommOperand(Name)));
+         else if(Name.startswith("mpi_comm_rank_") && CI->getNumArgOperands() > 1)
+            CommRanks.push_back(CI);
+      }
+   }
+
+   LLVMContext& Context = M.getContext();
+   Type* I32Ty = Type::getInt32Ty(Context);
+   Type* I32PtrTy = I32Ty->getPointerTo();
+   Type* ATy = ArrayType::get(I32Ty, 1);
+   GlobalVariable* CommRank = new GlobalVariable(M, ATy, false,
+         GlobalVariable::InternalLinkage, Constant::getAllOnesValue(ATy),
+         "CommRank");
+   Constant* Trap = M.getOrInsertFunction("llvm_comm_profiling_trap",
+         Type::getVoidTy(Context), I32Ty, I32Ty, I32Ty, I32Ty, (Type*)0);
+   Constant* RankTrap = M.getOrInsertFunction("llvm_comm_profiling_rank",
+         Type::getVoidTy(Context), I32Ty, I32Ty, (Type*)0);
+
+   IRBuilder<> Builder(Context);
+   for(auto& Send : Sends){
+      CallInst* CI = Send.first;
+      Builder.SetInsertPoint(CI);
+      Value* Args[4];
+      Args[0] = Builder.CreateLoad(Builder.CreatePointerCast(CI->getArgOperand(3), I32PtrTy));
+      Args[1] = Builder.CreateLoad(Builder.CreatePointerCast(CI->getArgOperand(1), I32PtrTy));
+      Args[2] = Builder.CreateLoad(Builder.CreatePointerCast(CI->getArgOperand(2), I32PtrTy));
+      Args[3] = Builder.CreateLoad(Builder.CreatePointerCast(CI->getArgOperand(Send.second), I32PtrTy));
+      Builder.CreateCall(Trap, Args);
+   }
+
+   // the rank is only known after the call returns
+   for(CallInst* CI : CommRanks){
+      Builder.SetInsertPoint(++BasicBlock::iterator(CI));
+      Value* Args[2];
+      Args[0] = Builder.CreateLoad(Builder.CreatePointerCast(CI->getArgOperand(0), I32PtrTy));
+      Args[1] = Builder.CreateLoad(Builder.CreatePointerCast(CI->getArgOperand(1), I32PtrTy));
+      Builder.CreateCall(RankTrap, Args);
+   }
+
+   InsertProfilingInitCall(Main, "llvm_start_comm_profiling", CommRank);
+   return true;
+}
@@ -15,6 +15,13 @@
 // edge in the program, instead of using control flow information to prune the
 // number of counters inserted.
 //
+// When re-profiling a slightly changed program, -prior-profile can be given an
+// earlier llvmprof.out.  Functions and loops that executed fewer than
+// -hot-threshold times in it are left without counters: their slots are either
+// initialized with the old counts or marked Uncounted, in which case the
+// profile loader estimates them from the surrounding flow.  The (0,entry) edge
+// of every function is always counted.
+//
 //===----------------------------------------------------------------------===//
 #define DEBUG_TYPE "insert-edge-profiling"
 
@@ -25,23 +32,59 @@
 #include <llvm/Pass.h>
 #include <llvm/Support/raw_ostream.h>
 #include <llvm/Transforms/Utils/BasicBlockUtils.h>
+#include <llvm/IR/Constants.h>
+#include <llvm/Analysis/LoopInfo.h>
+#include <llvm/Support/CommandLine.h>
 #include "ProfilingUtils.h"
+#include "ProfileInfoLoader.h"
+#include "ProfileDataTypes.h"
 #include "InitializeProfilerPass.h"
 #include "ProfileInstrumentations.h"
 #include <set>
+#include <map>
 using namespace llvm;
 
 STATISTIC(NumEdgesInserted, "The # of edges inserted.");
+STATISTIC(NumColdEdges, "The # of cold edges left uninstrumented.");
+
+enum ColdCountsMode {
+  COLD_CARRY,
+  COLD_ESTIMATE
+};
+
+static cl::opt<std::string>
+PriorProfile("prior-profile", cl::value_desc("filename"),
+             cl::desc("Previous edge profile used to skip cold code"));
+
+static cl::opt<unsigned>
+HotThreshold("hot-threshold", cl::init(1),
+             cl::desc("Functions and loops executed fewer times than this in "
+                      "-prior-profile are not instrumented"));
+
+static cl::opt<ColdCountsMode>
+ColdCounts("cold-counts", cl::desc("How uninstrumented edges get their count"),
+           cl::values(
+              clEnumValN(COLD_CARRY, "carry", "copy the count from -prior-profile"),
+              clEnumValN(COLD_ESTIMATE, "estimate", "let the profile loader estimate it"),
+              clEnumValEnd),
+           cl::init(COLD_CARRY));
 
 namespace {
   class EdgeProfiler : public ModulePass {
     bool runOnModule(Module &M);
+    void markColdEdges(Function &F, unsigned Base,
+                       const std::vector<uint64_t> &Prior,
+                       std::vector<bool> &Cold);
   public:
     static char ID; // Pass identification, replacement for typeid
     EdgeProfiler() : ModulePass(ID) {
       //initializeEdgeProfilerPass(*PassRegistry::getPassRegistry());
     }
 
+    virtual void getAnalysisUsage(AnalysisUsage &AU) const {
+      if (!PriorProfile.empty()) AU.addRequired<LoopInfo>();
+    }
+
     virtual const char *getPassName() const {
       return "Edge Profiler";
     }
@@ -58,6 +101,47 @@ static RegisterPass<EdgeProfiler> X("insert-edge-profiling",
 
 ModulePass *llvm::createEdgeProfilerPass() { return new EdgeProfiler(); }
 
+// markColdEdges - Decide which edge slots of F, numbered from Base in the same
+// order as the counters are laid out, need no counter.  A block's old count is
+// the sum of its incoming edges; every edge of a cold function and every edge
+// leaving a block whose innermost loop has a cold header is cold.  A prior
+// that was itself collected with cold edges skipped may hold Uncounted slots;
+// those are unknown, and a count built from an unknown slot never makes code
+// cold.
+void EdgeProfiler::markColdEdges(Function &F, unsigned Base,
+                                 const std::vector<uint64_t> &Prior,
+                                 std::vector<bool> &Cold) {
+  const uint64_t U = ProfileInfoLoader::Uncounted;
+  uint64_t EntryCount = Prior[Base];
+  bool FunctionIsCold = EntryCount != U && EntryCount < HotThreshold;
+
+  std::map<const BasicBlock*, uint64_t> BlockCount;
+  std::set<const BasicBlock*> Unknown;
+  if (EntryCount == U) Unknown.insert(&F.getEntryBlock());
+  else BlockCount[&F.getEntryBlock()] = EntryCount;
+  unsigned i = Base + 1;
+  for (Function::iterator BB = F.begin(), E = F.end(); BB != E; ++BB) {
+    TerminatorInst *TI = BB->getTerminator();
+    for (unsigned s = 0, e = TI->getNumSuccessors(); s != e; ++s, ++i) {
+      if (Prior[i] == U) Unknown.insert(TI->getSuccessor(s));
+      else BlockCount[TI->getSuccessor(s)] += Prior[i];
+    }
+  }
+
+  LoopInfo &LI = getAnalysis<LoopInfo>(F);
+  i = Base + 1;
+  for (Function::iterator BB = F.begin(), E = F.end(); BB != E; ++BB) {
+    bool BlockIsCold = FunctionIsCold;
+    if (Loop *L = LI.getLoopFor(BB)) {
+      const BasicBlock* H = L->getHeader();
+      BlockIsCold |= !Unknown.count(H) && BlockCount[H] < HotThreshold;
+    }
+    unsigned NumSucc = BB->getTerminator()->getNumSuccessors();
+    for (unsigned s = 0; s != NumSucc; ++s, ++i)
+      Cold[i] = BlockIsCold;
+  }
+}
+
 bool EdgeProfiler::runOnModule(Module &M) {
   Function *Main = M.getFunction("main");
   if (Main == 0) {
@@ -65,6 +149,7 @@ bool EdgeProfiler::runOnModule(Module &M) {
            << " with no main function!\n";
     return false;  // No main, no instrumentation!
   }
+  InsertCFGChecksums(M, Main);
 
   std::set<BasicBlock*> BlocksToInstrument;
   unsigned NumEdges = 0;
@@ -81,11 +166,53 @@ bool EdgeProfiler::runOnModule(Module &M) {
     }
   }
 
-  Type *ATy = ArrayType::get(Type::getInt64Ty(M.getContext()), NumEdges);
+  // Find the cold edges from the prior profile, if it matches this module.
+  std::vector<uint64_t> Prior;
+  std::vector<bool> Cold(NumEdges, false);
+  if (!PriorProfile.empty()) {
+    ProfileInfoLoader PIL("insert-edge-profiling", PriorProfile,
+                          PacketTypes({EdgeInfo, EdgeInfo64}));
+    Prior = PIL.getRawEdgeCounts();
+    if (PIL.hasError()) {
+      errs() << "WARNING: " << PIL.getError() << ", instrumenting all edges!\n";
+      Prior.clear();
+    } else if (Prior.size() != NumEdges) {
+      errs() << "WARNING: prior profile '" << PriorProfile
+             << "' is inconsistent with the current program,"
+             << " instrumenting all edges!\n";
+      Prior.clear();
+    }
+    unsigned Base = 0;
+    for (Module::iterator F = M.begin(), E = M.end(); F != E && !Prior.empty();
+         ++F) {
+      if (F->isDeclaration()) continue;
+      markColdEdges(*F, Base, Prior, Cold);
+      Base += 1;
+      for (Function::iterator BB = F->begin(), BE = F->end(); BB != BE; ++BB)
+        Base += BB->getTerminator()->getNumSuccessors();
+    }
+  }
+
+  Type *Int64Ty = Type::getInt64Ty(M.getContext());
+  ArrayType *ATy = ArrayType::get(Int64Ty, NumEdges);
+  Constant *Init = Constant::getNullValue(ATy);
+  if (!Prior.empty()) {
+    // Cold slots are never incremented, so their initial value is what ends up
+    // in the output file.
+    std::vector<Constant*> Inits(NumEdges, ConstantInt::get(Int64Ty, 0));
+    for (unsigned j = 0; j != NumEdges; ++j) {
+      if (!Cold[j]) continue;
+      uint64_t V = ColdCounts == COLD_CARRY ? Prior[j]
+                                            : ProfileInfoLoader::Uncounted;
+      Inits[j] = ConstantInt::get(Int64Ty, V);
+      ++NumColdEdges;
+    }
+    Init = ConstantArray::get(ATy, Inits);
+  }
   GlobalVariable *Counters =
     new GlobalVariable(M, ATy, false, GlobalValue::InternalLinkage,
-                       Constant::getNullValue(ATy), "EdgeProfCounters");
-  NumEdgesInserted = NumEdges;
+                       Init, "EdgeProfCounters");
+  NumEdgesInserted = NumEdges - NumColdEdges;
 
   // Instrument all of the edges...
   unsigned i = 0;
@@ -100,6 +227,12 @@ bool EdgeProfiler::runOnModule(Module &M) {
         // in the source or destination of the edge.
         TerminatorInst *TI = BB->getTerminator();
         for (unsigned s = 0, e = TI->getNumSuccessors(); s != e; ++s) {
+          // Cold edges keep their slot but get no counter.
+          if (Cold[i]) {
+            ++i;
+            continue;
+          }
+
           // If the edge is critical, split it.
           SplitCriticalEdge(TI, s, this);
 
@@ -0,0 +1,126 @@
+#include "preheader.h"
+#include <llvm/Pass.h>
+#include <llvm/IR/Module.h>
+#include <llvm/IR/IRBuilder.h>
+#include <llvm/IR/Constants.h>
+#include <llvm/Support/raw_ostream.h>
+
+#include "ValueUtils.h"
+#include "ProfilingUtils.h"
+#include "ProfileInstrumentations.h"
+#include "ProfileDataTypes.h"
+
+/**
+ * every allocation site gets HEAP_FIELDS counters after a HEAP_HEADER, the
+ * runtime is told about each allocation after it returns and about each free
+ * before it runs. a realloc is reported after it returns, so a failed one
+ * keeps the old block counted. the largest size of mpi_comm_size_
+ * is stored into HEAP_NPROCS, so runs of different scale can be fitted.
+ */
+namespace {
+   class HeapProfiler : public llvm::ModulePass
+   {
+      public:
+      static char ID;
+      HeapProfiler():ModulePass(ID) {};
+      bool runOnModule(llvm::Module&) override;
+   };
+}
+
+using namespace llvm;
+using namespace lle;
+char HeapProfiler::ID = 0;
+static RegisterPass<HeapProfiler> X("insert-heap-profiling",
+      "insert peak and size profiling of heap allocations", false, false);
+
+bool HeapProfiler::runOnModule(llvm::Module &M)
+{
+   Function *Main = M.getFunction("main");
+   if (Main == 0) {
+      errs() << "WARNING: cannot insert heap profiling into a module"
+         << " with no main function!\n";
+      return false;  // No main, no instrumentation!
+   }
+
+   std::vector<CallInst*> Sites = get_heap_alloc_calls(M);
+   std::vector<CallInst*> Frees, CommSizes;
+   for(Module::iterator F = M.begin(), E = M.end(); F != E; ++F){
+      if(F->isDeclaration()) continue;
+      for(inst_iterator I = inst_begin(*F), IE = inst_end(*F); I != IE; ++I){
+         CallInst* CI = dyn_cast<CallInst>(&*I);
+         if(CI == NULL) continue;
+         if(get_heap_call(CI).Kind == HEAP_CALL_FREE){
+            Frees.push_back(CI);
+            continue;
+         }
+         Function* Called = dyn_cast<Function>(castoff(CI->getCalledValue()));
+         if(Called && Called->getName().startswith("mpi_comm_size_"))
+            CommSizes.push_back(CI);
+      }
+   }
+
+   LLVMContext& Context = M.getContext();
+   Type* I32Ty = Type::getInt32Ty(Context);
+   Type* I64Ty = Type::getInt64Ty(Context);
+   Type* I8PtrTy = Type::getInt8PtrTy(Context);
+   Type* ATy = ArrayType::get(I64Ty, HEAP_HEADER + Sites.size() * HEAP_FIELDS);
+   GlobalVariable* Counters = new GlobalVariable(M, ATy, false,
+         GlobalVariable::InternalLinkage, Constant::getNullValue(ATy),
+         "HeapCounters");
+   Constant* AllocTrap = M.getOrInsertFunction("llvm_heap_profiling_alloc",
+         Type::getVoidTy(Context), I32Ty, I8PtrTy, I64Ty, (Type*)0);
+   Constant* FreeTrap = M.getOrInsertFunction("llvm_heap_profiling_free",
+         Type::getVoidTy(Context), I8PtrTy, (Type*)0);
+   Constant* ReallocTrap = M.getOrInsertFunction("llvm_heap_profiling_realloc",
+         Type::getVoidTy(Context), I32Ty, I8PtrTy, I8PtrTy, I64Ty, (Type*)0);
+
+   IRBuilder<> Builder(Context);
+   for(CallInst* CI : Frees){
+      Builder.SetInsertPoint(CI);
+      Builder.CreateCall(FreeTrap, Builder.CreatePointerCast(
+               CI->getArgOperand(get_heap_call(CI).Ptr), I8PtrTy));
+   }
+
+   unsigned Idx = 0;
+   for(CallInst* CI : Sites){
+      HeapCallSpec S = get_heap_call(CI);
+      Builder.SetInsertPoint(++BasicBlock::iterator(CI));
+      Value* Size = Builder.CreateZExtOrTrunc(CI->getArgOperand(S.Size), I64Ty);
+      if(S.Num >= 0)
+         Size = Builder.CreateMul(Size,
+               Builder.CreateZExtOrTrunc(CI->getArgOperand(S.Num), I64Ty));
+      Value* Site = ConstantInt::get(I32Ty, Idx++);
+      Value* New = Builder.CreatePointerCast(CI, I8PtrTy);
+      if(S.Ptr >= 0){
+         Value* Args[4];
+         Args[0] = Site;
+         Args[1] = Builder.CreatePointerCast(CI->getArgOperand(S.Ptr), I8PtrTy);
+         Args[2] = New;
+         Args[3] = Size;
+         Builder.CreateCall(ReallocTrap, Args);
+         continue;
+      }
+      Value* Args[3];
+      Args[0] = Site;
+      Args[1] = New;
+      Args[2] = Size;
+      Builder.CreateCall(AllocTrap, Args);
+   }
+
+   // HeapCounters[HEAP_NPROCS] = max(HeapCounters[HEAP_NPROCS], size)
+   Constant* Indices[2] = {
+      Constant::getNullValue(I32Ty), ConstantInt::get(I32Ty, HEAP_NPROCS)
+   };
+   Constant* NProcsPtr = ConstantExpr::getGetElementPtr(Counters, Indices);
+   for(CallInst* CI : CommSizes){
+      Builder.SetInsertPoint(++BasicBlock::iterator(CI));
+      Value* Old = Builder.CreateLoad(NProcsPtr);
+      Value* Size = Builder.CreateZExt(Builder.CreateLoad(Builder.CreatePointerCast(
+                  CI->getArgOperand(1), I32Ty->getPointerTo())), I64Ty);
+      Builder.CreateStore(Builder.CreateSelect(Builder.CreateICmpULT(Old, Size),
+               Size, Old), NProcsPtr);
+   }
+
+   InsertProfilingInitCall(Main, "llvm_start_heap_profiling", Counters);
+   return true;
+}
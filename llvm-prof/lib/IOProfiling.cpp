@@ -0,0 +1,118 @@
+#include "preheader.h"
+#include <llvm/Pass.h>
+#include <llvm/IR/Module.h>
+#include <llvm/IR/IRBuilder.h>
+#include <llvm/IR/Constants.h>
+#include <llvm/Support/raw_ostream.h>
+
+#include "ValueUtils.h"
+#include "ProfilingUtils.h"
+#include "ProfileInstrumentations.h"
+#include "ProfileDataTypes.h"
+
+#include <map>
+
+/**
+ * each io call gets IO_FIELDS counters: the number of calls, the bytes
+ * transferred and the elapsed nanoseconds. the clock is read before the call,
+ * the trap after it accounts all three.
+ */
+namespace {
+   class IOProfiler : public llvm::ModulePass
+   {
+      public:
+      static char ID;
+      IOProfiler():ModulePass(ID) {};
+      bool runOnModule(llvm::Module&) override;
+   };
+}
+
+using namespace llvm;
+using namespace lle;
+char IOProfiler::ID = 0;
+static RegisterPass<IOProfiler> X("insert-io-profiling",
+      "insert profiling for calls, bytes and time of fortran and posix io", false, false);
+
+/** gfortran transfer function name->(length param idx, bytes per unit)
+ * integer, real, logical and complex pass the kind, character the length.
+ * _gfortran_transfer_array passes a descriptor, its bytes are not counted.
+ */
+static
+std::map<StringRef, std::pair<unsigned, unsigned> > TransferSpec = {
+   {"_gfortran_transfer_integer"        , {2, 1}} ,
+   {"_gfortran_transfer_real"           , {2, 1}} ,
+   {"_gfortran_transfer_real128"        , {2, 1}} ,
+   {"_gfortran_transfer_logical"        , {2, 1}} ,
+   {"_gfortran_transfer_complex"        , {2, 2}} ,
+   {"_gfortran_transfer_complex128"     , {2, 2}} ,
+   {"_gfortran_transfer_character"      , {2, 1}} ,
+   {"_gfortran_transfer_character_wide" , {2, 4}}
+};
+
+// the bytes moved by CI, computed after the call returned
+static Value* TransferedBytes(CallInst* CI, IRBuilder<>& Builder)
+{
+   Type* I64Ty = Builder.getInt64Ty();
+   Function* Called = cast<Function>(castoff(CI->getCalledValue()));
+   StringRef Name = Called->getName();
+   if(!Name.startswith("_gfortran_")){
+      // posix read/write return the bytes or -1
+      if(!CI->getType()->isIntegerTy())
+         return ConstantInt::get(I64Ty, 0);
+      Value* Ret = Builder.CreateSExtOrTrunc(CI, I64Ty);
+      Value* Failed = Builder.CreateICmpSLT(Ret, ConstantInt::get(I64Ty, 0));
+      return Builder.CreateSelect(Failed, ConstantInt::get(I64Ty, 0), Ret);
+   }
+   // the *_write variants have the same parameters
+   if(Name.endswith("_write")) Name = Name.drop_back(sizeof("_write") - 1);
+   auto Found = TransferSpec.find(Name);
+   if(Found == TransferSpec.end() || Found->second.first >= CI->getNumArgOperands())
+      return ConstantInt::get(I64Ty, 0);
+   Value* Len = CI->getArgOperand(Found->second.first);
+   if(!Len->getType()->isIntegerTy())
+      return ConstantInt::get(I64Ty, 0);
+   Len = Builder.CreateZExtOrTrunc(Len, I64Ty);
+   return Builder.CreateMul(Len, ConstantInt::get(I64Ty, Found->second.second));
+}
+
+bool IOProfiler::runOnModule(llvm::Module &M)
+{
+   Function *Main = M.getFunction("main");
+   if (Main == 0) {
+      errs() << "WARNING: cannot insert io profiling into a module"
+         << " with no main function!\n";
+      return false;  // No main, no instrumentation!
+   }
+
+   std::vector<CallInst*> Calls = get_io_calls(M);
+
+   LLVMContext& Context = M.getContext();
+   Type* I32Ty = Type::getInt32Ty(Context);
+   Type* I64Ty = Type::getInt64Ty(Context);
+   Type* ATy = ArrayType::get(I64Ty, Calls.size() * IO_FIELDS);
+   GlobalVariable* Counters = new GlobalVariable(M, ATy, false,
+         GlobalVariable::InternalLinkage, Constant::getNullValue(ATy),
+         "IOCounters");
+   Constant* Clock = M.getOrInsertFunction("llvm_io_profiling_clock",
+         I64Ty, (Type*)0);
+   Constant* Trap = M.getOrInsertFunction("llvm_io_profiling_trap",
+         Type::getVoidTy(Context), I32Ty, I64Ty, I64Ty, (Type*)0);
+
+   IRBuilder<> Builder(Context);
+   unsigned Idx = 0;
+   for(CallInst* CI : Calls){
+      Builder.SetInsertPoint(CI);
+      Value* Start = Builder.CreateCall(Clock, "IOStart");
+
+      BasicBlock::iterator After = CI;
+      Builder.SetInsertPoint(++After);
+      Value* Args[3];
+      Args[0] = ConstantInt::get(I32Ty, Idx++);
+      Args[1] = TransferedBytes(CI, Builder);
+      Args[2] = Start;
+      Builder.CreateCall(Trap, Args);
+   }
+
+   InsertProfilingInitCall(Main, "llvm_start_io_profiling", Counters);
+   return true;
+}
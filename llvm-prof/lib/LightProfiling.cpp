@@ -0,0 +1,155 @@
+#define DEBUG_TYPE "insert-light-profiling"
+
+#include "preheader.h"
+#include <llvm/Pass.h>
+#include <llvm/ADT/Statistic.h>
+#include <llvm/IR/Module.h>
+#include <llvm/IR/IRBuilder.h>
+#include <llvm/IR/Constants.h>
+#include <llvm/Analysis/LoopInfo.h>
+#include <llvm/Analysis/ScalarEvolution.h>
+#include <llvm/Analysis/ScalarEvolutionExpander.h>
+#include <llvm/Transforms/Utils/BasicBlockUtils.h>
+#include <llvm/Support/raw_ostream.h>
+
+#include "ValueUtils.h"
+#include "ProfilingUtils.h"
+#include "ProfileInstrumentations.h"
+#include "ProfileDataTypes.h"
+
+STATISTIC(NumLightLoops, "The # of loops counted.");
+STATISTIC(NumTripCountsExpanded, "The # of loop trip counts computed in preheaders.");
+
+/**
+ * count only function entries and, for every loop, its entries and
+ * iterations (header executions). the loader estimates the other blocks
+ * statically, scaled by these counts.
+ *
+ * counters of a function: [entry] then LIGHT_LOOP_FIELDS per loop in
+ * get_loops_preorder order. when scalar evolution knows the trip count of a
+ * loop, the iterations are added once in the preheader, the loop body stays
+ * untouched. otherwise the header counts itself.
+ */
+namespace {
+   class LightProfiler : public llvm::ModulePass
+   {
+      public:
+      static char ID;
+      LightProfiler():ModulePass(ID) {};
+      void getAnalysisUsage(llvm::AnalysisUsage& AU) const override {
+         AU.addRequired<llvm::LoopInfo>();
+         AU.addRequired<llvm::ScalarEvolution>();
+      }
+      bool runOnModule(llvm::Module&) override;
+   };
+}
+
+using namespace llvm;
+using namespace lle;
+char LightProfiler::ID = 0;
+static RegisterPass<LightProfiler> X("insert-light-profiling",
+      "insert function entry and loop trip count profiling", false, false);
+
+// Counters[Idx] += V before the terminator of BB
+static void AddToCounter(BasicBlock* BB, unsigned Idx, Value* V,
+      GlobalVariable* Counters)
+{
+   Type* I64Ty = Type::getInt64Ty(BB->getContext());
+   Constant* Indices[2] = {
+      Constant::getNullValue(I64Ty), ConstantInt::get(I64Ty, Idx)
+   };
+   Constant* ElementPtr = ConstantExpr::getGetElementPtr(Counters, Indices);
+   IRBuilder<> Builder(BB->getTerminator());
+   Value* Old = Builder.CreateLoad(ElementPtr, "OldLightCounter");
+   Builder.CreateStore(Builder.CreateAdd(Old, V, "NewLightCounter"), ElementPtr);
+}
+
+bool LightProfiler::runOnModule(llvm::Module &M)
+{
+   Function *Main = M.getFunction("main");
+   if (Main == 0) {
+      errs() << "WARNING: cannot insert light profiling into a module"
+         << " with no main function!\n";
+      return false;  // No main, no instrumentation!
+   }
+
+   unsigned NumCounters = 0;
+   for(Module::iterator F = M.begin(), E = M.end(); F != E; ++F){
+      if(F->isDeclaration()) continue;
+      unsigned N = get_loops_preorder(getAnalysis<LoopInfo>(*F)).size();
+      NumCounters += 1 + N * LIGHT_LOOP_FIELDS;
+      NumLightLoops += N;
+   }
+
+   LLVMContext& Context = M.getContext();
+   Type* I64Ty = Type::getInt64Ty(Context);
+   Type* ATy = ArrayType::get(I64Ty, NumCounters);
+   GlobalVariable* Counters = new GlobalVariable(M, ATy, false,
+         GlobalVariable::InternalLinkage, Constant::getNullValue(ATy),
+         "LightProfCounters");
+
+   unsigned Idx = 0;
+   for(Module::iterator F = M.begin(), E = M.end(); F != E; ++F){
+      if(F->isDeclaration()) continue;
+      // each getAnalysis reruns both analyses of F, so keep them in this order
+      LoopInfo& LI = getAnalysis<LoopInfo>(*F);
+      ScalarEvolution& SE = getAnalysis<ScalarEvolution>(*F);
+      std::vector<Loop*> Loops = get_loops_preorder(LI);
+
+      IncrementCounterInBlock(&F->getEntryBlock(), Idx++, Counters);
+
+      // expand all known trip counts before the cfg is changed below
+      std::vector<std::pair<Loop*, unsigned> > Rest;
+      std::vector<std::vector<BasicBlock*> > RestPreds;
+      SCEVExpander Expander(SE, "light");
+      for(Loop* L : Loops){
+         unsigned LoopIdx = Idx;
+         Idx += LIGHT_LOOP_FIELDS;
+         BasicBlock* Preheader = L->getLoopPreheader();
+         const SCEV* BTC = Preheader ? SE.getBackedgeTakenCount(L) : NULL;
+         if(BTC && !isa<SCEVCouldNotCompute>(BTC)
+               && SE.getTypeSizeInBits(BTC->getType()) <= 64){
+            const SCEV* Trips = SE.getAddExpr(SE.getZeroExtendExpr(BTC, I64Ty),
+                  SE.getConstant(I64Ty, 1));
+            Value* V = Expander.expandCodeFor(Trips, I64Ty, Preheader->getTerminator());
+            IncrementCounterInBlock(Preheader, LoopIdx + LIGHT_LOOP_ENTRIES, Counters, false);
+            AddToCounter(Preheader, LoopIdx + LIGHT_LOOP_ITERATIONS, V, Counters);
+            ++NumTripCountsExpanded;
+            continue;
+         }
+         BasicBlock* Header = L->getHeader();
+         std::vector<BasicBlock*> Preds;
+         for(pred_iterator P = pred_begin(Header), PE = pred_end(Header); P != PE; ++P)
+            if(!L->contains(*P)) Preds.push_back(*P);
+         Rest.push_back(std::make_pair(L, LoopIdx));
+         RestPreds.push_back(Preds);
+      }
+
+      // the header counts the iterations, a preheader, split off if there is
+      // none, the entries
+      for(unsigned i = 0; i < Rest.size(); ++i){
+         BasicBlock* Header = Rest[i].first->getHeader();
+         unsigned LoopIdx = Rest[i].second;
+         std::vector<BasicBlock*>& Preds = RestPreds[i];
+         IncrementCounterInBlock(Header, LoopIdx + LIGHT_LOOP_ITERATIONS, Counters);
+         if(Preds.empty()) continue; // the entry block heads the loop
+         BasicBlock* Preheader = Preds.size() == 1 && Preds[0]->getTerminator()->getNumSuccessors() == 1
+            ? Preds[0] : NULL;
+         if(Preheader == NULL){
+            bool CanSplit = true;
+            for(BasicBlock* P : Preds)
+               if(isa<IndirectBrInst>(P->getTerminator())) CanSplit = false;
+            if(!CanSplit){
+               errs() << "WARNING: loop at '" << Header->getName() << "' in "
+                  << F->getName() << " has no preheader, its entries are not counted!\n";
+               continue;
+            }
+            Preheader = SplitBlockPredecessors(Header, Preds, ".lightph");
+         }
+         IncrementCounterInBlock(Preheader, LoopIdx + LIGHT_LOOP_ENTRIES, Counters, false);
+      }
+   }
+
+   InsertProfilingInitCall(Main, "llvm_start_light_profiling", Counters);
+   return true;
+}
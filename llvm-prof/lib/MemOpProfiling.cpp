@@ -0,0 +1,66 @@
+#include "preheader.h"
+#include <llvm/Pass.h>
+#include <llvm/IR/Module.h>
+#include <llvm/IR/IRBuilder.h>
+#include <llvm/IR/Constants.h>
+#include <llvm/Support/raw_ostream.h>
+
+#include "ValueUtils.h"
+#include "ProfilingUtils.h"
+#include "ProfileInstrumentations.h"
+#include "ProfileDataTypes.h"
+
+/**
+ * each memcpy/memmove/memset gets MEMOP_FIELDS counters, the runtime adds the
+ * length to the total bytes and increases the size bin it falls in.
+ */
+namespace {
+   class MemOpProfiler : public llvm::ModulePass
+   {
+      public:
+      static char ID;
+      MemOpProfiler():ModulePass(ID) {};
+      bool runOnModule(llvm::Module&) override;
+   };
+}
+
+using namespace llvm;
+using namespace lle;
+char MemOpProfiler::ID = 0;
+static RegisterPass<MemOpProfiler> X("insert-memop-profiling",
+      "insert length profiling for memcpy, memmove and memset", false, false);
+
+bool MemOpProfiler::runOnModule(llvm::Module &M)
+{
+   Function *Main = M.getFunction("main");
+   if (Main == 0) {
+      errs() << "WARNING: cannot insert memop profiling into a module"
+         << " with no main function!\n";
+      return false;  // No main, no instrumentation!
+   }
+
+   std::vector<CallInst*> Calls = get_memory_op_calls(M);
+
+   LLVMContext& Context = M.getContext();
+   Type* I32Ty = Type::getInt32Ty(Context);
+   Type* I64Ty = Type::getInt64Ty(Context);
+   Type* ATy = ArrayType::get(I64Ty, Calls.size() * MEMOP_FIELDS);
+   GlobalVariable* Counters = new GlobalVariable(M, ATy, false,
+         GlobalVariable::InternalLinkage, Constant::getNullValue(ATy),
+         "MemOpCounters");
+   Constant* Trap = M.getOrInsertFunction("llvm_memop_profiling_trap",
+         Type::getVoidTy(Context), I32Ty, I64Ty, (Type*)0);
+
+   IRBuilder<> Builder(Context);
+   unsigned Idx = 0;
+   for(CallInst* CI : Calls){
+      Builder.SetInsertPoint(CI);
+      Value* Args[2];
+      Args[0] = ConstantInt::get(I32Ty, Idx++);
+      Args[1] = Builder.CreateZExtOrTrunc(CI->getArgOperand(2), I64Ty);
+      Builder.CreateCall(Trap, Args);
+   }
+
+   InsertProfilingInitCall(Main, "llvm_start_memop_profiling", Counters);
+   return true;
+}
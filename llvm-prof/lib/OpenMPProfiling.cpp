@@ -0,0 +1,122 @@
+#include "preheader.h"
+#include <llvm/Pass.h>
+#include <llvm/IR/Module.h>
+#include <llvm/IR/IRBuilder.h>
+#include <llvm/IR/Constants.h>
+#include <llvm/Support/CommandLine.h>
+#include <llvm/Support/raw_ostream.h>
+
+#include "ValueUtils.h"
+#include "ProfilingUtils.h"
+#include "ProfileInstrumentations.h"
+#include "ProfileDataTypes.h"
+
+#include <algorithm>
+
+/**
+ * OmpInfo layout, for each parallel region in lle::get_omp_regions order:
+ *    [team size] [number of blocks NB] [number of threads MT]
+ *    MT rows of NB block counters, one row per omp thread
+ * thread ids not smaller than MT wrap around onto the first rows. Threads
+ * sharing a row would lose counts, so the counters are bumped with atomic
+ * adds.
+ */
+namespace {
+   class OpenMPProfiler : public llvm::ModulePass
+   {
+      public:
+      static char ID;
+      OpenMPProfiler():ModulePass(ID) {};
+      bool runOnModule(llvm::Module&) override;
+   };
+}
+
+using namespace llvm;
+using namespace lle;
+
+static cl::opt<unsigned> OmpMaxThreads("omp-max-threads", cl::init(64),
+      cl::desc("Number of per thread counter rows of each parallel region"));
+
+char OpenMPProfiler::ID = 0;
+static RegisterPass<OpenMPProfiler> X("insert-omp-profiling",
+      "insert per thread block profiling for openmp parallel regions", false, false);
+
+static Value* CounterAddress(GlobalVariable* Counters, Value* Index, IRBuilder<>& Builder)
+{
+   Value* Indices[2];
+   Indices[0] = Constant::getNullValue(Index->getType());
+   Indices[1] = Index;
+   return Builder.CreateInBoundsGEP(Counters, Indices);
+}
+
+bool OpenMPProfiler::runOnModule(llvm::Module &M)
+{
+   Function *Main = M.getFunction("main");
+   if (Main == 0) {
+      errs() << "WARNING: cannot insert omp profiling into a module"
+         << " with no main function!\n";
+      return false;  // No main, no instrumentation!
+   }
+
+   std::vector<Function*> Regions = get_omp_regions(M);
+   if (Regions.empty()) {
+      errs() << "WARNING: no openmp parallel region found!\n";
+      return false;
+   }
+
+   LLVMContext& Context = M.getContext();
+   Type* I32Ty = Type::getInt32Ty(Context);
+   Type* I64Ty = Type::getInt64Ty(Context);
+   unsigned MaxThreads = std::max(1u, (unsigned)OmpMaxThreads);
+
+   std::vector<Constant*> Init;
+   for(Function* R : Regions){
+      Init.push_back(ConstantInt::get(I64Ty, 0));
+      Init.push_back(ConstantInt::get(I64Ty, R->size()));
+      Init.push_back(ConstantInt::get(I64Ty, MaxThreads));
+      Init.resize(Init.size() + R->size() * MaxThreads, ConstantInt::get(I64Ty, 0));
+   }
+   ArrayType* ATy = ArrayType::get(I64Ty, Init.size());
+   GlobalVariable* Counters = new GlobalVariable(M, ATy, false,
+         GlobalVariable::InternalLinkage, ConstantArray::get(ATy, Init),
+         "OmpCounters");
+
+   Constant* ThreadNum = M.getOrInsertFunction("omp_get_thread_num", I32Ty, (Type*)0);
+   Constant* NumThreads = M.getOrInsertFunction("omp_get_num_threads", I32Ty, (Type*)0);
+
+   IRBuilder<> Builder(Context);
+   uint64_t Base = 0;
+   for(Function* R : Regions){
+      uint64_t NB = R->size();
+      BasicBlock* Entry = &R->getEntryBlock();
+      BasicBlock::iterator InsertPos = Entry->getFirstInsertionPt();
+      while (isa<AllocaInst>(InsertPos)) ++InsertPos;
+      Builder.SetInsertPoint(InsertPos);
+
+      // team size is the same for every thread of a region
+      Value* Team = Builder.CreateZExt(Builder.CreateCall(NumThreads), I64Ty);
+      Builder.CreateStore(Team, CounterAddress(Counters, ConstantInt::get(I64Ty, Base), Builder));
+
+      Value* Tid = Builder.CreateCall(ThreadNum);
+      Tid = Builder.CreateURem(Tid, ConstantInt::get(I32Ty, MaxThreads));
+      Value* Row = Builder.CreateAdd(ConstantInt::get(I64Ty, Base + 3),
+            Builder.CreateMul(Builder.CreateZExt(Tid, I64Ty), ConstantInt::get(I64Ty, NB)),
+            "OmpThreadRow");
+
+      uint64_t b = 0;
+      for(Function::iterator BB = R->begin(), E = R->end(); BB != E; ++BB, ++b){
+         if(&*BB != Entry){
+            InsertPos = BB->getFirstInsertionPt();
+            Builder.SetInsertPoint(InsertPos);
+         }
+         Value* Addr = CounterAddress(Counters,
+               Builder.CreateAdd(Row, ConstantInt::get(I64Ty, b)), Builder);
+         Builder.CreateAtomicRMW(AtomicRMWInst::Add, Addr,
+               ConstantInt::get(I64Ty, 1), Monotonic);
+      }
+      Base += 3 + NB * MaxThreads;
+   }
+
+   InsertProfilingInitCall(Main, "llvm_start_omp_profiling", Counters);
+   return true;
+}
@@ -46,6 +46,7 @@ bool PredBlockProfiler::runOnModule(Module& M)
 {
    unsigned Idx = 0;
    IRBuilder<> Builder(M.getContext());
+   InsertCFGChecksums(M, M.getFunction("main"));
 
    unsigned NumBlocks = 0;
    for (Module::iterator F = M.begin(), E = M.end(); F != E; ++F)
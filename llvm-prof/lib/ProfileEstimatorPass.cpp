@@ -15,6 +15,7 @@
 #include "preheader.h"
 #include "llvm/Analysis/Passes.h"
 #include "llvm/Analysis/LoopInfo.h"
+#include "llvm/Analysis/BranchProbabilityInfo.h"
 #include "ProfileInfo.h"
 #include "llvm/Pass.h"
 #include "llvm/Support/CommandLine.h"
@@ -38,10 +39,15 @@ namespace {
     std::set<BasicBlock*>  BBToVisit;
     std::map<Loop*,double> LoopExitWeights;
     std::map<Edge,double>  MinimalWeight;
+    // Measured weights used by estimateProfileInfo, ignored if unset.
+    double EntryWeight;
+    const BlockCounts *LoopTrips;
+    BranchProbabilityInfo *BPI;
   public:
     static char ID; // Class identification, replacement for typeinfo
     explicit ProfileEstimatorPass(const double execcount = 0)
-        : FunctionPass(ID), ExecCount(execcount) {
+        : FunctionPass(ID), ExecCount(execcount), EntryWeight(pow(2.0, 32.0)),
+          LoopTrips(0), BPI(0) {
       //initializeProfileEstimatorPassPass(*PassRegistry::getPassRegistry());
       if (execcount == 0) ExecCount = LoopWeight;
     }
@@ -58,6 +64,15 @@ namespace {
     /// run - Estimate the profile information from the specified file.
     virtual bool runOnFunction(Function &F);
 
+    /// estimate - Estimate F with the given LoopInfo, optionally starting
+    /// with Entry executions, using the trip counts in Trips for the loop
+    /// headers found there and splitting branches by Probs.
+    void estimate(Function &F, LoopInfo &Loops, double Entry,
+                  const BlockCounts *Trips, BranchProbabilityInfo *Probs);
+    const EdgeWeights &getEdgeWeights(const Function *F) {
+      return EdgeInformation[F];
+    }
+
     /// getAdjustedAnalysisPointer - This method is used when a pass implements
     /// an analysis interface through multiple inheritance.  If needed, it
     /// should override this to adjust the this pointer as needed for the
@@ -99,6 +114,17 @@ namespace llvm {
   Pass *createProfileEstimatorPass(const unsigned execcount) {
     return new ProfileEstimatorPass(execcount);
   }
+
+  void estimateProfileInfo(Function &F, LoopInfo &LI,
+                           BranchProbabilityInfo *BPI, double EntryCount,
+                           const ProfileInfo::BlockCounts &LoopTrips,
+                           ProfileInfo::EdgeWeights &Edges,
+                           ProfileInfo::BlockCounts &Blocks) {
+    ProfileEstimatorPass Estimator;
+    Estimator.estimate(F, LI, EntryCount, &LoopTrips, BPI);
+    Edges = Estimator.getEdgeWeights(&F);
+    Blocks = Estimator.getBlockCounts(&F);
+  }
 }
 
 static double ignoreMissing(double w) {
@@ -185,6 +211,11 @@ void ProfileEstimatorPass::recurseBasicBlock(BasicBlock *BB) {
   // *) Increase the flow into the loop by increasing the weight of this block.
   // There is at least one incoming backedge that will bring us this flow later
   // on. (So that the flow condition in this node is valid again.)
+  double Trips = ExecCount;
+  if (BBisHeader && LoopTrips) {
+    BlockCounts::const_iterator T = LoopTrips->find(BB);
+    if (T != LoopTrips->end()) Trips = T->second;
+  }
   if (BBisHeader) {
     double incoming = BBWeight;
     // Subtract the flow leaving the loop.
@@ -214,7 +245,7 @@ void ProfileEstimatorPass::recurseBasicBlock(BasicBlock *BB) {
         EdgeInformation[BB->getParent()][edge] = BBWeight;
         printEdgeWeight(edge);
         edge = getEdge(Latch, BB);
-        EdgeInformation[BB->getParent()][edge] = BBWeight * ExecCount;
+        EdgeInformation[BB->getParent()][edge] = BBWeight * Trips;
         printEdgeWeight(edge);
       }
     }
@@ -257,10 +288,10 @@ void ProfileEstimatorPass::recurseBasicBlock(BasicBlock *BB) {
       }
     }
     // Increase flow into the loop.
-    BBWeight *= (ExecCount+1);
+    BBWeight *= (Trips+1);
   }
 
-  BlockInformation[BB->getParent()][BB] = BBWeight;
+  blockCount(BB) = BBWeight;
   // Up until now we considered only the loop exiting edges, now we have a
   // definite block weight and must distribute this onto the outgoing edges.
   // Since there may be already flow attached to some of the edges, read this
@@ -295,11 +326,24 @@ void ProfileEstimatorPass::recurseBasicBlock(BasicBlock *BB) {
   }
 
   double fraction = Edges.size() ? floor(BBWeight/Edges.size()) : 0.0;
+  // With branch probabilities, split the flow in their ratio instead.
+  double FreeProb = 0, FreeWeight = BBWeight;
+  if (BPI)
+    for (SmallVector<Edge, 8>::iterator ei = Edges.begin(), ee = Edges.end();
+         ei != ee; ++ei) {
+      BranchProbability P = BPI->getEdgeProbability(BB, ei->second);
+      FreeProb += (double)P.getNumerator() / P.getDenominator();
+    }
   // Finally we know what flow is still not leaving the block, distribute this
   // flow onto the empty edges.
   for (SmallVector<Edge, 8>::iterator ei = Edges.begin(), ee = Edges.end();
        ei != ee; ++ei) {
     if (ei != (ee-1)) {
+      if (FreeProb > 0) {
+        BranchProbability P = BPI->getEdgeProbability(BB, ei->second);
+        fraction = floor(FreeWeight * P.getNumerator() / P.getDenominator()
+                         / FreeProb);
+      }
       EdgeInformation[BB->getParent()][*ei] += fraction;
       BBWeight -= fraction;
     } else {
@@ -326,10 +370,21 @@ void ProfileEstimatorPass::recurseBasicBlock(BasicBlock *BB) {
 bool ProfileEstimatorPass::runOnFunction(Function &F) {
   if (F.isDeclaration()) return false;
 
-  // Fetch LoopInfo and clear ProfileInfo for this function.
-  LI = &getAnalysis<LoopInfo>();
-  FunctionInformation.erase(&F);
-  BlockInformation[&F].clear();
+  // Fetch LoopInfo and estimate with the default weights.
+  estimate(F, getAnalysis<LoopInfo>(), pow(2.0, 32.0), 0, 0);
+  return false;
+}
+
+void ProfileEstimatorPass::estimate(Function &F, LoopInfo &Loops,
+                                    double Entry, const BlockCounts *Trips,
+                                    BranchProbabilityInfo *Probs) {
+  LI = &Loops;
+  EntryWeight = Entry;
+  LoopTrips = Trips;
+  BPI = Probs;
+
+  // Clear ProfileInfo for this function.
+  clearCounts(&F);
   EdgeInformation[&F].clear();
   BBToVisit.clear();
 
@@ -345,9 +400,9 @@ bool ProfileEstimatorPass::runOnFunction(Function &F) {
   // Since the entry block is the first one and has no predecessors, the edge
   // (0,entry) is inserted with the starting weight of 1.
   BasicBlock *entry = &F.getEntryBlock();
-  BlockInformation[&F][entry] = pow(2.0, 32.0);
+  blockCount(entry) = EntryWeight;
   Edge edge = getEdge(0,entry);
-  EdgeInformation[&F][edge] = BlockInformation[&F][entry];
+  EdgeInformation[&F][edge] = EntryWeight;
   printEdgeWeight(edge);
 
   // Since recurseBasicBlock() maybe returns with a block which was not fully
@@ -403,12 +458,12 @@ bool ProfileEstimatorPass::runOnFunction(Function &F) {
   // In case there was no safe way to assume edges, set as a last measure, 
   // set _everything_ to zero.
   if (cleanup) {
-    FunctionInformation[&F] = 0;
-    BlockInformation[&F].clear();
+    clearCounts(&F);
+    getFunctionCounts(&F).Count = 0;
     EdgeInformation[&F].clear();
     for (Function::const_iterator FI = F.begin(), FE = F.end(); FI != FE; ++FI) {
       const BasicBlock *BB = &(*FI);
-      BlockInformation[&F][BB] = 0;
+      blockCount(BB) = 0;
       const_pred_iterator predi = pred_begin(BB), prede = pred_end(BB);
       if (predi == prede) {
         Edge e = getEdge(0,BB);
@@ -430,5 +485,5 @@ bool ProfileEstimatorPass::runOnFunction(Function &F) {
     }
   }
 
-  return false;
+  return;
 }
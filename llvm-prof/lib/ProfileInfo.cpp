@@ -24,10 +24,14 @@
 #include "ProfileInstrumentations.h"
 #include "ProfilingUtils.h"
 #include "ValueUtils.h"
+#include <algorithm>
+#include <atomic>
 #include <functional>
 #include <limits>
+#include <memory>
 #include <queue>
 #include <set>
+#include <thread>
 using namespace llvm;
 
 namespace llvm {
@@ -65,21 +69,16 @@ double ProfileInfoT<MachineFunction, MachineBasicBlock>::MissingValue = -1;
 
 template<> double
 ProfileInfoT<Function,BasicBlock>::getExecutionCount(const CallInst* V) {
-	std::map<const CallInst*,ValueCounts>::iterator J =
-		ValueInformation.find(V);
-	if(J != ValueInformation.end()) return (double)J->second.Nums;
-   auto L = MPIFullInformation.find(V);
-   if(L != MPIFullInformation.end()) return (double) L->second.second;
-   auto K = MPInformation.find(V);
-   if(K != MPInformation.end()) return (double) K->second.second;
-	return MissingValue;
+   auto J = SiteLookup.find(V);
+   if(J == SiteLookup.end() || J->second.Count < 0) return MissingValue;
+   return TrapedSites[J->second.Count].Count;
 }
 
 template<> double
 ProfileInfoT<Function,BasicBlock>::getMPITime(const CallInst* V) {
-   auto T = MPITimeInformation.find(V);
-   if(T != MPITimeInformation.end()) return (double) T->second.second;
-	return MissingValue;
+   auto J = SiteLookup.find(V);
+   if(J == SiteLookup.end() || J->second.Time < 0) return MissingValue;
+   return TrapedSites[J->second.Time].Time;
 }
 
 template<> const Value*
@@ -95,101 +94,75 @@ ProfileInfoT<Function,BasicBlock>::getTrapedTarget(const Instruction* V)
    return NULL;
 }
 
-template<> const std::vector<int>&
-ProfileInfoT<Function,BasicBlock>::getValueContents(const CallInst* V) {
-	static std::vector<int> MissingContent(0);
-	static std::vector<int> ConstantContent;
-	static std::vector<int> UnCompress;
-	std::map<const CallInst*,ValueCounts>::iterator J =
-		ValueInformation.find(V);
-	if(J != ValueInformation.end()){
-		if(J->second.flags & CONSTANT_COMPRESS){
-			ConstantContent.resize(J->second.Nums);
-			int filled = cast<ConstantInt>(getTrapedTarget(V))->getZExtValue();
-			std::fill(ConstantContent.begin(), ConstantContent.end(), filled);
-			return ConstantContent;
-		}else if(J->second.flags & RUN_LENGTH_COMPRESS){
-			UnCompress.resize(J->second.Nums);
-			std::vector<int>::iterator write = UnCompress.begin();
-			for(std::vector<int>::const_iterator I = J->second.Contents.begin(),
-					E = J->second.Contents.end();I<E;I+=2){
-				int value = *I;
-				size_t len = *(I+1);
-				std::fill(write,write+len,value);
-				write+=len;
-			}
-			return UnCompress;
-
-		}
-		return J->second.Contents;
-	}
-	return MissingContent;
-}
-
 template<> unsigned
 ProfileInfoT<Function,BasicBlock>::getTrapedIndex(const Instruction* V)
 {
+   auto J = SiteLookup.find(V);
+   if(J != SiteLookup.end() && J->second.Index >= 0)
+      return TrapedSites[J->second.Index].Index;
+   // a value trap not loaded yet carries its index as first argument
    if(const CallInst* CI = dyn_cast<CallInst>(V)){
-      auto Found = MPIFullInformation.find(CI);
-      if(Found != MPIFullInformation.end()) return Found->second.first;
-
-      Found = MPInformation.find(CI);
-      if(Found != MPInformation.end()) return Found->second.first;
-
       ConstantInt* C = dyn_cast<ConstantInt>(CI->getArgOperand(0));
       if(!C) return -1;
       return C->getZExtValue();
    }
-   if(dyn_cast<LoadInst>(V)){
-      if(SLGInformation.find(V) == SLGInformation.end()) return -1;
-      return SLGInformation[V].first;
-   }
    return -1;
 }
 
-struct SortBasedIndex{
-   ProfileInfo& PI;
-   SortBasedIndex(ProfileInfo& PI):PI(PI) {}
-   int operator()(const Instruction* a, const Instruction* b)
-   {
-      return PI.getTrapedIndex(a) < PI.getTrapedIndex(b);
-   }
-};
-
-struct SortBasedTime{
-   ProfileInfo& PI;
-   SortBasedTime(ProfileInfo& PI):PI(PI){}
-   int operator()(const Instruction* a, const Instruction* b)
-   {
-      const CallInst* aC = cast<CallInst>(a);
-      const CallInst* bC = cast<CallInst>(b);
-      if(aC != NULL && bC != NULL)
-          return PI.getMPITime(aC) > PI.getMPITime(bC);
-      return 0;
+// SiteOrder - kinds in packet order, each by traped index, except the mpi
+// times which go from the longest to the shortest
+static bool SiteOrder(const ProfileInfo::TrapedSite& A, const ProfileInfo::TrapedSite& B)
+{
+   if(A.Kind != B.Kind) return A.Kind < B.Kind;
+   if(A.Kind == MPITimeInfo && A.Time != B.Time) return A.Time > B.Time;
+   return A.Index < B.Index;
+}
+
+// indexTrapedSites - the count of a call is the one of its value trap, else
+// of its MPIFullInfo or MPInfo counter; its index the one of its MPIFullInfo
+// or MPInfo counter, else of its value or load trap.
+template<> void
+ProfileInfoT<Function,BasicBlock>::indexTrapedSites()
+{
+   std::stable_sort(TrapedSites.begin(), TrapedSites.end(), SiteOrder);
+   SiteLookup.clear();
+   auto rank = [](ProfilingType Kind, bool ForCount){
+      switch(Kind){
+         case ValueInfo: return ForCount ? 3 : 1;
+         case MPIFullInfo: return 3;
+         case MPInfo: return 2;
+         case SLGInfo: return ForCount ? 0 : 1;
+         default: return 0;
+      }
+   };
+   for(unsigned s = 0; s < TrapedSites.size(); ++s){
+      const TrapedSite& S = TrapedSites[s];
+      auto Ins = SiteLookup.insert(std::make_pair(S.I, SiteRefs{-1, -1, -1}));
+      SiteRefs& R = Ins.first->second;
+      if(S.Kind == MPITimeInfo){
+         R.Time = s;
+         continue;
+      }
+      if(rank(S.Kind, true) &&
+            (R.Count < 0 || rank(TrapedSites[R.Count].Kind, true) < rank(S.Kind, true)))
+         R.Count = s;
+      if(R.Index < 0 || rank(TrapedSites[R.Index].Kind, false) < rank(S.Kind, false))
+         R.Index = s;
    }
-};
+}
+
+static bool KindBefore(const ProfileInfo::TrapedSite& S, ProfilingType Kind)
+{
+   return S.Kind < Kind;
+}
 
 template<> std::vector<const Instruction*>
 ProfileInfoT<Function,BasicBlock>::getAllTrapedValues(ProfilingType PT) {
-	std::vector<const Instruction*> ret;
-#define SELECT(what) \
-   if(PT == what##Info){\
-      ret.reserve(what##Information.size());\
-      auto J = what##Information.begin(),\
-      E = what##Information.end();\
-      for(;J!=E;++J) ret.push_back(J->first);\
-   }
-   SELECT(Value);
-   SELECT(SLG);
-   SELECT(MP);
-   SELECT(MPIFull);
-   SELECT(MPITime);
-  if(PT != MPITimeInfo)
-	   std::sort(ret.begin(), ret.end(), SortBasedIndex(*this));
-  else
-     std::sort(ret.begin(), ret.end(), SortBasedTime(*this));
-#undef SELECT
-	return ret;
+   std::vector<const Instruction*> ret;
+   for(auto I = std::lower_bound(TrapedSites.begin(), TrapedSites.end(), PT, KindBefore);
+         I != TrapedSites.end() && I->Kind == PT; ++I)
+      ret.push_back(I->I);
+   return ret;
 }
 
 template<> int
@@ -201,13 +174,9 @@ ProfileInfoT<Function, BasicBlock>::getRankValue(ProfilingType PT){
 
 template<> double
 ProfileInfoT<Function,BasicBlock>::getExecutionCount(const BasicBlock *BB) {
-  std::map<const Function*, BlockCounts>::iterator J =
-    BlockInformation.find(BB->getParent());
-  if (J != BlockInformation.end()) {
-    BlockCounts::iterator I = J->second.find(BB);
-    if (I != J->second.end())
-      return I->second;
-  }
+  const double *Known = findBlockCount(BB);
+  if (Known && *Known != MissingValue)
+    return *Known;
 
   double Count = MissingValue;
 
@@ -259,50 +228,44 @@ ProfileInfoT<Function,BasicBlock>::getExecutionCount(const BasicBlock *BB) {
     }
   }
 
-  if (Count != MissingValue) BlockInformation[BB->getParent()][BB] = Count;
+  if (Count != MissingValue) blockCount(BB) = Count;
   return Count;
 }
 
 template<>
 double ProfileInfoT<MachineFunction, MachineBasicBlock>::
         getExecutionCount(const MachineBasicBlock *MBB) {
-  std::map<const MachineFunction*, BlockCounts>::iterator J =
-    BlockInformation.find(MBB->getParent());
-  if (J != BlockInformation.end()) {
-    BlockCounts::iterator I = J->second.find(MBB);
-    if (I != J->second.end())
-      return I->second;
-  }
-
-  return MissingValue;
+  const double *Known = findBlockCount(MBB);
+  return Known ? *Known : MissingValue;
 }
 
 template<>
 double ProfileInfoT<Function,BasicBlock>::getExecutionCount(const Function *F) {
-  std::map<const Function*, double>::iterator J =
-    FunctionInformation.find(F);
-  if (J != FunctionInformation.end())
-    return J->second;
+  DenseMap<const Function*, unsigned>::iterator J = FunctionNumbers.find(F);
+  if (J != FunctionNumbers.end() &&
+      FunctionInformation[J->second].Count != MissingValue)
+    return FunctionInformation[J->second].Count;
 
   // isDeclaration() is checked here and not at start of function to allow
   // functions without a body still to have a execution count.
   if (F->isDeclaration()) return MissingValue;
 
   double Count = getExecutionCount(&F->getEntryBlock());
-  if (Count != MissingValue) FunctionInformation[F] = Count;
+  if (Count != MissingValue) getFunctionCounts(F).Count = Count;
   return Count;
 }
 
 template<>
 double ProfileInfoT<MachineFunction, MachineBasicBlock>::
         getExecutionCount(const MachineFunction *MF) {
-  std::map<const MachineFunction*, double>::iterator J =
-    FunctionInformation.find(MF);
-  if (J != FunctionInformation.end())
-    return J->second;
+  DenseMap<const MachineFunction*, unsigned>::iterator J =
+    FunctionNumbers.find(MF);
+  if (J != FunctionNumbers.end() &&
+      FunctionInformation[J->second].Count != MissingValue)
+    return FunctionInformation[J->second].Count;
 
   double Count = getExecutionCount(&MF->front());
-  if (Count != MissingValue) FunctionInformation[MF] = Count;
+  if (Count != MissingValue) getFunctionCounts(MF).Count = Count;
   return Count;
 }
 
@@ -311,7 +274,7 @@ void ProfileInfoT<Function,BasicBlock>::
         setExecutionCount(const BasicBlock *BB, double w) {
   DEBUG(dbgs() << "Creating Block " << BB->getName()
                << " (weight: " << format("%.20g",w) << ")\n");
-  BlockInformation[BB->getParent()][BB] = w;
+  blockCount(BB) = w;
 }
 
 template<>
@@ -319,7 +282,7 @@ void ProfileInfoT<MachineFunction, MachineBasicBlock>::
         setExecutionCount(const MachineBasicBlock *MBB, double w) {
   DEBUG(dbgs() << "Creating Block " << MBB->getBasicBlock()->getName()
                << " (weight: " << format("%.20g",w) << ")\n");
-  BlockInformation[MBB->getParent()][MBB] = w;
+  blockCount(MBB) = w;
 }
 
 template<>
@@ -338,17 +301,18 @@ void ProfileInfoT<Function,BasicBlock>::
   assert (oldw != MissingValue && "Adding weight to Block with no previous weight");
   DEBUG(dbgs() << "Adding to Block " << BB->getName()
                << " (new weight: " << format("%.20g",oldw + w) << ")\n");
-  BlockInformation[BB->getParent()][BB] = oldw + w;
+  blockCount(BB) = oldw + w;
 }
 
 template<>
 void ProfileInfoT<Function,BasicBlock>::removeBlock(const BasicBlock *BB) {
-  std::map<const Function*, BlockCounts>::iterator J =
-    BlockInformation.find(BB->getParent());
-  if (J == BlockInformation.end()) return;
+  DenseMap<const BasicBlock*, BlockNumber>::iterator J = BlockNumbers.find(BB);
+  if (J == BlockNumbers.end()) return;
 
   DEBUG(dbgs() << "Deleting " << BB->getName() << "\n");
-  J->second.erase(BB);
+  // the number is not reused, a new block at the same address gets another
+  FunctionInformation[J->second.first].Blocks[J->second.second] = MissingValue;
+  BlockNumbers.erase(J);
 }
 
 template<>
@@ -543,7 +507,8 @@ void ProfileInfoT<Function,BasicBlock>::splitEdge(const BasicBlock *FirstBB,
   double neww = floor(w / succ_count);
   ECs[n1] += neww;
   ECs[n2] += neww;
-  BlockInformation[F][NewBB] += neww;
+  double &NewCount = blockCount(NewBB);
+  NewCount = (NewCount == MissingValue ? 0 : NewCount) + neww;
   if (succ_count == 1) {
     ECs.erase(e);
   } else {
@@ -628,8 +593,7 @@ void ProfileInfoT<Function,BasicBlock>::transfer(const Function *Old,
     EdgeInformation[New] = J->second;
   }
   EdgeInformation.erase(Old);
-  BlockInformation.erase(Old);
-  FunctionInformation.erase(Old);
+  clearCounts(Old);
 }
 
 static double readEdgeOrRemember(ProfileInfo::Edge edge, double w,
@@ -871,7 +835,8 @@ void ProfileInfoT<Function,BasicBlock>::repair(const Function *F) {
       const BasicBlock *BB = *FI; ++FI;
       Edge e;
       if(CalculateMissingEdge(BB,e,true)) {
-        if (BlockInformation[F].find(BB) == BlockInformation[F].end()) {
+        const double *Known = findBlockCount(BB);
+        if (!Known || *Known == MissingValue) {
           setExecutionCount(BB,getExecutionCount(BB));
         }
         Unvisited.erase(BB);
@@ -1159,6 +1124,170 @@ void ProfileInfoT<Function,BasicBlock>::repair(const Function *F) {
   }
 }
 
+namespace {
+  // FlowGraph - The CFG of a function as dense arrays, for the flow solver.
+  // Node 0 stands for the caller: its out edge enters the entry block and the
+  // blocks without successors return into it, so the flow is conserved at
+  // every node, node 0 included.  Block i of the function is node i+1.
+  struct FlowGraph {
+    std::vector<ProfileInfo::Edge> Edges;
+    std::vector<double> Weights;              // MissingValue until known
+    std::vector<unsigned> From, To;           // nodes of each edge
+    std::vector<std::vector<unsigned> > In, Out;  // edges of each node
+    unsigned Measured, Inferred;
+
+    FlowGraph(const ProfileInfo &PI, const Function *F);
+    void solve();
+  private:
+    void addEdge(const ProfileInfo &PI, ProfileInfo::Edge E,
+                 unsigned Src, unsigned Dest);
+    bool sumSide(const std::vector<unsigned> &Side, double &Sum,
+                 unsigned &Open) const;
+  };
+}
+
+FlowGraph::FlowGraph(const ProfileInfo &PI, const Function *F)
+    : In(F->size() + 1), Out(F->size() + 1), Measured(0), Inferred(0) {
+  DenseMap<const BasicBlock*, unsigned> Node;
+  unsigned N = 0;
+  for (Function::const_iterator BB = F->begin(), E = F->end(); BB != E; ++BB)
+    Node[&*BB] = ++N;
+
+  const BasicBlock *Entry = &F->getEntryBlock();
+  addEdge(PI, ProfileInfo::getEdge(0, Entry), 0, Node[Entry]);
+  for (Function::const_iterator BI = F->begin(), BE = F->end(); BI != BE; ++BI) {
+    const BasicBlock *BB = &*BI;
+    unsigned Src = Node[BB];
+    succ_const_iterator SI = succ_begin(BB), SE = succ_end(BB);
+    if (SI == SE)
+      addEdge(PI, ProfileInfo::getEdge(BB, 0), Src, 0);
+    for (; SI != SE; ++SI) {
+      // A switch with several cases to one block has still one edge to it.
+      unsigned Dest = Node[*SI];
+      bool Seen = false;
+      for (unsigned i = 0, e = Out[Src].size(); i != e && !Seen; ++i)
+        Seen = To[Out[Src][i]] == Dest;
+      if (!Seen)
+        addEdge(PI, ProfileInfo::getEdge(BB, *SI), Src, Dest);
+    }
+  }
+}
+
+void FlowGraph::addEdge(const ProfileInfo &PI, ProfileInfo::Edge E,
+                        unsigned Src, unsigned Dest) {
+  unsigned Index = Edges.size();
+  Edges.push_back(E);
+  Weights.push_back(PI.getEdgeWeight(E));
+  if (Weights.back() != ProfileInfo::MissingValue) ++Measured;
+  From.push_back(Src);
+  To.push_back(Dest);
+  Out[Src].push_back(Index);
+  In[Dest].push_back(Index);
+}
+
+// sumSide - Sums the known edges of Side, returns false if more than one of
+// them is missing.  Open is the missing one, or ~0U if there is none.
+bool FlowGraph::sumSide(const std::vector<unsigned> &Side, double &Sum,
+                        unsigned &Open) const {
+  Sum = 0;
+  Open = ~0U;
+  for (unsigned i = 0, e = Side.size(); i != e; ++i) {
+    double W = Weights[Side[i]];
+    if (W != ProfileInfo::MissingValue) {
+      Sum += W;
+    } else if (Open == ~0U) {
+      Open = Side[i];
+    } else {
+      return false;
+    }
+  }
+  return true;
+}
+
+// solve - Calculates every edge that flow conservation determines: a node
+// with all in (or out) edges known has a known count, and the single missing
+// edge on its other side is the difference.  Each calculated edge revisits
+// its two nodes, so a function takes time linear in its edges.  An unknown
+// self loop is on both sides of its node and stays open.
+void FlowGraph::solve() {
+  std::vector<unsigned> Work;
+  std::vector<bool> Queued(In.size(), true);
+  for (unsigned N = In.size(); N-- > 0;)
+    Work.push_back(N);
+
+  while (!Work.empty()) {
+    unsigned N = Work.back(); Work.pop_back();
+    Queued[N] = false;
+
+    double InSum, OutSum;
+    unsigned InOpen, OutOpen;
+    bool InOne = sumSide(In[N], InSum, InOpen);
+    bool OutOne = sumSide(Out[N], OutSum, OutOpen);
+
+    unsigned E;
+    double W;
+    if (InOne && InOpen == ~0U && OutOne && OutOpen != ~0U) {
+      E = OutOpen; W = InSum - OutSum;
+    } else if (OutOne && OutOpen == ~0U && InOne && InOpen != ~0U) {
+      E = InOpen; W = OutSum - InSum;
+    } else {
+      continue;
+    }
+
+    // Inconsistent counts give no negative flow.
+    Weights[E] = std::max(W, 0.0);
+    ++Inferred;
+    if (!Queued[From[E]]) { Queued[From[E]] = true; Work.push_back(From[E]); }
+    if (!Queued[To[E]]) { Queued[To[E]] = true; Work.push_back(To[E]); }
+  }
+}
+
+// repair - Solves the flow of every function of Fs on Jobs threads, all the
+// hardware has for 0.  The solver only reads the profile and the CFGs, so the
+// functions are independent; their results are stored afterwards on this
+// thread, and the edges left open are estimated by repair(F).
+template<>
+ProfileInfoT<Function,BasicBlock>::RepairCounts
+ProfileInfoT<Function,BasicBlock>::repair(const std::vector<const Function*> &Fs,
+                                          unsigned Jobs) {
+  std::vector<std::unique_ptr<FlowGraph> > Graphs(Fs.size());
+  if (Jobs == 0) Jobs = std::thread::hardware_concurrency();
+  Jobs = std::max(1u, std::min<unsigned>(Jobs, Fs.size()));
+
+  std::atomic<size_t> Next(0);
+  std::vector<std::thread> Threads;
+  for (unsigned t = 0; t < Jobs; ++t)
+    Threads.push_back(std::thread([&]{
+      for (size_t i; (i = Next++) < Fs.size();) {
+        Graphs[i].reset(new FlowGraph(*this, Fs[i]));
+        Graphs[i]->solve();
+      }
+    }));
+  for (std::thread &T : Threads) T.join();
+
+  RepairCounts Counts;
+  for (size_t i = 0; i < Fs.size(); ++i) {
+    const FlowGraph &G = *Graphs[i];
+    EdgeWeights &Weights = EdgeInformation[Fs[i]];
+    unsigned Open = 0;
+    for (unsigned e = 0, ee = G.Edges.size(); e != ee; ++e) {
+      if (G.Weights[e] == MissingValue)
+        ++Open;
+      else
+        Weights[G.Edges[e]] = G.Weights[e];
+    }
+    Counts.Measured += G.Measured;
+    Counts.Inferred += G.Inferred;
+    Counts.Estimated += Open;
+    if (Open) {
+      DEBUG(dbgs() << "Estimating " << Open << " edges of "
+                   << Fs[i]->getName() << "\n");
+      repair(Fs[i]);
+    }
+  }
+  return Counts;
+}
+
 raw_ostream& operator<<(raw_ostream &O, const MachineFunction *MF) {
   return O << MF->getFunction()->getName() << "(MF)";
 }
@@ -16,12 +16,19 @@
 #include <llvm/IR/InstrTypes.h>
 #include <llvm/IR/Module.h>
 #include <llvm/Support/raw_ostream.h>
+#include <llvm/Support/MemoryBuffer.h>
+#if LLVM_VERSION_MAJOR==3 && LLVM_VERSION_MINOR==4
+#include <llvm/ADT/OwningPtr.h>
+#endif
 #include "ProfileInfoLoader.h"
 #include "ProfileInfoTypes.h"
 #include <cstdio>
 #include <cstdlib>
+#include <cstring>
 #include <assert.h>
+#include <algorithm>
 #include <vector>
+#include <map>
 using namespace llvm;
 
 raw_ostream &llvm::operator<<(raw_ostream &O, std::pair<const BasicBlock *,
@@ -69,6 +76,15 @@ static inline uint64_t ByteSwap(uint64_t Var, bool Really)
 static inline double ByteSwap(double Var, bool Really)
 {
    if (!Really) return Var;
+   uint64_t Bits;
+   memcpy(&Bits, &Var, sizeof(Bits));
+   Bits = ByteSwap(Bits, true);
+   memcpy(&Var, &Bits, sizeof(Var));
+   return Var;
+}
+
+static inline int ByteSwap(int Var, bool Really) {
+  return (int)ByteSwap((unsigned)Var, Really);
 }
 
 static uint64_t AddCounts(uint64_t A, uint64_t B) {
@@ -78,241 +94,661 @@ static uint64_t AddCounts(uint64_t A, uint64_t B) {
   return A + B;
 }
 
-template<class IntT>
-static void ReadProfilingBlock(const char *ToolName, FILE *F,
-                               bool ShouldByteSwap,
-                               std::vector<IntT> &Data) {
-  // Read the number of entries...
-  IntT NumEntries;
-  if (fread(&NumEntries, sizeof(IntT), 1, F) != 1) {
-    errs() << ToolName << ": data packet truncated!\n";
-    perror(0);
-    exit(1);
+// LoadRaw - Read a T from a possibly unaligned position, packets are only
+// aligned to 4 bytes in the file.
+template<class T>
+static inline T LoadRaw(const char *P) {
+  T V;
+  memcpy(&V, P, sizeof(T));
+  return V;
+}
+
+namespace llvm {
+// PacketView - The payload of a packet as an array of T, pointing into the
+// mapped profile file.  Nothing is copied, elements are byteswapped when they
+// are read.
+template<class T>
+struct PacketView {
+  const char *Data;
+  size_t Size;
+  bool Swap;
+
+  size_t size() const { return Size; }
+  T operator[](size_t i) const {
+    return ByteSwap(LoadRaw<T>(Data + i * sizeof(T)), Swap);
+  }
+  template<class DataT>
+  void copyTo(std::vector<DataT> &Dst) const {
+    Dst.resize(Size);
+    for (size_t i = 0; i != Size; ++i)
+      Dst[i] = (DataT)(*this)[i];
+  }
+};
+
+// PacketCursor - Walks over the packets of a mapped profile file.  Running
+// past the end of the file is an error, just like a short fread was: the
+// reason goes to Error and the cursor jumps to its end, so every loop over
+// it stops.  Reads after that return zeros and empty views.
+class PacketCursor {
+  const std::string &Filename;
+  std::string &Error;
+  const char *Begin, *Pos, *End;
+public:
+  bool Swap;
+
+  PacketCursor(const std::string &Filename, std::string &Error,
+               const char *Begin, size_t Size)
+    : Filename(Filename), Error(Error), Begin(Begin), Pos(Begin),
+      End(Begin + Size), Swap(false) {}
+
+  bool atEnd() const { return Pos == End; }
+  bool failed() const { return !Error.empty(); }
+  const char *data() const { return Pos; }
+  size_t offset() const { return Pos - Begin; }
+  size_t size() const { return End - Begin; }
+
+  // fail - Keep the first error, it is the one that explains the others.
+  void fail(const std::string &Reason) {
+    if (Error.empty())
+      Error = Reason;
+    Pos = End;
+  }
+
+  bool need(uint64_t N, size_t ElemSize, const char *What) {
+    if (N <= (size_t)(End - Pos) / ElemSize) return true;
+    std::string Reason;
+    raw_string_ostream OS(Reason);
+    OS << What << " packet truncated at position " << offset() << "/"
+       << size() << " of '" << Filename << "'";
+    fail(OS.str());
+    return false;
+  }
+
+  template<class T>
+  T read(const char *What = "data") {
+    if (!need(1, sizeof(T), What)) return T();
+    T V = ByteSwap(LoadRaw<T>(Pos), Swap);
+    Pos += sizeof(T);
+    return V;
+  }
+
+  template<class T>
+  PacketView<T> view(uint64_t N, const char *What = "data") {
+    if (!need(N, sizeof(T), What)) N = 0;
+    PacketView<T> V = {Pos, (size_t)N, Swap};
+    Pos += N * sizeof(T);
+    return V;
   }
-  NumEntries = ByteSwap(NumEntries, ShouldByteSwap);
 
-  // Read the counts...
-  std::vector<IntT> TempSpace(NumEntries);
+  // bytes - The next N bytes, null if the file has fewer.
+  const char *bytes(size_t N, const char *What) {
+    if (!need(N, 1, What)) return NULL;
+    const char *P = Pos;
+    Pos += N;
+    return P;
+  }
 
-  // Read in the block of data...
-  if (fread(&TempSpace[0], sizeof(IntT)*NumEntries, 1, F) != 1) {
-    errs() << ToolName << ": data packet truncated!\n";
-    perror(0);
-    exit(1);
+  // payload - A cursor over Length bytes at Offset of the file, an empty one
+  // if they are beyond its end.
+  PacketCursor payload(uint64_t Offset, uint64_t Length) {
+    if (Offset > size() || Length > size() - Offset) {
+      std::string Reason;
+      raw_string_ostream OS(Reason);
+      OS << "packet at " << Offset << " of " << Length
+         << " bytes is beyond the end of '" << Filename << "'";
+      fail(OS.str());
+      Offset = Length = 0;
+    }
+    PacketCursor C(Filename, Error, Begin + Offset, Length);
+    C.Swap = Swap;
+    return C;
   }
+};
+}
 
+// AccumulateCounts - Add the counts of a packet to Data.  The first packet of
+// a kind is just converted, later ones are summed in a loop without branches
+// so the compiler can vectorize it; Uncounted on either side keeps the other
+// value, as AddCounts does.
+template<class T, class DataT>
+static void AccumulateCounts(const PacketView<T> &P, std::vector<DataT> &Data) {
+  const size_t N = P.size();
+  const DataT U = (DataT)ProfileInfoLoader::Uncounted;
+  if (Data.empty()) {
+    Data.resize(N);
+    if (!P.Swap && sizeof(T) == sizeof(DataT))
+      memcpy(Data.data(), P.Data, N * sizeof(T));
+    else
+      for (size_t i = 0; i != N; ++i)
+        Data[i] = (DataT)P[i];
+    return;
+  }
   // Make sure we have enough space... The space is initialised to -1 to
   // facitiltate the loading of missing values for OptimalEdgeProfiling.
-  if (Data.size() < NumEntries)
-    Data.resize(NumEntries, ProfileInfoLoader::Uncounted);
-
-  // Accumulate the data we just read into the data.
-  if (!ShouldByteSwap) {
-    for (IntT i = 0; i != NumEntries; ++i) {
-      Data[i] = AddCounts(TempSpace[i], Data[i]);
+  if (Data.size() < N)
+    Data.resize(N, U);
+
+  DataT *D = Data.data();
+  const char *S = P.Data;
+  if (!P.Swap) {
+    for (size_t i = 0; i != N; ++i) {
+      DataT A = (DataT)LoadRaw<T>(S + i * sizeof(T)), B = D[i];
+      D[i] = A == U ? B : B == U ? A : A + B;
     }
   } else {
-    for (IntT i = 0; i != NumEntries; ++i) {
-      Data[i] = AddCounts(ByteSwap(TempSpace[i], true), Data[i]);
+    for (size_t i = 0; i != N; ++i) {
+      DataT A = (DataT)ByteSwap(LoadRaw<T>(S + i * sizeof(T)), true), B = D[i];
+      D[i] = A == U ? B : B == U ? A : A + B;
     }
   }
 }
-template<class T>
-static void ReadProfilingBlockDouble(const char *ToolName, FILE *F,
-                               bool ShouldByteSwap,
-                               std::vector<T> &Data) {
-  // Read the number of entries...
-  uint64_t NumEntries;
-  if (fread(&NumEntries, sizeof(uint64_t), 1, F) != 1) {
-    errs() << ToolName << ": data packet truncated!\n";
-    perror(0);
-    exit(1);
-  }
-  NumEntries = ByteSwap(NumEntries, ShouldByteSwap);
 
-  // Read the counts...
-  std::vector<double> TempSpace(NumEntries);
+// ReadProfilingBlock - A counter packet: the number of entries as IntT, then
+// the entries.
+template<class IntT, class DataT>
+static void ReadProfilingBlock(PacketCursor &C, std::vector<DataT> &Data) {
+  IntT NumEntries = C.read<IntT>();
+  AccumulateCounts(C.view<IntT>(NumEntries), Data);
+}
 
-  // Read in the block of data...
-  if (fread(&TempSpace[0], sizeof(double)*NumEntries, 1, F) != 1) {
-    errs() << ToolName << ": data packet truncated!\n";
-    perror(0);
-    exit(1);
-  }
+// ReadProfilingBlockDouble - A packet of doubles, a later packet replaces the
+// values of an earlier one.
+template<class T>
+static void ReadProfilingBlockDouble(PacketCursor &C, std::vector<T> &Data) {
+  uint64_t NumEntries = C.read<uint64_t>();
+  PacketView<double> P = C.view<double>(NumEntries);
 
-  // Make sure we have enough space... The space is initialised to -1 to
-  // facitiltate the loading of missing values for OptimalEdgeProfiling.
-  if (Data.size() < NumEntries)
-    Data.resize(NumEntries, 0);
+  if (Data.size() < P.size())
+    Data.resize(P.size(), 0);
 
-  for (uint64_t i = 0; i != NumEntries; ++i) {
-     Data[i] = (T)TempSpace[i];
+  for (uint64_t i = 0; i != P.size(); ++i) {
+     Data[i] = (T)P[i];
   }
 }
 
-static void ReadValueProfilingContents(const char* ToolName, FILE* F,
-		bool ShouldByteSwap, const size_t Counts,
+static void ReadValueProfilingContents(PacketCursor &C, const size_t Counts,
 		std::vector<std::vector<int> >& Data)
 {
-#define EXIT_IF_ERROR {\
-    errs() << ToolName << ": data packet truncated!\n";\
-    perror(0);\
-    exit(1);}
-
 	if(Data.size() < Counts)
 		Data.resize(Counts);
-   std::vector<int> TempSpace;
    for(unsigned i=0;i<Counts;++i){
-		unsigned count = 0;
-		if(fread(&count,sizeof(unsigned),1,F) != 1) EXIT_IF_ERROR;
-		count = ByteSwap(count, ShouldByteSwap);
+		unsigned count = C.read<unsigned>();
 		if(count==0) continue;
-		TempSpace.clear();
-		TempSpace.resize(count);
-		if(fread(&TempSpace[0],sizeof(int)*count,1,F) != 1){
-			EXIT_IF_ERROR;
-		}
-		Data[i].resize(TempSpace.size());
-      uint64_t (*BS)(uint64_t, bool) = ByteSwap;
-
-		//tranverse TempSpace with ByteSwap and write to Data[i]
-		std::transform(TempSpace.begin(), TempSpace.end(), Data[i].begin(),
-				std::bind(BS, std::placeholders::_1, ShouldByteSwap));
+		C.view<int>(count).copyTo(Data[i]);
 	}
-#undef EXIT_IF_ERROR
+}
+
+// MergeOmpCounts - Accumulate an OmpInfo packet into Data.  Every region
+// starts with its team size, block number and thread number, these are kept
+// rather than summed.
+static void MergeOmpCounts(const std::vector<uint64_t> &Packet,
+                           std::vector<uint64_t> &Data) {
+  if (Data.size() != Packet.size()) {
+    Data = Packet;
+    return;
+  }
+  size_t i = 0;
+  while (i + 3 <= Packet.size()) {
+    Data[i] = std::max(Data[i], Packet[i]);
+    size_t End = i + 3 + Packet[i+1] * Packet[i+2];
+    for (i += 3; i < End && i < Packet.size(); ++i)
+      Data[i] = AddCounts(Packet[i], Data[i]);
+  }
+}
+
+// MergeHeapCounts - Accumulate a HeapInfo packet into Data.  The process size
+// and the peaks of several runs are their maximum, the other counters are
+// summed.
+static void MergeHeapCounts(const std::vector<uint64_t> &Packet,
+                            std::vector<uint64_t> &Data) {
+  if (Data.size() != Packet.size()) {
+    Data = Packet;
+    return;
+  }
+  for (size_t i = 0; i < Packet.size(); ++i) {
+    bool IsMax = i < HEAP_HEADER ? i != HEAP_TOTAL_LIVE
+                                 : (i - HEAP_HEADER) % HEAP_FIELDS == HEAP_PEAK;
+    Data[i] = IsMax ? std::max(Data[i], Packet[i]) : Data[i] + Packet[i];
+  }
+}
+
+// MergeCommCounts - Accumulate the CommFields records of Packet into Data.
+// Records of the same source and destination are summed, Data stays sorted.
+void llvm::MergeCommCounts(const std::vector<uint64_t> &Packet,
+                           std::vector<uint64_t> &Data) {
+  std::map<std::pair<uint64_t, uint64_t>, std::pair<uint64_t, uint64_t> > M;
+  const std::vector<uint64_t>* Inputs[] = {&Data, &Packet};
+  for (const std::vector<uint64_t>* V : Inputs)
+    for (size_t i = 0; i + COMM_FIELDS <= V->size(); i += COMM_FIELDS) {
+      std::pair<uint64_t, uint64_t>& C =
+          M[std::make_pair((*V)[i + COMM_SRC], (*V)[i + COMM_DEST])];
+      C.first += (*V)[i + COMM_MESSAGES];
+      C.second += (*V)[i + COMM_BYTES];
+    }
+  Data.clear();
+  for (auto& R : M) {
+    Data.push_back(R.first.first);
+    Data.push_back(R.first.second);
+    Data.push_back(R.second.first);
+    Data.push_back(R.second.second);
+  }
+}
+
+uint64_t llvm::ProfileHash(const void *Data, size_t Size, uint64_t Seed) {
+  const unsigned char *P = (const unsigned char *)Data;
+  uint64_t H = Seed;
+  for (size_t i = 0; i != Size; ++i)
+    H = (H ^ P[i]) * 0x100000001b3ULL;
+  return H;
+}
+
+uint64_t llvm::ProfileNameHash(const std::string &Name) {
+  uint64_t H = ProfileHash(Name.data(), Name.size());
+  return H ? H : 1;
+}
+
+bool llvm::Is64BitPacket(unsigned Type) {
+  switch (Type) {
+  case BlockInfo64: case EdgeInfo64: case SampleInfo: case OmpInfo:
+  case StrideInfo: case IOInfo: case MemOpInfo: case LightInfo: case CommInfo:
+  case HeapInfo: case CFGInfo:
+    return true;
+  default:
+    return false;
+  }
+}
+
+bool llvm::IsDoublePacket(unsigned Type) {
+  return Type == BlockInfoDouble || Type == MPITimeInfo;
+}
+
+// SkipPacket - Step over the payload of a packet of type PacketType at C
+// without looking at it.  Returns false for a type of unknown layout.
+static bool SkipPacket(PacketCursor &C, unsigned PacketType) {
+  switch (PacketType) {
+  case ArgumentInfo:
+    C.bytes((C.read<unsigned>("arguments") + 3) & ~3, "arguments");
+    return true;
+  case ValueInfo: {
+    unsigned NumValues = C.read<unsigned>();
+    C.view<unsigned>(NumValues);
+    for (unsigned i = 0; i != NumValues; ++i)
+      C.view<int>(C.read<unsigned>());
+    return true;
+  }
+  case FunctionInfo: case BlockInfo: case EdgeInfo: case OptEdgeInfo:
+  case BBTraceInfo: case SLGInfo: case MPInfo: case MPIFullInfo: case RankInfo:
+    C.view<unsigned>(C.read<unsigned>());
+    return true;
+  default:
+    if (IsDoublePacket(PacketType))
+      C.view<double>(C.read<uint64_t>());
+    else if (Is64BitPacket(PacketType))
+      C.view<uint64_t>(C.read<uint64_t>());
+    else
+      return false;
+    return true;
+  }
+}
+
+PacketMask llvm::PacketTypes(std::initializer_list<unsigned> Types) {
+  PacketMask M;
+  for (unsigned T : Types)
+    M.set(T);
+  return M;
 }
 
 const uint64_t ProfileInfoLoader::Uncounted = ~0U;
 
-// ProfileInfoLoader ctor - Read the specified profiling data file, exiting the
-// program if the file is invalid or broken.
-//
-ProfileInfoLoader::ProfileInfoLoader(const char *ToolName,
-                                     const std::string &Filename)
-  : Filename(Filename) {
-  FILE *F = fopen(Filename.c_str(), "rb");
-  if (F == 0) {
-    errs() << ToolName << ": Error opening '" << Filename << "': ";
-    perror(0);
-    exit(1);
+// MapProfile - The contents of a profile, null with the reason in Error if it
+// can't be opened.  MemoryBuffer maps large files instead of reading them,
+// the packets are used in place.
+static MemoryBuffer *MapProfile(const std::string &Filename,
+                                std::string &Error) {
+#if LLVM_VERSION_MAJOR==3 && LLVM_VERSION_MINOR==4
+  OwningPtr<MemoryBuffer> Buffer;
+  error_code ec = MemoryBuffer::getFile(Filename, Buffer, -1, false);
+#else
+  auto BufferOrErr = MemoryBuffer::getFile(Filename, -1, false);
+  std::unique_ptr<MemoryBuffer> Buffer;
+  std::error_code ec = BufferOrErr.getError();
+  if (!ec)
+    Buffer = std::move(*BufferOrErr);
+#endif
+  if (ec) {
+    Error = "Error opening '" + Filename + "': " + ec.message();
+    return NULL;
   }
-  if (0 == (fseek(F, 0, SEEK_END), ftell(F))) {
+  if (Buffer->getBufferSize() == 0) {
     // end == begin == 0, then it is empty
     errs() << " Warnning '" << Filename << "' seems empty\n";
   }
-  fseek(F, 0, SEEK_SET);
-  std::vector<unsigned> TempCounters32;
+#if LLVM_VERSION_MAJOR==3 && LLVM_VERSION_MINOR==4
+  return Buffer.take();
+#else
+  return Buffer.release();
+#endif
+}
+
+// IsIndexedProfile - Whether C is at the header of an indexed profile, sets
+// the byte order of C if it is.
+static bool IsIndexedProfile(PacketCursor &C) {
+  uint64_t Magic = C.size() >= sizeof(ProfileV2Header)
+                       ? LoadRaw<uint64_t>(C.data()) : 0;
+  if (Magic != PROFILE_V2_MAGIC && ByteSwap(Magic, true) != PROFILE_V2_MAGIC)
+    return false;
+  C.Swap = Magic != PROFILE_V2_MAGIC;
+  return true;
+}
+
+// ReadPacketType - The type of the flat packet at C, the byte order of its
+// body is set from it.  0 if the file ends in the middle of the type.
+static unsigned ReadPacketType(PacketCursor &C) {
+  const char *P = C.bytes(sizeof(unsigned), "data");
+  if (P == NULL) return 0;
+  unsigned PacketType = LoadRaw<unsigned>(P);
+  // If the low eight bits of the packet are zero, we must be dealing with an
+  // endianness mismatch.  Byteswap all words read from the profiling
+  // information.
+  C.Swap = (char)PacketType == 0;
+  return ByteSwap(PacketType, C.Swap);
+}
+
+// ReadIndexHeader - The number of entries of the indexed profile at C, after
+// checking its version.  0 if the version is not supported.
+static unsigned ReadIndexHeader(const std::string &Filename, PacketCursor &C) {
+  C.read<uint64_t>("header");
+  unsigned Version = C.read<uint32_t>("header");
+  unsigned NumEntries = C.read<uint32_t>("header");
+  if (!C.failed() && Version != PROFILE_V2_VERSION) {
+    C.fail("'" + Filename + "' has unsupported version " +
+           std::to_string(Version));
+    return 0;
+  }
+  return NumEntries;
+}
+
+// ReadIndexEntry - The next entry of the table of contents at C.
+static ProfileV2Entry ReadIndexEntry(PacketCursor &C) {
+  ProfileV2Entry E;
+  E.type = C.read<uint32_t>("table of contents");
+  E.flags = C.read<uint32_t>("table of contents");
+  E.key = C.read<uint64_t>("table of contents");
+  E.offset = C.read<uint64_t>("table of contents");
+  E.length = C.read<uint64_t>("table of contents");
+  E.checksum = C.read<uint64_t>("table of contents");
+  return E;
+}
+
+// EntryPayload - A cursor over the payload of E, the i-th entry of the table
+// of contents at C, after checking it against its checksum.  An empty one if
+// the check fails, C is failed then.
+static PacketCursor EntryPayload(const std::string &Filename, PacketCursor &C,
+                                 const ProfileV2Entry &E, unsigned i) {
+  PacketCursor P = C.payload(E.offset, E.length);
+  if (!C.failed() && ProfileHash(P.data(), E.length) != E.checksum) {
+    C.fail("checksum mismatch of packet #" + std::to_string(i) + " (type " +
+           std::to_string(E.type) + ") in '" + Filename + "'");
+    return C.payload(0, 0);
+  }
+  return P;
+}
+
+// ProfileInfoLoader ctor - Read the specified profiling data file, stopping at
+// the first error if the file is invalid or broken.
+//
+ProfileInfoLoader::ProfileInfoLoader(const char *ToolName,
+                                     const std::string &Filename,
+                                     const PacketMask &Wanted)
+  : Filename(Filename), Wanted(Wanted) {
+  this->Wanted.set(ArgumentInfo);
+  if (Wanted[EdgeInfo] || Wanted[EdgeInfo64])
+    this->Wanted.set(SampleInfo);
+
+  Indexed = false;
+  std::unique_ptr<MemoryBuffer> Buffer(MapProfile(Filename, Error));
+  if (!Buffer)
+    return;
+  PacketCursor C(Filename, Error, Buffer->getBufferStart(),
+                 Buffer->getBufferSize());
+
+  Indexed = IsIndexedProfile(C);
+  if (Indexed)
+    readIndexed(ToolName, C);
 
   // Keep reading packets until we run out of them.
-  unsigned PacketType;
-  while (fread(&PacketType, sizeof(unsigned), 1, F) == 1) {
-    // If the low eight bits of the packet are zero, we must be dealing with an
-    // endianness mismatch.  Byteswap all words read from the profiling
-    // information.
-    bool ShouldByteSwap = (char)PacketType == 0;
-    PacketType = ByteSwap(PacketType, ShouldByteSwap);
+  while (!Indexed && !C.atEnd()) {
+    unsigned PacketType = ReadPacketType(C);
+    if (C.failed())
+      break;
+    if (isWanted(PacketType) || !SkipPacket(C, PacketType))
+      readPacket(C, PacketType);
+  }
+
+  // A sampled profile only counted part of the run, scale the edge counts by
+  // the ratio of all checks to the checks spent counting.
+  if (SampleCounts.size() == 2 && SampleCounts[1] != 0 &&
+      SampleCounts[1] != Uncounted && SampleCounts[0] != SampleCounts[1]) {
+    double Ratio = (double)SampleCounts[0] / SampleCounts[1];
+    for (std::vector<uint64_t>::iterator I = EdgeCounts.begin(),
+         E = EdgeCounts.end(); I != E; ++I)
+      if (*I != Uncounted) *I = (uint64_t)(*I * Ratio + 0.5);
+  }
+}
 
+// readPacket - Read the body of a packet of type PacketType at C and add it to
+// the counts.
+//
+void ProfileInfoLoader::readPacket(PacketCursor &C, unsigned PacketType) {
     switch (PacketType) {
     case ArgumentInfo: {
-      unsigned ArgLength;
-      if (fread(&ArgLength, sizeof(unsigned), 1, F) != 1) {
-        errs() << ToolName << ": arguments packet truncated!\n";
-        errs() << "  " << Filename << ": ";
-        perror(0);
-        exit(1);
-      }
-      ArgLength = ByteSwap(ArgLength, ShouldByteSwap);
-
-      // Read in the arguments...
-      std::vector<char> Chars(ArgLength+4);
-
-      if (ArgLength)
-        if (fread(&Chars[0], (ArgLength+3) & ~3, 1, F) != 1) {
-          errs() << ToolName << ": arguments packet truncated!\n";
-          perror(0);
-          exit(1);
-        }
-      CommandLines.push_back(std::string(&Chars[0], &Chars[ArgLength]));
+      unsigned ArgLength = C.read<unsigned>("arguments");
+
+      // The arguments are padded to a multiple of 4 bytes.
+      const char *Chars = C.bytes((ArgLength+3) & ~3, "arguments");
+      if (Chars)
+        CommandLines.push_back(std::string(Chars, ArgLength));
       break;
     }
 
     case FunctionInfo:
-      ReadProfilingBlock(ToolName, F, ShouldByteSwap, FunctionCounts);
+      ReadProfilingBlock<unsigned>(C, FunctionCounts);
       break;
 
+    // 32 bit packets are added to the 64 bit counts directly
     case BlockInfo:
-       ReadProfilingBlock(ToolName, F, ShouldByteSwap, TempCounters32);
-       if (BlockCounts.size() < TempCounters32.size())
-          BlockCounts.resize(TempCounters32.size(), Uncounted);
-       std::transform(TempCounters32.begin(), TempCounters32.end(),
-                      BlockCounts.begin(), BlockCounts.begin(),
-                      AddCounts);
-       TempCounters32.clear();
+      ReadProfilingBlock<unsigned>(C, BlockCounts);
       break;
 
     case EdgeInfo:
-      ReadProfilingBlock(ToolName, F, ShouldByteSwap, TempCounters32);
-       if (EdgeCounts.size() < TempCounters32.size())
-          EdgeCounts.resize(TempCounters32.size(), Uncounted);
-       std::transform(TempCounters32.begin(), TempCounters32.end(),
-                      EdgeCounts.begin(), EdgeCounts.begin(),
-                      AddCounts);
-       TempCounters32.clear();
+      ReadProfilingBlock<unsigned>(C, EdgeCounts);
       break;
 
     case OptEdgeInfo:
-      ReadProfilingBlock(ToolName, F, ShouldByteSwap, OptimalEdgeCounts);
+      ReadProfilingBlock<unsigned>(C, OptimalEdgeCounts);
       break;
 
+    // a trace is too large to keep, ReadBBTrace streams it instead
     case BBTraceInfo:
-      ReadProfilingBlock(ToolName, F, ShouldByteSwap, BBTrace);
+      SkipPacket(C, PacketType);
       break;
 
 	case ValueInfo:
-      ReadProfilingBlock(ToolName, F, ShouldByteSwap, ValueCounts);
-      ReadValueProfilingContents(ToolName, F, ShouldByteSwap, ValueCounts.size(), ValueContents);
+      ReadProfilingBlock<unsigned>(C, ValueCounts);
+      ReadValueProfilingContents(C, ValueCounts.size(), ValueContents);
       break;
 
    case SLGInfo:
-      ReadProfilingBlock(ToolName, F, ShouldByteSwap, SLGCounts);
+      ReadProfilingBlock<unsigned>(C, SLGCounts);
       break;
 
    case MPInfo:
-      ReadProfilingBlock(ToolName, F, ShouldByteSwap, MPICounts);
+      ReadProfilingBlock<unsigned>(C, MPICounts);
       break;
 
    case MPIFullInfo:
-      ReadProfilingBlock(ToolName, F, ShouldByteSwap, MPIFullCounters);
+      ReadProfilingBlock<unsigned>(C, MPIFullCounters);
       break;
 
    case BlockInfo64:
-      ReadProfilingBlock<uint64_t>(ToolName, F, ShouldByteSwap, BlockCounts);
+      ReadProfilingBlock<uint64_t>(C, BlockCounts);
       break;
 
    case EdgeInfo64:
-      ReadProfilingBlock<uint64_t>(ToolName, F, ShouldByteSwap, EdgeCounts);
+      ReadProfilingBlock<uint64_t>(C, EdgeCounts);
       break;
    //add by haomeng
    case BlockInfoDouble:
-      ReadProfilingBlockDouble(ToolName, F, ShouldByteSwap, BlockCounts);
+      ReadProfilingBlockDouble(C, BlockDoubleCounts);
+      if (BlockCounts.size() < BlockDoubleCounts.size())
+         BlockCounts.resize(BlockDoubleCounts.size(), 0);
+      std::copy(BlockDoubleCounts.begin(), BlockDoubleCounts.end(),
+                BlockCounts.begin());
       break;
    //add by haomeng
    case MPITimeInfo:
-      ReadProfilingBlockDouble(ToolName, F, ShouldByteSwap, TimeMess);
+      ReadProfilingBlockDouble(C, TimeMess);
       break;
    case RankInfo:
-      ReadProfilingBlock(ToolName, F, ShouldByteSwap, RankCounts);
+      ReadProfilingBlock<unsigned>(C, RankCounts);
+      break;
+   case SampleInfo:
+      ReadProfilingBlock<uint64_t>(C, SampleCounts);
+      break;
+   case OmpInfo: {
+      std::vector<uint64_t> TempCounters64;
+      ReadProfilingBlock<uint64_t>(C, TempCounters64);
+      MergeOmpCounts(TempCounters64, OmpCounts);
+      break;
+   }
+   case StrideInfo:
+      ReadProfilingBlock<uint64_t>(C, StrideCounts);
+      break;
+   case IOInfo:
+      ReadProfilingBlock<uint64_t>(C, IOCounts);
+      break;
+   case MemOpInfo:
+      ReadProfilingBlock<uint64_t>(C, MemOpCounts);
+      break;
+   case LightInfo:
+      ReadProfilingBlock<uint64_t>(C, LightCounts);
+      break;
+   case CommInfo: {
+      std::vector<uint64_t> TempCounters64;
+      ReadProfilingBlock<uint64_t>(C, TempCounters64);
+      MergeCommCounts(TempCounters64, CommCounts);
+      break;
+   }
+   case HeapInfo: {
+      std::vector<uint64_t> TempCounters64;
+      ReadProfilingBlock<uint64_t>(C, TempCounters64);
+      MergeHeapCounts(TempCounters64, HeapCounts);
+      break;
+   }
+   // every instrumentation and run writes the same checksums, keep the last
+   case CFGInfo:
+      CFGCounts.clear();
+      ReadProfilingBlock<uint64_t>(C, CFGCounts);
       break;
 
    default:
-      errs() << ToolName << ": Unknown packet type #" << PacketType << "!\n";
-      errs() << "at position "<<ftell(F) <<"/";
-      fseek(F,0,SEEK_END);
-      errs() << ftell(F) <<"\n";
-      fclose(F);
-      exit(1);
+      C.fail("Unknown packet type #" + std::to_string(PacketType) +
+             " at position " + std::to_string(C.offset() - sizeof(unsigned)) +
+             "/" + std::to_string(C.size()) + " of '" + Filename + "'");
+    }
+}
+
+// readIndexed - Read an indexed profile, C is at its header.  The payload of
+// every wanted entry of the table of contents is checked against its
+// checksum, the others are not touched at all.
+// Payloads of the whole program are read like the packets of a flat file,
+// the ones of a single function are kept by their key.
+//
+void ProfileInfoLoader::readIndexed(const char *ToolName, PacketCursor &C) {
+  unsigned NumEntries = ReadIndexHeader(Filename, C);
+  for (unsigned i = 0; i != NumEntries && !C.failed(); ++i) {
+    ProfileV2Entry E = ReadIndexEntry(C);
+    if (!isWanted(E.type))
+      continue;
+
+    PacketCursor P = EntryPayload(Filename, C, E, i);
+    if (E.key == 0) {
+      readPacket(P, E.type);
+      continue;
+    }
+    switch (E.type) {
+    case ArgumentInfo: case ValueInfo: case BlockInfoDouble: case MPITimeInfo:
+      errs() << ToolName << ": WARNING: packet #" << i << " (type " << E.type
+             << ") can't be a function record, ignored\n";
+      break;
+    default:
+      std::vector<uint64_t> &R = FunctionRecords[std::make_pair(E.type, E.key)];
+      if (Is64BitPacket(E.type))
+        ReadProfilingBlock<uint64_t>(P, R);
+      else
+        ReadProfilingBlock<unsigned>(P, R);
     }
   }
+}
 
-  fclose(F);
+const std::vector<uint64_t> *
+ProfileInfoLoader::getFunctionRecord(unsigned Type,
+                                     const std::string &Name) const {
+  auto I = FunctionRecords.find(std::make_pair(Type, ProfileNameHash(Name)));
+  return I == FunctionRecords.end() ? NULL : &I->second;
+}
+
+// TraceChunk - Pass the blocks of the trace packet at C to Fn, ChunkSize of
+// them at a time.
+static void TraceChunk(PacketCursor &C, unsigned Run, size_t ChunkSize,
+                       std::vector<unsigned> &Chunk, const TraceCallback &Fn) {
+  PacketView<unsigned> P = C.view<unsigned>(C.read<unsigned>("trace"), "trace");
+  for (size_t Begin = 0; Begin < P.size(); Begin += ChunkSize) {
+    size_t N = std::min(ChunkSize, P.size() - Begin);
+    for (size_t i = 0; i != N; ++i)
+      Chunk[i] = P[Begin + i];
+    Fn(Chunk.data(), N, Run);
+  }
+}
+
+// ReadBBTrace - Walk the block trace of a profile in file order.  The file is
+// mapped, only one chunk of the trace is converted to host order at a time.
+bool llvm::ReadBBTrace(const std::string &Filename, const TraceCallback &Fn,
+                       std::string &Error, size_t ChunkSize) {
+  Error.clear();
+  std::unique_ptr<MemoryBuffer> Buffer(MapProfile(Filename, Error));
+  if (!Buffer)
+    return false;
+  PacketCursor C(Filename, Error, Buffer->getBufferStart(),
+                 Buffer->getBufferSize());
+  std::vector<unsigned> Chunk(std::max<size_t>(ChunkSize, 1));
+  unsigned Run = 0;
+
+  if (IsIndexedProfile(C)) {
+    unsigned NumEntries = ReadIndexHeader(Filename, C);
+    for (unsigned i = 0; i != NumEntries && !C.failed(); ++i) {
+      ProfileV2Entry E = ReadIndexEntry(C);
+      if (E.type == ArgumentInfo && E.key == 0)
+        ++Run;
+      if (E.type != BBTraceInfo || E.key != 0)
+        continue;
+      PacketCursor P = EntryPayload(Filename, C, E, i);
+      TraceChunk(P, Run ? Run - 1 : 0, Chunk.size(), Chunk, Fn);
+    }
+    return !C.failed();
+  }
+
+  // every run writes its arguments first, the trace of a run follows them
+  while (!C.atEnd()) {
+    unsigned PacketType = ReadPacketType(C);
+    if (PacketType == ArgumentInfo)
+      ++Run;
+    if (PacketType == BBTraceInfo)
+      TraceChunk(C, Run ? Run - 1 : 0, Chunk.size(), Chunk, Fn);
+    else if (!C.failed() && !SkipPacket(C, PacketType))
+      C.fail("Unknown packet type #" + std::to_string(PacketType) +
+             " at position " + std::to_string(C.offset() - sizeof(unsigned)) +
+             "/" + std::to_string(C.size()) + " of '" + Filename + "'");
+  }
+  return !C.failed();
 }
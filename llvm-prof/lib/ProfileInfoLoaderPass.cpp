@@ -24,6 +24,8 @@
 #include <llvm/Support/Format.h>
 #include <llvm/Support/raw_ostream.h>
 #include <llvm/IR/Constants.h>
+#include <llvm/Analysis/LoopInfo.h>
+#include <llvm/Analysis/BranchProbabilityInfo.h>
 #include "ProfileInfo.h"
 #include "ProfileInfoLoader.h"
 #include "InitializeProfilerPass.h"
@@ -32,32 +34,51 @@
 #include "ValueUtils.h"
 #include <set>
 #include <vector>
+#include <memory>
 #include <numeric>
+#include <algorithm>
 using namespace llvm;
 
 STATISTIC(NumEdgesRead, "The # of edges read.");
+STATISTIC(NumEdgesInferred, "The # of edges inferred by flow conservation.");
+STATISTIC(NumEdgesEstimated, "The # of edges estimated by repair.");
 
 static cl::opt<std::string>
 ProfileInfoFilename("profile-info-file", cl::init("llvmprof.out"),
                     cl::value_desc("filename"),
                     cl::desc("Profile file loaded by -profile-loader"));
 
+static cl::opt<bool>
+RepairReport("profile-repair-report", cl::init(false),
+             cl::desc("Report how many edge counts of the functions with "
+                      "uncounted edges were measured, inferred or estimated"));
+
 namespace {
   class LoaderPass : public ModulePass, public ProfileInfo {
     std::string Filename;
+    PacketMask Wanted;
+    // Loaded - The profile read by the caller, null to read Filename.
+    const ProfileInfoLoader *Loaded;
     std::set<Edge> SpanningTree;
     std::set<const BasicBlock*> BBisUnvisited;
     unsigned ReadCount;
   public:
     static char ID; // Class identification, replacement for typeinfo
-    explicit LoaderPass(const std::string &filename = "")
-		: ModulePass(ID), Filename(filename) {
+    explicit LoaderPass(const std::string &filename = "",
+                        const PacketMask &wanted = AllPackets())
+		: ModulePass(ID), Filename(filename), Wanted(wanted), Loaded(0) {
 			// initializeProfileInfoAnalysisGroup(*PassRegistry::getPassRegistry());
 			if (filename.empty()) Filename = ProfileInfoFilename;
     }
+    explicit LoaderPass(const ProfileInfoLoader &PIL)
+      : ModulePass(ID), Filename(PIL.getFileName()), Wanted(AllPackets()),
+        Loaded(&PIL) {}
 
     virtual void getAnalysisUsage(AnalysisUsage &AU) const {
       AU.setPreservesAll();
+      // only computed when a light profile is estimated
+      AU.addRequired<LoopInfo>();
+      AU.addRequired<BranchProbabilityInfo>();
     }
 
     virtual const char *getPassName() const {
@@ -100,8 +121,57 @@ ModulePass *llvm::createProfileLoaderPass() { return new LoaderPass(); }
 /// createProfileLoaderPass - This function returns a Pass that loads the
 /// profiling information for the module from the specified filename, making it
 /// available to the optimizers.
-Pass *llvm::createProfileLoaderPass(const std::string &Filename) {
-  return new LoaderPass(Filename);
+Pass *llvm::createProfileLoaderPass(const std::string &Filename,
+                                    const PacketMask &Wanted) {
+  return new LoaderPass(Filename, Wanted);
+}
+
+Pass *llvm::createProfileLoaderPass(const ProfileInfoLoader &PIL) {
+  return new LoaderPass(PIL);
+}
+
+// LoaderPackets - The packet types runOnModule turns into profile information,
+// traces and the communication matrix are left to their own consumers.
+static PacketMask LoaderPackets() {
+  return PacketTypes({FunctionInfo, BlockInfo, EdgeInfo, OptEdgeInfo,
+                      ValueInfo, SLGInfo, MPInfo, MPIFullInfo, BlockInfo64,
+                      EdgeInfo64, BlockInfoDouble, MPITimeInfo, RankInfo,
+                      SampleInfo, OmpInfo, StrideInfo, IOInfo, MemOpInfo,
+                      LightInfo, HeapInfo, CFGInfo});
+}
+
+namespace {
+  // CFGRecord - A function of the profiled program, where its edge and block
+  // counters start.
+  struct CFGRecord {
+    uint64_t Checksum, Edges, Blocks;
+  };
+
+  // CFGLayout - The functions of the profiled program by name hash, and the
+  // number of edge and block counters of all of them.
+  struct CFGLayout {
+    std::map<uint64_t, CFGRecord> Functions;
+    uint64_t NumEdges, NumBlocks;
+
+    explicit CFGLayout(const std::vector<uint64_t> &CFGCounts)
+        : NumEdges(0), NumBlocks(0) {
+      for (size_t i = 0; i + CFG_FIELDS <= CFGCounts.size(); i += CFG_FIELDS) {
+        CFGRecord R = {CFGCounts[i + CFG_CHECKSUM], NumEdges, NumBlocks};
+        Functions[CFGCounts[i + CFG_NAME]] = R;
+        NumEdges += CFGCounts[i + CFG_EDGES];
+        NumBlocks += CFGCounts[i + CFG_BLOCKS];
+      }
+    }
+
+    // find - The record of F if its CFG is still the one profiled.
+    const CFGRecord *find(const Function &F) const {
+      std::map<uint64_t, CFGRecord>::const_iterator I =
+          Functions.find(ProfileNameHash(F.getName().str()));
+      if (I == Functions.end() || I->second.Checksum != FunctionCFGChecksum(F))
+        return NULL;
+      return &I->second;
+    }
+  };
 }
 
 void LoaderPass::readEdgeOrRemember(Edge edge, Edge &tocalc,
@@ -154,8 +224,8 @@ void LoaderPass::readEdge(ProfileInfo::Edge e,
                    << " (# "<< (ReadCount-1) << "): "
                    << (unsigned)getEdgeWeight(e) << "\n");
     } else {
-      // This happens only if reading optimal profiling information, not when
-      // reading regular profiling information.
+      // This happens if reading optimal profiling information, or edges left
+      // uninstrumented by -insert-edge-profiling -cold-counts=estimate.
       SpanningTree.insert(e);
     }
   }
@@ -170,15 +240,40 @@ inline unsigned sig_max(unsigned acc, unsigned b)
 }
 
 bool LoaderPass::runOnModule(Module &M) {
-  ProfileInfoLoader PIL("profile-loader", Filename);
+  std::unique_ptr<ProfileInfoLoader> Read;
+  if (!Loaded)
+    Read.reset(new ProfileInfoLoader("profile-loader", Filename,
+                                     Wanted & LoaderPackets()));
+  if (Read && Read->hasError()) {
+    errs() << "profile-loader: " << Read->getError() << "\n";
+    exit(1);
+  }
+  const ProfileInfoLoader &PIL = Loaded ? *Loaded : *Read;
+
+  // With the checksums of the profiled program the counters of a function are
+  // found by its name, and only the functions whose CFG changed since go
+  // missing.
+  CFGLayout Layout(PIL.getRawCFGCounts());
+  std::set<const Function*> Changed;
 
   EdgeInformation.clear();
   std::vector<uint64_t> Counters64 = PIL.getRawEdgeCounts();
   if (Counters64.size() > 0) {
     ReadCount = 0;
     std::vector<uint64_t>& Counters = Counters64;
+    bool ByCFG = !Layout.Functions.empty() && Layout.NumEdges == Counters.size();
+    NumEdgesRead = 0;
     for (Module::iterator F = M.begin(), E = M.end(); F != E; ++F) {
       if (F->isDeclaration()) continue;
+      if (ByCFG) {
+        const CFGRecord *R = Layout.find(*F);
+        if (R == NULL) {
+          Changed.insert(F);
+          continue;
+        }
+        ReadCount = R->Edges;
+      }
+      unsigned Begin = ReadCount;
       DEBUG(dbgs() << "Working on " << F->getName() << "\n");
       readEdge(getEdge(0,&F->getEntryBlock()), Counters);
       for (Function::iterator BB = F->begin(), E = F->end(); BB != E; ++BB) {
@@ -187,12 +282,29 @@ bool LoaderPass::runOnModule(Module &M) {
           readEdge(getEdge(BB,TI->getSuccessor(s)), Counters);
         }
       }
+      NumEdgesRead += ReadCount - Begin;
     }
-    if (ReadCount != Counters.size()) {
+    if (!ByCFG && ReadCount != Counters.size()) {
       errs() << "WARNING: profile information is inconsistent with "
              << "the current program!\n";
     }
-    NumEdgesRead = ReadCount;
+
+    // Estimate the uncounted edges from the flow around them.
+    std::set<const Function*> Incomplete;
+    for (std::set<Edge>::iterator ei = SpanningTree.begin(),
+         ee = SpanningTree.end(); ei != ee; ++ei)
+      Incomplete.insert(getFunction(*ei));
+    if (!Incomplete.empty()) {
+      RepairCounts R = repair(std::vector<const Function*>(Incomplete.begin(),
+                                                           Incomplete.end()));
+      NumEdgesInferred += R.Inferred;
+      NumEdgesEstimated += R.Estimated;
+      if (RepairReport)
+        errs() << "Repaired " << Incomplete.size() << " functions: "
+               << R.Measured << " edge counts measured, " << R.Inferred
+               << " inferred from the flow, " << R.Estimated << " estimated\n";
+    }
+    SpanningTree.clear();
   }
 
 #if 0
@@ -245,28 +357,57 @@ bool LoaderPass::runOnModule(Module &M) {
   }
 #endif
 
-  BlockInformation.clear();
+  clearBlockCounts();
   Counters64 = PIL.getRawBlockCounts();
   if (Counters64.size() > 0) {
     std::vector<uint64_t>& Counters = Counters64;
     ReadCount = 0;
+    bool ByCFG = !Layout.Functions.empty() && Layout.NumBlocks == Counters.size();
     for (Module::iterator F = M.begin(), E = M.end(); F != E; ++F) {
       if (F->isDeclaration()) continue;
-      for (Function::iterator BB = F->begin(), E = F->end(); BB != E; ++BB)
-        if (ReadCount < Counters.size())
-          // Here the data realm changes from the unsigned of the file to the
-          // double of the ProfileInfo. This conversion is save because we know
-          // that everything thats representable in unsinged is also
-          // representable in double.
-          BlockInformation[F][BB] = (double)Counters[ReadCount++];
+      if (ByCFG) {
+        const CFGRecord *R = Layout.find(*F);
+        if (R == NULL) {
+          Changed.insert(F);
+          continue;
+        }
+        ReadCount = R->Blocks;
+      }
+      // Here the data realm changes from the unsigned of the file to the
+      // double of the ProfileInfo. This conversion is save because we know
+      // that everything thats representable in unsinged is also
+      // representable in double.  The blocks of F are numbered in order, so
+      // they are copied as a whole.
+      std::vector<double> &Blocks = getFunctionCounts(F).Blocks;
+      for (unsigned b = 0, e = F->size(); b != e && ReadCount < Counters.size(); ++b)
+        Blocks[b] = (double)Counters[ReadCount++];
     }
-    if (ReadCount != Counters.size()) {
+    if (!ByCFG && ReadCount != Counters.size()) {
       errs() << "WARNING: profile information is inconsistent with "
              << "the current program!\n";
     }
   }
+  for (std::set<const Function*>::iterator I = Changed.begin(),
+       E = Changed.end(); I != E; ++I)
+    errs() << "WARNING: " << (*I)->getName() << " changed since it was "
+           << "profiled, its counts are missing!\n";
+  // An indexed profile may hold the blocks of a function in its own record.
+  for (Module::iterator F = M.begin(), E = M.end(); PIL.isIndexed() && F != E; ++F) {
+    const std::vector<uint64_t> *Record =
+        PIL.getFunctionRecord(BlockInfo64, F->getName().str());
+    if (Record == NULL) continue;
+    if (Record->size() != F->size()) {
+      errs() << "WARNING: profile information of " << F->getName()
+             << " is inconsistent with the current program!\n";
+      continue;
+    }
+    std::vector<double> &Blocks = getFunctionCounts(F).Blocks;
+    for (unsigned b = 0; b != Record->size(); ++b)
+      Blocks[b] = (double)(*Record)[b];
+  }
 
-  FunctionInformation.clear();
+  for (unsigned i = 0; i != FunctionInformation.size(); ++i)
+    FunctionInformation[i].Count = MissingValue;
   std::vector<unsigned> Counters = PIL.getRawFunctionCounts();
   if (Counters.size() > 0) {
     ReadCount = 0;
@@ -277,7 +418,7 @@ bool LoaderPass::runOnModule(Module &M) {
         // double of the ProfileInfo. This conversion is save because we know
         // that everything thats representable in unsinged is also
         // representable in double.
-        FunctionInformation[F] = (double)Counters[ReadCount++];
+        getFunctionCounts(F).Count = (double)Counters[ReadCount++];
     }
     if (ReadCount != Counters.size()) {
       errs() << "WARNING: profile information is inconsistent with "
@@ -285,7 +426,49 @@ bool LoaderPass::runOnModule(Module &M) {
     }
   }
 
+  Counters64 = PIL.getRawLightCounts();
+  if (Counters64.size() > 0 && EdgeInformation.empty()) {
+    // Only function entries and loop trips are counted, estimate the other
+    // blocks from the branch probabilities scaled by them.
+    ReadCount = 0;
+    for (Module::iterator F = M.begin(), E = M.end(); F != E; ++F) {
+      if (F->isDeclaration()) continue;
+      // the second getAnalysis recomputes the first in place
+      LoopInfo &LI = getAnalysis<LoopInfo>(*F);
+      BranchProbabilityInfo &BPI = getAnalysis<BranchProbabilityInfo>(*F);
+      std::vector<Loop*> Loops = lle::get_loops_preorder(LI);
+      if (ReadCount + 1 + Loops.size() * LIGHT_LOOP_FIELDS > Counters64.size()) {
+        ReadCount = ~0U;
+        break;
+      }
+      double Entry = (double)Counters64[ReadCount++];
+      BlockCounts Trips;
+      for (unsigned l = 0; l < Loops.size(); ++l) {
+        double Entries = Counters64[ReadCount + LIGHT_LOOP_ENTRIES];
+        double Iterations = Counters64[ReadCount + LIGHT_LOOP_ITERATIONS];
+        ReadCount += LIGHT_LOOP_FIELDS;
+        // without counted entries, keep the static loop weight
+        if (Entries > 0)
+          Trips[Loops[l]->getHeader()] = std::max(Iterations / Entries - 1, 0.0);
+        else if (Iterations == 0)
+          Trips[Loops[l]->getHeader()] = 0;
+      }
+      BlockCounts Blocks;
+      estimateProfileInfo(*F, LI, &BPI, Entry, Trips, EdgeInformation[F],
+                          Blocks);
+      for (BlockCounts::iterator I = Blocks.begin(), E = Blocks.end(); I != E; ++I)
+        blockCount(I->first) = I->second;
+      getFunctionCounts(F).Count = Entry;
+    }
+    if (ReadCount != Counters64.size()) {
+      errs() << "WARNING: profile information is inconsistent with "
+             << "the current program!\n";
+    }
+  }
+
   ValueInformation.clear();
+  TrapedSites.clear();
+  SiteLookup.clear();
   Counters = PIL.getRawValueCounts();
   if(Counters.size() > 0) {
 	  ReadCount = 0;
@@ -299,11 +482,22 @@ bool LoaderPass::runOnModule(Module &M) {
 			  ValueCounts Ins;
 			  Ins.Nums = Counters[index];
 			  const std::vector<int>& content = PIL.getRawValueContent(index);
-			  Ins.flags = (ProfilingFlags)content.front();
-			  Ins.Contents.resize(content.size()-1);
-			  copy(content.begin()+1,content.end(),Ins.Contents.begin());
+			  // a trap never executed has no contents, not even the flags
+			  Ins.flags = content.empty() ? (ProfilingFlags)0 : (ProfilingFlags)content.front();
+			  if(!content.empty())
+				  Ins.Contents.assign(content.begin()+1,content.end());
+			  // a constant is the single run of the traped value
+			  if(Ins.flags & CONSTANT_COMPRESS){
+				  Ins.flags = RUN_LENGTH_COMPRESS;
+				  Ins.Contents.clear();
+				  if(const ConstantInt* C = dyn_cast_or_null<ConstantInt>(getTrapedTarget(Call))){
+					  Ins.Contents.push_back(C->getZExtValue());
+					  Ins.Contents.push_back(Ins.Nums);
+				  }
+			  }
 			  //should NOT insert two values into one cell.
 			  ValueInformation[Call] = Ins;
+			  addTrapedSite(Call, ValueInfo, index, Ins.Nums);
 		  }
 	  }
   }
@@ -325,6 +519,7 @@ bool LoaderPass::runOnModule(Module &M) {
                  index = store_idx++;
               }else if(LoadInst* LI = dyn_cast<LoadInst>(&*I)){
                  SLGInformation[LI] = std::make_pair(load_idx, (Instruction*)NULL);
+                 addTrapedSite(LI, SLGInfo, load_idx, MissingValue);
                  index = Counters[load_idx++];
                  if(index == 0 || index == ~0U/*unsigned -1*/){
                     continue;
@@ -349,7 +544,6 @@ bool LoaderPass::runOnModule(Module &M) {
   if(Counters.size() > 0)
       RankInformation = Counters[0];
 
-  MPInformation.clear();
   Counters = PIL.getRawMPICounts();
   if(Counters.size() > 0) {
      ReadCount = 0;
@@ -358,14 +552,13 @@ bool LoaderPass::runOnModule(Module &M) {
            CallInst* CI = dyn_cast<CallInst>(&*I);
            if(CI == NULL) continue;
            if(lle::get_mpi_count_idx(CI)){
-              MPInformation[CI] = std::make_pair(ReadCount, Counters[ReadCount]);
+              addTrapedSite(CI, MPInfo, ReadCount, Counters[ReadCount]);
               ++ReadCount;
            }
         }
      }
   }
 
-  MPIFullInformation.clear();
   Counters = PIL.getRawMPIFullCounts();
   if(Counters.size() > 0) {
      ReadCount = 0;
@@ -374,14 +567,13 @@ bool LoaderPass::runOnModule(Module &M) {
            CallInst* CI = dyn_cast<CallInst>(&*I);
            if(CI == NULL) continue;
            if(lle::get_mpi_count_idx(CI)){
-              MPIFullInformation[CI] = std::make_pair(ReadCount, Counters[ReadCount]);
+              addTrapedSite(CI, MPIFullInfo, ReadCount, Counters[ReadCount]);
               ++ReadCount;
            }
         }
      }
   }
 
-  MPITimeInformation.clear();
   std::vector<double> MPITimeCounters = PIL.getRawTimeMess();
   if(MPITimeCounters.size() > 0) {
      ReadCount = 0;
@@ -398,11 +590,111 @@ bool LoaderPass::runOnModule(Module &M) {
            {
               if(str.startswith("mpi_init_")||str.startswith("mpi_comm_rank_")||str.startswith("mpi_comm_size_"))
                  continue;
-              MPITimeInformation[CI] = std::make_pair(ReadCount, MPITimeCounters[ReadCount]);
+              addTrapedSite(CI, MPITimeInfo, ReadCount, MissingValue,
+                            MPITimeCounters[ReadCount]);
               ++ReadCount;
            }
         }
      }
   }
+  // every per call site query is one lookup from here on
+  indexTrapedSites();
+
+  OmpInformation.clear();
+  Counters64 = PIL.getRawOmpCounts();
+  if(Counters64.size() > 0) {
+     std::vector<Function*> Regions = lle::get_omp_regions(M);
+     ReadCount = 0;
+     for(unsigned r = 0; r < Regions.size() && ReadCount + 3 <= Counters64.size(); ++r){
+        uint64_t NB = Counters64[ReadCount+1], MT = Counters64[ReadCount+2];
+        if(NB != Regions[r]->size() || ReadCount + 3 + NB*MT > Counters64.size())
+           break;
+        OmpRegionCounts& R = OmpInformation[Regions[r]];
+        R.TeamSize = Counters64[ReadCount];
+        ReadCount += 3;
+        R.ThreadCounts.assign(MT, std::vector<double>(NB));
+        for(uint64_t t = 0; t < MT; ++t)
+           for(uint64_t b = 0; b < NB; ++b)
+              R.ThreadCounts[t][b] = (double)Counters64[ReadCount++];
+     }
+     if (ReadCount != Counters64.size()) {
+        errs() << "WARNING: profile information is inconsistent with "
+               << "the current program!\n";
+     }
+  }
+
+  StrideInformation.clear();
+  Counters64 = PIL.getRawStrideCounts();
+  if(Counters64.size() > 0) {
+     std::vector<Instruction*> Accesses = lle::get_loop_memory_accesses(M);
+     if(Accesses.size() * STRIDE_BINS != Counters64.size()) {
+        errs() << "WARNING: profile information is inconsistent with "
+               << "the current program!\n";
+     } else {
+        ReadCount = 0;
+        for(Instruction* I : Accesses){
+           StrideCounts& C = StrideInformation[I];
+           C.assign(Counters64.begin() + ReadCount,
+                    Counters64.begin() + ReadCount + STRIDE_BINS);
+           ReadCount += STRIDE_BINS;
+        }
+     }
+  }
+
+  IOInformation.clear();
+  Counters64 = PIL.getRawIOCounts();
+  if(Counters64.size() > 0) {
+     std::vector<CallInst*> Calls = lle::get_io_calls(M);
+     if(Calls.size() * IO_FIELDS != Counters64.size()) {
+        errs() << "WARNING: profile information is inconsistent with "
+               << "the current program!\n";
+     } else {
+        ReadCount = 0;
+        for(CallInst* CI : Calls){
+           IOCounts& C = IOInformation[CI];
+           C.assign(Counters64.begin() + ReadCount,
+                    Counters64.begin() + ReadCount + IO_FIELDS);
+           ReadCount += IO_FIELDS;
+        }
+     }
+  }
+
+  MemOpInformation.clear();
+  Counters64 = PIL.getRawMemOpCounts();
+  if(Counters64.size() > 0) {
+     std::vector<CallInst*> Calls = lle::get_memory_op_calls(M);
+     if(Calls.size() * MEMOP_FIELDS != Counters64.size()) {
+        errs() << "WARNING: profile information is inconsistent with "
+               << "the current program!\n";
+     } else {
+        ReadCount = 0;
+        for(CallInst* CI : Calls){
+           MemOpCounts& C = MemOpInformation[CI];
+           C.assign(Counters64.begin() + ReadCount,
+                    Counters64.begin() + ReadCount + MEMOP_FIELDS);
+           ReadCount += MEMOP_FIELDS;
+        }
+     }
+  }
+
+  HeapInformation.clear();
+  HeapTotal.clear();
+  Counters64 = PIL.getRawHeapCounts();
+  if(Counters64.size() > 0) {
+     std::vector<CallInst*> Calls = lle::get_heap_alloc_calls(M);
+     if(HEAP_HEADER + Calls.size() * HEAP_FIELDS != Counters64.size()) {
+        errs() << "WARNING: profile information is inconsistent with "
+               << "the current program!\n";
+     } else {
+        HeapTotal.assign(Counters64.begin(), Counters64.begin() + HEAP_HEADER);
+        ReadCount = HEAP_HEADER;
+        for(CallInst* CI : Calls){
+           HeapCounts& C = HeapInformation[CI];
+           C.assign(Counters64.begin() + ReadCount,
+                    Counters64.begin() + ReadCount + HEAP_FIELDS);
+           ReadCount += HEAP_FIELDS;
+        }
+     }
+  }
   return false;
 }
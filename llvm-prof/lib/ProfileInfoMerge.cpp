@@ -0,0 +1,251 @@
+#include "preheader.h"
+#include <llvm/Support/raw_ostream.h>
+#include "ProfileInfoMerge.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <thread>
+
+using namespace llvm;
+
+static const uint64_t U = ProfileInfoLoader::Uncounted;
+
+static bool isUncounted(uint64_t V) { return V == U; }
+static bool isUncounted(unsigned V) { return V == U; }
+static bool isUncounted(double) { return false; }
+
+// resize - Make room for N counters, nothing seen yet.
+void ProfileInfoMerge::Counters::resize(size_t N)
+{
+   if(Seen.size() >= N) return;
+   if(IsDouble) DoubleSum.resize(N, 0.);
+   else Sum.resize(N, U);
+   Mean.resize(N, 0.);
+   M2.resize(N, 0.);
+   Min.resize(N, HUGE_VAL);
+   Max.resize(N, -HUGE_VAL);
+   ArgMax.resize(N, 0);
+   Seen.resize(N, 0);
+}
+
+// add - Add Values, the counters of the profile of rank Rank, to the sums
+// and the distribution. Returns false if their number differs.
+template<class T>
+bool ProfileInfoMerge::Counters::add(const std::vector<T>& Values, uint64_t Rank)
+{
+   bool SameSize = Seen.empty() || Values.empty() || Seen.size() == Values.size();
+   resize(Values.size());
+   for(size_t i = 0; i < Values.size(); ++i){
+      if(isUncounted(Values[i])) continue;
+      double V = Values[i];
+      if(IsDouble) DoubleSum[i] += V;
+      else Sum[i] = isUncounted(Sum[i]) ? (uint64_t)Values[i] : Sum[i] + Values[i];
+      double Delta = V - Mean[i];
+      Mean[i] += Delta / ++Seen[i];
+      M2[i] += Delta * (V - Mean[i]);
+      Min[i] = std::min(Min[i], V);
+      // ties go to the lower rank, whatever order the files come in
+      if(V > Max[i] || (V == Max[i] && Rank < ArgMax[i])){
+         Max[i] = V;
+         ArgMax[i] = Rank;
+      }
+   }
+   return SameSize;
+}
+
+void ProfileInfoMerge::Counters::add(const Counters& Other)
+{
+   resize(Other.Seen.size());
+   for(size_t i = 0; i < Other.Seen.size(); ++i){
+      if(Other.Seen[i] == 0) continue;
+      if(IsDouble) DoubleSum[i] += Other.DoubleSum[i];
+      else Sum[i] = isUncounted(Sum[i]) ? Other.Sum[i] : Sum[i] + Other.Sum[i];
+      double N1 = Seen[i], N2 = Other.Seen[i], N = N1 + N2;
+      double Delta = Other.Mean[i] - Mean[i];
+      Mean[i] += Delta * N2 / N;
+      M2[i] += Other.M2[i] + Delta * Delta * N1 * N2 / N;
+      Min[i] = std::min(Min[i], Other.Min[i]);
+      // ties go to the lower rank, whatever order the partial sums come in
+      if(Other.Max[i] > Max[i] || (Other.Max[i] == Max[i] && Other.ArgMax[i] < ArgMax[i])){
+         Max[i] = Other.Max[i];
+         ArgMax[i] = Other.ArgMax[i];
+      }
+      Seen[i] += Other.Seen[i];
+   }
+}
+
+ProfileInfoMerge::ProfileInfoMerge(std::string toolName, std::string fileName)
+   :Filename(fileName), Toolname(toolName),
+   FunctionCounts(FunctionInfo), BlockCounts(BlockInfo64),
+   BlockDoubleCounts(BlockInfoDouble, true), EdgeCounts(EdgeInfo64),
+   OptimalEdgeCounts(OptEdgeInfo), SLGCounts(SLGInfo), MPICounts(MPInfo),
+   MPIFullCounts(MPIFullInfo), MPITimeCounts(MPITimeInfo, true),
+   NumProfiles(0)
+{
+}
+
+// addCFGCounts - Keep the checksums of the profiled program, profiles of
+// another revision of it can't be merged by position.
+void ProfileInfoMerge::addCFGCounts(const std::vector<uint64_t>& Other,
+      const std::string& From)
+{
+   if(CFGCounts.empty())
+      CFGCounts = Other;
+   else if(!Other.empty() && Other != CFGCounts)
+      errs() << "WARNING: " << From
+         << " was profiled from another revision of the program!\n";
+}
+
+void ProfileInfoMerge::addProfileInfo(const ProfileInfoLoader& THS, size_t Index)
+{
+   uint64_t Rank = THS.getRawRankCounts().empty() ? Index : THS.getRawRankCounts()[0];
+   bool SameSize = true;
+   SameSize &= FunctionCounts.add(THS.getRawFunctionCounts(), Rank);
+   // the block counts of double profiles are only kept once, as double
+   if(THS.getRawBlockDoubleCounts().empty())
+      SameSize &= BlockCounts.add(THS.getRawBlockCounts(), Rank);
+   SameSize &= BlockDoubleCounts.add(THS.getRawBlockDoubleCounts(), Rank);
+   SameSize &= EdgeCounts.add(THS.getRawEdgeCounts(), Rank);
+   SameSize &= OptimalEdgeCounts.add(THS.getRawOptimalEdgeCounts(), Rank);
+   SameSize &= SLGCounts.add(THS.getRawSLGCounts(), Rank);
+   SameSize &= MPICounts.add(THS.getRawMPICounts(), Rank);
+   SameSize &= MPIFullCounts.add(THS.getRawMPIFullCounts(), Rank);
+   SameSize &= MPITimeCounts.add(THS.getRawTimeMess(), Rank);
+   addCFGCounts(THS.getRawCFGCounts(), THS.getFileName());
+   if(!SameSize)
+      errs() << "WARNING: " << THS.getFileName()
+         << " has other counters than the profiles merged before it!\n";
+   for(unsigned i = 0; i < THS.getNumExecutions(); ++i)
+      CommandLines.push_back(std::make_pair(Index, THS.getExecution(i)));
+   ++NumProfiles;
+}
+
+void ProfileInfoMerge::addProfileInfo(const ProfileInfoMerge& Other)
+{
+   FunctionCounts.add(Other.FunctionCounts);
+   BlockCounts.add(Other.BlockCounts);
+   BlockDoubleCounts.add(Other.BlockDoubleCounts);
+   EdgeCounts.add(Other.EdgeCounts);
+   OptimalEdgeCounts.add(Other.OptimalEdgeCounts);
+   SLGCounts.add(Other.SLGCounts);
+   MPICounts.add(Other.MPICounts);
+   MPIFullCounts.add(Other.MPIFullCounts);
+   MPITimeCounts.add(Other.MPITimeCounts);
+   addCFGCounts(Other.CFGCounts, "a partial merge");
+   CommandLines.insert(CommandLines.end(), Other.CommandLines.begin(),
+         Other.CommandLines.end());
+   NumProfiles += Other.NumProfiles;
+}
+
+// MergedPackets - The packet types addProfileInfo merges, the others are not
+// loaded at all.
+static PacketMask MergedPackets()
+{
+   return PacketTypes({FunctionInfo, BlockInfo, EdgeInfo, OptEdgeInfo,
+         SLGInfo, MPInfo, MPIFullInfo, BlockInfo64, EdgeInfo64,
+         BlockInfoDouble, MPITimeInfo, RankInfo, CFGInfo});
+}
+
+bool ProfileInfoMerge::addProfileFiles(const std::vector<std::string>& Files,
+      unsigned Jobs)
+{
+   Jobs = std::max(1u, std::min<unsigned>(Jobs, Files.size()));
+   std::vector<ProfileInfoMerge> Parts(Jobs, ProfileInfoMerge(Toolname, Filename));
+   std::vector<std::string> Errors(Files.size());
+   std::vector<std::thread> Threads;
+
+   // only one loaded file per thread is alive at a time
+   std::atomic<size_t> Next(0);
+   for(unsigned t = 0; t < Jobs; ++t)
+      Threads.push_back(std::thread([&, t]{
+         for(size_t i; (i = Next++) < Files.size();){
+            ProfileInfoLoader THS(Toolname.c_str(), Files[i], MergedPackets());
+            if(THS.hasError()) Errors[i] = THS.getError();
+            else Parts[t].addProfileInfo(THS, i);
+         }
+      }));
+   for(std::thread& T : Threads) T.join();
+
+   bool Loaded = true;
+   for(const std::string& E : Errors)
+      if(!E.empty()){
+         errs() << Toolname << ": " << E << "\n";
+         Loaded = false;
+      }
+   if(!Loaded) return false;
+
+   // Parts[i] += Parts[i+Step], doubling Step until Parts[0] holds all
+   for(unsigned Step = 1; Step < Jobs; Step *= 2){
+      Threads.clear();
+      for(unsigned i = 0; i + Step < Jobs; i += 2 * Step)
+         Threads.push_back(std::thread([&Parts, i, Step]{
+            Parts[i].addProfileInfo(Parts[i + Step]);
+         }));
+      for(std::thread& T : Threads) T.join();
+   }
+   addProfileInfo(Parts[0]);
+   return true;
+}
+
+// statistic - Statistic S of counter i over the profiles which counted it.
+double ProfileInfoMerge::Counters::statistic(MergeStat S, size_t i) const
+{
+   switch(S){
+      case MergeSum:    return IsDouble ? DoubleSum[i] : (double)Sum[i];
+      case MergeMean:   return Mean[i];
+      case MergeMin:    return Min[i];
+      case MergeMax:    return Max[i];
+      case MergeArgMax: return ArgMax[i];
+      case MergeStddev: return std::sqrt(M2[i] / Seen[i]);
+   }
+   return 0.;
+}
+
+// count - Statistic S of counter i as an integer, Uncounted if no profile
+// counted it.  Integer sums and means stay exact, like -merge=avg did.
+uint64_t ProfileInfoMerge::Counters::count(MergeStat S, size_t i) const
+{
+   if(Seen[i] == 0) return U;
+   if(S == MergeSum && !IsDouble) return Sum[i];
+   if(S == MergeMean && !IsDouble) return Sum[i] / Seen[i];
+   return (uint64_t)(statistic(S, i) + 0.5);
+}
+
+bool ProfileInfoMerge::writeTotalFile(MergeStat S, const std::string& File)
+{
+   ProfileInfoWriter totalFile((this->Toolname.c_str()),File);
+   // every packet is computed while it is written, without a copy of it
+   for(const Counters* C : {&FunctionCounts, &BlockCounts, &BlockDoubleCounts,
+         &EdgeCounts, &OptimalEdgeCounts, &SLGCounts, &MPICounts,
+         &MPIFullCounts, &MPITimeCounts}){
+      size_t N = C->Seen.size();
+      if(C->IsDouble){
+         totalFile.writeGenerated(C->Type, N, [&](uint64_t i){
+               return C->Seen[i] ? C->statistic(S, i) : 0.; });
+         continue;
+      }
+      // function, optimal edge, slg and mpi counters have no 64 bit packet,
+      // the ones above 32 bit are clamped instead of wrapped around
+      bool Narrow = !Is64BitPacket(C->Type);
+      size_t Clamped = 0;
+      totalFile.writeGenerated(C->Type, N, [&](uint64_t i){
+            uint64_t V = C->count(S, i);
+            if(Narrow && V != U && V >= U){
+               ++Clamped;
+               return U - 1;
+            }
+            return V; });
+      if(Clamped)
+         errs() << "WARNING: " << Clamped << " counters of packet type " << C->Type
+            << " overflow 32 bit, saved as " << U - 1 << "\n";
+   }
+   totalFile.write(CFGInfo, CFGCounts);
+   std::stable_sort(CommandLines.begin(), CommandLines.end(),
+         [](const std::pair<size_t, std::string>& L,
+            const std::pair<size_t, std::string>& R){ return L.first < R.first; });
+   for(unsigned i = 0;i < this->CommandLines.size();i++){
+      totalFile.write(this->CommandLines[i].second);
+   }
+   return !totalFile.hasFailed();
+}
@@ -3,13 +3,17 @@
 #include "ProfileInfoWriter.h"
 
 #include <stdio.h>
+#include <stdint.h>
 #include <stdlib.h>
+#include <string.h>
 #include <assert.h>
 
 using namespace llvm;
 
 ProfileInfoWriter::ProfileInfoWriter(const char* ToolName, 
-      const std::string& Filename)
+      const std::string& Filename, ProfileFormat Format):ToolName(ToolName),
+   Format(Format), Payloads(NULL), Out(NULL), Skip(false), Length(0),
+   Checksum(0), Failed(false)
 {
    File = fopen(Filename.c_str(), "wb");
 
@@ -19,33 +23,106 @@ ProfileInfoWriter::ProfileInfoWriter(const char* ToolName,
       exit(1);
    }
    assert(File);
+   if(Format == ProfileIndexed && (Payloads = tmpfile()) == NULL){
+      errs() << ToolName << ": Error creating the payloads of '" << Filename << "': ";
+      perror(0);
+      exit(1);
+   }
 }
 
 ProfileInfoWriter::~ProfileInfoWriter()
 {
+   if(File && Format == ProfileIndexed){
+      /* header, table of contents, then the aligned payloads, which are
+       * already aligned relative to each other */
+      ProfileV2Header Header = {PROFILE_V2_MAGIC, PROFILE_V2_VERSION,
+         (uint32_t)Entries.size()};
+      uint64_t Base = sizeof(Header) + sizeof(ProfileV2Entry) * Entries.size();
+      assert(Base % PROFILE_V2_ALIGN == 0);
+      for(unsigned i = 0; i < Entries.size(); ++i)
+         Entries[i].offset += Base;
+      fwrite(&Header, sizeof(Header), 1, File);
+      if(!Entries.empty())
+         fwrite(&Entries[0], sizeof(ProfileV2Entry), Entries.size(), File);
+      char Buffer[1 << 16];
+      size_t n;
+      rewind(Payloads);
+      while((n = fread(Buffer, 1, sizeof(Buffer), Payloads)) != 0)
+         fwrite(Buffer, 1, n, File);
+   }
+   if(Payloads) fclose(Payloads);
    if(File) fclose(File);
 }
 
-void ProfileInfoWriter::write(const std::string &cmd)
+// checkCount - A packet of a 32 bit type counts its entries in 32 bit, more
+// would be written as a corrupt packet.
+bool ProfileInfoWriter::checkCount(ProfilingType Type, uint64_t N)
 {
-   unsigned ArgLength = cmd.length();
-   ProfilingType Type = ArgumentInfo;
-   if(ArgLength <= 0) return;
-   fwrite(&Type,sizeof(unsigned), 1, this->File);
-   fwrite(&ArgLength, sizeof(unsigned), 1, this->File);
-   fwrite(&cmd[0], (ArgLength+3) & ~3, 1, this->File);
+   if(IsDoublePacket(Type) || Is64BitPacket(Type) || N <= UINT32_MAX)
+      return true;
+   errs() << ToolName << ": " << N << " counters don't fit a packet of type "
+      << Type << ", it is not written\n";
+   Failed = true;
+   return false;
+}
+
+// beginPacket - Start a packet of Type, the counters of the function with
+// name hash Key or of the whole program if Key is 0.
+void ProfileInfoWriter::beginPacket(ProfilingType Type, uint64_t Key)
+{
+   Length = 0;
+   Checksum = ProfileHash(NULL, 0);
+   if(Format == ProfileFlat){
+      // a flat file matches counters by position only
+      Skip = Key != 0;
+      Out = File;
+      unsigned T = Type;
+      if(!Skip) fwrite(&T, sizeof(unsigned), 1, File);
+      return;
+   }
+   Skip = false;
+   Out = Payloads;
+   static const char Zeros[PROFILE_V2_ALIGN] = {0};
+   long Pos = ftell(Payloads);
+   long Pad = (PROFILE_V2_ALIGN - Pos % PROFILE_V2_ALIGN) % PROFILE_V2_ALIGN;
+   fwrite(Zeros, 1, Pad, Payloads);
+   ProfileV2Entry E;
+   memset(&E, 0, sizeof(E));
+   E.type = Type;
+   E.key = Key;
+   E.offset = Pos + Pad;
+   Entries.push_back(E);
 }
 
-void ProfileInfoWriter::write(ProfilingType Type, const std::vector<unsigned int> &Counter)
+// emit - Append Size bytes to the packet, the checksum of an indexed payload
+// is updated as it goes.
+void ProfileInfoWriter::emit(const void* Data, size_t Size)
 {
-   assert(Type != ValueInfo);
-   //errs()<<"store counter\n";
-
-   unsigned NumEntries = Counter.size();
-   if(NumEntries <= 0) return;
-   fwrite(&Type, sizeof(unsigned), 1, this->File);
-   fwrite(&NumEntries, sizeof(unsigned), 1, this->File);
-   fwrite(&Counter[0], sizeof(unsigned)*NumEntries, 1, this->File);
-     // errs()<<"store over!\n";
+   if(Skip || Size == 0) return;
+   fwrite(Data, 1, Size, Out);
+   Length += Size;
+   if(Format == ProfileIndexed)
+      Checksum = ProfileHash(Data, Size, Checksum);
+}
+
+void ProfileInfoWriter::endPacket()
+{
+   if(Format == ProfileIndexed){
+      Entries.back().length = Length;
+      Entries.back().checksum = Checksum;
+   }
+   Out = NULL;
 }
 
+void ProfileInfoWriter::write(const std::string &cmd)
+{
+   unsigned ArgLength = cmd.length();
+   if(ArgLength <= 0) return;
+   static const char Zeros[4] = {0};
+   beginPacket(ArgumentInfo, 0);
+   emit(&ArgLength, sizeof(unsigned));
+   emit(cmd.data(), ArgLength);
+   // The arguments are padded to a multiple of 4 bytes.
+   emit(Zeros, ((ArgLength+3) & ~3) - ArgLength);
+   endPacket();
+}
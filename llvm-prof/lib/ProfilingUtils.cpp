@@ -22,6 +22,9 @@
 #include <llvm/IR/Module.h>
 #include <llvm/Support/raw_ostream.h>
 #include "ProfilingUtils.h"
+#include "ProfileInfoLoader.h"
+#include "ProfileDataTypes.h"
+#include <map>
 
 using namespace llvm;
 
@@ -355,3 +358,46 @@ void llvm::InsertProfilingShutdownCall(Function *Callee, Module *Mod) {
   GlobalDtors->setInitializer(ConstantArray::get(
       cast<ArrayType>(GlobalDtors->getType()->getElementType()), dtors));
 }
+
+uint64_t llvm::FunctionCFGChecksum(const Function &F) {
+  std::map<const BasicBlock*, uint64_t> Index;
+  uint64_t NumBlocks = 0;
+  for (Function::const_iterator BB = F.begin(), E = F.end(); BB != E; ++BB)
+    Index[BB] = NumBlocks++;
+  uint64_t H = ProfileHash(&NumBlocks, sizeof(NumBlocks));
+  for (Function::const_iterator BB = F.begin(), E = F.end(); BB != E; ++BB) {
+    const TerminatorInst *TI = BB->getTerminator();
+    uint64_t NumSuccs = TI ? TI->getNumSuccessors() : 0;
+    H = ProfileHash(&NumSuccs, sizeof(NumSuccs), H);
+    for (unsigned s = 0; s != NumSuccs; ++s) {
+      uint64_t Succ = Index[TI->getSuccessor(s)];
+      H = ProfileHash(&Succ, sizeof(Succ), H);
+    }
+  }
+  return H;
+}
+
+void llvm::InsertCFGChecksums(Module &M, Function *MainFn) {
+  if (MainFn == 0 || M.getNamedGlobal("CFGChecksums")) return;
+  Type *Int64Ty = Type::getInt64Ty(M.getContext());
+  std::vector<Constant*> Fields;
+  for (Module::iterator F = M.begin(), E = M.end(); F != E; ++F) {
+    if (F->isDeclaration()) continue;
+    // the edge profilers count the entry edge and every successor
+    uint64_t NumEdges = 1;
+    for (Function::iterator BB = F->begin(), BE = F->end(); BB != BE; ++BB)
+      NumEdges += BB->getTerminator()->getNumSuccessors();
+    uint64_t Record[CFG_FIELDS];
+    Record[CFG_NAME] = ProfileNameHash(F->getName().str());
+    Record[CFG_CHECKSUM] = FunctionCFGChecksum(*F);
+    Record[CFG_BLOCKS] = F->size();
+    Record[CFG_EDGES] = NumEdges;
+    for (unsigned i = 0; i != CFG_FIELDS; ++i)
+      Fields.push_back(ConstantInt::get(Int64Ty, Record[i]));
+  }
+  ArrayType *ATy = ArrayType::get(Int64Ty, Fields.size());
+  GlobalVariable *Checksums =
+    new GlobalVariable(M, ATy, true, GlobalValue::InternalLinkage,
+                       ConstantArray::get(ATy, Fields), "CFGChecksums");
+  InsertProfilingInitCall(MainFn, "llvm_start_cfg_checksums", Checksums);
+}
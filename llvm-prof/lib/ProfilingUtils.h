@@ -17,6 +17,8 @@
 #ifndef PROFILINGUTILS_H
 #define PROFILINGUTILS_H
 
+#include <stdint.h>
+
 namespace llvm {
   class BasicBlock;
   class Function;
@@ -43,6 +45,15 @@ namespace llvm {
                                bool beginning = true);
   void InsertProfilingShutdownCall(Function *Callee, Module *Mod);
 
+  /// FunctionCFGChecksum - A hash of the number of blocks of F and of the
+  /// successors of every block, it changes whenever the edge or block
+  /// counters of F would be laid out differently.
+  uint64_t FunctionCFGChecksum(const Function &F);
+  /// InsertCFGChecksums - Have the program write a CFGInfo packet, the
+  /// CFGFields of every defined function of M, on exit.  Call it before the
+  /// instrumentation changes the CFG, only its first call in M inserts it.
+  void InsertCFGChecksums(Module &M, Function *MainFn);
+
 }
 
 #endif
@@ -0,0 +1,299 @@
+//===- SampledEdgeProfiling.cpp - Insert bursty sampled edge counters -----===//
+//
+//                      The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// This pass implements Arnold-Ryder style bursty sampling on top of the edge
+// profiler.  The body of every function is duplicated: the original blocks
+// form the fast version, the copies carry the same edge counters as
+// -insert-edge-profiling.  A check is placed at the function entry and on
+// every loop back-edge; it decrements the global llvm_sample_countdown and
+// jumps into the counting or the fast version depending on
+// llvm_sample_active, which the runtime flips when the countdown expires.
+//
+// The counter layout is identical to the edge profiler, so the usual loader
+// reads the output.  The runtime also writes a SampleInfo packet with the
+// number of checks executed in total and while counting, which the loader
+// uses to scale the edge counts back to the whole run.  Functions which can't
+// be duplicated get no counters, their slots are Uncounted, so the loader
+// estimates them from the surrounding flow instead of taking them as never
+// executed, and leaves them out of the scaling.
+//
+//===----------------------------------------------------------------------===//
+#define DEBUG_TYPE "insert-sampled-edge-profiling"
+
+#include "preheader.h"
+#include <llvm/ADT/Statistic.h>
+#include <llvm/ADT/SmallVector.h>
+#include <llvm/Analysis/CFG.h>
+#include <llvm/IR/Constants.h>
+#include <llvm/IR/IRBuilder.h>
+#include <llvm/IR/Instructions.h>
+#include <llvm/IR/Module.h>
+#include <llvm/Pass.h>
+#include <llvm/Support/Debug.h>
+#include <llvm/Support/raw_ostream.h>
+#include <llvm/Transforms/Utils/BasicBlockUtils.h>
+#include <llvm/Transforms/Utils/Cloning.h>
+#include <llvm/Transforms/Utils/SSAUpdater.h>
+#include <llvm/Transforms/Utils/ValueMapper.h>
+#include "ProfilingUtils.h"
+#include "ProfileInstrumentations.h"
+#include "ProfileInfoLoader.h"
+#include <vector>
+using namespace llvm;
+
+STATISTIC(NumSampledFunctions, "The # of functions duplicated for sampling.");
+STATISTIC(NumSampleChecks, "The # of sampling checks inserted.");
+STATISTIC(NumUncountedFunctions, "The # of functions left Uncounted.");
+
+namespace {
+  class SampledEdgeProfiler : public ModulePass {
+    GlobalVariable *Counters;
+    Constant *Countdown;
+    Constant *Active;
+    Constant *SwitchFn;
+
+    bool runOnModule(Module &M);
+    bool canDuplicate(Function &F);
+    BasicBlock *insertSampleCheck(BasicBlock *CheckBB, BasicBlock *Fast,
+                                  BasicBlock *Prof);
+    void instrumentFunction(Function &F, unsigned &CounterIdx);
+  public:
+    static char ID; // Pass identification, replacement for typeid
+    SampledEdgeProfiler() : ModulePass(ID) {}
+
+    virtual const char *getPassName() const {
+      return "Sampled Edge Profiler";
+    }
+  };
+}
+
+char SampledEdgeProfiler::ID = 0;
+static RegisterPass<SampledEdgeProfiler> X("insert-sampled-edge-profiling",
+      "Insert bursty sampled instrumentation for edge profiling", false, false);
+
+ModulePass *llvm::createSampledEdgeProfilerPass() {
+  return new SampledEdgeProfiler();
+}
+
+// canDuplicate - Blocks reached through indirectbr can not be cloned safely.
+bool SampledEdgeProfiler::canDuplicate(Function &F) {
+  for (Function::iterator BB = F.begin(), E = F.end(); BB != E; ++BB)
+    if (isa<IndirectBrInst>(BB->getTerminator())) return false;
+  return true;
+}
+
+// insertSampleCheck - Append the countdown check to CheckBB, which then
+// continues to Prof while sampling and to Fast otherwise.  Returns the block
+// holding the final branch, which is the new predecessor of Fast and Prof.
+BasicBlock *SampledEdgeProfiler::insertSampleCheck(BasicBlock *CheckBB,
+                                                   BasicBlock *Fast,
+                                                   BasicBlock *Prof) {
+  LLVMContext &Context = CheckBB->getContext();
+  Function *F = CheckBB->getParent();
+  Type *Int32Ty = Type::getInt32Ty(Context);
+  Constant *Zero = Constant::getNullValue(Int32Ty);
+
+  BasicBlock *SwitchBB = BasicBlock::Create(Context, "sample.switch", F);
+  BasicBlock *PickBB = BasicBlock::Create(Context, "sample.pick", F);
+
+  IRBuilder<> Builder(CheckBB);
+  Value *Old = Builder.CreateLoad(Countdown, "OldCountdown");
+  Value *New = Builder.CreateSub(Old, ConstantInt::get(Int32Ty, 1),
+                                 "NewCountdown");
+  Builder.CreateStore(New, Countdown);
+  Builder.CreateCondBr(Builder.CreateICmpEQ(New, Zero), SwitchBB, PickBB);
+
+  Builder.SetInsertPoint(SwitchBB);
+  Builder.CreateCall(SwitchFn);
+  Builder.CreateBr(PickBB);
+
+  Builder.SetInsertPoint(PickBB);
+  Value *Sampling = Builder.CreateLoad(Active, "Sampling");
+  Builder.CreateCondBr(Builder.CreateICmpNE(Sampling, Zero), Prof, Fast);
+
+  ++NumSampleChecks;
+  return PickBB;
+}
+
+void SampledEdgeProfiler::instrumentFunction(Function &F, unsigned &i) {
+  LLVMContext &Context = F.getContext();
+
+  // Move the static allocas into a new entry block, so that both versions
+  // share them.
+  BasicBlock *OldEntry = &F.getEntryBlock();
+  BasicBlock *Entry = BasicBlock::Create(Context, "sample.entry", &F, OldEntry);
+  while (isa<AllocaInst>(OldEntry->begin())) {
+    Instruction *Alloca = OldEntry->begin();
+    Alloca->removeFromParent();
+    Entry->getInstList().push_back(Alloca);
+  }
+
+  std::vector<BasicBlock*> Blocks;
+  for (Function::iterator BB = F.begin(), E = F.end(); BB != E; ++BB)
+    if (&*BB != Entry) Blocks.push_back(BB);
+
+  SmallVector<std::pair<const BasicBlock*, const BasicBlock*>, 16> BackEdges;
+  FindFunctionBackedges(F, BackEdges);
+
+  // Create the counting version.
+  ValueToValueMapTy VMap;
+  std::vector<BasicBlock*> Clones;
+  for (unsigned b = 0, e = Blocks.size(); b != e; ++b) {
+    BasicBlock *Clone = CloneBasicBlock(Blocks[b], VMap, ".prof", &F);
+    VMap[Blocks[b]] = Clone;
+    Clones.push_back(Clone);
+  }
+  for (unsigned b = 0, e = Clones.size(); b != e; ++b)
+    for (BasicBlock::iterator I = Clones[b]->begin(), IE = Clones[b]->end();
+         I != IE; ++I)
+      RemapInstruction(I, VMap, RF_IgnoreMissingEntries);
+
+  insertSampleCheck(Entry, OldEntry, Clones[0]);
+
+  // Count the edges of the counting version, in the order the edge profiler
+  // uses for the original blocks.
+  IncrementCounterInBlock(Clones[0], i++, Counters);
+  for (unsigned b = 0, e = Clones.size(); b != e; ++b) {
+    TerminatorInst *TI = Clones[b]->getTerminator();
+    for (unsigned s = 0, se = TI->getNumSuccessors(); s != se; ++s) {
+      SplitCriticalEdge(TI, s, this);
+      if (TI->getNumSuccessors() == 1)
+        IncrementCounterInBlock(Clones[b], i++, Counters, false);
+      else
+        IncrementCounterInBlock(TI->getSuccessor(s), i++, Counters);
+    }
+  }
+
+  // Route every back-edge of both versions through a check.
+  for (unsigned b = 0, e = BackEdges.size(); b != e; ++b) {
+    BasicBlock *Latch = const_cast<BasicBlock*>(BackEdges[b].first);
+    BasicBlock *Header = const_cast<BasicBlock*>(BackEdges[b].second);
+    BasicBlock *ProfLatch = cast<BasicBlock>(VMap[Latch]);
+    BasicBlock *ProfHeader = cast<BasicBlock>(VMap[Header]);
+    BasicBlock *CheckBB = BasicBlock::Create(Context, "sample.check", &F);
+
+    // The counter of a critical back-edge sits in a block split off from the
+    // latch; the check goes after it.
+    TerminatorInst *TI = Latch->getTerminator();
+    TerminatorInst *ProfTI = ProfLatch->getTerminator();
+    BasicBlock *ProfFrom = ProfLatch;
+    for (unsigned s = 0, se = TI->getNumSuccessors(); s != se; ++s) {
+      if (TI->getSuccessor(s) != Header) continue;
+      TI->setSuccessor(s, CheckBB);
+      if (ProfTI->getSuccessor(s) != ProfHeader)
+        ProfFrom = ProfTI->getSuccessor(s);
+    }
+    TerminatorInst *FromTI = ProfFrom->getTerminator();
+    for (unsigned s = 0, se = FromTI->getNumSuccessors(); s != se; ++s)
+      if (FromTI->getSuccessor(s) == ProfHeader)
+        FromTI->setSuccessor(s, CheckBB);
+
+    BasicBlock *PickBB = insertSampleCheck(CheckBB, Header, ProfHeader);
+    for (BasicBlock::iterator I = Header->begin(); isa<PHINode>(I); ++I) {
+      PHINode *PN = cast<PHINode>(I);
+      for (unsigned p = 0, pe = PN->getNumIncomingValues(); p != pe; ++p)
+        if (PN->getIncomingBlock(p) == Latch) PN->setIncomingBlock(p, PickBB);
+    }
+    for (BasicBlock::iterator I = ProfHeader->begin(); isa<PHINode>(I); ++I) {
+      PHINode *PN = cast<PHINode>(I);
+      for (unsigned p = 0, pe = PN->getNumIncomingValues(); p != pe; ++p)
+        if (PN->getIncomingBlock(p) == ProfFrom)
+          PN->setIncomingBlock(p, PickBB);
+    }
+  }
+
+  // A value and its copy now may both reach a use, merge them with PHIs.
+  std::vector<Instruction*> Defs;
+  for (unsigned b = 0, e = Blocks.size(); b != e; ++b)
+    for (BasicBlock::iterator I = Blocks[b]->begin(), IE = Blocks[b]->end();
+         I != IE; ++I)
+      if (!I->getType()->isVoidTy() && !I->use_empty()) Defs.push_back(I);
+
+  for (unsigned d = 0, de = Defs.size(); d != de; ++d) {
+    Instruction *Def = Defs[d];
+    Instruction *Copy = cast<Instruction>(VMap[Def]);
+    SSAUpdater SSA;
+    SSA.Initialize(Def->getType(), Def->getName());
+    SSA.AddAvailableValue(Def->getParent(), Def);
+    SSA.AddAvailableValue(Copy->getParent(), Copy);
+
+    SmallVector<Use*, 16> Uses;
+    Instruction *Versions[2] = { Def, Copy };
+    for (unsigned v = 0; v != 2; ++v)
+      for (Value::use_iterator UI = Versions[v]->use_begin(),
+           UE = Versions[v]->use_end(); UI != UE; ++UI) {
+        // Uses in the defining block itself are already correct.
+        Instruction *User = cast<Instruction>(*UI);
+        if (!isa<PHINode>(User) && User->getParent() == Versions[v]->getParent())
+          continue;
+        Uses.push_back(&UI.getUse());
+      }
+    for (unsigned u = 0, ue = Uses.size(); u != ue; ++u)
+      SSA.RewriteUse(*Uses[u]);
+  }
+  ++NumSampledFunctions;
+}
+
+bool SampledEdgeProfiler::runOnModule(Module &M) {
+  Function *Main = M.getFunction("main");
+  if (Main == 0) {
+    errs() << "WARNING: cannot insert sampled edge profiling into a module"
+           << " with no main function!\n";
+    return false;  // No main, no instrumentation!
+  }
+  InsertCFGChecksums(M, Main);
+
+  // Same counter layout as the edge profiler.
+  unsigned NumEdges = 0;
+  for (Module::iterator F = M.begin(), E = M.end(); F != E; ++F) {
+    if (F->isDeclaration()) continue;
+    ++NumEdges;
+    for (Function::iterator BB = F->begin(), E = F->end(); BB != E; ++BB)
+      NumEdges += BB->getTerminator()->getNumSuccessors();
+  }
+
+  LLVMContext &Context = M.getContext();
+  Type *ATy = ArrayType::get(Type::getInt64Ty(Context), NumEdges);
+  Counters = new GlobalVariable(M, ATy, false, GlobalValue::InternalLinkage,
+                                Constant::getNullValue(ATy),
+                                "SampledEdgeProfCounters");
+  Countdown = M.getOrInsertGlobal("llvm_sample_countdown",
+                                  Type::getInt32Ty(Context));
+  Active = M.getOrInsertGlobal("llvm_sample_active",
+                               Type::getInt32Ty(Context));
+  SwitchFn = M.getOrInsertFunction("llvm_sample_switch",
+                                   Type::getVoidTy(Context), (Type *)0);
+
+  Type *Int64Ty = Type::getInt64Ty(Context);
+  std::vector<Constant*> Inits(NumEdges, ConstantInt::get(Int64Ty, 0));
+  bool AnyUncounted = false;
+  unsigned i = 0;
+  for (Module::iterator F = M.begin(), E = M.end(); F != E; ++F) {
+    if (F->isDeclaration()) continue;
+    unsigned Slots = 1;
+    for (Function::iterator BB = F->begin(), BE = F->end(); BB != BE; ++BB)
+      Slots += BB->getTerminator()->getNumSuccessors();
+    if (!canDuplicate(*F)) {
+      // Never incremented, the initial value is what ends up in the output.
+      DEBUG(dbgs() << "Not sampling " << F->getName() << "\n");
+      for (unsigned e = i + Slots; i != e; ++i)
+        Inits[i] = ConstantInt::get(Int64Ty, ProfileInfoLoader::Uncounted);
+      AnyUncounted = true;
+      ++NumUncountedFunctions;
+      continue;
+    }
+    instrumentFunction(*F, i);
+  }
+  if (AnyUncounted)
+    Counters->setInitializer(ConstantArray::get(cast<ArrayType>(ATy), Inits));
+
+  // Add the initialization call to main.
+  InsertProfilingInitCall(Main, "llvm_start_sampled_edge_profiling", Counters);
+  return true;
+}
@@ -0,0 +1,82 @@
+#include "preheader.h"
+#include <llvm/Pass.h>
+#include <llvm/IR/Module.h>
+#include <llvm/IR/IRBuilder.h>
+#include <llvm/IR/Constants.h>
+#include <llvm/Support/raw_ostream.h>
+
+#include "ValueUtils.h"
+#include "ProfilingUtils.h"
+#include "ProfileInstrumentations.h"
+#include "ProfileDataTypes.h"
+
+/**
+ * each load/store in a loop gets STRIDE_BINS counters, the runtime compares
+ * its address with the one of the previous execution and increases the bin
+ * the stride falls in.
+ */
+namespace {
+   class StrideProfiler : public llvm::ModulePass
+   {
+      public:
+      static char ID;
+      StrideProfiler():ModulePass(ID) {};
+      bool runOnModule(llvm::Module&) override;
+   };
+}
+
+using namespace llvm;
+using namespace lle;
+char StrideProfiler::ID = 0;
+static RegisterPass<StrideProfiler> X("insert-stride-profiling",
+      "insert address stride profiling for loads and stores in loops", false, false);
+
+bool StrideProfiler::runOnModule(llvm::Module &M)
+{
+   Function *Main = M.getFunction("main");
+   if (Main == 0) {
+      errs() << "WARNING: cannot insert stride profiling into a module"
+         << " with no main function!\n";
+      return false;  // No main, no instrumentation!
+   }
+
+   std::vector<Instruction*> Accesses = get_loop_memory_accesses(M);
+
+   LLVMContext& Context = M.getContext();
+   Type* I32Ty = Type::getInt32Ty(Context);
+   Type* I8PtrTy = Type::getInt8PtrTy(Context);
+   Type* ATy = ArrayType::get(Type::getInt64Ty(Context), Accesses.size() * STRIDE_BINS);
+   GlobalVariable* Counters = new GlobalVariable(M, ATy, false,
+         GlobalVariable::InternalLinkage, Constant::getNullValue(ATy),
+         "StrideCounters");
+   Constant* Trap = M.getOrInsertFunction("llvm_stride_profiling_trap",
+         Type::getVoidTy(Context), I32Ty, I8PtrTy, I32Ty, (Type*)0);
+
+   IRBuilder<> Builder(Context);
+   unsigned Idx = 0;
+   for(Instruction* I : Accesses){
+      Value* Ptr;
+      Type* Ty;
+      if(LoadInst* LI = dyn_cast<LoadInst>(I)){
+         Ptr = LI->getPointerOperand();
+         Ty = LI->getType();
+      }else{
+         StoreInst* SI = cast<StoreInst>(I);
+         Ptr = SI->getPointerOperand();
+         Ty = SI->getValueOperand()->getType();
+      }
+      // pointers and aggregates have no primitive size, count them as 8 bytes
+      unsigned Size = Ty->getPrimitiveSizeInBits() / 8;
+      if(Size == 0) Size = 8;
+
+      Builder.SetInsertPoint(I);
+      Value* Args[3];
+      Args[0] = ConstantInt::get(I32Ty, Idx++);
+      Args[1] = Builder.CreatePointerCast(Ptr, I8PtrTy);
+      Args[2] = ConstantInt::get(I32Ty, Size);
+      Builder.CreateCall(Trap, Args);
+   }
+
+   InsertProfilingInitCall(Main, "llvm_start_stride_profiling", Counters);
+   return true;
+}
@@ -14,6 +14,10 @@
  *                   \
  *                    \
  *                     LibCallTiming-------LibFnTiming
+ *                                  \
+ *                                   \------MemOpTiming
+ *
+ * TimgingSource  -----IOTiming
  *
  *
  *How does TimingSource work?
@@ -119,12 +123,13 @@ static unsigned get_datatype_index(StringRef Name, const CallInst& I)
 }
 
 template <class MapT>
-static void load_and_init_with_map(const char* file, double* cpu_times, MapT& M)
+static bool load_and_init_with_map(const char* file, double* cpu_times,
+                                   MapT& M, std::string& Error)
 {
    FILE* f = fopen(file,"r");
    if(f == NULL){
-      fprintf(stderr, "Could not open %s file: %s", file, strerror(errno));
-      exit(-1);
+      Error = std::string("Could not open ") + file + " file: " + strerror(errno);
+      return false;
    }
 
    double nanosec;
@@ -144,9 +149,11 @@ static void load_and_init_with_map(const char* file, double* cpu_times, MapT& M)
       }
    }
    fclose(f);
+   return true;
 }
 
-static void load_and_init_with_func(const char* file, std::map<std::string,FitFormula>& mpifitfunc)
+static bool load_and_init_with_func(const char* file,
+      std::map<std::string,FitFormula>& mpifitfunc, std::string& Error)
 {
     std::string funcname;
     unsigned long range;
@@ -158,8 +165,8 @@ static void load_and_init_with_func(const char* file, std::map<std::string,FitFo
 
     if(!ifs.is_open())
     {
-        errs() << "Can not open file " << file << "\n";
-        exit(-1);
+        Error = std::string("Can not open file ") + file;
+        return false;
     }
     
     while(ifs.good())
@@ -202,8 +209,8 @@ static void load_and_init_with_func(const char* file, std::map<std::string,FitFo
             }
             else
             {
-                errs() << "something wrong in the formula\n";
-                exit(-1);
+                Error = std::string("something wrong in the formula of ") + file;
+                return false;
             }
         }
         
@@ -223,6 +230,7 @@ static void load_and_init_with_func(const char* file, std::map<std::string,FitFo
             it->second.range.push_back(range);
         }
     }
+    return true;
 }
 
 void TimingSource::Register_(const char* name, const char* desc, std::function<TimingSource*()>&& func)
@@ -264,11 +272,21 @@ void TimingSource::print(raw_ostream& OS) const
 MPITiming::MPITiming(Kind K, size_t N):TimingSource(K, N)
 {
    char* REnv = getenv("MPI_SIZE");
-   if(REnv == NULL){
-      errs()<<"please set environment MPI_SIZE same as when profiling\n";
-      exit(-1);
+   this->R = REnv ? atoi(REnv) : 0;
+}
+
+bool MPITiming::checkSize(std::string& Error) const
+{
+   if(R == 0){
+      Error = "please set environment MPI_SIZE same as when profiling";
+      return false;
    }
-   this->R = atoi(REnv);
+   return true;
+}
+
+bool MPITiming::init_with_file(const char* file, std::string& Error)
+{
+   return checkSize(Error) && TimingSource::init_with_file(file, Error);
 }
 
 StringRef LmbenchTiming::getName(EnumTy IG)
@@ -339,13 +357,14 @@ double LmbenchTiming::count(BasicBlock& BB) const
 }
 
 
-void LmbenchTiming::load_lmbench(const char* file, double* cpu_times)
+bool LmbenchTiming::load_lmbench(const char* file, double* cpu_times,
+                                 std::string& Error)
 {
 #define eq(a,b) (strcmp(a,b)==0)
    FILE* f = fopen(file,"r");
    if(f == NULL){
-      fprintf(stderr, "Could not open %s file: %s", file, strerror(errno));
-      exit(-1);
+      Error = std::string("Could not open ") + file + " file: " + strerror(errno);
+      return false;
    }
 
    double nanosec;
@@ -362,6 +381,7 @@ void LmbenchTiming::load_lmbench(const char* file, double* cpu_times)
    }
    fclose(f);
 #undef eq
+   return true;
 }
 
 
@@ -467,7 +487,8 @@ double IrinstTiming::mpi_count(BasicBlock& BB) const
    return counts;
 }
 */
-void IrinstTiming::load_irinst(const char* file, double* cpu_times)
+bool IrinstTiming::load_irinst(const char* file, double* cpu_times,
+                               std::string& Error)
 {
    static const std::map<StringRef, IrinstTiming::EnumTy> InstMap = 
    {
@@ -524,7 +545,7 @@ void IrinstTiming::load_irinst(const char* file, double* cpu_times)
       {"double mul",    FLOAT_MUL},
       {"double div",    FLOAT_DIV}
    };
-   load_and_init_with_map(file, cpu_times, InstMap);
+   return load_and_init_with_map(file, cpu_times, InstMap, Error);
 }
 
 IrinstMaxTiming::IrinstMaxTiming() { this->kindof = Kind::IrinstMax; }
@@ -578,12 +599,13 @@ MPBenchReTiming::~MPBenchReTiming()
    if(latency) delete latency;
 }
 
-void MPBenchReTiming::init_with_file(const char* file)
+bool MPBenchReTiming::init_with_file(const char* file, std::string& Error)
 {
+   if(!checkSize(Error)) return false;
    FILE* f = fopen(file,"r");
    if(f == NULL){
-      fprintf(stderr, "Could not open %s file: %s", file, strerror(errno));
-      exit(-1);
+      Error = std::string("Could not open ") + file + " file: " + strerror(errno);
+      return false;
    }
    char line[512], field[128], group[128];
    unsigned off;
@@ -598,11 +620,14 @@ void MPBenchReTiming::init_with_file(const char* file)
       else continue;
       *expr = FreeExpression::Construct(group);
       if(*expr == NULL){
-         fprintf(stderr, "Couldn't construct free expression: %s", group);
-         exit(-1);
+         Error = std::string("Couldn't construct free expression: ") + group;
+         fclose(f);
+         return false;
       }
       (*expr)->init_param(line+off);
    }
+   fclose(f);
+   return true;
 }
 
 double MPBenchReTiming::newcount(const llvm::Instruction &I, double bfreq,
@@ -696,9 +721,10 @@ static const std::map<StringRef, LibFnTiming::EnumTy> LibFnMap =
    {"pow"   , POW      } ,
    {"cabs"  , CABS     }
 };
-void LibFnTiming::load_libfn(const char* file, double* param)
+bool LibFnTiming::load_libfn(const char* file, double* param,
+                             std::string& Error)
 {
-   load_and_init_with_map(file, param, LibFnMap);
+   return load_and_init_with_map(file, param, LibFnMap, Error);
 }
 
 LibFnTiming::LibFnTiming()
@@ -723,6 +749,93 @@ double LibFnTiming::count(const llvm::CallInst& CI, double bfreq) const
    return ret;
 }
 
+// memcpy_16, memcpy_64, ... memset_262144
+static const std::map<std::string, unsigned> MemOpMap = []
+{
+   std::map<std::string, unsigned> M;
+   const char* Ops[] = {"memcpy", "memmove", "memset"};
+   for (unsigned o = 0; o < 3; ++o)
+      for (unsigned b = 0; b < MEMOP_BINS; ++b)
+         M[std::string(Ops[o]) + "_" + std::to_string(MEMOP_BIN_SIZE(b))] =
+             o * MEMOP_BINS + b;
+   return M;
+}();
+bool MemOpTiming::load_memop(const char* file, double* param,
+                             std::string& Error)
+{
+   return load_and_init_with_map(file, param, MemOpMap, Error);
+}
+
+MemOpTiming::MemOpTiming()
+    : LibCallTiming(Kind::MemOp, MemOpNumSpec)
+    , T(params)
+{
+   file_initializer = load_memop;
+}
+
+unsigned MemOpTiming::op_base(const llvm::CallInst& CI)
+{
+   Function* F = dyn_cast<Function>(lle::castoff(CI.getCalledValue()));
+   StringRef Name = F->getName();
+   if (Name.startswith("llvm.")) Name = Name.drop_front(sizeof("llvm.") - 1);
+   if (Name.startswith("memmove")) return MEMOP_MOVE;
+   if (Name.startswith("memset")) return MEMOP_SET;
+   return MEMOP_COPY;
+}
+
+double MemOpTiming::count(const llvm::CallInst& CI, double bfreq) const
+{
+   if (!lle::is_memory_op(&CI))
+      return 0.;
+   unsigned Bin = 0;
+   if (ConstantInt* Len = dyn_cast<ConstantInt>(CI.getArgOperand(2)))
+      while (Bin < MEMOP_BINS - 1 && Len->getZExtValue() > MEMOP_BIN_SIZE(Bin))
+         ++Bin;
+   return bfreq * params[op_base(CI) + Bin];
+}
+
+double MemOpTiming::count(const llvm::CallInst& CI,
+                          const std::vector<double>& Counts) const
+{
+   unsigned Base = op_base(CI);
+   const unsigned Top = MEMOP_BINS - 1;
+   double ret = 0., LowBytes = 0.;
+   for (unsigned b = 0; b < Top; ++b) {
+      ret += Counts[MEMOP_BIN0 + b] * params[Base + b];
+      LowBytes += Counts[MEMOP_BIN0 + b] * MEMOP_BIN_SIZE(b);
+   }
+   // the top bin is open, so it is charged by the bytes it moved: what the
+   // lower bins can not account for of the recorded total, at least its size
+   double TopCalls = Counts[MEMOP_BIN0 + Top];
+   double TopBytes = std::max(Counts[MEMOP_BYTES] - LowBytes,
+                              TopCalls * MEMOP_BIN_SIZE(Top));
+   ret += TopBytes / MEMOP_BIN_SIZE(Top) * params[Base + Top];
+   return ret;
+}
+
+static const std::map<StringRef, IOTiming::EnumTy> IOMap =
+{
+   {"io_call" , IO_PER_CALL } ,
+   {"io_byte" , IO_PER_BYTE }
+};
+bool IOTiming::load_io(const char* file, double* param,
+                       std::string& Error)
+{
+   return load_and_init_with_map(file, param, IOMap, Error);
+}
+
+IOTiming::IOTiming()
+    : TimingSource(Kind::IO, IONumSpec)
+    , T(params)
+{
+   file_initializer = load_io;
+}
+
+double IOTiming::count(const llvm::CallInst& CI, double Calls, double Bytes) const
+{
+   return Calls * get(IO_PER_CALL) + Bytes * get(IO_PER_BYTE);
+}
+
 LatencyTiming::LatencyTiming()
     : MPITiming(Kind::Latency, MPINumSpec)
     , T(params)
@@ -732,8 +845,8 @@ LatencyTiming::LatencyTiming()
       {"mpi_latency", MPI_LATENCY},
       {"mpi_bandwidth", MPI_BANDWIDTH}
    };
-   file_initializer = [](const char* file, double* param){
-      load_and_init_with_map(file,param,MPIMap);
+   file_initializer = [](const char* file, double* param, std::string& Error){
+      return load_and_init_with_map(file,param,MPIMap,Error);
    };
     //file_initializer = load_files;
 }
@@ -744,9 +857,10 @@ std::map<std::string,FitFormula> LatencyTiming::MPIFitFunc = []
     return ret;
 }();
 
-void LatencyTiming::load_files(const char* file, double* param)
+bool LatencyTiming::load_files(const char* file, double* param,
+                               std::string& Error)
 {
-    load_and_init_with_func(file,MPIFitFunc);
+    return load_and_init_with_func(file,MPIFitFunc,Error);
 }
 double LatencyTiming::Comm_amount(const llvm::Instruction &I,double bfreq, double total) const
 {
@@ -982,3 +1096,7 @@ const char* LibFnTiming::Name = TimingSource::Register<LibFnTiming>(
     "libfn", "loading lib func call timing source");
 const char* LatencyTiming::Name = TimingSource::Register<LatencyTiming>(
     "latency", "load mpi latency timing source");
+const char* MemOpTiming::Name = TimingSource::Register<MemOpTiming>(
+    "memop", "loading size dependent memcpy/memmove/memset timing source");
+const char* IOTiming::Name = TimingSource::Register<IOTiming>(
+    "io", "loading io call and byte timing source");
@@ -5,9 +5,16 @@
 #include <llvm/IR/Function.h>
 #include <llvm/IR/Constants.h>
 #include <llvm/IR/Instructions.h>
+#include <llvm/IR/IntrinsicInst.h>
+#include <llvm/IR/Module.h>
+#include <llvm/ADT/SCCIterator.h>
+#include <llvm/Analysis/LoopInfo.h>
 #include <llvm/Support/raw_ostream.h>
 
 #include <unordered_map>
+#include <set>
+#include <map>
+#include <algorithm>
 
 using namespace lle;
 using namespace llvm;
@@ -110,3 +117,171 @@ MPICategoryType lle::get_mpi_collection(const llvm::CallInst* CI)
       throw std::out_of_range("not considered mpi instruction collection");
    return MpiSpec.at(Called->getName()).first;
 }
+
+/** OpenMP Specific
+ * fork function name->outlined function param idx
+ */
+static
+std::map<StringRef, unsigned> OmpForkSpec = {
+   {"__kmpc_fork_call"    , 2} ,
+   {"GOMP_parallel"       , 0} ,
+   {"GOMP_parallel_start" , 0}
+};
+
+Function* lle::get_omp_outlined(const llvm::CallInst* CI)
+{
+   Value* CV = const_cast<CallInst*>(CI)->getCalledValue();
+   Function* Called = dyn_cast<Function>(castoff(CV));
+   if(Called == NULL) return NULL;
+   auto Found = OmpForkSpec.find(Called->getName());
+   if(Found == OmpForkSpec.end() || Found->second >= CI->getNumArgOperands())
+      return NULL;
+   Function* Outlined = dyn_cast<Function>(castoff(CI->getArgOperand(Found->second)));
+   if(Outlined == NULL || Outlined->isDeclaration()) return NULL;
+   return Outlined;
+}
+
+std::vector<Function*> lle::get_omp_regions(Module& M)
+{
+   std::vector<Function*> Regions;
+   std::set<Function*> Seen;
+   for(Module::iterator F = M.begin(), E = M.end(); F != E; ++F){
+      if(F->isDeclaration()) continue;
+      for(inst_iterator I = inst_begin(*F), IE = inst_end(*F); I != IE; ++I){
+         CallInst* CI = dyn_cast<CallInst>(&*I);
+         if(CI == NULL) continue;
+         Function* Outlined = get_omp_outlined(CI);
+         if(Outlined && Seen.insert(Outlined).second)
+            Regions.push_back(Outlined);
+      }
+   }
+   return Regions;
+}
+
+std::vector<Instruction*> lle::get_loop_memory_accesses(Module& M)
+{
+   std::vector<Instruction*> Accesses;
+   for(Module::iterator F = M.begin(), E = M.end(); F != E; ++F){
+      if(F->isDeclaration()) continue;
+      std::set<const BasicBlock*> InLoop;
+      for(scc_iterator<Function*> I = scc_begin(&*F); !I.isAtEnd(); ++I)
+         if(I.hasLoop()) InLoop.insert((*I).begin(), (*I).end());
+      for(Function::iterator BB = F->begin(), BE = F->end(); BB != BE; ++BB){
+         if(!InLoop.count(BB)) continue;
+         for(BasicBlock::iterator I = BB->begin(), IE = BB->end(); I != IE; ++I)
+            if(isa<LoadInst>(I) || isa<StoreInst>(I))
+               Accesses.push_back(I);
+      }
+   }
+   return Accesses;
+}
+
+/** IO Specific
+ * gfortran splits a read/write statement into _gfortran_st_* calls which open
+ * and close it, and _gfortran_transfer_* calls for each item.
+ */
+static
+std::set<StringRef> PosixIOSpec = {
+   "read", "write", "pread", "pwrite", "pread64", "pwrite64"
+};
+
+bool lle::is_io_call(const llvm::CallInst* CI)
+{
+   Value* CV = const_cast<CallInst*>(CI)->getCalledValue();
+   Function* Called = dyn_cast<Function>(castoff(CV));
+   if(Called == NULL) return false;
+   StringRef Name = Called->getName();
+   return Name.startswith("_gfortran_st_")
+      || Name.startswith("_gfortran_transfer_")
+      || PosixIOSpec.count(Name);
+}
+
+std::vector<CallInst*> lle::get_io_calls(Module& M)
+{
+   std::vector<CallInst*> Calls;
+   for(Module::iterator F = M.begin(), E = M.end(); F != E; ++F){
+      if(F->isDeclaration()) continue;
+      for(inst_iterator I = inst_begin(*F), IE = inst_end(*F); I != IE; ++I){
+         CallInst* CI = dyn_cast<CallInst>(&*I);
+         if(CI && is_io_call(CI)) Calls.push_back(CI);
+      }
+   }
+   return Calls;
+}
+
+bool lle::is_memory_op(const llvm::CallInst* CI)
+{
+   if(isa<MemIntrinsic>(CI)) return true;
+   Value* CV = const_cast<CallInst*>(CI)->getCalledValue();
+   Function* Called = dyn_cast<Function>(castoff(CV));
+   if(Called == NULL || CI->getNumArgOperands() < 3) return false;
+   StringRef Name = Called->getName();
+   return Name == "memcpy" || Name == "memmove" || Name == "memset";
+}
+
+std::vector<CallInst*> lle::get_memory_op_calls(Module& M)
+{
+   std::vector<CallInst*> Calls;
+   for(Module::iterator F = M.begin(), E = M.end(); F != E; ++F){
+      if(F->isDeclaration()) continue;
+      for(inst_iterator I = inst_begin(*F), IE = inst_end(*F); I != IE; ++I){
+         CallInst* CI = dyn_cast<CallInst>(&*I);
+         if(CI && is_memory_op(CI)) Calls.push_back(CI);
+      }
+   }
+   return Calls;
+}
+
+static
+std::map<StringRef, HeapCallSpec> HeapSpec = {
+   {"malloc"                   , {HEAP_CALL_ALLOC , 0  , -1 , -1}} ,
+   {"calloc"                   , {HEAP_CALL_ALLOC , 1  , 0  , -1}} ,
+   {"realloc"                  , {HEAP_CALL_ALLOC , 1  , -1 , 0}}  ,
+   {"free"                     , {HEAP_CALL_FREE  , -1 , -1 , 0}}  ,
+   {"_gfortran_allocate"       , {HEAP_CALL_ALLOC , 0  , -1 , -1}} ,
+   {"_gfortran_allocate_array" , {HEAP_CALL_ALLOC , 1  , -1 , -1}} ,
+   {"_gfortran_deallocate"     , {HEAP_CALL_FREE  , -1 , -1 , 0}}
+};
+
+HeapCallSpec lle::get_heap_call(const llvm::CallInst* CI)
+{
+   HeapCallSpec None = {HEAP_CALL_NONE, -1, -1, -1};
+   Value* CV = const_cast<CallInst*>(CI)->getCalledValue();
+   Function* Called = dyn_cast<Function>(castoff(CV));
+   if(Called == NULL) return None;
+   auto Found = HeapSpec.find(Called->getName());
+   if(Found == HeapSpec.end()) return None;
+   const HeapCallSpec& S = Found->second;
+   int Max = std::max(S.Size, std::max(S.Num, S.Ptr));
+   if((int)CI->getNumArgOperands() <= Max) return None;
+   if(S.Kind == HEAP_CALL_ALLOC && !CI->getType()->isPointerTy()) return None;
+   return S;
+}
+
+std::vector<CallInst*> lle::get_heap_alloc_calls(Module& M)
+{
+   std::vector<CallInst*> Calls;
+   for(Module::iterator F = M.begin(), E = M.end(); F != E; ++F){
+      if(F->isDeclaration()) continue;
+      for(inst_iterator I = inst_begin(*F), IE = inst_end(*F); I != IE; ++I){
+         CallInst* CI = dyn_cast<CallInst>(&*I);
+         if(CI && get_heap_call(CI).Kind == HEAP_CALL_ALLOC) Calls.push_back(CI);
+      }
+   }
+   return Calls;
+}
+
+static void push_loop_preorder(Loop* L, std::vector<Loop*>& Loops)
+{
+   Loops.push_back(L);
+   for(Loop::iterator S = L->begin(), E = L->end(); S != E; ++S)
+      push_loop_preorder(*S, Loops);
+}
+
+std::vector<Loop*> lle::get_loops_preorder(LoopInfo& LI)
+{
+   std::vector<Loop*> Loops;
+   for(LoopInfo::iterator L = LI.begin(), E = LI.end(); L != E; ++L)
+      push_loop_preorder(*L, Loops);
+   return Loops;
+}
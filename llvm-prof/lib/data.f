@@ -35,4 +35,6 @@
          write(*,FMT) MPI_2COMPLEX, 2*sizeof(c), "MPI_2COMPLEX"
          write(*,FMT) MPI_2DOUBLE_COMPLEX, 2*sizeof(dc),
      &   "MPI_2DOUBLE_COMPLEX"
+
+         write(*,'(A,I0)') "#define FORTRAN_COMM_WORLD ", MPI_COMM_WORLD
       END
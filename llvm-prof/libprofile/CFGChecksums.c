@@ -0,0 +1,27 @@
+/*===-- CFGChecksums.c - Support library for cfg checksums ----------------===*\
+|*
+|* This file writes the CFGInfo packet inserted by InsertCFGChecksums next to
+|* the edge and block counters.  It lets the loader find the counters of every
+|* function whose CFG did not change since the profiled revision.
+|*
+\*===----------------------------------------------------------------------===*/
+
+#include "Profiling.h"
+#include <stdlib.h>
+
+static uint64_t *ArrayStart;
+static uint64_t NumElements;
+
+static void CFGChecksumsAtExitHandler(void) {
+  write_profiling_data_long(CFGInfo, ArrayStart, NumElements);
+}
+
+int llvm_start_cfg_checksums(int argc, const char **argv,
+                             uint64_t *arrayStart, uint64_t numElements) {
+  int Ret = save_arguments(argc, argv);
+  if (ArrayStart == NULL)
+    atexit(CFGChecksumsAtExitHandler);
+  ArrayStart = arrayStart;
+  NumElements = numElements;
+  return Ret;
+}
@@ -0,0 +1,70 @@
+/*===-- CombinedProfiling.c - Support library for combined profiling ------===*\
+|*
+|* This file implements the call back routines for the combined profiling
+|* instrumentation pass.  This should be used with the
+|* -insert-combined-profiling LLVM pass.  All counter arrays live in one arena
+|* described by a table of CombinedFields; a single atexit handler writes a
+|* packet for each of them.
+|*
+\*===----------------------------------------------------------------------===*/
+
+#include "Profiling.h"
+#include <stdlib.h>
+#include <stdio.h>
+
+static uint64_t *Descriptors;
+static uint64_t NumDescriptors;
+
+#define DESC(i, f) Descriptors[(i) * COMBINED_FIELDS + (f)]
+#define DESC_START(i) ((void*)(uintptr_t)DESC(i, COMBINED_START))
+
+static void CombinedProfAtExitHandler(void) {
+  uint64_t i;
+  for (i = 0; i < NumDescriptors; ++i) {
+    uint64_t Count = DESC(i, COMBINED_COUNT);
+    switch (DESC(i, COMBINED_TYPE)) {
+    case EdgeInfo64:
+      write_profiling_data_long(EdgeInfo64, DESC_START(i), Count);
+      break;
+    case BlockInfoDouble:
+      write_profiling_data_double(BlockInfoDouble, DESC_START(i), Count);
+      break;
+    case MPIFullInfo:
+      mpi_profiling_write(DESC_START(i), Count - FORTRAN_DATATYPE_MAP_SIZE * 2);
+      break;
+    case MPITimeInfo:
+      /* the rank array follows the time array */
+      if (i + 1 < NumDescriptors && DESC(i + 1, COMBINED_TYPE) == MPITimeInfo) {
+        write_time_rank_profiling_data_double(MPITimeInfo, DESC_START(i), Count,
+                                              DESC_START(i + 1),
+                                              DESC(i + 1, COMBINED_COUNT));
+        ++i;
+      }
+      break;
+    case RankInfo:
+      write_profiling_data(RankInfo, DESC_START(i), Count);
+      break;
+    default:
+      fprintf(stderr, "LLVM profiling runtime: unknown combined packet %lu\n",
+              (unsigned long)DESC(i, COMBINED_TYPE));
+      break;
+    }
+  }
+}
+
+/* llvm_start_combined_profiling - This is the main entry point of the combined
+ * profiling library.  It prepares the arrays which need it and sets up the
+ * atexit handler.
+ */
+int llvm_start_combined_profiling(int argc, const char **argv,
+                                  uint64_t *descriptors, uint64_t numElements) {
+  int Ret = save_arguments(argc, argv);
+  uint64_t i;
+  Descriptors = descriptors;
+  NumDescriptors = numElements / COMBINED_FIELDS;
+  for (i = 0; i < NumDescriptors; ++i)
+    if (DESC(i, COMBINED_TYPE) == MPIFullInfo)
+      mpi_profiling_init(DESC_START(i), DESC(i, COMBINED_COUNT));
+  atexit(CombinedProfAtExitHandler);
+  return Ret;
+}
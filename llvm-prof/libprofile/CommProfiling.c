@@ -0,0 +1,100 @@
+/*===-- CommProfiling.c - Support library for communication profiling -----===*\
+|*
+|* This file implements the call back routines for the communication matrix
+|* profiling instrumentation pass.  This should be used with the
+|* -insert-comm-profiling LLVM pass.  Every mpi_send_, mpi_isend_ and
+|* mpi_sendrecv_ accounts one message and its bytes to the destination rank,
+|* at exit the nonzero destinations are written as CommFields records.
+|*
+|* Only MPI_COMM_WORLD is recorded: the source is the rank of the process in
+|* it, and sends on any other communicator are skipped, their ranks aren't
+|* translated.  How many were skipped is reported at exit.
+|*
+\*===----------------------------------------------------------------------===*/
+
+#include "Profiling.h"
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+
+/* messages and bytes sent to each destination rank, grown on demand */
+static uint64_t (*Table)[2];
+static unsigned TableSize;
+static int *Rank; /* set after the first mpi_comm_rank_ on MPI_COMM_WORLD,
+                   -1 before, NULL if the pass gave no slot for it */
+static uint32_t DT[FORTRAN_DATATYPE_MAP_SIZE];
+static int UnknownType = -1;
+static uint64_t OtherComms; /* sends skipped, not on MPI_COMM_WORLD */
+
+static void init_datatype_size(void) {
+#include "datatype.h"
+}
+
+void llvm_comm_profiling_rank(int Comm, int R) {
+  if (Comm == FORTRAN_COMM_WORLD && Rank != NULL && *Rank < 0) *Rank = R;
+}
+
+void llvm_comm_profiling_trap(int Dest, int Count, int Datatype, int Comm) {
+  uint64_t Size = 0;
+  if (Comm != FORTRAN_COMM_WORLD) {
+    ++OtherComms;
+    return;
+  }
+  if (Dest < 0) return; /* MPI_PROC_NULL */
+  if ((unsigned)Dest >= TableSize) {
+    unsigned NewSize = TableSize ? TableSize * 2 : 64;
+    while (NewSize <= (unsigned)Dest) NewSize *= 2;
+    Table = realloc(Table, sizeof(*Table) * NewSize);
+    if (Table == NULL) {
+      fprintf(stderr, "LLVM profiling runtime: out of memory for comm matrix\n");
+      exit(1);
+    }
+    memset(Table + TableSize, 0, sizeof(*Table) * (NewSize - TableSize));
+    TableSize = NewSize;
+  }
+  if (Datatype >= 0 && Datatype < FORTRAN_DATATYPE_MAP_SIZE)
+    Size = DT[Datatype];
+  if (Size == 0) UnknownType = Datatype;
+  ++Table[Dest][0];
+  Table[Dest][1] += (uint64_t)Count * Size;
+}
+
+static void CommProfAtExitHandler(void) {
+  uint64_t *Records;
+  unsigned i, N = 0;
+  if (UnknownType >= 0)
+    fprintf(stderr, "WARNNING: doesn't consider MPI Fortran Type %d\n",
+            UnknownType);
+  if (OtherComms)
+    fprintf(stderr, "WARNING: %lu sends not on MPI_COMM_WORLD are not in the"
+            " comm matrix\n", (unsigned long)OtherComms);
+  for (i = 0; i < TableSize; ++i)
+    if (Table[i][0]) ++N;
+  if (N == 0) return; /* an empty packet can't be read back */
+  Records = malloc(sizeof(uint64_t) * N * COMM_FIELDS);
+  if (Records == NULL) { /* already exiting */
+    fprintf(stderr, "LLVM profiling runtime: out of memory for comm matrix\n");
+    return;
+  }
+  N = 0;
+  for (i = 0; i < TableSize; ++i) {
+    if (Table[i][0] == 0) continue;
+    Records[N + COMM_SRC] = Rank == NULL || *Rank < 0 ? 0 : *Rank;
+    Records[N + COMM_DEST] = i;
+    Records[N + COMM_MESSAGES] = Table[i][0];
+    Records[N + COMM_BYTES] = Table[i][1];
+    N += COMM_FIELDS;
+  }
+  write_profiling_data_long(CommInfo, Records, N);
+  free(Records);
+}
+
+int llvm_start_comm_profiling(int argc, const char** argv,
+                              int* arrayStart, int numElements)
+{
+  int Ret = save_arguments(argc, argv);
+  Rank = numElements > 0 ? arrayStart : NULL;
+  init_datatype_size();
+  atexit(CommProfAtExitHandler);
+  return Ret;
+}
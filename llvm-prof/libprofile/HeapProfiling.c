@@ -0,0 +1,129 @@
+/*===-- HeapProfiling.c - Support library for heap profiling --------------===*\
+|*
+|* This file implements the call back routines for the heap profiling
+|* instrumentation pass.  This should be used with the -insert-heap-profiling
+|* LLVM pass.  Every allocation is remembered with its site and size in an
+|* open addressing table, so a free can take the bytes off the live bytes of
+|* the site again.  Peak live bytes are kept per site and for the process.
+|*
+\*===----------------------------------------------------------------------===*/
+
+#include "Profiling.h"
+#include <stdlib.h>
+#include <stdio.h>
+
+static uint64_t *ArrayStart;
+static uint64_t NumElements;
+
+typedef struct {
+  void *Ptr;       /* NULL: empty, Tombstone: removed */
+  unsigned Site;
+  uint64_t Size;
+} Allocation;
+
+static Allocation *Table;
+static uint64_t TableSize;    /* power of two */
+static uint64_t TableUsed;    /* live and removed slots */
+static uint64_t TableLive;
+static char TombstoneObj;
+#define Tombstone ((void*)&TombstoneObj)
+
+static uint64_t hash_ptr(void *Ptr) {
+  uint64_t H = (uint64_t)(uintptr_t)Ptr;
+  H ^= H >> 33;
+  H *= 0xff51afd7ed558ccdULL;
+  H ^= H >> 33;
+  return H;
+}
+
+static void table_insert(void *Ptr, unsigned Site, uint64_t Size);
+
+static void table_grow(void) {
+  Allocation *Old = Table;
+  uint64_t OldSize = TableSize, i;
+  /* only rehash if mostly removed slots filled the table */
+  if (TableSize == 0) TableSize = 1024;
+  else if (TableLive * 4 > TableSize) TableSize *= 2;
+  Table = calloc(TableSize, sizeof(Allocation));
+  if (Table == NULL) {
+    fprintf(stderr, "LLVM profiling runtime: out of memory for heap table\n");
+    exit(1);
+  }
+  TableUsed = TableLive = 0;
+  for (i = 0; i < OldSize; ++i)
+    if (Old[i].Ptr && Old[i].Ptr != Tombstone)
+      table_insert(Old[i].Ptr, Old[i].Site, Old[i].Size);
+  free(Old);
+}
+
+static void table_insert(void *Ptr, unsigned Site, uint64_t Size) {
+  uint64_t i;
+  if ((TableUsed + 1) * 2 > TableSize) table_grow();
+  i = hash_ptr(Ptr) & (TableSize - 1);
+  while (Table[i].Ptr && Table[i].Ptr != Tombstone)
+    i = (i + 1) & (TableSize - 1);
+  if (Table[i].Ptr == NULL) ++TableUsed;
+  ++TableLive;
+  Table[i].Ptr = Ptr;
+  Table[i].Site = Site;
+  Table[i].Size = Size;
+}
+
+static Allocation *table_find(void *Ptr) {
+  uint64_t i;
+  if (TableSize == 0) return NULL;
+  i = hash_ptr(Ptr) & (TableSize - 1);
+  while (Table[i].Ptr) {
+    if (Table[i].Ptr == Ptr) return &Table[i];
+    i = (i + 1) & (TableSize - 1);
+  }
+  return NULL;
+}
+
+void llvm_heap_profiling_free(void *Ptr) {
+  Allocation *A;
+  if (ArrayStart == NULL || Ptr == NULL) return;
+  if ((A = table_find(Ptr)) == NULL) return; /* allocated uninstrumented */
+  ArrayStart[HEAP_TOTAL_LIVE] -= A->Size;
+  ArrayStart[HEAP_HEADER + A->Site * HEAP_FIELDS + HEAP_LIVE] -= A->Size;
+  A->Ptr = Tombstone;
+  --TableLive;
+}
+
+void llvm_heap_profiling_alloc(unsigned Site, void *Ptr, uint64_t Size) {
+  uint64_t *C, *H = ArrayStart;
+  unsigned Bin = 0;
+  if (H == NULL || Ptr == NULL) return;
+  C = &H[HEAP_HEADER + Site * HEAP_FIELDS];
+  while (Bin < HEAP_BINS - 1 && Size > HEAP_BIN_SIZE(Bin)) ++Bin;
+  ++C[HEAP_CALLS];
+  ++C[HEAP_BIN0 + Bin];
+  C[HEAP_BYTES] += Size;
+  if ((C[HEAP_LIVE] += Size) > C[HEAP_PEAK]) C[HEAP_PEAK] = C[HEAP_LIVE];
+  if ((H[HEAP_TOTAL_LIVE] += Size) > H[HEAP_TOTAL_PEAK])
+    H[HEAP_TOTAL_PEAK] = H[HEAP_TOTAL_LIVE];
+  table_insert(Ptr, Site, Size);
+}
+
+/* called after realloc returned New. NULL for a nonzero Size means it failed
+ * and Old is still allocated */
+void llvm_heap_profiling_realloc(unsigned Site, void *Old, void *New,
+                                 uint64_t Size) {
+  if (New == NULL && Size != 0) return;
+  llvm_heap_profiling_free(Old);
+  llvm_heap_profiling_alloc(Site, New, Size);
+}
+
+static void HeapProfAtExitHandler(void) {
+  write_profiling_data_long(HeapInfo, ArrayStart, NumElements);
+}
+
+int llvm_start_heap_profiling(int argc, const char** argv,
+                              uint64_t* arrayStart, uint64_t numElements)
+{
+  int Ret = save_arguments(argc, argv);
+  ArrayStart = arrayStart;
+  NumElements = numElements;
+  atexit(HeapProfAtExitHandler);
+  return Ret;
+}
@@ -0,0 +1,44 @@
+/*===-- IOProfiling.c - Support library for io profiling ------------------===*\
+|*
+|* This file implements the call back routines for the io profiling
+|* instrumentation pass.  This should be used with the -insert-io-profiling
+|* LLVM pass.  Every instrumented io call reads the clock before it runs, and
+|* accounts its call, bytes and elapsed nanoseconds after it returns.
+|*
+\*===----------------------------------------------------------------------===*/
+
+#include "Profiling.h"
+#include <stdlib.h>
+#include <time.h>
+
+static uint64_t *ArrayStart;
+static uint64_t NumElements;
+
+uint64_t llvm_io_profiling_clock(void) {
+  struct timespec T;
+  clock_gettime(CLOCK_MONOTONIC, &T);
+  return (uint64_t)T.tv_sec * 1000000000 + T.tv_nsec;
+}
+
+void llvm_io_profiling_trap(unsigned Index, uint64_t Bytes, uint64_t Start) {
+  uint64_t *C;
+  if (ArrayStart == NULL) return; /* executed before main */
+  C = &ArrayStart[Index * IO_FIELDS];
+  ++C[IO_CALLS];
+  C[IO_BYTES] += Bytes;
+  C[IO_NANOSEC] += llvm_io_profiling_clock() - Start;
+}
+
+static void IOProfAtExitHandler(void) {
+  write_profiling_data_long(IOInfo, ArrayStart, NumElements);
+}
+
+int llvm_start_io_profiling(int argc, const char** argv,
+                            uint64_t* arrayStart, uint64_t numElements)
+{
+  int Ret = save_arguments(argc, argv);
+  ArrayStart = arrayStart;
+  NumElements = numElements;
+  atexit(IOProfAtExitHandler);
+  return Ret;
+}
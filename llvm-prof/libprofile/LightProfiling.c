@@ -0,0 +1,28 @@
+/*===-- LightProfiling.c - Support library for light profiling ------------===*\
+|*
+|* This file implements the call back routines for the light profiling
+|* instrumentation pass.  This should be used with the -insert-light-profiling
+|* LLVM pass.  The counters are only updated inline at function entries and
+|* loop preheaders or headers, there is no trap here.
+|*
+\*===----------------------------------------------------------------------===*/
+
+#include "Profiling.h"
+#include <stdlib.h>
+
+static uint64_t *ArrayStart;
+static uint64_t NumElements;
+
+static void LightProfAtExitHandler(void) {
+  write_profiling_data_long(LightInfo, ArrayStart, NumElements);
+}
+
+int llvm_start_light_profiling(int argc, const char** argv,
+                               uint64_t* arrayStart, uint64_t numElements)
+{
+  int Ret = save_arguments(argc, argv);
+  ArrayStart = arrayStart;
+  NumElements = numElements;
+  atexit(LightProfAtExitHandler);
+  return Ret;
+}
@@ -31,14 +31,7 @@ static void MPIProfAtExitHandler(void) {
    * collected into simple edge profiles.  Since we directly count each edge, we
    * just write out all of the counters directly.
    */
-  unsigned* MapTable = ArrayStart + NumElements;
-  unsigned* VisitTable = MapTable + FORTRAN_DATATYPE_MAP_SIZE;
-  unsigned i;
-  for(i=0;i<FORTRAN_DATATYPE_MAP_SIZE;++i){
-    if(*VisitTable++ == 1 && *MapTable++ == 0)
-      fprintf(stderr, "WARNNING: doesn't consider MPI Fortran Type %d\n", i);
-  }
-  write_profiling_data(MPIFullInfo, ArrayStart, NumElements);
+  mpi_profiling_write(ArrayStart, NumElements);
 }
 
 static int init_datatype_map(uint32_t* DT)
@@ -48,6 +41,23 @@ static int init_datatype_map(uint32_t* DT)
    return 0;
 }
 
+unsigned mpi_profiling_init(unsigned *Start, unsigned NumElements) {
+  unsigned NumCounters = NumElements - FORTRAN_DATATYPE_MAP_SIZE * 2;
+  init_datatype_map(Start + NumCounters);
+  return NumCounters;
+}
+
+void mpi_profiling_write(unsigned *Start, unsigned NumCounters) {
+  unsigned* MapTable = Start + NumCounters;
+  unsigned* VisitTable = MapTable + FORTRAN_DATATYPE_MAP_SIZE;
+  unsigned i;
+  for(i=0;i<FORTRAN_DATATYPE_MAP_SIZE;++i){
+    if(*VisitTable++ == 1 && *MapTable++ == 0)
+      fprintf(stderr, "WARNNING: doesn't consider MPI Fortran Type %d\n", i);
+  }
+  write_profiling_data(MPIFullInfo, Start, NumCounters);
+}
+
 
 /* llvm_start_edge_profiling - This is the main entry point of the edge
  * profiling library.  It is responsible for setting up the atexit handler.
@@ -56,8 +66,7 @@ int llvm_start_mpi_profiling(int argc, const char **argv,
                               unsigned *arrayStart, unsigned numElements) {
   int Ret = save_arguments(argc, argv);
   ArrayStart = arrayStart;
-  NumElements = numElements - FORTRAN_DATATYPE_MAP_SIZE * 2;
-  init_datatype_map(ArrayStart + NumElements);
+  NumElements = mpi_profiling_init(ArrayStart, numElements);
   atexit(MPIProfAtExitHandler);
   return Ret;
 }
@@ -0,0 +1,38 @@
+/*===-- MemOpProfiling.c - Support library for memory op profiling --------===*\
+|*
+|* This file implements the call back routines for the memory op profiling
+|* instrumentation pass.  This should be used with the -insert-memop-profiling
+|* LLVM pass.  Every instrumented memcpy/memmove/memset adds its length to the
+|* total bytes of the call site and counts the call in one size bin.
+|*
+\*===----------------------------------------------------------------------===*/
+
+#include "Profiling.h"
+#include <stdlib.h>
+
+static uint64_t *ArrayStart;
+static uint64_t NumElements;
+
+void llvm_memop_profiling_trap(unsigned Index, uint64_t Length) {
+  uint64_t *C;
+  unsigned Bin = 0;
+  if (ArrayStart == NULL) return; /* executed before main */
+  C = &ArrayStart[Index * MEMOP_FIELDS];
+  while (Bin < MEMOP_BINS - 1 && Length > MEMOP_BIN_SIZE(Bin)) ++Bin;
+  C[MEMOP_BYTES] += Length;
+  ++C[MEMOP_BIN0 + Bin];
+}
+
+static void MemOpProfAtExitHandler(void) {
+  write_profiling_data_long(MemOpInfo, ArrayStart, NumElements);
+}
+
+int llvm_start_memop_profiling(int argc, const char** argv,
+                               uint64_t* arrayStart, uint64_t numElements)
+{
+  int Ret = save_arguments(argc, argv);
+  ArrayStart = arrayStart;
+  NumElements = numElements;
+  atexit(MemOpProfAtExitHandler);
+  return Ret;
+}
@@ -0,0 +1,29 @@
+/*===-- OpenMPProfiling.c - Support library for openmp profiling ----------===*\
+|*
+|* This file implements the call back routines for the openmp parallel region
+|* profiling instrumentation pass.  This should be used with the
+|* -insert-omp-profiling LLVM pass.  The instrumented program fills the
+|* region headers and per thread counters itself, here they are only written
+|* out.
+|*
+\*===----------------------------------------------------------------------===*/
+
+#include "Profiling.h"
+#include <stdlib.h>
+
+static uint64_t *ArrayStart;
+static uint64_t NumElements;
+
+static void OmpProfAtExitHandler(void) {
+  write_profiling_data_long(OmpInfo, ArrayStart, NumElements);
+}
+
+int llvm_start_omp_profiling(int argc, const char** argv,
+                             uint64_t* arrayStart, uint64_t numElements)
+{
+  int Ret = save_arguments(argc, argv);
+  ArrayStart = arrayStart;
+  NumElements = numElements;
+  atexit(OmpProfAtExitHandler);
+  return Ret;
+}
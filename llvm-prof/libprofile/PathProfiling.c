@@ -26,18 +26,20 @@
 #include <stdlib.h>
 #include <stdio.h>
 
-/* note that this is used for functions with large path counts,
-         but it is unlikely those paths will ALL be executed */
-#define ARBITRARY_HASH_BIN_COUNT 100
+/* initial number of slots of a hash table, it doubles when half full */
+#define INITIAL_HASH_SLOT_COUNT 64
 
-typedef struct pathHashEntry_s {
+typedef struct {
   uint32_t pathNumber;
   uint32_t pathCount;
-  struct pathHashEntry_s* next;
+  uint32_t used;
 } pathHashEntry_t;
 
+/* open addressing with linear probing, slots is a power of two */
 typedef struct pathHashTable_s {
-  pathHashEntry_t* hashBins[ARBITRARY_HASH_BIN_COUNT];
+  pathHashEntry_t* entries;
+  uint32_t slots;
+  uint32_t shift; /* 32 - log2(slots) */
   uint32_t pathCounts;
 } pathHashTable_t;
 
@@ -47,106 +49,113 @@ typedef struct {
   void* array;
 } ftEntry_t;
 
+/* the whole path packet is built here and written with one write */
+typedef struct {
+  char* data;
+  size_t size;
+  size_t capacity;
+} pathBuffer_t;
+
 /* pointer to the function table allocated in the instrumented program */
 ftEntry_t* ft;
 uint32_t ftSize;
 
-/* write an array table to file */
-void writeArrayTable(uint32_t fNumber, ftEntry_t* ft, uint32_t* funcCount) {
-  int outFile = getOutFile();
-  uint32_t arrayHeaderLocation = 0;
-  uint32_t arrayCurrentLocation = 0;
-  uint32_t arrayIterator = 0;
-  uint32_t functionUsed = 0;
-  uint32_t pathCounts = 0;
-
-  /* look through each entry in the array to determine whether the function
-     was executed at all */
-  for( arrayIterator = 0; arrayIterator < ft->size; arrayIterator++ ) {
-    uint32_t pc = ((uint32_t*)ft->array)[arrayIterator];
-
-    /* was this path executed? */
-    if( pc ) {
-      PathProfileTableEntry pte;
-      pte.pathNumber = arrayIterator;
-      pte.pathCounter = pc;
-      pathCounts++;
-
-      /* one-time initialization stuff */
-      if(!functionUsed) {
-        arrayHeaderLocation = lseek(outFile, 0, SEEK_CUR);
-        lseek(outFile, sizeof(PathProfileHeader), SEEK_CUR);
-        functionUsed = 1;
-        (*funcCount)++;
-      }
-
-      /* write path data */
-      if (write(outFile, &pte, sizeof(PathProfileTableEntry)) < 0) {
-        fprintf(stderr, "error: unable to write path entry to output file.\n");
-        return;
-      }
+static void* reserveBuffer(pathBuffer_t* buffer, size_t bytes) {
+  void* at;
+  if (buffer->size + bytes > buffer->capacity) {
+    size_t capacity = buffer->capacity ? buffer->capacity : 4096;
+    while (buffer->size + bytes > capacity) capacity *= 2;
+    buffer->data = realloc(buffer->data, capacity);
+    if (!buffer->data) {
+      fprintf(stderr, "error: out of memory for the path profile.\n");
+      exit(1);
     }
+    buffer->capacity = capacity;
   }
+  at = buffer->data + buffer->size;
+  buffer->size += bytes;
+  return at;
+}
 
-  /* If this function was executed, write the header */
-  if( functionUsed ) {
-    PathProfileHeader fHeader;
-    fHeader.fnNumber = fNumber;
-    fHeader.numEntries = pathCounts;
+static void appendEntry(pathBuffer_t* buffer, uint32_t pathNumber,
+                        uint32_t pathCounter) {
+  PathProfileTableEntry pte;
+  pte.pathNumber = pathNumber;
+  pte.pathCounter = pathCounter;
+  memcpy(reserveBuffer(buffer, sizeof(pte)), &pte, sizeof(pte));
+}
 
-    arrayCurrentLocation = lseek(outFile, 0, SEEK_CUR);
-    lseek(outFile, arrayHeaderLocation, SEEK_SET);
+static void appendHeader(pathBuffer_t* buffer, uint32_t fNumber,
+                         uint32_t numEntries) {
+  PathProfileHeader fHeader;
+  fHeader.fnNumber = fNumber;
+  fHeader.numEntries = numEntries;
+  memcpy(reserveBuffer(buffer, sizeof(fHeader)), &fHeader, sizeof(fHeader));
+}
 
-    if (write(outFile, &fHeader, sizeof(PathProfileHeader)) < 0) {
-      fprintf(stderr,
-              "error: unable to write function header to output file.\n");
-      return;
-    }
+/* write an array table to the buffer, if any of its paths was executed */
+void writeArrayTable(uint32_t fNumber, ftEntry_t* ft, uint32_t* funcCount,
+                     pathBuffer_t* buffer) {
+  uint32_t* counters = (uint32_t*)ft->array;
+  uint32_t arrayIterator = 0;
+  uint32_t pathCounts = 0;
 
-    lseek(outFile, arrayCurrentLocation, SEEK_SET);
-  }
+  /* count the executed paths first, so the header goes before them */
+  for( arrayIterator = 0; arrayIterator < ft->size; arrayIterator++ )
+    if( counters[arrayIterator] ) pathCounts++;
+  if( !pathCounts ) return;
+
+  appendHeader(buffer, fNumber, pathCounts);
+  for( arrayIterator = 0; arrayIterator < ft->size; arrayIterator++ )
+    if( counters[arrayIterator] )
+      appendEntry(buffer, arrayIterator, counters[arrayIterator]);
+  (*funcCount)++;
 }
 
-static uint32_t hash (uint32_t key) {
-  /* this may benefit from a proper hash function */
-  return key%ARBITRARY_HASH_BIN_COUNT;
+static uint32_t hash (uint32_t key, uint32_t shift) {
+  /* fibonacci hashing, the high bits of the product depend on all key bits */
+  return (key * 2654435761U) >> shift;
 }
 
-/* output a specific function's hash table to the profile file */
-void writeHashTable(uint32_t functionNumber, pathHashTable_t* hashTable) {
-  int outFile = getOutFile();
-  PathProfileHeader header;
+/* output a specific function's hash table to the buffer */
+void writeHashTable(uint32_t functionNumber, pathHashTable_t* hashTable,
+                    pathBuffer_t* buffer) {
   uint32_t i;
-
-  header.fnNumber = functionNumber;
-  header.numEntries = hashTable->pathCounts;
-
-  if (write(outFile, &header, sizeof(PathProfileHeader)) < 0) {
-    fprintf(stderr, "error: unable to write function header to output file.\n");
-    return;
+  appendHeader(buffer, functionNumber, hashTable->pathCounts);
+  for (i = 0; i < hashTable->slots; i++) {
+    pathHashEntry_t* hashEntry = &hashTable->entries[i];
+    if (hashEntry->used)
+      appendEntry(buffer, hashEntry->pathNumber, hashEntry->pathCount);
   }
+  free(hashTable->entries);
+}
 
-  for (i = 0; i < ARBITRARY_HASH_BIN_COUNT; i++) {
-    pathHashEntry_t* hashEntry = hashTable->hashBins[i];
-
-    while (hashEntry) {
-      pathHashEntry_t* temp;
-
-      PathProfileTableEntry pte;
-      pte.pathNumber = hashEntry->pathNumber;
-      pte.pathCounter = hashEntry->pathCount;
-
-      if (write(outFile, &pte, sizeof(PathProfileTableEntry)) < 0) {
-        fprintf(stderr, "error: unable to write path entry to output file.\n");
-        return;
-      }
+static pathHashEntry_t* findSlot(pathHashTable_t* hashTable,
+                                 uint32_t pathNumber) {
+  uint32_t index = hash(pathNumber, hashTable->shift);
+  while (hashTable->entries[index].used &&
+         hashTable->entries[index].pathNumber != pathNumber)
+    index = (index + 1) & (hashTable->slots - 1);
+  return &hashTable->entries[index];
+}
 
-      temp = hashEntry;
-      hashEntry = hashEntry->next;
-      free (temp);
+static void resizeHashTable(pathHashTable_t* hashTable, uint32_t slots) {
+  pathHashEntry_t* old = hashTable->entries;
+  uint32_t oldSlots = hashTable->slots;
+  uint32_t i;
 
-    }
+  hashTable->entries = calloc(slots, sizeof(pathHashEntry_t));
+  if (!hashTable->entries) {
+    fprintf(stderr, "error: out of memory for the path hash table.\n");
+    exit(1);
   }
+  hashTable->slots = slots;
+  hashTable->shift = 32;
+  while ((1U << (32 - hashTable->shift)) < slots) hashTable->shift--;
+  for (i = 0; i < oldSlots; i++)
+    if (old[i].used)
+      *findSlot(hashTable, old[i].pathNumber) = old[i];
+  free(old);
 }
 
 /* Return a pointer to this path's specific path counter */
@@ -154,27 +163,26 @@ static uint32_t* getPathCounter(uint32_t functionNumber,
                                        uint32_t pathNumber) {
   pathHashTable_t* hashTable;
   pathHashEntry_t* hashEntry;
-  uint32_t index = hash(pathNumber);
 
-  if( ft[functionNumber-1].array == 0)
-    ft[functionNumber-1].array = calloc(sizeof(pathHashTable_t), 1);
+  if( ft[functionNumber-1].array == 0) {
+    hashTable = calloc(sizeof(pathHashTable_t), 1);
+    resizeHashTable(hashTable, INITIAL_HASH_SLOT_COUNT);
+    ft[functionNumber-1].array = hashTable;
+  }
 
   hashTable = (pathHashTable_t*)((ftEntry_t*)ft)[functionNumber-1].array;
-  hashEntry = hashTable->hashBins[index];
-
-  while (hashEntry) {
-    if (hashEntry->pathNumber == pathNumber) {
-      return &hashEntry->pathCount;
-    }
-
-    hashEntry = hashEntry->next;
+  hashEntry = findSlot(hashTable, pathNumber);
+  if (hashEntry->used)
+    return &hashEntry->pathCount;
+
+  /* keep at least half of the slots empty */
+  if (2 * (hashTable->pathCounts + 1) > hashTable->slots) {
+    resizeHashTable(hashTable, hashTable->slots * 2);
+    hashEntry = findSlot(hashTable, pathNumber);
   }
-
-  hashEntry = malloc(sizeof(pathHashEntry_t));
   hashEntry->pathNumber = pathNumber;
   hashEntry->pathCount = 0;
-  hashEntry->next = hashTable->hashBins[index];
-  hashTable->hashBins[index] = hashEntry;
+  hashEntry->used = 1;
   hashTable->pathCounts++;
   return &hashEntry->pathCount;
 }
@@ -217,44 +225,46 @@ void llvm_decrement_path_count (uint32_t functionNumber, uint32_t pathNumber) {
  *  ... |       ...       |       ...       |  // entry 2.n
  *      +-----------------+-----------------+
  *
+ * The packet is built in memory first, its header is filled in there, so
+ * the file is written once and never seeked.
  */
 static void pathProfAtExitHandler(void) {
   int outFile = getOutFile();
   uint32_t i;
   uint32_t header[2] = { PathInfo, 0 };
-  uint32_t headerLocation;
-  uint32_t currentLocation;
+  pathBuffer_t buffer = { 0, 0, 0 };
+  size_t written = 0;
 
-  /* skip over the header for now */
-  headerLocation = lseek(outFile, 0, SEEK_CUR);
-  lseek(outFile, 2*sizeof(uint32_t), SEEK_CUR);
+  /* reserve the header for now */
+  reserveBuffer(&buffer, sizeof(header));
 
   /* Iterate through each function */
   for( i = 0; i < ftSize; i++ ) {
     if( ft[i].type == ProfilingArray ) {
-      writeArrayTable(i+1,&ft[i],header + 1);
+      writeArrayTable(i+1,&ft[i],header + 1,&buffer);
 
     } else if( ft[i].type == ProfilingHash ) {
-      /* If the hash exists, write it to file */
+      /* If the hash exists, write it to the buffer */
       if( ft[i].array ) {
-        writeHashTable(i+1,ft[i].array);
+        writeHashTable(i+1,ft[i].array,&buffer);
         header[1]++;
         free(ft[i].array);
       }
     }
   }
 
-  /* Setup and write the path profile header */
-  currentLocation = lseek(outFile, 0, SEEK_CUR);
-  lseek(outFile, headerLocation, SEEK_SET);
-
-  if (write(outFile, header, sizeof(header)) < 0) {
-    fprintf(stderr,
-            "error: unable to write path profile header to output file.\n");
-    return;
+  /* Setup the path profile header and write everything */
+  memcpy(buffer.data, header, sizeof(header));
+  while (written < buffer.size) {
+    ssize_t n = write(outFile, buffer.data + written, buffer.size - written);
+    if (n < 0) {
+      fprintf(stderr,
+              "error: unable to write path profile to output file.\n");
+      break;
+    }
+    written += n;
   }
-
-  lseek(outFile, currentLocation, SEEK_SET);
+  free(buffer.data);
 }
 /* llvm_start_path_profiling - This is the main entry point of the path
  * profiling library.  It is responsible for setting up the atexit handler.
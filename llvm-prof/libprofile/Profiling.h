@@ -38,4 +38,13 @@ void write_profiling_data_long(enum ProfilingType PT, uint64_t* Start,
 //add by haomeng
 void write_profiling_data_double(enum ProfilingType PT, double* Start,
                                uint64_t NumElements);
+void write_time_rank_profiling_data_double(enum ProfilingType PT, double* Start,
+                          uint64_t NumElements, int* StartRank, int NumRankElements);
+
+/* mpi_profiling_init - Fill the datatype map behind the mpi counters, return
+ * the number of counters.  mpi_profiling_write checks the map and writes the
+ * counters.
+ */
+unsigned mpi_profiling_init(unsigned *Start, unsigned NumElements);
+void mpi_profiling_write(unsigned *Start, unsigned NumCounters);
 #endif
@@ -0,0 +1,95 @@
+/*===-- SampledEdgeProfiling.c - Support for sampled edge profiling -------===*\
+|*
+|*                     The LLVM Compiler Infrastructure
+|*
+|* This file is distributed under the University of Illinois Open Source
+|* License. See LICENSE.TXT for details.
+|*
+|*===----------------------------------------------------------------------===*|
+|*
+|* This file implements the call back routines for the bursty sampled edge
+|* profiling instrumentation pass.  This should be used with the
+|* -insert-sampled-edge-profiling LLVM pass.
+|*
+|* Every check in the instrumented program decrements llvm_sample_countdown;
+|* when it reaches zero llvm_sample_switch toggles llvm_sample_active.  Out of
+|* every LLVM_PROF_SAMPLE_INTERVAL checks, LLVM_PROF_SAMPLE_BURST are spent in
+|* the counting code.
+|*
+\*===----------------------------------------------------------------------===*/
+
+#include "Profiling.h"
+#include <stdlib.h>
+
+uint32_t llvm_sample_countdown = 1;
+uint32_t llvm_sample_active = 0;
+
+static uint64_t *ArrayStart;
+static uint64_t NumElements;
+static uint32_t SampleInterval = 10000;
+static uint32_t SampleBurst = 100;
+/* Checks executed in finished periods: [0] in total, [1] while counting. */
+static uint64_t SampleChecks[2];
+
+static uint32_t read_env_count(const char *Name, uint32_t Default) {
+  const char *Value = getenv(Name);
+  unsigned long N;
+  if (Value == NULL) return Default;
+  N = strtoul(Value, NULL, 10);
+  return N ? (uint32_t)N : Default;
+}
+
+/* llvm_sample_switch - Called by the instrumented code when the countdown
+ * expires.  Accounts the finished period and starts the next one.
+ */
+void llvm_sample_switch(void) {
+  if (llvm_sample_active) {
+    SampleChecks[0] += SampleBurst;
+    SampleChecks[1] += SampleBurst;
+    if (SampleInterval > SampleBurst) {
+      llvm_sample_active = 0;
+      llvm_sample_countdown = SampleInterval - SampleBurst;
+    } else
+      llvm_sample_countdown = SampleBurst;
+  } else {
+    SampleChecks[0] += SampleInterval - SampleBurst;
+    llvm_sample_active = 1;
+    llvm_sample_countdown = SampleBurst;
+  }
+}
+
+/* SampledEdgeProfAtExitHandler - When the program exits, account the
+ * unfinished period and write out the sampling ratio and the counters.
+ */
+static void SampledEdgeProfAtExitHandler(void) {
+  uint32_t Period = llvm_sample_active ? SampleBurst
+                                       : SampleInterval - SampleBurst;
+  uint64_t Done = Period - llvm_sample_countdown;
+  SampleChecks[0] += Done;
+  if (llvm_sample_active) SampleChecks[1] += Done;
+
+  write_profiling_data_long(SampleInfo, SampleChecks, 2);
+  write_profiling_data_long(EdgeInfo64, ArrayStart, NumElements);
+}
+
+/* llvm_start_sampled_edge_profiling - This is the main entry point of the
+ * sampled edge profiling library.  It reads the sampling period from the
+ * environment and sets up the atexit handler.
+ */
+int llvm_start_sampled_edge_profiling(int argc, const char **argv,
+                                      uint64_t *arrayStart,
+                                      uint64_t numElements) {
+  int Ret = save_arguments(argc, argv);
+  ArrayStart = arrayStart;
+  NumElements = numElements;
+
+  SampleInterval = read_env_count("LLVM_PROF_SAMPLE_INTERVAL", SampleInterval);
+  SampleBurst = read_env_count("LLVM_PROF_SAMPLE_BURST", SampleBurst);
+  if (SampleBurst > SampleInterval) SampleBurst = SampleInterval;
+  llvm_sample_active = SampleInterval == SampleBurst;
+  llvm_sample_countdown = llvm_sample_active ? SampleBurst
+                                             : SampleInterval - SampleBurst;
+
+  atexit(SampledEdgeProfAtExitHandler);
+  return Ret;
+}
@@ -0,0 +1,57 @@
+/*===-- StrideProfiling.c - Support library for stride profiling ----------===*\
+|*
+|* This file implements the call back routines for the stride profiling
+|* instrumentation pass.  This should be used with the -insert-stride-profiling
+|* LLVM pass.  For every instrumented load/store it keeps the last address and
+|* the last stride, and counts each execution in one of the StrideBins.
+|*
+\*===----------------------------------------------------------------------===*/
+
+#include "Profiling.h"
+#include <stdlib.h>
+
+struct StrideHistory {
+  uintptr_t Last;   /* address of previous execution, 0 if none */
+  intptr_t  Stride; /* stride of previous execution */
+};
+
+static uint64_t *ArrayStart;
+static uint64_t NumElements;
+static struct StrideHistory *History;
+
+void llvm_stride_profiling_trap(unsigned Index, void *Addr, unsigned Size) {
+  struct StrideHistory *H;
+  if (History == NULL) return; /* executed before main */
+  H = &History[Index];
+  if (H->Last != 0) {
+    intptr_t Stride = (intptr_t)((uintptr_t)Addr - H->Last);
+    uintptr_t Dist = Stride < 0 ? -(uintptr_t)Stride : (uintptr_t)Stride;
+    enum StrideBins Bin;
+    if (Dist <= Size)
+      Bin = STRIDE_UNIT;
+    else if (Stride == H->Stride)
+      Bin = Dist < STRIDE_SMALL_LIMIT ? STRIDE_SMALL : STRIDE_LARGE;
+    else
+      Bin = STRIDE_IRREGULAR;
+    ++ArrayStart[Index * STRIDE_BINS + Bin];
+    H->Stride = Stride;
+  }
+  H->Last = (uintptr_t)Addr;
+}
+
+static void StrideProfAtExitHandler(void) {
+  write_profiling_data_long(StrideInfo, ArrayStart, NumElements);
+  free(History);
+  History = NULL;
+}
+
+int llvm_start_stride_profiling(int argc, const char** argv,
+                                uint64_t* arrayStart, uint64_t numElements)
+{
+  int Ret = save_arguments(argc, argv);
+  ArrayStart = arrayStart;
+  NumElements = numElements;
+  History = calloc(numElements / STRIDE_BINS + 1, sizeof(struct StrideHistory));
+  atexit(StrideProfAtExitHandler);
+  return Ret;
+}
@@ -10,6 +10,8 @@
 #include <sys/time.h>
 #include <float.h>
 #include <complex.h>
+#include <string.h>
+#include "ProfileDataTypes.h"
 
 #define REPNUM 20000
 #define INTREP 100
@@ -65,6 +67,29 @@
       uint64_t cycle = median(sum, REPNUM);                                    \
       printf(#FUNC ":\t%lf nanoseconds,\t%lu cycles\n", cycle* res, cycle);    \
    }
+/* time FUNC(dst, SRC, len) at the size of every memop bin */
+#define MEMREPNUM 200
+#define REPEATMEM(FUNC, SRC)                                                   \
+   {                                                                           \
+      unsigned b, i, j;                                                        \
+      for (b = 0; b < MEMOP_BINS; ++b) {                                       \
+         size_t len = MEMOP_BIN_SIZE(b);                                       \
+         for (i = 0; i < MEMREPNUM; ++i) {                                     \
+            beg = timing();                                                    \
+            for (j = 0; j < INTREP; ++j) {                                     \
+               FUNC(membuf[0], SRC, len);                                      \
+            }                                                                  \
+            end = timing();                                                    \
+            sum[i] = (end - beg) / INTREP;                                     \
+         }                                                                     \
+         uint64_t cycle = median(sum, MEMREPNUM);                              \
+         printf(#FUNC "_%lu:\t%lf nanoseconds,\t%lu cycles\n",                 \
+                (unsigned long)len, cycle* res, cycle);                        \
+      }                                                                        \
+   }
+
+static char membuf[2][MEMOP_BIN_SIZE(MEMOP_BINS - 1)];
+
 static double double_rand(){
    struct timeval t = {0};
    gettimeofday(&t, NULL);
@@ -103,5 +128,8 @@ int main()
    REPEATCABS(cabs);
 #undef PARAASSIGN
 #undef PARALIST
+   REPEATMEM(memcpy, membuf[1]);
+   REPEATMEM(memmove, membuf[1]);
+   REPEATMEM(memset, (int)b);
    return 0;
 }
@@ -72,7 +72,7 @@
  *          ...
  *          for(unsigned i=0;i<Sources.size();++i)
  *          {
- *  ------------Sources[i]->init_with_file(Files[i].c_str());
+ *  ------------Sources[i]->init_with_file(Files[i].c_str(), Error);
  *  |            ...
  *  |       }
  *  |   }
@@ -80,17 +80,9 @@
  *  |
  *  |
  *  |   At TimingSource.cpp class TimingSource
- *  --->init_with_file(const char* file)
+ *  --->init_with_file(const char* file, std::string& Error)
  *      {
- *  --------init(std::bind(file_initializer,file,std::placeholders::_1));
- *  |   }
- *  |
- *  |
- *  |
- *  |   At TimingSource.cpp class TimingSource
- *  --->init(std::function<void(double*)> func)
- *      {
- *          func(params.data());
+ *          return file_initializer(file, params.data(), Error);
  *      }
  *
  *
@@ -112,20 +104,15 @@
 #include <llvm/IR/LLVMContext.h>
 #include <llvm/Support/Signals.h>
 #include <llvm/Support/CommandLine.h>
-#include <llvm/Bitcode/ReaderWriter.h>
-#include <llvm/Support/MemoryBuffer.h>
+#include <llvm/Support/Format.h>
+#include <cmath>
+#include <glob.h>
+#include <memory>
+#include <thread>
 #include <llvm/Support/ManagedStatic.h>
 #include <llvm/Support/PrettyStackTrace.h>
 #include "passes.h"
-
-#if LLVM_VERSION_MAJOR == 3 && LLVM_VERSION_MINOR == 4
-#include <llvm/Support/system_error.h>
-#include <llvm/ADT/OwningPtr.h>
-#else
-#include <system_error>
-#include <memory>
-#define OwningPtr unique_ptr
-#endif
+#include "server.h"
 
 #define Require3rdArg(errstr) if(MergeFile.size()==0){\
         errs()<<errstr<<"\n";\
@@ -139,7 +126,7 @@ using namespace std;
 namespace {
   cl::opt<std::string>
   BitcodeFile(cl::Positional, cl::desc("<program bitcode file>"),
-              cl::Required);
+              cl::Optional);
 
   cl::opt<std::string>
   ProfileDataFile(cl::Positional, cl::desc("<llvmprof.out file>"),
@@ -147,6 +134,21 @@ namespace {
 
   cl::opt<bool> DiffMode("diff",cl::desc("Compare two out file"));
   cl::opt<bool> CommMode("print-comm-size",cl::desc("Print the comm size of every communication operation"));
+  cl::opt<bool> HeapFit("heap-fit",cl::desc("Fit the heap peak of every allocation site against MPI_SIZE of the out files"));
+  cl::opt<bool> TraceStats("trace-stats",cl::desc("Print block transitions, loop iterations and reuse intervals of the block trace"));
+  cl::opt<bool> CommMatrix("comm-matrix",cl::desc("Aggregate the communication matrix of every rank's out file"));
+  cl::opt<bool> Server("server",cl::desc("Keep modules, timing sources and profiles loaded and answer requests line by line from stdin, or the clients of -server-socket"));
+  cl::opt<std::string> ServerSocket("server-socket", cl::value_desc("path"),
+        cl::desc("Unix socket -server listens on"), cl::init(""));
+  cl::list<std::string> Batch("batch", cl::value_desc("glob"), cl::ZeroOrMore,
+        cl::desc("Evaluate every profile matching the glob against the bitcode, one row per profile"));
+  enum BatchFormat { BATCH_CSV, BATCH_JSON };
+  cl::opt<BatchFormat> BatchOutput("batch-format",
+        cl::desc("Layout of the rows printed by -batch"), cl::values(
+        clEnumValN(BATCH_CSV, "csv", "a header line, then comma separated values"),
+        clEnumValN(BATCH_JSON, "json", "a json object per line"),
+        clEnumValEnd),
+     cl::init(BATCH_CSV));
 
   static void printHelpStr(StringRef HelpStr, size_t Indent,
         size_t FirstLineIndentedBy) {
@@ -190,18 +192,147 @@ namespace {
   enum MergeAlgo {
      MERGE_NONE,
      MERGE_SUM,
-     MERGE_AVG
+     MERGE_AVG,
+     MERGE_MIN,
+     MERGE_MAX,
+     MERGE_STDDEV,
+     MERGE_ARGMAX,
+     MERGE_STATS
   };
   cl::opt<MergeAlgo> Merge("merge",cl::desc("Merge the Profile info"), cl::values(
         clEnumValN(MERGE_NONE, "none", "do not merge"),
         clEnumValN(MERGE_SUM, "sum", "cacluate sum of total"),
         clEnumValN(MERGE_AVG, "avg", "caculate averange of total"),
+        clEnumValN(MERGE_MIN, "min", "minimum of every counter"),
+        clEnumValN(MERGE_MAX, "max", "maximum of every counter, the critical profile"),
+        clEnumValN(MERGE_STDDEV, "stddev", "standard deviation of every counter"),
+        clEnumValN(MERGE_ARGMAX, "argmax", "rank holding the maximum of every counter"),
+        clEnumValN(MERGE_STATS, "stats", "all of them, into <output>.sum, .mean, .min, .max, .stddev and .argmax"),
         clEnumValEnd), 
      cl::init(MERGE_NONE));
 
+  cl::opt<unsigned> MergeJobs("merge-jobs",
+        cl::desc("Number of threads loading and summing the merged files"),
+        cl::init(std::max(1u, std::thread::hardware_concurrency())));
+
   cl::list<std::string> MergeFile(cl::Positional,cl::desc("<Merge file list>"),cl::ZeroOrMore);
 
   cl::opt<bool> Convert("to-block", cl::desc("Convert Profiling Types to BasicBlockInfo Type"));
+  cl::opt<ProfileFormat> OutputFormat("profile-format",
+        cl::desc("Layout of the file written by -to-block"), cl::values(
+        clEnumValN(ProfileFlat, "flat", "a stream of packets matched by position"),
+        clEnumValN(ProfileIndexed, "indexed", "a table of contents and a record per function"),
+        clEnumValEnd),
+     cl::init(ProfileFlat));
+}
+
+// defined by the printer, a column of -batch too
+extern cl::opt<bool> InstNumber;
+
+// expandProfiles - the files matching the -batch globs, each glob sorted. a
+// glob matching nothing is kept as the file name.
+static std::vector<std::string> expandProfiles()
+{
+   std::vector<std::string> Files;
+   for(const std::string& Pattern : Batch){
+      glob_t G;
+      if(glob(Pattern.c_str(), GLOB_NOCHECK, NULL, &G) == 0)
+         Files.insert(Files.end(), G.gl_pathv, G.gl_pathv + G.gl_pathc);
+      globfree(&G);
+   }
+   return Files;
+}
+
+// printQuoted - Str as a quoted csv field or json string.
+static void printQuoted(raw_ostream& O, StringRef Str, bool JSON)
+{
+   O << '"';
+   for(char C : Str){
+      if(C == '"') O << (JSON ? "\\\"" : "\"\"");
+      else if(JSON && C == '\\') O << "\\\\";
+      else if(JSON && (unsigned char)C < 0x20) O << format("\\u%04x", C);
+      else O << C;
+   }
+   O << '"';
+}
+
+// printBatchRow - a row of -batch, after the header of its columns for the
+// first csv row.
+static void printBatchRow(const std::string& Profile,
+      const std::vector<std::pair<std::string, double> >& Row, bool First)
+{
+   raw_ostream& O = outs();
+   if(BatchOutput == BATCH_JSON){
+      O << "{\"profile\":";
+      printQuoted(O, Profile, true);
+      for(auto& C : Row){
+         O << ",\"" << C.first << "\":";
+         if(std::isfinite(C.second)) O << format("%.17g", C.second);
+         else O << "null";
+      }
+      O << "}\n";
+      return;
+   }
+   if(First){
+      O << "profile";
+      for(auto& C : Row) O << "," << C.first;
+      O << "\n";
+   }
+   printQuoted(O, Profile, false);
+   for(auto& C : Row) O << "," << format("%.17g", C.second);
+   O << "\n";
+}
+
+// runBatch - evaluate every -batch profile against M. the module is parsed
+// and the timing sources are loaded once, each profile only runs its loader
+// and a ProfileBatchRow.
+static int runBatch(Module& M)
+{
+   if(Timing.size() == 0 && !InstNumber && !CommMode){
+      errs() << "-batch needs -timing, -inst-number or -print-comm-size\n";
+      return 1;
+   }
+   // the profiles come from -batch, the positionals after the bitcode are
+   // all timing source files
+   std::vector<std::string> SourceFiles;
+   if(ProfileDataFile.getNumOccurrences())
+      SourceFiles.push_back(ProfileDataFile);
+   SourceFiles.insert(SourceFiles.end(), MergeFile.begin(), MergeFile.end());
+
+   std::unique_ptr<ProfileTimingPrint> TimingPass;
+   PacketMask Wanted = CountPackets();
+   if(Timing.size() != 0){
+      if(SourceFiles.empty()){
+         errs() << "no timing source file\n";
+         return 1;
+      }
+      TimingPass.reset(new ProfileTimingPrint(std::move(Timing.getValue()), SourceFiles));
+      if(TimingPass->hasError()){
+         errs() << TimingPass->getError() << "\n";
+         return 1;
+      }
+      Wanted = Wanted | ProfileTimingPrint::wantedPackets();
+   }
+   if(CommMode)
+      Wanted = Wanted | ProfileInfoComm::wantedPackets();
+
+   bool First = true;
+   for(const std::string& Profile : expandProfiles()){
+      // a bad file only costs its row, the loader pass would exit instead
+      ProfileInfoLoader PIL("llvm-prof", Profile, Wanted);
+      if(PIL.hasError()){
+         errs() << "WARNING: " << PIL.getError() << ", skipped\n";
+         continue;
+      }
+      std::vector<std::pair<std::string, double> > Row;
+      PassManager PassMgr;
+      PassMgr.add(createProfileLoaderPass(PIL));
+      PassMgr.add(new ProfileBatchRow(TimingPass.get(), InstNumber, CommMode, Row));
+      PassMgr.run(M);
+      printBatchRow(Profile, Row, First);
+      First = false;
+   }
+   return 0;
 }
 
 namespace llvm {
@@ -213,14 +344,6 @@ namespace cl{
 }
 }
 
-struct AvgAcc{
-   size_t N;
-   unsigned operator()(unsigned Lhs, unsigned Rhs){ 
-      ++N;
-      return Lhs+Rhs;
-   }
-};
-
 int main(int argc, char **argv) {
   // Print a stack trace if we signal out.
   sys::PrintStackTraceOnErrorSignal();
@@ -231,18 +354,44 @@ int main(int argc, char **argv) {
   
   cl::ParseCommandLineOptions(argc, argv, "llvm profile dump decoder\n");
 
+  if(Server) {
+     ProfileServer S(Context);
+     if(!ServerSocket.empty())
+        return S.listen(ServerSocket);
+     S.serve(stdin, outs());
+     return 0;
+  }
+  if(BitcodeFile.empty()) {
+     errs() << argv[0] << ": no bitcode file given\n";
+     return 1;
+  }
+
   // Read in the bitcode file...
   std::string ErrorMessage;
-  error_code ec;
   Module *M = 0;
   if(DiffMode) {
      ProfileInfoLoader PIL1(argv[0], BitcodeFile);
      ProfileInfoLoader PIL2(argv[0], ProfileDataFile);
-     
+     for(const ProfileInfoLoader* PIL : {&PIL1, &PIL2})
+        if(PIL->hasError()){
+           errs() << argv[0] << ": " << PIL->getError() << "\n";
+           return 1;
+        }
+
      ProfileInfoCompare Compare(PIL1,PIL2);
      Compare.run();
      return 0;
   }
+  if(CommMatrix) {
+     /** every positional argument is a rank's out file **/
+     std::vector<std::string> Files(1, BitcodeFile);
+     if(ProfileDataFile.getNumOccurrences())
+        Files.push_back(ProfileDataFile);
+     Files.insert(Files.end(), MergeFile.begin(), MergeFile.end());
+     ProfileInfoCommMatrix Matrix(Files);
+     Matrix.run();
+     return 0;
+  }
   if(Merge != MERGE_NONE) {
      /** argument alignment: 
       *  BitcodeFile ProfileDataFile MergeFile 
@@ -256,55 +405,48 @@ int main(int argc, char **argv) {
         return 0;
      }
 
-     //Initialize the ProfileInfoMerge class using one of merge files
-     ProfileInfoLoader AHS(argv[0], MergeFile.back());
-     ProfileInfoMerge MergeClass(std::string(argv[0]), BitcodeFile, AHS);
-
-     for (std::vector<std::string>::iterator merIt = MergeFile.begin(),
-                                             END = MergeFile.end() - 1;
-          merIt != END; ++merIt) {
-        //errs()<<*merIt<<"\n";
-       ProfileInfoLoader THS(argv[0], *merIt);
-       MergeClass.addProfileInfo(THS);
-     }
-     if (Merge == MERGE_SUM) {
-       MergeClass.writeTotalFile();
-     } else if (Merge == MERGE_AVG) {
-       /** avg = sum/N **/
-       MergeClass.writeTotalFile(
-           std::bind2nd(std::divides<unsigned>(), MergeFile.size()));
-     }
-     return 0;
+     ProfileInfoMerge MergeClass(std::string(argv[0]), BitcodeFile);
+     if(!MergeClass.addProfileFiles(MergeFile, MergeJobs))
+        return 1;
+     static const MergeStat Stats[] = {
+        MergeSum, MergeSum, MergeMean, MergeMin, MergeMax, MergeStddev, MergeArgMax
+     };
+     bool Written = true;
+     if (Merge == MERGE_STATS) {
+       const char* Suffix[] = {"", ".sum", ".mean", ".min", ".max", ".stddev", ".argmax"};
+       for (unsigned i = MERGE_SUM; i < MERGE_STATS; ++i)
+          Written &= MergeClass.writeTotalFile(Stats[i], std::string(BitcodeFile) + Suffix[i]);
+     } else
+       Written = MergeClass.writeTotalFile(Stats[Merge]);
+     return Written ? 0 : 1;
   }
-#if LLVM_VERSION_MAJOR==3 && LLVM_VERSION_MINOR==4
-  OwningPtr<MemoryBuffer> Buffer;
-  if (!(ec = MemoryBuffer::getFileOrSTDIN(BitcodeFile, Buffer.get()))) {
-     M = ParseBitcodeFile(Buffer.get(), Context, &ErrorMessage);
-  } else
-     ErrorMessage = ec.message();
-
-#else
-
-  auto Buffer = MemoryBuffer::getFileOrSTDIN(BitcodeFile);
-  if (!(ec = Buffer.getError())){
-     auto R = parseBitcodeFile(&**Buffer, Context);
-     if(R.getError()){
-        M = NULL;
-        ErrorMessage = R.getError().message();
-     }else
-        M = R.get();
-  } else
-     ErrorMessage = ec.message();
-#endif
+  M = loadModule(BitcodeFile, Context, ErrorMessage);
   if (M == 0) {
      errs() << argv[0] << ": " << BitcodeFile << ": "
         << ErrorMessage << "\n";
      return 1;
   }
 
-  // Run the printer pass.
+  if(!Batch.empty())
+     return runBatch(*M);
+
+  // The trace is streamed from the file by the pass itself.
+  if(TraceStats) {
+     PassManager TracePM;
+     TracePM.add(new ProfileTraceStats(ProfileDataFile));
+     TracePM.run(*M);
+     return 0;
+  }
+
+  // Run the printer pass.  The loader only reads the packets the mode asks
+  // for.
+  PacketMask Wanted = CommMode ? ProfileInfoComm::wantedPackets()
+                    : Convert ? ProfileInfoConverter::wantedPackets()
+                    : HeapFit ? ProfileHeapFit::wantedPackets()
+                    : Timing.size() != 0 ? ProfileTimingPrint::wantedPackets()
+                    : ProfileInfoPrinterPass::wantedPackets();
   PassManager PassMgr;
-  PassMgr.add(createProfileLoaderPass(ProfileDataFile));
+  PassMgr.add(createProfileLoaderPass(ProfileDataFile, Wanted));
 
   if(CommMode) {
      PassMgr.add(new ProfileInfoComm());
@@ -313,17 +455,32 @@ int main(int argc, char **argv) {
   }
   if(Convert){
      Require3rdArg("no output file");
-     ProfileInfoWriter PIW(argv[0], MergeFile.front());
+     ProfileInfoWriter PIW(argv[0], MergeFile.front(), OutputFormat);
      PassMgr.add(new ProfileInfoConverter(PIW));
+  }else if(HeapFit){
+     std::vector<std::string> Files(1, ProfileDataFile);
+     Files.insert(Files.end(), MergeFile.begin(), MergeFile.end());
+     PassMgr.add(new ProfileHeapFit(Files));
   }else if(Timing.size() != 0){
      Require3rdArg("no timing source file");
-     PassMgr.add(new ProfileTimingPrint(std::move(Timing.getValue()), MergeFile));
+     ProfileTimingPrint* TimingPass =
+        new ProfileTimingPrint(std::move(Timing.getValue()), MergeFile);
+     if(TimingPass->hasError()){
+        errs() << argv[0] << ": " << TimingPass->getError() << "\n";
+        delete TimingPass;
+        return 1;
+     }
+     PassMgr.add(TimingPass);
   }else{
      // Read the profiling information. This is redundant since we load it again
      // using the standard profile info provider pass, but for now this gives us
      // access to additional information not exposed via the ProfileInfo
-     // interface.
-     ProfileInfoLoader PIL(argv[0], ProfileDataFile);
+     // interface.  Only its command lines are used.
+     ProfileInfoLoader PIL(argv[0], ProfileDataFile, PacketMask());
+     if(PIL.hasError()){
+        errs() << argv[0] << ": " << PIL.getError() << "\n";
+        return 1;
+     }
      PassMgr.add(new ProfileInfoPrinterPass(PIL));
   }
   PassMgr.run(*M);
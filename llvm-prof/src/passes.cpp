@@ -43,11 +43,18 @@
  */
 #include "passes.h"
 #include <ProfileInfo.h>
+#include <ProfileInfoLoader.h>
 #include <llvm/IR/Module.h>
+#include <llvm/Analysis/LoopInfo.h>
 #include <llvm/Support/CommandLine.h>
+#include <map>
+#include <unordered_map>
 #include <fstream>
 #include <iterator>
+#include <algorithm>
 #include <float.h>
+#include <cmath>
+#include <llvm/Support/Format.h>
 #include "ValueUtils.h"
 
 using namespace llvm;
@@ -59,9 +66,27 @@ namespace {
    cl::opt<std::string> TimingIgnore("timing-ignore",
                                      cl::desc("ignore list for timing mode"),
                                      cl::init(""));
+   cl::opt<std::string> CriticalProfile("critical-profile",
+         cl::desc("compare the timing with the one of this profile, such as the -merge=max of all ranks"),
+         cl::init(""));
+   cl::opt<unsigned> TraceTop("trace-top",
+         cl::desc("number of block transitions printed by -trace-stats"),
+         cl::init(20));
 };
 
 char ProfileInfoConverter::ID = 0;
+
+PacketMask llvm::CountPackets()
+{
+   return PacketTypes({FunctionInfo, BlockInfo, EdgeInfo, OptEdgeInfo,
+         BlockInfo64, EdgeInfo64, BlockInfoDouble, SampleInfo, LightInfo,
+         CFGInfo});
+}
+
+PacketMask ProfileInfoConverter::wantedPackets()
+{
+   return CountPackets();
+}
 void ProfileInfoConverter::getAnalysisUsage(AnalysisUsage &AU) const
 {
    AU.addRequired<ProfileInfo>();
@@ -72,6 +97,19 @@ bool ProfileInfoConverter::runOnModule(Module &M)
 {
    ProfileInfo& PI = getAnalysis<ProfileInfo>();
 
+   if(Writer.getFormat() == ProfileIndexed){
+      // a record per function, found by its name instead of its position
+      std::vector<uint64_t> Counters;
+      for (Module::iterator F = M.begin(), E = M.end(); F != E; ++F) {
+         if (F->isDeclaration()) continue;
+         Counters.clear();
+         for (Function::iterator BB = F->begin(), E = F->end(); BB != E; ++BB)
+            Counters.push_back(PI.getExecutionCount(BB));
+         Writer.write(BlockInfo64, F->getName().str(), Counters);
+      }
+      return false;
+   }
+
    std::vector<unsigned> Counters;
    for (Module::iterator F = M.begin(), E = M.end(); F != E; ++F) {
       if (F->isDeclaration()) continue;
@@ -89,11 +127,11 @@ bool ProfileInfoConverter::runOnModule(Module &M)
 bool ProfileInfoCompare::run()
 {
 #define CRITICAL_EQUAL(what) if(Lhs.get##what() != Rhs.get##what()){\
-      errs()<<#what" differ\n";\
+      Out<<#what" differ\n";\
       return 0;\
    }
 #define WARN_EQUAL(what) if(Lhs.getRaw##what() != Rhs.getRaw##what()){\
-      errs()<<#what" differ\n";\
+      Out<<#what" differ\n";\
    }
 
    CRITICAL_EQUAL(NumExecutions);
@@ -105,14 +143,57 @@ bool ProfileInfoCompare::run()
    if(Lhs.getRawValueCounts().size() == Rhs.getRawValueCounts().size()){
       for(uint i=0;i<Lhs.getRawValueCounts().size();++i){
          if(Lhs.getRawValueContent(i) != Rhs.getRawValueContent(i))
-            errs()<<"ValueContent at "<<i<<" differ\n";
+            Out<<"ValueContent at "<<i<<" differ\n";
       }
    }
    return 0;
 #undef CRITICAL_EQUAL
 }
 
+// sum the matrix rows of every rank into one global matrix, print it sparse
+// as source, destination, messages and bytes, followed by the total per rank
+bool ProfileInfoCommMatrix::run()
+{
+   std::vector<uint64_t> Global;
+   for(auto& File : Files){
+      ProfileInfoLoader PIL("llvm-prof", File, PacketTypes({CommInfo}));
+      if(PIL.hasError()){
+         errs()<<"WARNING: "<<PIL.getError()<<", skipped\n";
+         continue;
+      }
+      if(PIL.getRawCommCounts().empty())
+         errs()<<"WARNING: "<<File<<" has no communication matrix\n";
+      MergeCommCounts(PIL.getRawCommCounts(), Global);
+   }
+
+   std::map<uint64_t, std::pair<uint64_t, uint64_t> > Sent, Received;
+   outs()<<"Src\tDest\tMessages\tBytes\n";
+   for(size_t i = 0; i + COMM_FIELDS <= Global.size(); i += COMM_FIELDS){
+      uint64_t Msgs = Global[i+COMM_MESSAGES], Bytes = Global[i+COMM_BYTES];
+      outs()<<Global[i+COMM_SRC]<<"\t"<<Global[i+COMM_DEST]<<"\t"
+         <<Msgs<<"\t"<<Bytes<<"\n";
+      Sent[Global[i+COMM_SRC]].first += Msgs;
+      Sent[Global[i+COMM_SRC]].second += Bytes;
+      Received[Global[i+COMM_DEST]].first += Msgs;
+      Received[Global[i+COMM_DEST]].second += Bytes;
+   }
+
+   std::set<uint64_t> Ranks;
+   for(auto& S : Sent) Ranks.insert(S.first);
+   for(auto& R : Received) Ranks.insert(R.first);
+   outs()<<"\nRank\tSent Messages\tSent Bytes\tReceived Messages\tReceived Bytes\n";
+   for(uint64_t R : Ranks){
+      outs()<<R<<"\t"<<Sent[R].first<<"\t"<<Sent[R].second<<"\t"
+         <<Received[R].first<<"\t"<<Received[R].second<<"\n";
+   }
+   return 0;
+}
+
 char ProfileInfoComm::ID = 0;
+PacketMask ProfileInfoComm::wantedPackets()
+{
+   return CountPackets() | PacketTypes({MPInfo, MPIFullInfo});
+}
 void ProfileInfoComm::getAnalysisUsage(AnalysisUsage &AU) const
 {
    AU.setPreservesAll();
@@ -143,16 +224,366 @@ bool ProfileInfoComm::runOnModule(Module &M)
 }
 
 
+char ProfileHeapFit::ID = 0;
+
+// HeapModel - y = a + b * X(P) of peak bytes y against process number P
+struct HeapModel {
+   const char* Name;
+   double (*X)(double);
+};
+static const HeapModel HeapModels[] = {
+   {"a"         , [](double) { return 0.; }}           ,
+   {"a+b*P"     , [](double P) { return P; }}          ,
+   {"a+b/P"     , [](double P) { return 1 / P; }}      ,
+   {"a+b*log2P" , [](double P) { return log2(P); }}    ,
+   {"a+b*sqrtP" , [](double P) { return sqrt(P); }}
+};
+
+// fitHeapModel - least squares fit of every HeapModel to Points, return the
+// one with the smallest residual and set its A, B
+static const HeapModel& fitHeapModel(const std::map<double, double>& Points,
+      double& A, double& B)
+{
+   const HeapModel* Best = &HeapModels[0];
+   double BestSSE = DBL_MAX;
+   for(const HeapModel& Model : HeapModels){
+      double N = Points.size(), SX = 0, SY = 0, SXX = 0, SXY = 0;
+      for(auto& P : Points){
+         double X = Model.X(P.first);
+         SX += X; SY += P.second; SXX += X*X; SXY += X*P.second;
+      }
+      double D = N*SXX - SX*SX;
+      double b = fabs(D) > DBL_EPSILON ? (N*SXY - SX*SY) / D : 0;
+      double a = (SY - b*SX) / N, SSE = 0;
+      for(auto& P : Points){
+         double E = a + b*Model.X(P.first) - P.second;
+         SSE += E*E;
+      }
+      // a better fit must beat the simpler model clearly
+      if(SSE < BestSSE * (1 - 1e-6)){
+         Best = &Model; BestSSE = SSE; A = a; B = b;
+      }
+   }
+   return *Best;
+}
+
+// the heap packets are loaded from every file by runOnModule itself
+PacketMask ProfileHeapFit::wantedPackets()
+{
+   return PacketMask();
+}
+
+// fit the peak bytes of every allocation site against the process number of
+// the profiled runs, the largest rank of a run counts. predict MPI_SIZE.
+bool ProfileHeapFit::runOnModule(Module& M)
+{
+   char* REnv = getenv("MPI_SIZE");
+   if(REnv == NULL){
+      errs()<<"please set environment MPI_SIZE to the predicted scale\n";
+      exit(-1);
+   }
+   double Target = atoi(REnv);
+
+   std::vector<CallInst*> Sites = lle::get_heap_alloc_calls(M);
+   std::vector<std::map<double, double> > SitePeaks(Sites.size());
+   std::map<double, double> TotalPeaks;
+   for(auto& File : Files){
+      ProfileInfoLoader PIL("llvm-prof", File, PacketTypes({HeapInfo}));
+      if(PIL.hasError()){
+         errs()<<"WARNING: "<<PIL.getError()<<", skipped\n";
+         continue;
+      }
+      const std::vector<uint64_t>& C = PIL.getRawHeapCounts();
+      if(C.size() != HEAP_HEADER + Sites.size() * HEAP_FIELDS){
+         errs()<<"WARNING: "<<File<<" has no heap profile of the current program\n";
+         continue;
+      }
+      double P = C[HEAP_NPROCS] ? C[HEAP_NPROCS] : 1;
+      TotalPeaks[P] = std::max(TotalPeaks[P], (double)C[HEAP_TOTAL_PEAK]);
+      for(unsigned s = 0; s < Sites.size(); ++s)
+         SitePeaks[s][P] = std::max(SitePeaks[s][P],
+               (double)C[HEAP_HEADER + s*HEAP_FIELDS + HEAP_PEAK]);
+   }
+   if(TotalPeaks.empty()) return false;
+
+   double A = 0, B = 0;
+   const HeapModel& TM = fitHeapModel(TotalPeaks, A, B);
+   outs()<<"Heap peak fitted from "<<TotalPeaks.size()<<" process numbers, predicted at MPI_SIZE="<<Target<<":\n\n";
+   outs()<<"Total\t"<<TM.Name<<"\ta="<<A<<"\tb="<<B<<"\t"
+      <<format("%.0f", std::max(A + B*TM.X(Target), 0.))<<"\n\n";
+   outs()<<"Model\t\ta\tb\tPredicted\tWhere\n";
+   for(unsigned s = 0; s < Sites.size(); ++s){
+      bool Used = false;
+      for(auto& P : SitePeaks[s]) Used |= P.second > 0;
+      if(!Used) continue;
+      const HeapModel& SM = fitHeapModel(SitePeaks[s], A, B);
+      const BasicBlock* BB = Sites[s]->getParent();
+      outs()<<SM.Name<<"\t"<<A<<"\t"<<B<<"\t"
+         <<format("%.0f", std::max(A + B*SM.X(Target), 0.))<<"\t"
+         <<BB->getParent()->getName()<<":\""<<BB->getName()<<"\"\n";
+   }
+   return false;
+}
+
+char ProfileTraceStats::ID = 0;
+
+// Log2Bin - the bin of V in a histogram of powers of two, bin k holds
+// [2^k, 2^(k+1)), V = 0 goes to bin 0
+static unsigned Log2Bin(uint64_t V)
+{
+   unsigned k = 0;
+   while(V >>= 1) ++k;
+   return k;
+}
+
+static void printLog2Histogram(const std::vector<uint64_t>& Hist)
+{
+   uint64_t Total = 0;
+   for(uint64_t N : Hist) Total += N;
+   for(unsigned k = 0; k < Hist.size(); ++k){
+      if(Hist[k] == 0) continue;
+      outs()<<"  ["<<(1ULL<<k)<<", "<<(2ULL<<k)<<")\t"<<Hist[k]<<"\t"
+         <<format("%.2f%%", 100. * Hist[k] / Total)<<"\n";
+   }
+}
+
+static raw_ostream& printBlock(raw_ostream& O, const BasicBlock* BB)
+{
+   return O<<BB->getParent()->getName()<<":\""<<BB->getName()<<"\"";
+}
+
+void ProfileTraceStats::getAnalysisUsage(AnalysisUsage& AU) const
+{
+   AU.setPreservesAll();
+   AU.addRequired<LoopInfo>();
+}
+
+// the trace numbers the blocks of the module in order. a loop is active
+// from the visit of its header from outside until a block outside of it,
+// every visit of the header in between is one more iteration. the active
+// loops are kept per function, so a call in a loop does not end it.
+bool ProfileTraceStats::runOnModule(Module& M)
+{
+   std::vector<BasicBlock*> Blocks;
+   std::vector<unsigned> FuncOf;   /* function number of every block */
+   std::vector<Loop*> LoopOf;      /* innermost loop of every block */
+   std::vector<Loop*> Loops;       /* in the order of their headers */
+   std::map<Loop*, unsigned> LoopIds;
+   unsigned NumFuncs = 0;
+   for(Module::iterator F = M.begin(), FE = M.end(); F != FE; ++F){
+      if(F->isDeclaration()) continue;
+      LoopInfo& LI = getAnalysis<LoopInfo>(*F);
+      for(Function::iterator BB = F->begin(), BBE = F->end(); BB != BBE; ++BB){
+         Loop* L = LI.getLoopFor(BB);
+         Blocks.push_back(BB);
+         FuncOf.push_back(NumFuncs);
+         LoopOf.push_back(L);
+         if(L && L->getHeader() == BB){
+            LoopIds[L] = Loops.size();
+            Loops.push_back(L);
+         }
+      }
+      ++NumFuncs;
+   }
+
+   std::unordered_map<uint64_t, uint64_t> Transitions;
+   std::vector<std::vector<uint64_t> > LoopHist(Loops.size(), std::vector<uint64_t>(64));
+   std::vector<uint64_t> ReuseHist(64), LastPos(Blocks.size());
+   std::vector<std::vector<std::pair<Loop*, uint64_t> > > Active(NumFuncs);
+   uint64_t Pos = 0, Total = 0, FirstTouches = 0, OutOfRange = 0;
+   unsigned Prev = ~0U, CurRun = 0;
+   unsigned NumRuns = 0;
+
+   auto closeLoop = [&](std::pair<Loop*, uint64_t>& A){
+      ++LoopHist[LoopIds[A.first]][Log2Bin(A.second)];
+   };
+   // a new run starts without blocks seen or loops entered
+   auto endRun = [&](){
+      for(auto& S : Active){
+         for(auto& A : S) closeLoop(A);
+         S.clear();
+      }
+      std::fill(LastPos.begin(), LastPos.end(), 0);
+      Prev = ~0U;
+      Pos = 0;
+   };
+
+   std::string Error;
+   bool Read = ReadBBTrace(Filename, [&](const unsigned* Trace, size_t N, unsigned Run){
+      if(NumRuns == 0 || Run != CurRun){
+         if(NumRuns) endRun();
+         CurRun = Run;
+         ++NumRuns;
+      }
+      for(size_t i = 0; i < N; ++i){
+         unsigned B = Trace[i];
+         if(B >= Blocks.size()){
+            ++OutOfRange;
+            continue;
+         }
+         ++Total;
+         ++Pos;
+         if(Prev != ~0U) ++Transitions[(uint64_t)Prev << 32 | B];
+         Prev = B;
+
+         if(LastPos[B]) ++ReuseHist[Log2Bin(Pos - LastPos[B])];
+         else ++FirstTouches;
+         LastPos[B] = Pos;
+
+         BasicBlock* BB = Blocks[B];
+         auto& S = Active[FuncOf[B]];
+         while(!S.empty() && !S.back().first->contains(BB)){
+            closeLoop(S.back());
+            S.pop_back();
+         }
+         Loop* L = LoopOf[B];
+         if(L && L->getHeader() == BB){
+            if(!S.empty() && S.back().first == L) ++S.back().second;
+            else S.push_back(std::make_pair(L, 1));
+         }
+      }
+   }, Error);
+   if(!Read){
+      errs()<<"llvm-prof: "<<Error<<"\n";
+      exit(1);
+   }
+   endRun();
+
+   if(OutOfRange)
+      errs()<<"WARNING: "<<OutOfRange<<" traced blocks are not in the program, ignored\n";
+   outs()<<"Trace of "<<Total<<" blocks in "<<NumRuns<<" runs, "
+      <<Transitions.size()<<" distinct transitions\n\n";
+
+   std::vector<std::pair<uint64_t, uint64_t> > Top(Transitions.begin(), Transitions.end());
+   size_t NumTop = std::min<size_t>(TraceTop, Top.size());
+   std::partial_sort(Top.begin(), Top.begin() + NumTop, Top.end(),
+         [](const std::pair<uint64_t, uint64_t>& L, const std::pair<uint64_t, uint64_t>& R){
+            return L.second > R.second || (L.second == R.second && L.first < R.first); });
+   outs()<<"Count\tPercent\tFrom\tTo\n";
+   for(size_t i = 0; i < NumTop; ++i){
+      outs()<<Top[i].second<<"\t"<<format("%.2f%%", 100. * Top[i].second / Total)<<"\t";
+      printBlock(outs(), Blocks[Top[i].first >> 32])<<"\t";
+      printBlock(outs(), Blocks[Top[i].first & 0xffffffff])<<"\n";
+   }
+
+   outs()<<"\nLoop iterations per entry:\n";
+   for(unsigned l = 0; l < Loops.size(); ++l){
+      const std::vector<uint64_t>& H = LoopHist[l];
+      uint64_t Entries = 0;
+      for(uint64_t N : H) Entries += N;
+      if(Entries == 0) continue;
+      printBlock(outs(), Loops[l]->getHeader())<<"\tdepth "<<Loops[l]->getLoopDepth()
+         <<"\t"<<Entries<<" entries\n";
+      printLog2Histogram(H);
+   }
+
+   outs()<<"\nReuse intervals, in traced blocks between two visits of a block ("
+      <<FirstTouches<<" first visits):\n";
+   printLog2Histogram(ReuseHist);
+   return false;
+}
+
 char ProfileTimingPrint::ID = 0;
+
+// ompRegionTiming - the block timing of an omp outlined function is the work
+// of its busiest thread, Serial receives the work summed over all threads.
+static double ompRegionTiming(const ProfileInfo::OmpRegionCounts& R,
+                              Function& F, BBlockTiming* BT, double& Serial)
+{
+   double MaxWork = 0.;
+   Serial = 0.;
+   for(auto& Thread : R.ThreadCounts){
+      double Work = 0.;
+      unsigned b = 0;
+      for(Function::iterator BB = F.begin(), E = F.end(); BB != E && b < Thread.size(); ++BB, ++b)
+         Work += Thread[b] * BT->count(*BB);
+      MaxWork = std::max(MaxWork, Work);
+      Serial += Work;
+   }
+   return MaxWork;
+}
+
+// criticalBlockCounts - block counts of PIL in the order of the blocks of M,
+// summed over the in edges of each block for an edge profile.
+static std::vector<double> criticalBlockCounts(Module& M, const ProfileInfoLoader& PIL)
+{
+   std::vector<double> Counts;
+   if(!PIL.getRawBlockDoubleCounts().empty())
+      return PIL.getRawBlockDoubleCounts();
+   if(!PIL.getRawBlockCounts().empty())
+      return std::vector<double>(PIL.getRawBlockCounts().begin(), PIL.getRawBlockCounts().end());
+   const std::vector<uint64_t>& Edges = PIL.getRawEdgeCounts();
+   std::map<BasicBlock*, double> InFlow;
+   size_t e = 0;
+   auto Read = [&](BasicBlock* To){
+      if(e < Edges.size() && Edges[e] != ProfileInfoLoader::Uncounted)
+         InFlow[To] += Edges[e];
+      ++e;
+   };
+   for(Module::iterator F = M.begin(), FE = M.end(); F != FE; ++F){
+      if(F->isDeclaration()) continue;
+      Read(&F->getEntryBlock());
+      for(Function::iterator BB = F->begin(), BBE = F->end(); BB != BBE; ++BB){
+         TerminatorInst* TI = BB->getTerminator();
+         for(unsigned s = 0; s < TI->getNumSuccessors(); ++s)
+            Read(TI->getSuccessor(s));
+      }
+   }
+   for(Module::iterator F = M.begin(), FE = M.end(); F != FE; ++F)
+      for(Function::iterator BB = F->begin(), BBE = F->end(); BB != BBE; ++BB)
+         Counts.push_back(InFlow[BB]);
+   return Counts;
+}
+
+// printCriticalTiming - the block timing of the critical profile and its
+// measured mpi time, next to the prediction of the profile being evaluated.
+void ProfileTimingPrint::printCriticalTiming(Module& M, double BlockTiming,
+      double MpiTiming)
+{
+   ProfileInfoLoader PIL("llvm-prof", CriticalProfile,
+         CountPackets() | PacketTypes({MPITimeInfo}));
+   if(PIL.hasError()){
+      errs()<<"llvm-prof: "<<PIL.getError()<<"\n";
+      exit(1);
+   }
+   std::vector<double> Counts = criticalBlockCounts(M, PIL);
+   double CriticalBlock = 0., CriticalMpi = 0.;
+   for(TimingSource* S : Sources){
+      if(!isa<BBlockTiming>(S)) continue;
+      size_t i = 0;
+      for(Module::iterator F = M.begin(), FE = M.end(); F != FE; ++F)
+         for(Function::iterator BB = F->begin(), BBE = F->end(); BB != BBE; ++BB, ++i)
+            if(i < Counts.size() && !Ignore.count(F->getName()))
+               CriticalBlock += Counts[i] * S->count(*BB);
+      break;
+   }
+   for(double T : PIL.getRawTimeMess())
+      CriticalMpi += T;
+   CriticalMpi *= pow(10,9);
+
+   outs()<<"Critical Block Timing: "<<CriticalBlock<<" ns\n";
+   if(CriticalBlock > DBL_EPSILON)
+      outs()<<"Block Timing / Critical: "<<BlockTiming / CriticalBlock<<"\n";
+   if(CriticalMpi > DBL_EPSILON){
+      outs()<<"Critical Real MPI Timing: "<<CriticalMpi<<" ns\n";
+      outs()<<"MPI Timing / Critical Real: "<<MpiTiming / CriticalMpi<<"\n";
+   }
+}
+
+PacketMask ProfileTimingPrint::wantedPackets()
+{
+   return CountPackets() | PacketTypes({MPInfo, MPIFullInfo, MPITimeInfo,
+         RankInfo, OmpInfo, IOInfo, MemOpInfo});
+}
+
 void ProfileTimingPrint::getAnalysisUsage(AnalysisUsage &AU) const
 {
    AU.setPreservesAll();
    AU.addRequired<ProfileInfo>();
 }
 
-bool ProfileTimingPrint::runOnModule(Module &M)
+TimingResult ProfileTimingPrint::compute(Module &M, ProfileInfo& PI)
 {
-   ProfileInfo& PI = getAnalysis<ProfileInfo>();
    double AbsoluteTiming = 0.0, BlockTiming = 0.0, MpiTiming = 0.0, CallTiming = 0.0;
    double MpiTimingsize = 0.0;
    double MpiFittingTime = 0.0;
@@ -161,6 +592,9 @@ bool ProfileTimingPrint::runOnModule(Module &M)
    double AmountOfMpiComm = 0.0;//add by haomeng. The amount of commucation of mpi
    double RealMpiTime = 0.0;//add by haomeng. The real time of mpi
    double RealWaitTime = 0.0;//add by haomeng. The real wait time of mpi
+   double OmpTiming = 0.0, OmpSerialTiming = 0.0; // omp regions, busiest thread vs all threads
+   double IOTime = 0.0, RealIOTime = 0.0; // io calls, predicted vs measured
+   double MemOpTime = 0.0; // memcpy/memmove/memset, by length
    std::map<std::string, double> InstNum;
    std::map<std::string, double> InstTime;
    for(TimingSource* S : Sources){
@@ -212,12 +646,25 @@ bool ProfileTimingPrint::runOnModule(Module &M)
                }
                FuncTiming += timing; // 基本块频率×基本块时间
             }
+            if(auto R = PI.getOmpRegion(F)){
+               double Serial;
+               FuncTiming = ompRegionTiming(*R, *F, BT, Serial);
+               OmpTiming += FuncTiming;
+               OmpSerialTiming += Serial;
+            }
             if (TimingDebug)
               outs() << FuncTiming << "\t"
                      << "max=" << MaxTimes << "*" << MaxCount << "\t" << MaxName
                      << "\t" << F->getName() << "\n";
             BlockTiming += FuncTiming;
 #else
+            if(auto R = PI.getOmpRegion(F)){
+               double Serial, Parallel = ompRegionTiming(*R, *F, BT, Serial);
+               BlockTiming += Parallel;
+               OmpTiming += Parallel;
+               OmpSerialTiming += Serial;
+               continue;
+            }
             for(Function::iterator BB = F->begin(), BBE = F->end(); BB != BBE; ++BB){
                BlockTiming += PI.getExecutionCount(BB) * S->count(*BB);
             }
@@ -228,7 +675,7 @@ bool ProfileTimingPrint::runOnModule(Module &M)
          auto MT = cast<MPITiming>(S);
          auto S = PI.getAllTrapedValues(MPIFullInfo);
          auto U = PI.getAllTrapedValues(MPInfo);
-         if(U.size()>0) outs()<<"Notice: Old Mpi Profiling Format\n";
+         if(U.size()>0) errs()<<"Notice: Old Mpi Profiling Format\n";
          S.insert(S.end(), U.begin(), U.end());
 //add by haomeng. Calculate the real time of mpi
          for(Module::iterator F = M.begin(), E = M.end(); F!= E; ++F){
@@ -283,7 +730,17 @@ bool ProfileTimingPrint::runOnModule(Module &M)
             MpiFittingTime += fittingtime;
          }
       }
-      if(isa<LibCallTiming>(S) && CallTiming < DBL_EPSILON){
+      if(isa<MemOpTiming>(S) && MemOpTime < DBL_EPSILON){
+         auto MT = cast<MemOpTiming>(S);
+         for(CallInst* CI : lle::get_memory_op_calls(M)){
+            const BasicBlock* BB = CI->getParent();
+            if(Ignore.count(BB->getParent()->getName())) continue;
+            if(const ProfileInfo::MemOpCounts* C = PI.getMemOpCounts(CI))
+               MemOpTime += MT->count(*CI, *C);
+            else
+               MemOpTime += MT->count(*CI, PI.getExecutionCount(BB));
+         }
+      }else if(isa<LibCallTiming>(S) && CallTiming < DBL_EPSILON){
          auto CT = cast<LibCallTiming>(S);
          for(auto& F : M){
             for(auto& BB : F){
@@ -295,18 +752,21 @@ bool ProfileTimingPrint::runOnModule(Module &M)
             }
          }
       }
+      if(isa<IOTiming>(S) && IOTime < DBL_EPSILON){
+         auto IT = cast<IOTiming>(S);
+         for(CallInst* CI : lle::get_io_calls(M)){
+            const BasicBlock* BB = CI->getParent();
+            if(Ignore.count(BB->getParent()->getName())) continue;
+            const ProfileInfo::IOCounts* C = PI.getIOCounts(CI);
+            // without io profiling the bytes are unknown, only count calls
+            double Calls = C ? (*C)[IO_CALLS] : PI.getExecutionCount(BB);
+            double Bytes = C ? (*C)[IO_BYTES] : 0.;
+            IOTime += IT->count(*CI, Calls, Bytes);
+            if(C) RealIOTime += (*C)[IO_NANOSEC];
+         }
+      }
    }
-   AbsoluteTiming = BlockTiming + MpiTiming/*MpiTiming */+ CallTiming;
-   outs()<<"Block Timing: "<<BlockTiming<<" ns\n";
-   outs()<<"MPI Timing: "<<MpiTiming<<" ns\n";
-   outs()<<"Call Timing: "<<CallTiming<<" ns\n";
-   outs()<<"Timing: "<<AbsoluteTiming<<" ns\n";
-   outs()<<"Inst Num: "<< AllIrNum << "\n";
-   outs()<<"Mpi Num: "<< MPICallNUM<< "\n";
-   outs()<<"Comm Amount: "<< AmountOfMpiComm<< "\n";
-   outs()<<"Real MPI Timing: "<< RealMpiTime*pow(10,9) << " ns\n";
-   outs()<<"Real MPI Wait Timing: "<< RealWaitTime*pow(10,9) << " ns\n";
-   outs()<<"MPI Fitting Timing: "<< MpiFittingTime*pow(10,9) << " ns\n";
+   AbsoluteTiming = BlockTiming + MpiTiming/*MpiTiming */+ CallTiming + MemOpTime + IOTime;
 //   {
 //      outs()<<"================The counts of instructions===========\n";
 //      typedef std::pair<std::string, double> PAIR;
@@ -554,6 +1014,101 @@ bool ProfileTimingPrint::runOnModule(Module &M)
 //      outs()<<"Pred computation time1: "<<predcomtime+CallTiming <<"\n";
 //   }
 
+   TimingResult R;
+   R.Block = BlockTiming;
+   R.Omp = OmpTiming;
+   R.OmpSerial = OmpSerialTiming;
+   R.Mpi = MpiTiming;
+   R.Call = CallTiming;
+   R.MemOp = MemOpTime;
+   R.IO = IOTime;
+   R.RealIO = RealIOTime;
+   R.Total = AbsoluteTiming;
+   R.IrNum = AllIrNum;
+   R.MpiNum = MPICallNUM;
+   R.CommAmount = AmountOfMpiComm;
+   R.RealMpi = RealMpiTime*pow(10,9);
+   R.RealWait = RealWaitTime*pow(10,9);
+   R.MpiFitting = MpiFittingTime*pow(10,9);
+   return R;
+}
+
+bool ProfileTimingPrint::runOnModule(Module &M)
+{
+   TimingResult R = compute(M, getAnalysis<ProfileInfo>());
+   outs()<<"Block Timing: "<<R.Block<<" ns\n";
+   if(R.Omp > DBL_EPSILON){
+      outs()<<"OpenMP Region Timing: "<<R.Omp<<" ns\n";
+      outs()<<"OpenMP Parallelism: "<<R.OmpSerial/R.Omp<<"\n";
+   }
+   outs()<<"MPI Timing: "<<R.Mpi<<" ns\n";
+   outs()<<"Call Timing: "<<R.Call<<" ns\n";
+   if(R.MemOp > DBL_EPSILON)
+      outs()<<"MemOp Timing: "<<R.MemOp<<" ns\n";
+   if(R.IO > DBL_EPSILON){
+      outs()<<"IO Timing: "<<R.IO<<" ns\n";
+      outs()<<"Real IO Timing: "<<R.RealIO<<" ns\n";
+   }
+   outs()<<"Timing: "<<R.Total<<" ns\n";
+   outs()<<"Inst Num: "<< R.IrNum << "\n";
+   outs()<<"Mpi Num: "<< R.MpiNum<< "\n";
+   outs()<<"Comm Amount: "<< R.CommAmount<< "\n";
+   outs()<<"Real MPI Timing: "<< R.RealMpi << " ns\n";
+   outs()<<"Real MPI Wait Timing: "<< R.RealWait << " ns\n";
+   outs()<<"MPI Fitting Timing: "<< R.MpiFitting << " ns\n";
+   if(CriticalProfile != "")
+      printCriticalTiming(M, R.Block, R.Mpi);
+   return false;
+}
+
+char ProfileBatchRow::ID = 0;
+
+void ProfileBatchRow::getAnalysisUsage(AnalysisUsage &AU) const
+{
+   AU.setPreservesAll();
+   AU.addRequired<ProfileInfo>();
+}
+
+bool ProfileBatchRow::runOnModule(Module &M)
+{
+   ProfileInfo& PI = getAnalysis<ProfileInfo>();
+   if(Timing){
+      TimingResult R = Timing->compute(M, PI);
+      Row.push_back(std::make_pair("block_ns", R.Block));
+      Row.push_back(std::make_pair("omp_ns", R.Omp));
+      Row.push_back(std::make_pair("omp_serial_ns", R.OmpSerial));
+      Row.push_back(std::make_pair("mpi_ns", R.Mpi));
+      Row.push_back(std::make_pair("call_ns", R.Call));
+      Row.push_back(std::make_pair("memop_ns", R.MemOp));
+      Row.push_back(std::make_pair("io_ns", R.IO));
+      Row.push_back(std::make_pair("real_io_ns", R.RealIO));
+      Row.push_back(std::make_pair("timing_ns", R.Total));
+      Row.push_back(std::make_pair("ir_num", R.IrNum));
+      Row.push_back(std::make_pair("mpi_num", R.MpiNum));
+      Row.push_back(std::make_pair("comm_amount", R.CommAmount));
+      Row.push_back(std::make_pair("real_mpi_ns", R.RealMpi));
+      Row.push_back(std::make_pair("real_mpi_wait_ns", R.RealWait));
+      Row.push_back(std::make_pair("mpi_fitting_ns", R.MpiFitting));
+   }
+   if(InstNumber)
+      Row.push_back(std::make_pair("inst_number", instructionCount(M, PI)));
+   if(Comm){
+      // the sums of the lines -print-comm-size prints
+      double Calls = 0., Size = 0.;
+      auto S = PI.getAllTrapedValues(MPIFullInfo);
+      auto U = PI.getAllTrapedValues(MPInfo);
+      S.insert(S.end(), U.begin(), U.end());
+      for(auto I : S){
+         const CallInst* CI = cast<CallInst>(I);
+         Function* func = dyn_cast<Function>(lle::castoff(
+                  const_cast<CallInst*>(CI)->getCalledValue()));
+         if(func == NULL || !func->getName().startswith("mpi_")) continue;
+         Calls += PI.getExecutionCount(CI->getParent());
+         Size += PI.getExecutionCount(CI);
+      }
+      Row.push_back(std::make_pair("comm_calls", Calls));
+      Row.push_back(std::make_pair("comm_size", Size));
+   }
    return false;
 }
 
@@ -561,14 +1116,14 @@ ProfileTimingPrint::ProfileTimingPrint(std::vector<TimingSource*>&& TS,
       std::vector<std::string>& Files):ModulePass(ID), Sources(TS)
 {
    if(Sources.size() > Files.size()){
-      errs()<<"No Enough File to initialize Timing Source\n";
-      exit(-1);
+      Error = "No Enough File to initialize Timing Source";
+      return;
    }
    if(TimingIgnore!=""){
       std::ifstream IgnoreFile(TimingIgnore);
       if(!IgnoreFile.is_open()){
-         errs()<<"Couldn't open ignore file: "<<TimingIgnore<<"\n";
-         exit(-1);
+         Error = "Couldn't open ignore file: " + TimingIgnore.getValue();
+         return;
       }
       std::copy(std::istream_iterator<std::string>(IgnoreFile),
                 std::istream_iterator<std::string>(),
@@ -576,7 +1131,7 @@ ProfileTimingPrint::ProfileTimingPrint(std::vector<TimingSource*>&& TS,
       IgnoreFile.close();
    }
    for(unsigned i = 0; i < Sources.size(); ++i){
-      Sources[i]->init_with_file(Files[i].c_str());
+      if(!Sources[i]->init_with_file(Files[i].c_str(), Error)) return;
 #ifndef NDEBUG
       if(TimingDebug){
          outs()<<"parsed "<<Files[i]<<" file's content:\n";
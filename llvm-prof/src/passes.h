@@ -2,10 +2,22 @@
 #define LLVM_PROF_PASSES_H_H
 #include <llvm/Pass.h>
 #include "TimingSource.h"
+#include "ProfileInfo.h"
+#include "ProfileInfoLoader.h"
 #include "ProfileInfoWriter.h"
+#include <llvm/Support/raw_ostream.h>
 #include <set>
 #include <vector>
 namespace llvm{
+   /// CountPackets - the packet types the block and edge counts of
+   /// ProfileInfo are computed from. every mode below declares the packets it
+   /// needs by wantedPackets(), the others are not loaded.
+   PacketMask CountPackets();
+
+   /// instructionCount - the instructions of M run by the block counts of PI,
+   /// without the mpi calls. printed by -inst-number.
+   double instructionCount(Module& M, ProfileInfo& PI);
+
    /// ProfileInfoPrinterPass - Helper pass to dump the profile information for
    /// a module.
    //
@@ -13,6 +25,7 @@ namespace llvm{
       ProfileInfoLoader &PIL;
       public:
       static char ID; // Class identification, replacement for typeinfo.
+      static PacketMask wantedPackets();
       explicit ProfileInfoPrinterPass(ProfileInfoLoader &_PIL)
          : ModulePass(ID), PIL(_PIL) {}
 
@@ -35,6 +48,11 @@ namespace llvm{
       void printMPICounts(ProfilingType Info);
       void printRankInfo(ProfilingType Info);
       void printMPITime(ProfilingType Info, std::map<const CallInst*, int>& MPICallNum);
+      void printStrideCounts(Module& M);
+      void printIOCounts(Module& M);
+      void printMemOpCounts(Module& M);
+      void printHeapCounts(Module& M);
+      void printLightError(Module& M, std::vector<std::pair<BasicBlock*, double> >& Counts);
       virtual const char* getPassName() const {
          return "Print Profile Info";
       }
@@ -44,6 +62,7 @@ namespace llvm{
       ProfileInfoWriter& Writer;
       public:
       static char ID;
+      static PacketMask wantedPackets();
       ProfileInfoConverter(ProfileInfoWriter& PIW):ModulePass(ID), Writer(PIW) {}
       void getAnalysisUsage(AnalysisUsage& AU) const;
       bool runOnModule(Module& M);
@@ -52,27 +71,92 @@ namespace llvm{
    {
       ProfileInfoLoader& Lhs;
       ProfileInfoLoader& Rhs;
+      raw_ostream& Out;      /* where the differences are reported */
+      public:
+      explicit ProfileInfoCompare(ProfileInfoLoader& LHS,ProfileInfoLoader& RHS,
+            raw_ostream& O = errs())
+         :Lhs(LHS), Rhs(RHS), Out(O) {}
+      bool run();
+   };
+   class ProfileInfoCommMatrix
+   {
+      std::vector<std::string>& Files;
       public:
-      explicit ProfileInfoCompare(ProfileInfoLoader& LHS,ProfileInfoLoader& RHS)
-         :Lhs(LHS), Rhs(RHS) {}
+      explicit ProfileInfoCommMatrix(std::vector<std::string>& F):Files(F) {}
       bool run();
    };
    class ProfileInfoComm: public ModulePass
    {
       public:
       static char ID;
+      static PacketMask wantedPackets();
       ProfileInfoComm(): ModulePass(ID){}
       void getAnalysisUsage(AnalysisUsage& AU) const override;
       bool runOnModule(Module& M) override;
    };
+   class ProfileHeapFit: public ModulePass
+   {
+      std::vector<std::string> Files;
+      public:
+      static char ID;
+      static PacketMask wantedPackets();
+      ProfileHeapFit(std::vector<std::string>& F):ModulePass(ID), Files(F) {}
+      bool runOnModule(Module& M) override;
+   };
+   /// ProfileTraceStats - block pair transitions, loop iterations and reuse
+   /// intervals of the block trace of a profile, computed in one pass over
+   /// the streamed trace. memory grows with the program, not the trace.
+   class ProfileTraceStats: public ModulePass
+   {
+      std::string Filename;
+      public:
+      static char ID;
+      explicit ProfileTraceStats(const std::string& F):ModulePass(ID), Filename(F) {}
+      void getAnalysisUsage(AnalysisUsage& AU) const override;
+      bool runOnModule(Module& M) override;
+   };
+   /// TimingResult - the times -timing predicts and measures for a profile,
+   /// in ns, and the counts printed with them.
+   struct TimingResult {
+      double Block, Omp, OmpSerial, Mpi, Call, MemOp, IO, RealIO, Total;
+      double IrNum, MpiNum, CommAmount;
+      double RealMpi, RealWait, MpiFitting;
+   };
    class ProfileTimingPrint: public ModulePass
    {
       std::vector<TimingSource*> Sources;
       std::set<std::string> Ignore;
+      std::string Error;
+      void printCriticalTiming(Module& M, double BlockTiming, double MpiTiming);
       public:
       static char ID;
+      static PacketMask wantedPackets();
+      /// the sources are loaded from File, if one can't be, hasError() is
+      /// true and the pass must not be run.
       ProfileTimingPrint(std::vector<TimingSource*>&& S, std::vector<std::string>& File);
       ~ProfileTimingPrint();
+      bool hasError() const { return !Error.empty(); }
+      const std::string& getError() const { return Error; }
+      /// compute - the timing of the profile PI, by the sources loaded once
+      /// by the constructor.
+      TimingResult compute(Module& M, ProfileInfo& PI);
+      void getAnalysisUsage(AnalysisUsage& AU) const override;
+      bool runOnModule(Module& M) override;
+   };
+   /// ProfileBatchRow - a row of -batch for the profile loaded before it:
+   /// the results of -timing, -inst-number and -print-comm-size, those asked
+   /// for, as (column, value) pairs. Timing is shared by all rows, so its
+   /// sources are only loaded once.
+   class ProfileBatchRow: public ModulePass
+   {
+      ProfileTimingPrint* Timing;
+      bool InstNumber, Comm;
+      std::vector<std::pair<std::string, double> >& Row;
+      public:
+      static char ID;
+      ProfileBatchRow(ProfileTimingPrint* T, bool I, bool C,
+            std::vector<std::pair<std::string, double> >& R)
+         :ModulePass(ID), Timing(T), InstNumber(I), Comm(C), Row(R) {}
       void getAnalysisUsage(AnalysisUsage& AU) const override;
       bool runOnModule(Module& M) override;
    };
@@ -1,6 +1,7 @@
 #include "passes.h"
 #include <llvm/Analysis/BlockFrequencyInfo.h>
 #include <ProfileInfo.h>
+#include <ProfileInfoLoader.h>
 #include <llvm/IR/Module.h>
 #include <llvm/IR/Function.h>
 #include <llvm/Support/Format.h>
@@ -8,6 +9,8 @@
 #include <llvm/Support/raw_ostream.h>
 #include <llvm/Support/FormattedStream.h>
 #include "ValueUtils.h"
+#include <numeric>
+#include <cmath>
 
 #if LLVM_VERSION_MAJOR == 3 && LLVM_VERSION_MINOR == 4
 #include <llvm/Assembly/AssemblyAnnotationWriter.h>
@@ -28,6 +31,8 @@ cl::opt<bool> PrintAllCode("print-all-code",
 		cl::desc("Print annotated code for the entire program"));
 cl::opt<bool> ValueContentPrint("value-content",
 		cl::desc("Print detailed value content in value profiling"));
+cl::opt<std::string> LightReference("light-reference", cl::value_desc("filename"),
+		cl::desc("Report the error of the block counts against this edge profile"));
 
 // PairSecondSort - A sorting predicate to sort by the second element of a pair.
 template<class T>
@@ -45,8 +50,38 @@ static double ignoreMissing(double w) {
 	return w;
 }
 
+double llvm::instructionCount(Module& M, ProfileInfo& PI)
+{
+	double Count = 0.;
+	for (Module::iterator FI = M.begin(), FE = M.end(); FI != FE; ++FI) {
+		if (FI->isDeclaration()) continue;
+		for (Function::iterator BB = FI->begin(), BBE = FI->end();
+				BB != BBE; ++BB) {
+			double w = ignoreMissing(PI.getExecutionCount(BB));
+			for(BasicBlock::iterator IB = BB->begin(), IE = BB->end();
+					IB != IE; ++IB) {
+				CallInst* CI = dyn_cast<CallInst>(&*IB);
+				Function* func = CI ? dyn_cast<Function>(
+						lle::castoff(CI->getCalledValue())) : NULL;
+				if(func == NULL || !func->getName().startswith("mpi_"))
+					Count += w;
+			}
+		}
+	}
+	return Count;
+}
+
 char ProfileInfoPrinterPass::ID = 0;
 
+// wantedPackets - -inst-number only weighs the blocks, -value-content only
+// prints the traped values, everything else may be printed
+PacketMask ProfileInfoPrinterPass::wantedPackets()
+{
+	if(InstNumber) return CountPackets();
+	if(ValueContentPrint) return PacketTypes({ValueInfo});
+	return AllPackets();
+}
+
 void ProfileInfoPrinterPass::getAnalysisUsage(AnalysisUsage& AU) const
 {
 	AU.setPreservesAll();
@@ -61,22 +96,18 @@ void ProfileInfoPrinterPass::printValueContent()
 	outs()<<"No.\t\tType\t\tContent\n";
 	for(std::vector<const Instruction*>::const_iterator I = Calls.begin(), E = Calls.end(); I!=E; ++I){
 		const CallInst* CI = dyn_cast<CallInst>(*I);
-		std::vector<int> Contents = PI.getValueContents(CI);
+		ValueRuns Runs = PI.getValueRuns(CI);
 		const Value* traped = PI.getTrapedTarget(CI);
 		outs()<<PI.getTrapedIndex(CI)<<". \t";
 		if(isa<Constant>(traped))outs()<<"Constant";
 		else outs()<<"Variable";
 		outs()<<"("<<(unsigned)PI.getExecutionCount(CI)<<"):\t";
-		std::vector<int>::iterator II = Contents.begin(),EE=Contents.end(),BND;
-		while(II!=EE){
-			BND = std::upper_bound(II, EE, *II);
-			size_t len = BND-II;
-			if (len>5)
-				outs()<<*II<<"<repeat "<<len<<" times>,";
+		for(ValueRuns::iterator II = Runs.begin(), EE = Runs.end(); II!=EE; ++II){
+			if (II->Length>5)
+				outs()<<II->Value<<"<repeat "<<II->Length<<" times>,";
 			else
-				for(unsigned i=0;i<len;i++)
-					outs()<<*II<<",";
-			II=BND;
+				for(unsigned i=0;i<II->Length;i++)
+					outs()<<II->Value<<",";
 		}
 		outs()<<"\n";
 	}
@@ -247,6 +278,118 @@ void ProfileInfoPrinterPass::printSLGCounts()
 	}
 }
 
+void ProfileInfoPrinterPass::printStrideCounts(Module& M)
+{
+	ProfileInfo& PI = getAnalysis<ProfileInfo>();
+	std::vector<std::pair<Instruction*, double> > Accesses;
+	for(Instruction* I : lle::get_loop_memory_accesses(M)){
+		const ProfileInfo::StrideCounts* C = PI.getStrideCounts(I);
+		if(C == NULL) continue;
+		Accesses.push_back(std::make_pair(I, std::accumulate(C->begin(), C->end(), 0.)));
+	}
+	if(Accesses.empty()) return;
+
+	if(!Unsort)
+		sort(Accesses.begin(), Accesses.end(), PairSecondSortReverse<Instruction*>());
+
+	outs() << "\n===" << std::string(73, '-') << "===\n";
+	if(!ListAll)
+		outs() << "Top 20 most frequently executed loads/stores by stride:\n\n";
+	else
+		outs() << "Sorted loads/stores by stride:\n\n";
+	outs() <<" ##      Count\tUnit%\tSmall%\tLarge%\tIrreg%\tWhere\n";
+	unsigned AccessesToPrint = Accesses.size();
+	if (!ListAll && AccessesToPrint > 20) AccessesToPrint = 20;
+	for (unsigned i = 0; i != AccessesToPrint; ++i) {
+		double Total = Accesses[i].second;
+		if (!Unsort && Total == 0) break;
+		const ProfileInfo::StrideCounts& C = *PI.getStrideCounts(Accesses[i].first);
+		const BasicBlock* BB = Accesses[i].first->getParent();
+		outs() << format("%3d", i+1) << ". "
+			<< format("%5.0f", Total) << "\t";
+		for(unsigned b = 0; b != STRIDE_BINS; ++b)
+			outs() << format("%5.1f", Total ? C[b]/Total*100 : 0.) << "\t";
+		outs() << BB->getParent()->getName() << ":\""
+			<< BB->getName() << "\"\t"
+			<< *Accesses[i].first << "\n";
+	}
+}
+
+void ProfileInfoPrinterPass::printIOCounts(Module& M)
+{
+	ProfileInfo& PI = getAnalysis<ProfileInfo>();
+	std::vector<std::pair<CallInst*, double> > Calls;
+	for(CallInst* CI : lle::get_io_calls(M)){
+		const ProfileInfo::IOCounts* C = PI.getIOCounts(CI);
+		if(C == NULL) continue;
+		Calls.push_back(std::make_pair(CI, (*C)[IO_NANOSEC]));
+	}
+	if(Calls.empty()) return;
+
+	if(!Unsort)
+		sort(Calls.begin(), Calls.end(), PairSecondSortReverse<CallInst*>());
+
+	outs() << "\n===" << std::string(73, '-') << "===\n";
+	if(!ListAll)
+		outs() << "Top 20 most time consuming io calls:\n\n";
+	else
+		outs() << "Sorted io calls:\n\n";
+	outs() <<" ##      Calls\t     Bytes\t   Time(ns)\tWhere\n";
+	unsigned CallsToPrint = Calls.size();
+	if (!ListAll && CallsToPrint > 20) CallsToPrint = 20;
+	for (unsigned i = 0; i != CallsToPrint; ++i) {
+		const ProfileInfo::IOCounts& C = *PI.getIOCounts(Calls[i].first);
+		if (!Unsort && C[IO_CALLS] == 0) break;
+		const BasicBlock* BB = Calls[i].first->getParent();
+		Function* Called = dyn_cast<Function>(lle::castoff(Calls[i].first->getCalledValue()));
+		outs() << format("%3d", i+1) << ". "
+			<< format("%5.0f", C[IO_CALLS]) << "\t"
+			<< format("%10.0f", C[IO_BYTES]) << "\t"
+			<< format("%11.0f", C[IO_NANOSEC]) << "\t"
+			<< BB->getParent()->getName() << ":\""
+			<< BB->getName() << "\"\t"
+			<< Called->getName() << "\n";
+	}
+}
+
+void ProfileInfoPrinterPass::printMemOpCounts(Module& M)
+{
+	ProfileInfo& PI = getAnalysis<ProfileInfo>();
+	std::vector<std::pair<CallInst*, double> > Calls;
+	for(CallInst* CI : lle::get_memory_op_calls(M)){
+		const ProfileInfo::MemOpCounts* C = PI.getMemOpCounts(CI);
+		if(C == NULL) continue;
+		Calls.push_back(std::make_pair(CI, (*C)[MEMOP_BYTES]));
+	}
+	if(Calls.empty()) return;
+
+	if(!Unsort)
+		sort(Calls.begin(), Calls.end(), PairSecondSortReverse<CallInst*>());
+
+	outs() << "\n===" << std::string(73, '-') << "===\n";
+	if(!ListAll)
+		outs() << "Top 20 memcpy/memmove/memset by bytes:\n\n";
+	else
+		outs() << "Sorted memcpy/memmove/memset by bytes:\n\n";
+	outs() <<" ##      Calls\t     Bytes\t    Avg\tWhere\n";
+	unsigned CallsToPrint = Calls.size();
+	if (!ListAll && CallsToPrint > 20) CallsToPrint = 20;
+	for (unsigned i = 0; i != CallsToPrint; ++i) {
+		const ProfileInfo::MemOpCounts& C = *PI.getMemOpCounts(Calls[i].first);
+		double N = std::accumulate(C.begin() + MEMOP_BIN0, C.end(), 0.);
+		if (!Unsort && N == 0) break;
+		const BasicBlock* BB = Calls[i].first->getParent();
+		Function* Called = dyn_cast<Function>(lle::castoff(Calls[i].first->getCalledValue()));
+		outs() << format("%3d", i+1) << ". "
+			<< format("%5.0f", N) << "\t"
+			<< format("%10.0f", C[MEMOP_BYTES]) << "\t"
+			<< format("%7.0f", N ? C[MEMOP_BYTES]/N : 0.) << "\t"
+			<< BB->getParent()->getName() << ":\""
+			<< BB->getName() << "\"\t"
+			<< Called->getName() << "\n";
+	}
+}
+
 void ProfileInfoPrinterPass::printMPICounts(ProfilingType Info)
 {
 	ProfileInfo& PI = getAnalysis<ProfileInfo>();
@@ -444,6 +587,112 @@ ProfileInfoPrinterPass::printStaticBlockFrequency(
 	return FunctionsToPrint;
 }
 
+void ProfileInfoPrinterPass::printHeapCounts(Module& M)
+{
+	ProfileInfo& PI = getAnalysis<ProfileInfo>();
+	const ProfileInfo::HeapCounts& Total = PI.getHeapTotal();
+	if(Total.empty()) return;
+	std::vector<std::pair<CallInst*, double> > Calls;
+	for(CallInst* CI : lle::get_heap_alloc_calls(M)){
+		const ProfileInfo::HeapCounts* C = PI.getHeapCounts(CI);
+		if(C == NULL) continue;
+		Calls.push_back(std::make_pair(CI, (*C)[HEAP_PEAK]));
+	}
+
+	if(!Unsort)
+		sort(Calls.begin(), Calls.end(), PairSecondSortReverse<CallInst*>());
+
+	outs() << "\n===" << std::string(73, '-') << "===\n";
+	outs() << "Heap peak of " << format("%.0f", Total[HEAP_NPROCS]) << " processes: "
+		<< format("%.0f", Total[HEAP_TOTAL_PEAK]) << " bytes, "
+		<< format("%.0f", Total[HEAP_TOTAL_LIVE]) << " bytes live at exit\n\n";
+	if(!ListAll)
+		outs() << "Top 20 allocation sites by peak live bytes:\n\n";
+	else
+		outs() << "Sorted allocation sites by peak live bytes:\n\n";
+	outs() <<" ##      Calls\t      Peak\t     Bytes\tWhere\n";
+	unsigned CallsToPrint = Calls.size();
+	if (!ListAll && CallsToPrint > 20) CallsToPrint = 20;
+	for (unsigned i = 0; i != CallsToPrint; ++i) {
+		const ProfileInfo::HeapCounts& C = *PI.getHeapCounts(Calls[i].first);
+		if (!Unsort && C[HEAP_CALLS] == 0) break;
+		const BasicBlock* BB = Calls[i].first->getParent();
+		Function* Called = dyn_cast<Function>(lle::castoff(Calls[i].first->getCalledValue()));
+		outs() << format("%3d", i+1) << ". "
+			<< format("%5.0f", C[HEAP_CALLS]) << "\t"
+			<< format("%10.0f", C[HEAP_PEAK]) << "\t"
+			<< format("%10.0f", C[HEAP_BYTES]) << "\t"
+			<< BB->getParent()->getName() << ":\""
+			<< BB->getName() << "\"\t"
+			<< Called->getName() << "\n";
+	}
+}
+
+void ProfileInfoPrinterPass::printLightError(Module& M,
+		std::vector<std::pair<BasicBlock*, double> >& Counts)
+{
+	ProfileInfoLoader PIL("llvm-prof", LightReference,
+			PacketTypes({EdgeInfo, EdgeInfo64}));
+	if(PIL.hasError()){
+		errs() << "WARNING: " << PIL.getError() << "\n";
+		return;
+	}
+	const std::vector<uint64_t>& Edges = PIL.getRawEdgeCounts();
+	if(Edges.empty()){
+		errs() << "WARNING: " << LightReference << " has no edge profile!\n";
+		return;
+	}
+
+	// block counts of the reference are the sum of their incoming edges, in
+	// the edge order of the loader
+	std::map<const BasicBlock*, double> Ref;
+	unsigned ReadCount = 0;
+	for (Module::iterator F = M.begin(), E = M.end(); F != E; ++F) {
+		if (F->isDeclaration()) continue;
+		if (ReadCount < Edges.size()) Ref[&F->getEntryBlock()] += Edges[ReadCount++];
+		for (Function::iterator BB = F->begin(), BE = F->end(); BB != BE; ++BB) {
+			TerminatorInst* TI = BB->getTerminator();
+			for (unsigned s = 0, e = TI->getNumSuccessors(); s != e; ++s)
+				if (ReadCount < Edges.size()) Ref[TI->getSuccessor(s)] += Edges[ReadCount++];
+		}
+	}
+	if (ReadCount != Edges.size()) {
+		errs() << "WARNING: profile information is inconsistent with "
+			<< "the current program!\n";
+		return;
+	}
+
+	// relative error of each block, weighted by its reference count
+	double Total = 0, AbsError = 0, Within = 0;
+	std::vector<std::pair<BasicBlock*, double> > Errors;
+	for (auto& C : Counts) {
+		double R = Ref[C.first], D = fabs(C.second - R);
+		Total += R;
+		AbsError += D;
+		if (D <= 0.1 * R) Within += R;
+		Errors.push_back(std::make_pair(C.first, D));
+	}
+	sort(Errors.begin(), Errors.end(), PairSecondSortReverse<BasicBlock*>());
+
+	outs() << "\n===" << std::string(73, '-') << "===\n";
+	outs() << "Block count error against " << LightReference << ":\n\n";
+	outs() << "weighted relative error:\t" << format("%.2f%%", Total ? AbsError / Total * 100 : 0.) << "\n";
+	outs() << "weight within 10%:\t\t" << format("%.2f%%", Total ? Within / Total * 100 : 100.) << "\n\n";
+	outs() << " ##    Estimated\t    Reference\tBlock\n";
+	unsigned BlocksToPrint = Errors.size();
+	if (!ListAll && BlocksToPrint > 20) BlocksToPrint = 20;
+	ProfileInfo &PI = getAnalysis<ProfileInfo>();
+	for (unsigned i = 0; i != BlocksToPrint; ++i) {
+		if (Errors[i].second == 0) break;
+		BasicBlock* BB = Errors[i].first;
+		outs() << format("%3d", i+1) << ". "
+			<< format("%12.0f", ignoreMissing(PI.getExecutionCount(BB))) << "\t"
+			<< format("%12.0f", Ref[BB]) << "\t"
+			<< BB->getParent()->getName() << ":\""
+			<< BB->getName() << "\"\n";
+	}
+}
+
 bool ProfileInfoPrinterPass::runOnModule(Module &M) {
 	ProfileInfo &PI = getAnalysis<ProfileInfo>();
 	std::set<Function*> FunctionToPrint;
@@ -452,9 +701,6 @@ bool ProfileInfoPrinterPass::runOnModule(Module &M) {
 		printValueContent();
 		return false;
 	}
-	double instcount = 0.0;
-	double mpicount = 0.0;
-
 	std::vector<std::pair<Function*, double> > FunctionCounts;
 	std::vector<std::pair<BasicBlock*, double> > Counts;
 	//add by haomeng
@@ -479,7 +725,6 @@ bool ProfileInfoPrinterPass::runOnModule(Module &M) {
 			int BBCount = 0;
 			for(BasicBlock::iterator IB = BB->begin(), IE = BB->end();
 					IB != IE; ++IB) {
-				instcount+=w;
 				CallInst* CI = dyn_cast<CallInst>(&*IB);
 				if(CI == NULL) continue;
 				Value* CV = const_cast<CallInst*>(CI)->getCalledValue();
@@ -489,7 +734,6 @@ bool ProfileInfoPrinterPass::runOnModule(Module &M) {
 				StringRef str = func->getName();
 				if(str.startswith("mpi_"))
 				{
-					mpicount+=w;
 					if(
 							str.startswith("mpi_init_")||
 							str.startswith("mpi_comm_rank_")||
@@ -517,12 +761,18 @@ bool ProfileInfoPrinterPass::runOnModule(Module &M) {
 		printMPICounts(MPIFullInfo);
 		printAnnotatedCode(FunctionToPrint,M);
 		printMPITime(MPITimeInfo, MPICallNum);
+		printStrideCounts(M);
+		printIOCounts(M);
+		printMemOpCounts(M);
+		printHeapCounts(M);
+		if(!LightReference.empty())
+			printLightError(M, Counts);
 		//printStaticBlockFrequency(StaticCounts);
 
 	}
 	else
 	{
-		outs()<<"Inst number:\t"<<instcount-mpicount<<"\n";
+		outs()<<"Inst number:\t"<<instructionCount(M, PI)<<"\n";
 
 	}
 
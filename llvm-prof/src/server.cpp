@@ -0,0 +1,243 @@
+#include "server.h"
+#include <ProfileInfo.h>
+#include <ProfileInfoLoader.h>
+#include <llvm/PassManager.h>
+#include <llvm/Bitcode/ReaderWriter.h>
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/Format.h>
+#include <llvm/Support/MemoryBuffer.h>
+#include <iterator>
+#include <sstream>
+#include <errno.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#if LLVM_VERSION_MAJOR == 3 && LLVM_VERSION_MINOR == 4
+#include <llvm/Support/system_error.h>
+#include <llvm/ADT/OwningPtr.h>
+#else
+#include <system_error>
+#endif
+
+using namespace llvm;
+
+Module* llvm::loadModule(const std::string& File, LLVMContext& Context,
+      std::string& ErrorMessage)
+{
+   Module* M = 0;
+#if LLVM_VERSION_MAJOR==3 && LLVM_VERSION_MINOR==4
+   OwningPtr<MemoryBuffer> Buffer;
+   error_code ec;
+   if (!(ec = MemoryBuffer::getFileOrSTDIN(File, Buffer.get()))) {
+      M = ParseBitcodeFile(Buffer.get(), Context, &ErrorMessage);
+   } else
+      ErrorMessage = ec.message();
+#else
+   std::error_code ec;
+   auto Buffer = MemoryBuffer::getFileOrSTDIN(File);
+   if (!(ec = Buffer.getError())){
+      auto R = parseBitcodeFile(&**Buffer, Context);
+      if(R.getError())
+         ErrorMessage = R.getError().message();
+      else
+         M = R.get();
+   } else
+      ErrorMessage = ec.message();
+#endif
+   return M;
+}
+
+void ProfileServer::help(raw_ostream& Out)
+{
+   Out << "module <name> <bitcode>                load a module\n"
+       << "timing <name> <source:...> <file>...   load timing sources, as -timing\n"
+       << "profile <name> <llvmprof.out>          load a profile\n"
+       << "run <module> <timing> <profile>        predict the timing, as -timing\n"
+       << "inst <module> <profile>                count the instructions, as -inst-number\n"
+       << "comm <module> <profile>                sum the mpi calls, as -print-comm-size\n"
+       << "diff <profile> <profile>               compare two profiles, as -diff\n"
+       << "drop <name>                            unload a module, timing or profile\n"
+       << "list                                   list what is loaded\n"
+       << "quit                                   stop the server\n";
+}
+
+// evaluate - a run, inst or comm request: the columns of the -batch row of
+// the profile, one "<column> <value>" line each.
+std::string ProfileServer::evaluate(const Words& Args, raw_ostream& Out)
+{
+   bool Run = Args[0] == "run";
+   if(Args.size() != (Run ? 4 : 3))
+      return "usage: " + Args[0] + (Run ? " <module> <timing> <profile>" : " <module> <profile>");
+   auto M = Modules.find(Args[1]);
+   if(M == Modules.end()) return "no module " + Args[1];
+   ProfileTimingPrint* Timing = NULL;
+   if(Run){
+      auto T = Timings.find(Args[2]);
+      if(T == Timings.end()) return "no timing " + Args[2];
+      Timing = T->second.get();
+   }
+   auto P = Profiles.find(Args.back());
+   if(P == Profiles.end()) return "no profile " + Args.back();
+
+   std::vector<std::pair<std::string, double> > Row;
+   PassManager PassMgr;
+   PassMgr.add(createProfileLoaderPass(*P->second));
+   PassMgr.add(new ProfileBatchRow(Timing, Args[0] == "inst", Args[0] == "comm", Row));
+   PassMgr.run(*M->second);
+   for(auto& C : Row)
+      Out << C.first << " " << format("%.17g", C.second) << "\n";
+   return "";
+}
+
+// request - answer the request Args on Out, the reason if it failed.
+std::string ProfileServer::request(const Words& Args, raw_ostream& Out, bool& Quit)
+{
+   const std::string& Cmd = Args[0];
+   if(Cmd == "quit"){
+      Quit = true;
+      return "";
+   }
+   if(Cmd == "help"){
+      help(Out);
+      return "";
+   }
+   if(Cmd == "list"){
+      for(auto& E : Modules) Out << "module " << E.first << "\n";
+      for(auto& E : Timings) Out << "timing " << E.first << "\n";
+      for(auto& E : Profiles)
+         Out << "profile " << E.first << " " << E.second->getFileName() << "\n";
+      return "";
+   }
+   if(Cmd == "module"){
+      if(Args.size() != 3) return "usage: module <name> <bitcode>";
+      std::string Error;
+      Module* M = loadModule(Args[2], Context, Error);
+      if(M == NULL) return Args[2] + ": " + Error;
+      Modules[Args[1]].reset(M);
+      return "";
+   }
+   if(Cmd == "timing"){
+      if(Args.size() < 3) return "usage: timing <name> <source:...> <file>...";
+      std::vector<TimingSource*> Sources;
+      StringRef Kinds = Args[2];
+      std::string Error;
+      while(!Kinds.empty()){
+         std::pair<StringRef, StringRef> Split = Kinds.split(':');
+         if(TimingSource* TS = TimingSource::Construct(Split.first))
+            Sources.push_back(TS);
+         else if(Error.empty())
+            Error = "no timing source " + Split.first.str();
+         Kinds = Split.second;
+      }
+      if(!Error.empty()){
+         for(TimingSource* TS : Sources) delete TS;
+         return Error;
+      }
+      std::vector<std::string> Files(Args.begin() + 3, Args.end());
+      std::unique_ptr<ProfileTimingPrint> Timing(
+            new ProfileTimingPrint(std::move(Sources), Files));
+      if(Timing->hasError()) return Timing->getError();
+      Timings[Args[1]] = std::move(Timing);
+      return "";
+   }
+   if(Cmd == "profile"){
+      if(Args.size() != 3) return "usage: profile <name> <llvmprof.out>";
+      std::unique_ptr<ProfileInfoLoader> Profile(
+            new ProfileInfoLoader("llvm-prof", Args[2]));
+      if(Profile->hasError()) return Profile->getError();
+      Profiles[Args[1]] = std::move(Profile);
+      return "";
+   }
+   if(Cmd == "run" || Cmd == "inst" || Cmd == "comm")
+      return evaluate(Args, Out);
+   if(Cmd == "diff"){
+      if(Args.size() != 3) return "usage: diff <profile> <profile>";
+      auto L = Profiles.find(Args[1]), R = Profiles.find(Args[2]);
+      if(L == Profiles.end()) return "no profile " + Args[1];
+      if(R == Profiles.end()) return "no profile " + Args[2];
+      ProfileInfoCompare(*L->second, *R->second, Out).run();
+      return "";
+   }
+   if(Cmd == "drop"){
+      if(Args.size() != 2) return "usage: drop <name>";
+      if(Modules.erase(Args[1]) + Timings.erase(Args[1]) + Profiles.erase(Args[1]) == 0)
+         return "nothing named " + Args[1];
+      return "";
+   }
+   return "unknown request " + Cmd + ", try help";
+}
+
+bool ProfileServer::serve(FILE* In, raw_ostream& Out)
+{
+   char* Line = NULL;
+   size_t Size = 0;
+   bool Quit = false;
+   while(!Quit && getline(&Line, &Size, In) != -1){
+      std::istringstream Stream(Line);
+      Words Args((std::istream_iterator<std::string>(Stream)),
+            std::istream_iterator<std::string>());
+      if(Args.empty()) continue;
+      std::string Error = request(Args, Out, Quit);
+      if(Error.empty()) Out << "ok\n";
+      else Out << "error: " << Error << "\n";
+      Out.flush();
+   }
+   free(Line);
+   return !Quit;
+}
+
+int ProfileServer::listen(const std::string& Path)
+{
+   sockaddr_un Addr;
+   memset(&Addr, 0, sizeof(Addr));
+   Addr.sun_family = AF_UNIX;
+   if(Path.size() >= sizeof(Addr.sun_path)){
+      errs() << "llvm-prof: " << Path << ": socket path too long\n";
+      return 1;
+   }
+   strcpy(Addr.sun_path, Path.c_str());
+   // only a socket left by an earlier server is replaced, never another file
+   struct stat St;
+   if(lstat(Path.c_str(), &St) == 0){
+      if(!S_ISSOCK(St.st_mode)){
+         errs() << "llvm-prof: " << Path << ": exists and is not a socket\n";
+         return 1;
+      }
+      unlink(Path.c_str());
+   }
+   int Sock = socket(AF_UNIX, SOCK_STREAM, 0);
+   if(Sock < 0 || bind(Sock, (sockaddr*)&Addr, sizeof(Addr)) < 0
+         || ::listen(Sock, 8) < 0){
+      errs() << "llvm-prof: " << Path << ": " << strerror(errno) << "\n";
+      if(Sock >= 0) close(Sock);
+      return 1;
+   }
+   // a client hanging up before its answer must not kill the server
+   signal(SIGPIPE, SIG_IGN);
+
+   bool Running = true;
+   while(Running){
+      int Client = accept(Sock, NULL, NULL);
+      if(Client < 0){
+         if(errno == EINTR) continue;
+         errs() << "llvm-prof: " << Path << ": " << strerror(errno) << "\n";
+         break;
+      }
+      FILE* In = fdopen(dup(Client), "r");
+      raw_fd_ostream Out(Client, true);
+      if(In){
+         Running = serve(In, Out);
+         fclose(In);
+      }
+      // the errors of a client gone away are its own
+      Out.clear_error();
+   }
+   close(Sock);
+   unlink(Path.c_str());
+   return 0;
+}
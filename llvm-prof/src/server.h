@@ -0,0 +1,43 @@
+#ifndef LLVM_PROF_SERVER_H_H
+#define LLVM_PROF_SERVER_H_H
+#include "passes.h"
+#include <llvm/IR/LLVMContext.h>
+#include <llvm/IR/Module.h>
+#include <llvm/Support/raw_ostream.h>
+#include <stdio.h>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+namespace llvm{
+   /// loadModule - parse the bitcode of File into Context, null with the
+   /// reason in Error if it can't.
+   Module* loadModule(const std::string& File, LLVMContext& Context,
+         std::string& Error);
+
+   /// ProfileServer - answers the requests of a line protocol with the
+   /// modules, timing sources and profiles it loaded kept resident between
+   /// them, so a driver fitting a model pays for parsing them only once.
+   /// every request is a line of blank separated words, its answer lines end
+   /// with "ok" or "error: <reason>". see help() for the requests.
+   class ProfileServer
+   {
+      typedef std::vector<std::string> Words;
+      LLVMContext& Context;
+      std::map<std::string, std::unique_ptr<Module> > Modules;
+      std::map<std::string, std::unique_ptr<ProfileTimingPrint> > Timings;
+      std::map<std::string, std::unique_ptr<ProfileInfoLoader> > Profiles;
+      std::string request(const Words& Args, raw_ostream& Out, bool& Quit);
+      std::string evaluate(const Words& Args, raw_ostream& Out);
+      void help(raw_ostream& Out);
+      public:
+      explicit ProfileServer(LLVMContext& C):Context(C) {}
+      /// serve - answer the requests read from In on Out, until "quit" or
+      /// the end of In. false if it was "quit".
+      bool serve(FILE* In, raw_ostream& Out);
+      /// listen - serve the clients of the unix socket at Path one after
+      /// another, until one of them quits.
+      int listen(const std::string& Path);
+   };
+}
+#endif
@@ -0,0 +1,205 @@
+#include <gtest/gtest.h>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <vector>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <llvm/Support/raw_ostream.h>
+#include "ProfileDataTypes.h"
+#include "ProfileInfoLoader.h"
+#include "ProfileInfoMerge.h"
+#include "ProfileInfoWriter.h"
+
+using namespace llvm;
+
+// TempFile - a fresh file name, removed with the object
+struct TempFile
+{
+   std::string Name;
+   TempFile(const TempFile&) = delete;
+   TempFile() {
+      char Path[] = "/tmp/llvmprof-unit-XXXXXX";
+      close(mkstemp(Path));
+      Name = Path;
+   }
+   ~TempFile() { unlink(Name.c_str()); }
+};
+
+static const std::vector<unsigned> Functions = {3, 0, 7};
+static const std::vector<uint64_t> Edges = {1, 5000000000ULL, 0, 42};
+static const std::vector<double> Times = {0.5, 1.25};
+static const std::vector<uint64_t> Record = {9, 8, 7};
+
+static void writeProfile(const std::string& File, ProfileFormat Format)
+{
+   ProfileInfoWriter W("unit-test", File, Format);
+   W.write("./a.out -n 4");
+   W.write(FunctionInfo, Functions);
+   W.write(EdgeInfo64, Edges);
+   W.write(MPITimeInfo, Times);
+   W.write(EdgeInfo64, "main", Record);
+}
+
+static void expectProfile(const ProfileInfoLoader& PIL)
+{
+   ASSERT_FALSE(PIL.hasError()) << PIL.getError();
+   ASSERT_EQ(PIL.getNumExecutions(), 1u);
+   EXPECT_EQ(PIL.getExecution(0), "./a.out -n 4");
+   EXPECT_EQ(PIL.getRawFunctionCounts(), Functions);
+   EXPECT_EQ(PIL.getRawEdgeCounts(), Edges);
+   EXPECT_EQ(PIL.getRawTimeMess(), Times);
+}
+
+TEST(ProfileInfo, FlatRoundTrip)
+{
+   TempFile F;
+   writeProfile(F.Name, ProfileFlat);
+   ProfileInfoLoader PIL("unit-test", F.Name);
+   expectProfile(PIL);
+   EXPECT_FALSE(PIL.isIndexed());
+   // a flat file has no function records
+   EXPECT_EQ(PIL.getFunctionRecord(EdgeInfo64, "main"), nullptr);
+}
+
+TEST(ProfileInfo, IndexedRoundTrip)
+{
+   TempFile F;
+   writeProfile(F.Name, ProfileIndexed);
+   ProfileInfoLoader PIL("unit-test", F.Name);
+   expectProfile(PIL);
+   EXPECT_TRUE(PIL.isIndexed());
+   const std::vector<uint64_t>* R = PIL.getFunctionRecord(EdgeInfo64, "main");
+   ASSERT_NE(R, nullptr);
+   EXPECT_EQ(*R, Record);
+}
+
+TEST(ProfileInfo, RejectedChecksum)
+{
+   TempFile F;
+   writeProfile(F.Name, ProfileIndexed);
+   std::vector<char> Bytes;
+   {
+      std::ifstream In(F.Name, std::ios::binary);
+      Bytes.assign(std::istreambuf_iterator<char>(In), std::istreambuf_iterator<char>());
+   }
+   ASSERT_FALSE(Bytes.empty());
+   // the last byte belongs to the payload of the last packet
+   Bytes.back() ^= 0x5a;
+   {
+      std::ofstream Out(F.Name, std::ios::binary);
+      Out.write(Bytes.data(), Bytes.size());
+   }
+   ProfileInfoLoader PIL("unit-test", F.Name);
+   ASSERT_TRUE(PIL.hasError());
+   EXPECT_NE(PIL.getError().find("checksum mismatch"), std::string::npos);
+}
+
+TEST(ProfileInfo, TruncatedAndMissing)
+{
+   TempFile F;
+   writeProfile(F.Name, ProfileFlat);
+   ASSERT_EQ(truncate(F.Name.c_str(), 30), 0);
+   EXPECT_TRUE(ProfileInfoLoader("unit-test", F.Name).hasError());
+   EXPECT_TRUE(ProfileInfoLoader("unit-test", F.Name + ".missing").hasError());
+}
+
+// mergeWith - the MergeStat S of the profiles Files merged with Jobs threads
+static std::vector<uint64_t> mergeWith(const std::vector<std::string>& Files,
+      unsigned Jobs, MergeStat S, std::vector<double>& Times)
+{
+   TempFile Out;
+   ProfileInfoMerge M("unit-test", Out.Name);
+   EXPECT_TRUE(M.addProfileFiles(Files, Jobs));
+   EXPECT_EQ(M.getNumProfiles(), Files.size());
+   EXPECT_TRUE(M.writeTotalFile(S));
+   ProfileInfoLoader PIL("unit-test", Out.Name);
+   EXPECT_FALSE(PIL.hasError()) << PIL.getError();
+   EXPECT_EQ(PIL.getNumExecutions(), Files.size());
+   Times = PIL.getRawTimeMess();
+   return PIL.getRawEdgeCounts();
+}
+
+TEST(ProfileInfoMerge, SameResultWithAnyJobs)
+{
+   // counter 1 ties between the ranks 1 and 3, counter 2 is left Uncounted
+   // by some of them
+   const uint64_t U = ProfileInfoLoader::Uncounted;
+   std::vector<std::vector<uint64_t> > Counts = {
+      {10, 4, U, 1}, {20, 9, 2, 3}, {30, 1, U, 5}, {40, 9, 8, 7},
+      {50, 2, 6, 11}, {60, 3, U, 13}, {70, 5, 4, 17}};
+   std::vector<TempFile> Files(Counts.size());
+   std::vector<std::string> Names;
+   for(unsigned i = 0; i < Counts.size(); ++i){
+      ProfileInfoWriter W("unit-test", Files[i].Name);
+      W.write("run " + std::to_string(i));
+      W.write(EdgeInfo64, Counts[i]);
+      W.write(MPITimeInfo, std::vector<double>{0.1 * i, 3.0 / (i + 1)});
+      Names.push_back(Files[i].Name);
+   }
+   for(MergeStat S : {MergeSum, MergeMean, MergeMin, MergeMax, MergeStddev,
+         MergeArgMax}){
+      std::vector<double> Times1;
+      std::vector<uint64_t> One = mergeWith(Names, 1, S, Times1);
+      for(unsigned Jobs : {2u, 3u, 4u, 16u}){
+         std::vector<double> TimesN;
+         EXPECT_EQ(mergeWith(Names, Jobs, S, TimesN), One)
+            << "stat " << S << " with " << Jobs << " jobs";
+         ASSERT_EQ(TimesN.size(), Times1.size());
+         for(size_t i = 0; i < Times1.size(); ++i)
+            EXPECT_DOUBLE_EQ(TimesN[i], Times1[i])
+               << "stat " << S << " with " << Jobs << " jobs";
+      }
+      if(S == MergeSum) EXPECT_EQ(One[2], 20u);
+      if(S == MergeArgMax) EXPECT_EQ(One[1], 1u);
+   }
+}
+
+TEST(ProfileInfoMerge, UnreadableFile)
+{
+   TempFile Good, Out;
+   {
+      ProfileInfoWriter W("unit-test", Good.Name);
+      W.write(EdgeInfo64, Edges);
+   }
+   ProfileInfoMerge M("unit-test", Out.Name);
+   EXPECT_FALSE(M.addProfileFiles({Good.Name, Good.Name + ".missing"}, 2));
+   EXPECT_EQ(M.getNumProfiles(), 0u);
+}
+
+TEST(ProfileInfoWriter, ValuesRoundTrip)
+{
+   // flags first: a plain content, a never traped value, a run length one
+   const std::vector<unsigned> Counts = {3, 0, 5};
+   const std::vector<std::vector<int> > Contents = {
+      {0, 7, -1, 7}, {}, {RUN_LENGTH_COMPRESS, 4, 2, 9, 3}};
+   for(ProfileFormat Format : {ProfileFlat, ProfileIndexed}){
+      TempFile F;
+      {
+         ProfileInfoWriter W("unit-test", F.Name, Format);
+         W.write("./a.out");
+         W.writeValues(Counts, Contents);
+         W.write(EdgeInfo64, Edges);
+         EXPECT_FALSE(W.hasFailed());
+      }
+      ProfileInfoLoader PIL("unit-test", F.Name);
+      ASSERT_FALSE(PIL.hasError()) << PIL.getError();
+      EXPECT_EQ(PIL.getRawValueCounts(), Counts);
+      for(unsigned i = 0; i < Counts.size(); ++i)
+         EXPECT_EQ(PIL.getRawValueContent(i), Contents[i]) << "value " << i;
+      // the packet after it is still found
+      EXPECT_EQ(PIL.getRawEdgeCounts(), Edges);
+   }
+}
+
+TEST(ProfileInfoWriter, OversizedPacketReported)
+{
+   TempFile F;
+   ProfileInfoWriter W("unit-test", F.Name);
+   EXPECT_FALSE(W.hasFailed());
+   // counted, not materialized: the writer refuses before it asks for any
+   W.writeGenerated(EdgeInfo, (uint64_t)UINT32_MAX + 1,
+         [](uint64_t){ return 0u; });
+   EXPECT_TRUE(W.hasFailed());
+}
@@ -0,0 +1,169 @@
+#include <gtest/gtest.h>
+#include <memory>
+#include <string>
+#include <vector>
+#include <dirent.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <llvm/IR/Constants.h>
+#include <llvm/IR/IRBuilder.h>
+#include <llvm/IR/LLVMContext.h>
+#include <llvm/IR/Module.h>
+#include <llvm/PassManager.h>
+#if LLVM_VERSION_MAJOR==3 && LLVM_VERSION_MINOR==4
+#include <llvm/Analysis/Verifier.h>
+#else
+#include <llvm/IR/Verifier.h>
+#endif
+#include <llvm/Support/raw_ostream.h>
+#include "ProfileInfoLoader.h"
+#include "ProfileInstrumentations.h"
+
+using namespace llvm;
+
+extern "C" {
+   extern uint32_t llvm_sample_countdown;
+   extern uint32_t llvm_sample_active;
+   void llvm_sample_switch(void);
+   int llvm_start_sampled_edge_profiling(int argc, const char** argv,
+         uint64_t* arrayStart, uint64_t numElements);
+}
+
+// runSampled - the profile of a child which executes Checks sampling checks
+// with LLVM_PROF_SAMPLE_INTERVAL=10 and LLVM_PROF_SAMPLE_BURST=3, counting
+// slot 0 in the counting version like the instrumented code and leaving
+// slot 1 Uncounted
+static std::string runSampled(const std::string& Dir, unsigned Checks)
+{
+   pid_t Child = fork();
+   if(Child == 0){
+      static uint64_t Counters[2] = {0, ProfileInfoLoader::Uncounted};
+      const char* Argv[] = {"sampled"};
+      setenv("PROFILING_OUTDIR", Dir.c_str(), 1);
+      setenv("LLVMPROF_OUTPUT", "sampled.out", 1);
+      setenv("LLVM_PROF_SAMPLE_INTERVAL", "10", 1);
+      setenv("LLVM_PROF_SAMPLE_BURST", "3", 1);
+      llvm_start_sampled_edge_profiling(1, Argv, Counters, 2);
+      for(unsigned i = 0; i < Checks; ++i){
+         if(--llvm_sample_countdown == 0) llvm_sample_switch();
+         if(llvm_sample_active) ++Counters[0];
+      }
+      exit(0);
+   }
+   int Status;
+   waitpid(Child, &Status, 0);
+   EXPECT_TRUE(WIFEXITED(Status) && WEXITSTATUS(Status) == 0);
+   // the runtime may append its pid to the name
+   std::string File;
+   if(DIR* D = opendir(Dir.c_str())){
+      while(dirent* E = readdir(D))
+         if(std::string(E->d_name).compare(0, 11, "sampled.out") == 0)
+            File = Dir + "/" + E->d_name;
+      closedir(D);
+   }
+   return File;
+}
+
+TEST(SampledEdge, RatioScalesCountedSlots)
+{
+   char Dir[] = "/tmp/llvmprof-sampled-XXXXXX";
+   ASSERT_NE(mkdtemp(Dir), nullptr);
+   // 100 periods of 10 checks, 3 of each spent counting
+   std::string File = runSampled(Dir, 1000);
+   ASSERT_FALSE(File.empty());
+   ProfileInfoLoader PIL("unit-test", File);
+   unlink(File.c_str());
+   rmdir(Dir);
+   ASSERT_FALSE(PIL.hasError()) << PIL.getError();
+   EXPECT_EQ(PIL.getRawSampleCounts(), (std::vector<uint64_t>{1000, 300}));
+   ASSERT_EQ(PIL.getRawEdgeCounts().size(), 2u);
+   EXPECT_EQ(PIL.getRawEdgeCounts()[0], 1000u);
+   EXPECT_EQ(PIL.getRawEdgeCounts()[1], ProfileInfoLoader::Uncounted);
+}
+
+// numSlots - the edge counter slots of F
+static unsigned numSlots(Function& F)
+{
+   unsigned Slots = 1;
+   for(Function::iterator BB = F.begin(), E = F.end(); BB != E; ++BB)
+      Slots += BB->getTerminator()->getNumSuccessors();
+   return Slots;
+}
+
+static bool hasBlock(Function& F, StringRef Prefix)
+{
+   for(Function::iterator BB = F.begin(), E = F.end(); BB != E; ++BB)
+      if(BB->getName().startswith(Prefix)) return true;
+   return false;
+}
+
+TEST(SampledEdge, IndirectBrLeftUncounted)
+{
+   LLVMContext Context;
+   Module* M = new Module("sampled", Context);
+   std::unique_ptr<Module> Owner(M);
+   Type* Int32Ty = Type::getInt32Ty(Context);
+
+   // main: a counted loop of 10 iterations
+   Function* Main = Function::Create(FunctionType::get(Int32Ty, false),
+         GlobalValue::ExternalLinkage, "main", M);
+   BasicBlock* Entry = BasicBlock::Create(Context, "entry", Main);
+   BasicBlock* Loop = BasicBlock::Create(Context, "loop", Main);
+   BasicBlock* Exit = BasicBlock::Create(Context, "exit", Main);
+   IRBuilder<> B(Entry);
+   B.CreateBr(Loop);
+   B.SetInsertPoint(Loop);
+   PHINode* I = B.CreatePHI(Int32Ty, 2, "i");
+   Value* Next = B.CreateAdd(I, ConstantInt::get(Int32Ty, 1), "next");
+   I->addIncoming(ConstantInt::get(Int32Ty, 0), Entry);
+   I->addIncoming(Next, Loop);
+   B.CreateCondBr(B.CreateICmpSLT(Next, ConstantInt::get(Int32Ty, 10)), Loop, Exit);
+   B.SetInsertPoint(Exit);
+   B.CreateRet(Next);
+
+   // jump: an indirectbr, which can't be duplicated
+   Type* PtrTy = Type::getInt8PtrTy(Context);
+   Function* Jump = Function::Create(
+         FunctionType::get(Type::getVoidTy(Context), PtrTy, false),
+         GlobalValue::ExternalLinkage, "jump", M);
+   BasicBlock* JEntry = BasicBlock::Create(Context, "entry", Jump);
+   BasicBlock* A = BasicBlock::Create(Context, "a", Jump);
+   BasicBlock* C = BasicBlock::Create(Context, "c", Jump);
+   B.SetInsertPoint(JEntry);
+   IndirectBrInst* IB = B.CreateIndirectBr(Jump->arg_begin(), 2);
+   IB->addDestination(A);
+   IB->addDestination(C);
+   B.SetInsertPoint(A);
+   B.CreateRetVoid();
+   B.SetInsertPoint(C);
+   B.CreateRetVoid();
+
+   unsigned MainSlots = numSlots(*Main), JumpSlots = numSlots(*Jump);
+
+   PassManager PassMgr;
+   PassMgr.add(createSampledEdgeProfilerPass());
+   PassMgr.run(*M);
+
+#if LLVM_VERSION_MAJOR==3 && LLVM_VERSION_MINOR==4
+   EXPECT_FALSE(verifyModule(*M, ReturnStatusAction));
+#else
+   EXPECT_FALSE(verifyModule(*M, &errs()));
+#endif
+   // the loop got the entry and the back-edge checks, jump was not cloned
+   EXPECT_TRUE(hasBlock(*Main, "sample.entry"));
+   EXPECT_TRUE(hasBlock(*Main, "sample.check"));
+   EXPECT_FALSE(hasBlock(*Jump, "sample.entry"));
+
+   GlobalVariable* Counters = M->getGlobalVariable("SampledEdgeProfCounters", true);
+   ASSERT_NE(Counters, nullptr);
+   Constant* Init = Counters->getInitializer();
+   for(unsigned i = 0; i < MainSlots + JumpSlots; ++i){
+      ConstantInt* V = dyn_cast<ConstantInt>(Init->getAggregateElement(i));
+      ASSERT_NE(V, nullptr);
+      EXPECT_EQ(V->getZExtValue(), i < MainSlots ? 0 : ProfileInfoLoader::Uncounted)
+         << "slot " << i;
+   }
+}
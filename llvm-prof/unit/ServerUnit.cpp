@@ -0,0 +1,231 @@
+#include <gtest/gtest.h>
+#include <algorithm>
+#include <string>
+#include <thread>
+#include <vector>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <llvm/Bitcode/ReaderWriter.h>
+#include <llvm/IR/Constants.h>
+#include <llvm/IR/IRBuilder.h>
+#include <llvm/Support/raw_ostream.h>
+#include "ProfileInfoWriter.h"
+#include "server.h"
+
+using namespace llvm;
+
+static std::string tempName(const char* Suffix)
+{
+   char Path[] = "/tmp/llvmprof-server-XXXXXX";
+   close(mkstemp(Path));
+   unlink(Path);
+   return std::string(Path) + Suffix;
+}
+
+// connectTo - a client of the socket at Path, waiting for the server to
+// bind it. null if it never does.
+static FILE* connectTo(const std::string& Path)
+{
+   sockaddr_un Addr;
+   memset(&Addr, 0, sizeof(Addr));
+   Addr.sun_family = AF_UNIX;
+   strcpy(Addr.sun_path, Path.c_str());
+   for(int Try = 0; Try < 500; ++Try){
+      int Sock = socket(AF_UNIX, SOCK_STREAM, 0);
+      if(connect(Sock, (sockaddr*)&Addr, sizeof(Addr)) == 0)
+         return fdopen(Sock, "r+");
+      close(Sock);
+      usleep(10000);
+   }
+   return NULL;
+}
+
+// ask - send the request Line, the answer lines up to its "ok" or "error"
+static std::vector<std::string> ask(FILE* Client, const std::string& Line)
+{
+   fprintf(Client, "%s\n", Line.c_str());
+   fflush(Client);
+   std::vector<std::string> Answer;
+   char Buffer[4096];
+   while(fgets(Buffer, sizeof(Buffer), Client)){
+      std::string L(Buffer);
+      if(!L.empty() && L.back() == '\n') L.pop_back();
+      Answer.push_back(L);
+      if(L == "ok" || L.compare(0, 6, "error:") == 0) break;
+   }
+   return Answer;
+}
+
+TEST(ProfileServer, RefusesToReplaceAFile)
+{
+   std::string Path = tempName(".sock");
+   FILE* F = fopen(Path.c_str(), "w");
+   ASSERT_NE(F, nullptr);
+   fputs("not a socket\n", F);
+   fclose(F);
+   LLVMContext Context;
+   ProfileServer S(Context);
+   EXPECT_EQ(S.listen(Path), 1);
+   struct stat St;
+   ASSERT_EQ(stat(Path.c_str(), &St), 0);
+   EXPECT_TRUE(S_ISREG(St.st_mode));
+   unlink(Path.c_str());
+}
+
+TEST(ProfileServer, AnswersErrorsOverSocket)
+{
+   std::string Profile = tempName(".out"), Path = tempName(".sock");
+   {
+      ProfileInfoWriter W("unit-test", Profile);
+      W.write("./a.out");
+      W.write(EdgeInfo64, std::vector<uint64_t>{1, 2, 3});
+   }
+   LLVMContext Context;
+   ProfileServer S(Context);
+   int Result = -1;
+   std::thread Server([&]{ Result = S.listen(Path); });
+
+   FILE* Client = connectTo(Path);
+   ASSERT_NE(Client, nullptr);
+   std::vector<std::string> A;
+
+   A = ask(Client, "profile p " + Profile);
+   ASSERT_EQ(A.size(), 1u);
+   EXPECT_EQ(A[0], "ok");
+
+   // a file the loader can't read is an answer, not the end of the server
+   A = ask(Client, "profile q " + Profile + ".missing");
+   ASSERT_EQ(A.size(), 1u);
+   EXPECT_EQ(A[0].compare(0, 6, "error:"), 0) << A[0];
+   EXPECT_NE(A[0].find(".missing"), std::string::npos) << A[0];
+
+   A = ask(Client, "timing t lmbench " + Profile + ".missing");
+   ASSERT_EQ(A.size(), 1u);
+   EXPECT_EQ(A[0].compare(0, 6, "error:"), 0) << A[0];
+
+   A = ask(Client, "list");
+   ASSERT_EQ(A.size(), 2u);
+   EXPECT_EQ(A[0], "profile p " + Profile);
+   EXPECT_EQ(A[1], "ok");
+
+   A = ask(Client, "quit");
+   ASSERT_EQ(A.size(), 1u);
+   EXPECT_EQ(A[0], "ok");
+   fclose(Client);
+
+   Server.join();
+   EXPECT_EQ(Result, 0);
+   EXPECT_NE(access(Path.c_str(), F_OK), 0);
+   unlink(Profile.c_str());
+}
+
+// writeLoopModule - the bitcode of a main with a loop of 10 iterations in
+// File, its blocks: entry (br), loop (phi, add, icmp, br) and exit (ret)
+static void writeLoopModule(const std::string& File)
+{
+   LLVMContext Context;
+   Module M("loop", Context);
+   Type* Int32Ty = Type::getInt32Ty(Context);
+   Function* Main = Function::Create(FunctionType::get(Int32Ty, false),
+         GlobalValue::ExternalLinkage, "main", &M);
+   BasicBlock* Entry = BasicBlock::Create(Context, "entry", Main);
+   BasicBlock* Loop = BasicBlock::Create(Context, "loop", Main);
+   BasicBlock* Exit = BasicBlock::Create(Context, "exit", Main);
+   IRBuilder<> B(Entry);
+   B.CreateBr(Loop);
+   B.SetInsertPoint(Loop);
+   PHINode* I = B.CreatePHI(Int32Ty, 2, "i");
+   Value* Next = B.CreateAdd(I, ConstantInt::get(Int32Ty, 1), "next");
+   I->addIncoming(ConstantInt::get(Int32Ty, 0), Entry);
+   I->addIncoming(Next, Loop);
+   B.CreateCondBr(B.CreateICmpSLT(Next, ConstantInt::get(Int32Ty, 10)), Loop, Exit);
+   B.SetInsertPoint(Exit);
+   B.CreateRet(Next);
+
+   raw_fd_ostream Out(open(File.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644), true);
+   WriteBitcodeToFile(&M, Out);
+}
+
+static void writeBlocks(const std::string& File, const std::vector<unsigned>& Blocks)
+{
+   ProfileInfoWriter W("unit-test", File);
+   W.write("./loop");
+   W.write(BlockInfo, Blocks);
+}
+
+TEST(ProfileServer, EvaluatesModuleOverSocket)
+{
+   std::string Bitcode = tempName(".bc"), Costs = tempName(".irinst"),
+      P = tempName(".out"), Q = tempName(".out"), Path = tempName(".sock");
+   writeLoopModule(Bitcode);
+   writeBlocks(P, {1, 10, 1});
+   writeBlocks(Q, {1, 9, 1});
+   {
+      FILE* F = fopen(Costs.c_str(), "w");
+      ASSERT_NE(F, nullptr);
+      fputs("fix_add:\t2 nanoseconds\nicmp:\t1 nanoseconds\n", F);
+      fclose(F);
+   }
+   LLVMContext Context;
+   ProfileServer S(Context);
+   int Result = -1;
+   std::thread Server([&]{ Result = S.listen(Path); });
+
+   FILE* Client = connectTo(Path);
+   ASSERT_NE(Client, nullptr);
+   std::vector<std::string> A;
+
+   EXPECT_EQ(ask(Client, "module m " + Bitcode).back(), "ok");
+   EXPECT_EQ(ask(Client, "profile p " + P).back(), "ok");
+   EXPECT_EQ(ask(Client, "profile q " + Q).back(), "ok");
+   EXPECT_EQ(ask(Client, "timing t irinst " + Costs).back(), "ok");
+
+   // 1 * 1 + 10 * 4 + 1 * 1 instructions
+   A = ask(Client, "inst m p");
+   ASSERT_EQ(A.size(), 2u);
+   EXPECT_EQ(A[0], "inst_number 42");
+   EXPECT_EQ(A[1], "ok");
+
+   // no mpi call at all
+   A = ask(Client, "comm m p");
+   ASSERT_EQ(A.size(), 3u);
+   EXPECT_EQ(A[0], "comm_calls 0");
+   EXPECT_EQ(A[1], "comm_size 0");
+   EXPECT_EQ(A[2], "ok");
+
+   // only the add and the icmp of the loop cost anything
+   A = ask(Client, "run m t p");
+   ASSERT_FALSE(A.empty());
+   EXPECT_EQ(A.back(), "ok");
+   EXPECT_NE(std::find(A.begin(), A.end(), "block_ns 30"), A.end());
+
+   A = ask(Client, "diff p p");
+   ASSERT_EQ(A.size(), 1u);
+   EXPECT_EQ(A[0], "ok");
+   A = ask(Client, "diff p q");
+   ASSERT_EQ(A.size(), 2u);
+   EXPECT_EQ(A[0], "BlockCounts differ");
+   EXPECT_EQ(A[1], "ok");
+
+   EXPECT_EQ(ask(Client, "drop m").back(), "ok");
+   A = ask(Client, "inst m p");
+   ASSERT_EQ(A.size(), 1u);
+   EXPECT_EQ(A[0], "error: no module m");
+   A = ask(Client, "drop m");
+   ASSERT_EQ(A.size(), 1u);
+   EXPECT_EQ(A[0], "error: nothing named m");
+
+   EXPECT_EQ(ask(Client, "quit").back(), "ok");
+   fclose(Client);
+   Server.join();
+   EXPECT_EQ(Result, 0);
+   for(const std::string& F : {Bitcode, Costs, P, Q})
+      unlink(F.c_str());
+}
@@ -0,0 +1,146 @@
+#include <gtest/gtest.h>
+#include <map>
+#include <string>
+#include <vector>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <llvm/IR/Constants.h>
+#include <llvm/IR/IRBuilder.h>
+#include <llvm/IR/LLVMContext.h>
+#include <llvm/IR/Module.h>
+#include <llvm/PassManager.h>
+#include <llvm/Support/raw_ostream.h>
+#include "ProfileDataTypes.h"
+#include "ProfileInfo.h"
+#include "ProfileInfoLoader.h"
+#include "ProfileInfoWriter.h"
+
+using namespace llvm;
+
+typedef std::map<int, uint64_t> Histogram;
+
+TEST(ValueRuns, Plain)
+{
+   std::vector<int> Contents = {4, 4, -2, 4, 9, 9};
+   ValueRuns R(Contents, false);
+   EXPECT_EQ(R.size(), 6u);
+   EXPECT_EQ(R.sum(), 28);
+   EXPECT_DOUBLE_EQ(R.mean(), 28. / 6);
+   EXPECT_EQ(R.histogram(), (Histogram{{-2, 1}, {4, 3}, {9, 2}}));
+   EXPECT_EQ(R.distinct(), (std::vector<int>{-2, 4, 9}));
+   EXPECT_EQ(R.expand(), Contents);
+   // the first two 4 are one run, the later one is not adjacent
+   std::vector<uint64_t> Lengths;
+   for(ValueRuns::iterator I = R.begin(), E = R.end(); I != E; ++I)
+      Lengths.push_back(I->Length);
+   EXPECT_EQ(Lengths, (std::vector<uint64_t>{2, 1, 1, 2}));
+}
+
+TEST(ValueRuns, RunLength)
+{
+   // (value, length) pairs, 3 is stored as two adjacent runs
+   std::vector<int> Contents = {3, 2, 3, 1, -7, 4, 3, 5};
+   ValueRuns R(Contents, true);
+   std::vector<std::pair<int, uint64_t> > Runs;
+   for(ValueRuns::iterator I = R.begin(), E = R.end(); I != E; ++I)
+      Runs.push_back(std::make_pair(I->Value, I->Length));
+   EXPECT_EQ(Runs, (std::vector<std::pair<int, uint64_t> >{{3, 3}, {-7, 4}, {3, 5}}));
+   EXPECT_EQ(R.size(), 12u);
+   EXPECT_EQ(R.sum(), 3 * 8 - 7 * 4);
+   EXPECT_DOUBLE_EQ(R.mean(), -4. / 12);
+   EXPECT_EQ(R.histogram(), (Histogram{{-7, 4}, {3, 8}}));
+   EXPECT_EQ(R.distinct(), (std::vector<int>{-7, 3}));
+   EXPECT_EQ(R.expand(), (std::vector<int>{3, 3, 3, -7, -7, -7, -7, 3, 3, 3, 3, 3}));
+}
+
+TEST(ValueRuns, OddRunLengthTrimmed)
+{
+   // the last value has no length, it is not a run
+   std::vector<int> Contents = {6, 2, 1};
+   ValueRuns R(Contents, true);
+   EXPECT_EQ(R.expand(), (std::vector<int>{6, 6}));
+   EXPECT_EQ(R.size(), 2u);
+   EXPECT_EQ(R.distinct(), (std::vector<int>{6}));
+
+   std::vector<int> One = {5};
+   ValueRuns Empty(One, true);
+   EXPECT_TRUE(Empty.empty());
+   EXPECT_EQ(Empty.size(), 0u);
+   EXPECT_DOUBLE_EQ(Empty.mean(), 0.);
+}
+
+namespace {
+   // the runs of every value trap of main, copied out of the ProfileInfo
+   struct ValueRunsOf : public ModulePass
+   {
+      static char ID;
+      std::vector<std::vector<int> >& Values;
+      std::vector<int64_t>& Sums;
+      explicit ValueRunsOf(std::vector<std::vector<int> >& V, std::vector<int64_t>& S)
+         :ModulePass(ID), Values(V), Sums(S) {}
+      void getAnalysisUsage(AnalysisUsage& AU) const override {
+         AU.setPreservesAll();
+         AU.addRequired<ProfileInfo>();
+      }
+      bool runOnModule(Module& M) override {
+         ProfileInfo& PI = getAnalysis<ProfileInfo>();
+         Function* Main = M.getFunction("main");
+         for(Function::iterator BB = Main->begin(), E = Main->end(); BB != E; ++BB)
+            for(BasicBlock::iterator I = BB->begin(), IE = BB->end(); I != IE; ++I)
+               if(CallInst* CI = dyn_cast<CallInst>(&*I)){
+                  ValueRuns R = PI.getValueRuns(CI);
+                  Values.push_back(R.expand());
+                  Sums.push_back(R.sum());
+               }
+         return false;
+      }
+   };
+   char ValueRunsOf::ID = 0;
+}
+
+TEST(ValueRuns, LoaderExpandsConstants)
+{
+   LLVMContext Context;
+   Module M("values", Context);
+   Type* Int32Ty = Type::getInt32Ty(Context);
+   Constant* Trap = M.getOrInsertFunction("llvm_profiling_trap_value",
+         Type::getVoidTy(Context), Int32Ty, Int32Ty, Int32Ty, (Type*)0);
+   Function* Main = Function::Create(FunctionType::get(Int32Ty, Int32Ty, false),
+         GlobalValue::ExternalLinkage, "main", &M);
+   IRBuilder<> B(BasicBlock::Create(Context, "entry", Main));
+   // #0 traps the constant 7, #1 the argument, #2 is never executed
+   Value* Args[3] = {B.getInt32(0), B.getInt32(7), B.getInt32(1)};
+   B.CreateCall(Trap, Args);
+   Args[0] = B.getInt32(1); Args[1] = Main->arg_begin(); Args[2] = B.getInt32(0);
+   B.CreateCall(Trap, Args);
+   Args[0] = B.getInt32(2); Args[1] = Main->arg_begin();
+   B.CreateCall(Trap, Args);
+   B.CreateRet(B.getInt32(0));
+
+   char Name[] = "/tmp/llvmprof-values-XXXXXX";
+   close(mkstemp(Name));
+   {
+      ProfileInfoWriter W("unit-test", Name);
+      W.write("./values");
+      W.writeValues(std::vector<unsigned>{5, 7, 0}, std::vector<std::vector<int> >{
+            {CONSTANT_COMPRESS}, {RUN_LENGTH_COMPRESS, 3, 2, 3, 1, 5, 4}, {}});
+   }
+   ProfileInfoLoader PIL("unit-test", Name);
+   unlink(Name);
+   ASSERT_FALSE(PIL.hasError()) << PIL.getError();
+
+   std::vector<std::vector<int> > Values;
+   std::vector<int64_t> Sums;
+   PassManager PassMgr;
+   PassMgr.add(createProfileLoaderPass(PIL));
+   PassMgr.add(new ValueRunsOf(Values, Sums));
+   PassMgr.run(M);
+
+   ASSERT_EQ(Values.size(), 3u);
+   EXPECT_EQ(Values[0], std::vector<int>(5, 7));
+   EXPECT_EQ(Sums[0], 35);
+   EXPECT_EQ(Values[1], (std::vector<int>{3, 3, 3, 5, 5, 5, 5}));
+   EXPECT_EQ(Sums[1], 29);
+   EXPECT_TRUE(Values[2].empty());
+}